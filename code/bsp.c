@@ -32,6 +32,8 @@ Suite 120, Rockville, Maryland 20850 USA.
 #include "qcommon.h"
 #include "bsp.h"
 
+#include <pthread.h>
+
 #ifdef BSPC
 #include "../bspc/l_qfiles.h"
 #endif
@@ -54,44 +56,240 @@ bspFormat_t *bspFormats[] = {
 
 const int numBspFormats = ARRAY_LEN( bspFormats );
 
-#define MAX_BSP_FILES 1
+// each watch or daemon worker keeps a BSP loaded while using it
+#define MAX_BSP_FILES 32
 bspFile_t *bsp_loadedFiles[MAX_BSP_FILES] = {0};
 
+// bsp_loadedFiles and the references of loaded BSPs are shared between threads
+static pthread_mutex_t bsp_loadedLock = PTHREAD_MUTEX_INITIALIZER;
+
+// BSPs without references that are kept loaded, see BSP_KeepUnused
+static int bsp_keepUnused = 0;
+static int bsp_lastUsed[MAX_BSP_FILES];
+static int bsp_useCount = 0;
+
+
+// find format from the ident and version in a file header
+const bspFormat_t *BSP_FindFormat( const void *data, int length ) {
+	int				i, ident, version;
+
+	if ( length < 8 ) {
+		return NULL;
+	}
+
+	ident = LittleLong( ((const int *)data)[0] );
+	version = LittleLong( ((const int *)data)[1] );
+
+	for ( i = 0; i < numBspFormats; i++ ) {
+		if ( bspFormats[i]->ident == ident && bspFormats[i]->version == version
+			&& length >= bspFormats[i]->lumpsOffset + bspFormats[i]->numLumps * 8 ) {
+			return bspFormats[i];
+		}
+	}
+
+	return NULL;
+}
+
+// output format from a name on the command line, or NULL
+bspFormat_t *BSP_FormatForName( const char *formatName ) {
+	if ( Q_stricmp( formatName, "quake3" ) == 0 ) {
+		return &quake3BspFormat;
+	} else if ( Q_stricmp( formatName, "rtcw" ) == 0 ) {
+		return &wolfBspFormat;
+	} else if ( Q_stricmp( formatName, "et" ) == 0 ) {
+		// ZTM: TODO: This need to be a different format than RTCW so that there is a different save function; so that converting et maps to rtcw can convert foliage
+		return &wolfBspFormat;
+	} else if ( Q_stricmp( formatName, "darks" ) == 0 ) {
+		return &darksBspFormat;
+	} else if ( Q_stricmp( formatName, "rbsp" ) == 0 ) {
+		return &sof2BspFormat;
+	} else if ( Q_stricmp( formatName, "fakk" ) == 0 ) {
+		return &fakkBspFormat;
+	} else if ( Q_stricmp( formatName, "alice" ) == 0 ) {
+		return &aliceBspFormat;
+	} else if ( Q_stricmp( formatName, "ef2" ) == 0 ) {
+		return &ef2BspFormat;
+	} else if ( Q_stricmp( formatName, "mohaa" ) == 0 ) {
+		return &mohaaBspFormat;
+	} else if ( Q_stricmp( formatName, "q3test106" ) == 0 ) {
+		return &q3Test106BspFormat;
+	}
+
+	return NULL;
+}
+
+static void BSP_FreeInternal( bspFile_t *bsp );
+
+// returns an already loaded BSP with a new reference, or NULL
+static bspFile_t *BSP_FindLoaded( const char *name ) {
+	bspFile_t		*loaded = NULL;
+	int				i;
+
+	pthread_mutex_lock( &bsp_loadedLock );
+
+	for ( i = 0; i < MAX_BSP_FILES; i++ ) {
+		if ( bsp_loadedFiles[i] && !Q_stricmp( bsp_loadedFiles[i]->name, name ) ) {
+			bsp_loadedFiles[i]->references++;
+			bsp_lastUsed[i] = ++bsp_useCount;
+			loaded = bsp_loadedFiles[i];
+			break;
+		}
+	}
+
+	pthread_mutex_unlock( &bsp_loadedLock );
+
+	return loaded;
+}
+
+// remove the least recently used BSP without references, bsp_loadedLock must be held
+static bspFile_t *BSP_RemoveUnused( int *slot ) {
+	bspFile_t		*bspFile;
+	int				i, oldest = -1;
+
+	for ( i = 0; i < MAX_BSP_FILES; i++ ) {
+		if ( bsp_loadedFiles[i] && bsp_loadedFiles[i]->references <= 0
+			&& ( oldest == -1 || bsp_lastUsed[i] < bsp_lastUsed[oldest] ) ) {
+			oldest = i;
+		}
+	}
+
+	if ( oldest == -1 ) {
+		return NULL;
+	}
+
+	bspFile = bsp_loadedFiles[oldest];
+	bsp_loadedFiles[oldest] = NULL;
+	*slot = oldest;
+
+	return bspFile;
+}
+
+// add a BSP that was loaded by this thread, a slot is not reserved while loading
+static void BSP_AddLoaded( bspFile_t *bspFile ) {
+	bspFile_t		*unused = NULL;
+	int				i, slot = -1;
+
+	pthread_mutex_lock( &bsp_loadedLock );
+
+	bspFile->references++;
+
+	for ( i = 0; i < MAX_BSP_FILES; i++ ) {
+		if ( !bsp_loadedFiles[i] ) {
+			slot = i;
+			break;
+		}
+	}
+
+	if ( slot == -1 ) {
+		unused = BSP_RemoveUnused( &slot );
+	}
+
+	if ( slot != -1 ) {
+		bsp_loadedFiles[slot] = bspFile;
+		bsp_lastUsed[slot] = ++bsp_useCount;
+	}
+
+	pthread_mutex_unlock( &bsp_loadedLock );
+
+	if ( unused ) {
+		BSP_FreeInternal( unused );
+	}
+
+	// with every slot referenced the BSP isn't kept loaded, BSP_Free frees it
+	// when the last reference is released
+}
+
+// if keepData, data was allocated with malloc and the caller frees it unless bspFile->fileData is data
+static bspFile_t *BSP_LoadFormats( const char *name, const void *data, int length, qboolean keepData ) {
+	int				i;
+	bspFile_t		*bspFile = NULL;
+
+	if ( BSP_IsArchive( data, length ) ) {
+		void	*image;
+		int		imageLength;
+
+		TRACE_BEGIN( "BSP_ExtractArchive" );
+		image = BSP_ExtractArchive( data, length, &imageLength );
+		TRACE_END( "BSP_ExtractArchive" );
+		if ( !image ) {
+			Com_Printf( "Error: Corrupt BSP archive %s\n", name );
+			return NULL;
+		}
+
+		bspFile = BSP_LoadFormats( name, image, imageLength, qtrue );
+
+		if ( !bspFile || bspFile->fileData != image ) {
+			free( image );
+		}
+		return bspFile;
+	}
+
+	//
+	// check formats
+	//
+	for ( i = 0; i < numBspFormats; i++ ) {
+		bspFile = bspFormats[i]->loadFunction( bspFormats[i], name, data, length, keepData );
+		if ( bspFile ) {
+			break;
+		}
+	}
+
+	// not an error that exits, a daemon or watch request can name any file
+	if ( i == numBspFormats && length < 8 ) {
+		Com_Printf( "Error: Unsupported BSP %s: file is too short\n", name );
+		return NULL;
+	}
+
+	if ( i == numBspFormats ) {
+		int ident = LittleLong( ((int *)data)[0] );
+		int version = LittleLong( ((int *)data)[1] );
+
+		Com_Printf( "Error: Unsupported BSP %s: ident %c%c%c%c, version %d\n",
+				name, ident & 0xff, ( ident >> 8 ) & 0xff, ( ident >> 16 ) & 0xff,
+				( ident >> 24 ) & 0xff, version );
+		return NULL;
+	}
+
+	if ( bspFile ) {
+		Q_strncpyz( bspFile->name, name, sizeof ( bspFile->name ) );
+		bspFile->format = bspFormats[i];
+		BSP_AddLoaded( bspFile );
+	}
+
+	return bspFile;
+}
 
 bspFile_t *BSP_Load( const char *name ) {
 	union {
 		int				*i;
 		void			*v;
 	} buf;
-	int				i;
 	int				length;
 	bspFile_t		*bspFile = NULL;
-	int				freeSlot = -1;
 
 #ifndef BSPC
 	if ( !name || !name[0] ) {
-		Com_Error( ERR_DROP, "BSP_Load: NULL name" );
+		Com_Printf( "Error: BSP_Load: NULL name\n" );
+		return NULL;
 	}
 #endif
 
-	// check if already loaded
-	for ( i = 0; i < MAX_BSP_FILES; i++ ) {
-		if ( !bsp_loadedFiles[i] ) {
-			if ( freeSlot == -1 ) {
-				freeSlot = i;
-			}
-			continue;
-		}
-
-		if ( !Q_stricmp( bsp_loadedFiles[i]->name, name ) ) {
-			bsp_loadedFiles[i]->references++;
-			return bsp_loadedFiles[i];
-		}
+	bspFile = BSP_FindLoaded( name );
+	if ( bspFile ) {
+		return bspFile;
 	}
 
-	if ( freeSlot == -1 ) {
-		Com_Error( ERR_DROP, "No free slot to load BSP '%s'", name );
+	TRACE_BEGIN_FILE( "BSP_Load", name );
+
+#ifndef BSPC
+	// use the .bspk file if it is up to date
+	bspFile = BSP_LoadBspk( name );
+	if ( bspFile ) {
+		BSP_AddLoaded( bspFile );
+		TRACE_END( "BSP_Load" );
+		return bspFile;
 	}
+#endif
 
 	//
 	// load the file
@@ -104,78 +302,473 @@ bspFile_t *BSP_Load( const char *name ) {
 
 	if ( !buf.i ) {
 		// File not found.
+		TRACE_END( "BSP_Load" );
 		return NULL;
 	}
 
-	//
-	// check formats
-	//
-	for ( i = 0; i < numBspFormats; i++ ) {
-		bspFile = bspFormats[i]->loadFunction( bspFormats[i], name, buf.v, length );
-		if ( bspFile ) {
-			break;
+	bspFile = BSP_LoadFormats( name, buf.v, length, qtrue );
+
+	// the loader may keep the file image for arrays that are stored the same way in memory
+	if ( !bspFile || bspFile->fileData != buf.v ) {
+		FS_FreeFile (buf.v);
+	}
+
+	TRACE_END( "BSP_Load" );
+
+	return bspFile;
+}
+
+// load BSP from file data that the caller already read, data is not freed
+bspFile_t *BSP_LoadData( const char *name, const void *data, int length ) {
+	bspFile_t		*bspFile;
+
+	bspFile = BSP_FindLoaded( name );
+	if ( bspFile ) {
+		return bspFile;
+	}
+
+	TRACE_BEGIN_FILE( "BSP_LoadData", name );
+	bspFile = BSP_LoadFormats( name, data, length, qfalse );
+	TRACE_END( "BSP_LoadData" );
+
+	return bspFile;
+}
+
+/*
+=================
+BSP_ReadLumps
+
+Build a file image with the header and the lumps in diskMask ( 1 << lump ).
+The lumps are packed after the header and the lump table is updated, other
+lumps are empty.
+=================
+*/
+static byte *BSP_ReadLumps( const char *name, int fd, const bspFormat_t *format, const byte *header, int diskMask, int *lengthOut ) {
+	byte			*image;
+	int				*imageLumps;
+	int				headerLength, imageLength;
+	int				i;
+
+	headerLength = format->lumpsOffset + format->numLumps * 8;
+	imageLength = headerLength;
+
+	for ( i = 0; i < format->numLumps; i++ ) {
+		const int *lump = (const int *)( header + format->lumpsOffset ) + i * 2;
+
+		if ( ( diskMask & ( 1 << i ) ) && LittleLong( lump[1] ) > 0 ) {
+			imageLength += ( LittleLong( lump[1] ) + 3 ) & ~3;
 		}
 	}
 
-	if ( i == numBspFormats ) {
-		int ident = LittleLong( buf.i[0] );
-		int version = LittleLong( buf.i[1] );
+	image = malloc( imageLength );
+	Com_Memset( image, 0, imageLength );
+	Com_Memcpy( image, header, headerLength );
+	imageLumps = (int *)( image + format->lumpsOffset );
+	imageLength = headerLength;
 
-		Com_Error( ERR_DROP, "Unsupported BSP %s: ident %c%c%c%c, version %d",
-				name, ident & 0xff, ( ident >> 8 ) & 0xff, ( ident >> 16 ) & 0xff,
-				( ident >> 24 ) & 0xff, version );
+	for ( i = 0; i < format->numLumps; i++ ) {
+		int fileofs = LittleLong( imageLumps[i * 2] );
+		int filelen = LittleLong( imageLumps[i * 2 + 1] );
+
+		imageLumps[i * 2] = 0;
+		imageLumps[i * 2 + 1] = 0;
+
+		if ( !( diskMask & ( 1 << i ) ) || filelen <= 0 ) {
+			continue;
+		}
+
+		if ( FS_Pread( fd, image + imageLength, filelen, fileofs ) != filelen ) {
+			Com_Printf( "Error: Could not read lump %d of '%s'\n", i, name );
+			free( image );
+			return NULL;
+		}
+
+		imageLumps[i * 2] = LittleLong( imageLength );
+		imageLumps[i * 2 + 1] = LittleLong( filelen );
+		imageLength += ( filelen + 3 ) & ~3;
+	}
+
+	*lengthOut = imageLength;
+	return image;
+}
+
+/*
+=================
+BSP_LoadLumps
+
+Read the header and only the lumps in lumpMask (BSPLUMP_BIT) and the lumps
+they depend on. Other lumps are left empty. The BSP is not shared with
+BSP_Load and its checksum is not valid.
+=================
+*/
+bspFile_t *BSP_LoadLumps( const char *name, int lumpMask ) {
+	const bspFormat_t	*format;
+	byte			header[BSP_MAX_HEADER_LENGTH];
+	byte			*image;
+	int				headerLength, imageLength;
+	int				diskMask, prevMask;
+	int				i, fd;
+	qboolean		archive;
+	bspFile_t		*bspFile;
+
+	fd = FS_Open( name, qfalse );
+	if ( fd == -1 ) {
+		return NULL;
+	}
+
+	headerLength = FS_Pread( fd, header, sizeof ( header ), 0 );
+	archive = BSP_IsArchive( header, headerLength );
+
+	if ( archive ) {
+		headerLength = BSP_ReadArchiveHeader( fd, header, sizeof ( header ) );
+	}
+
+	format = BSP_FindFormat( header, headerLength );
+
+	if ( !format ) {
+		Com_Printf( "Unsupported BSP %s\n", name );
+		FS_Close( fd );
+		return NULL;
+	}
+
+	// add lumps needed by the requested lumps until nothing changes
+	do {
+		prevMask = lumpMask;
+
+		for ( i = 0; i < BSPLUMP_MAX; i++ ) {
+			if ( lumpMask & BSPLUMP_BIT( i ) ) {
+				lumpMask |= format->lumpDefs[i].dependencies;
+			}
+		}
+	} while ( lumpMask != prevMask );
+
+	diskMask = 0;
+	for ( i = 0; i < BSPLUMP_MAX; i++ ) {
+		if ( !( lumpMask & BSPLUMP_BIT( i ) ) ) {
+			continue;
+		}
+
+		if ( format->lumpDefs[i].lump >= 0 ) {
+			diskMask |= 1 << format->lumpDefs[i].lump;
+		}
+		diskMask |= format->lumpDefs[i].extraLumps;
+	}
+
+	if ( archive ) {
+		image = BSP_ReadArchiveLumps( fd, diskMask, &imageLength );
+
+		if ( !image ) {
+			Com_Printf( "Error: Corrupt BSP archive %s\n", name );
+		}
+	} else {
+		image = BSP_ReadLumps( name, fd, format, header, diskMask, &imageLength );
+	}
+
+	FS_Close( fd );
+
+	if ( !image ) {
+		return NULL;
+	}
+
+	bspFile = format->loadFunction( format, name, image, imageLength, qtrue );
+
+	if ( !bspFile || bspFile->fileData != image ) {
+		free( image );
 	}
 
 	if ( bspFile ) {
 		Q_strncpyz( bspFile->name, name, sizeof ( bspFile->name ) );
+		bspFile->format = format;
 		bspFile->references++;
-		bsp_loadedFiles[freeSlot] = bspFile;
 	}
 
-	FS_FreeFile (buf.v);
-
 	return bspFile;
 }
 
+/*
+=================
+BSP_FreeArray
+
+Free an array of bsp unless it points into the mapped .bspk file or the
+file image kept by the loader.
+=================
+*/
+void BSP_FreeArray( bspFile_t *bsp, void *array ) {
+	if ( bsp->mappedData && (byte *)array >= (byte *)bsp->mappedData
+		&& (byte *)array < (byte *)bsp->mappedData + bsp->mappedLength ) {
+		return;
+	}
+
+	if ( bsp->fileData && (byte *)array >= (byte *)bsp->fileData
+		&& (byte *)array < (byte *)bsp->fileData + bsp->fileLength ) {
+		return;
+	}
+
+	free( array );
+}
+
+static void *BSP_CopyArray( const void *array, size_t size ) {
+	void *copy;
+
+	if ( !array ) {
+		return NULL;
+	}
+
+	copy = malloc( size );
+	Com_Memcpy( copy, array, size );
+
+	return copy;
+}
+
+/*
+=================
+BSP_ReleaseFileData
+
+Called by loaders after setting up the arrays, forget the file image if no
+array points into it so that the caller frees it. The parts of the image
+that aren't used by arrays stay allocated as long as the BSP, so if the
+arrays use less than two thirds of it they are copied out of it and
+the image is forgotten as well.
+=================
+*/
+void BSP_ReleaseFileData( bspFile_t *bsp ) {
+	struct {
+		void	**array;
+		size_t	size;
+	} arrays[] = {
+		{ (void **)&bsp->entityString, bsp->entityStringLength },
+		{ (void **)&bsp->shaders, bsp->numShaders * sizeof ( *bsp->shaders ) },
+		{ (void **)&bsp->planes, bsp->numPlanes * sizeof ( *bsp->planes ) },
+		{ (void **)&bsp->nodes, bsp->numNodes * sizeof ( *bsp->nodes ) },
+		{ (void **)&bsp->leafs, bsp->numLeafs * sizeof ( *bsp->leafs ) },
+		{ (void **)&bsp->leafSurfaces, bsp->numLeafSurfaces * sizeof ( *bsp->leafSurfaces ) },
+		{ (void **)&bsp->leafBrushes, bsp->numLeafBrushes * sizeof ( *bsp->leafBrushes ) },
+		{ (void **)&bsp->submodels, bsp->numSubmodels * sizeof ( *bsp->submodels ) },
+		{ (void **)&bsp->brushes, bsp->numBrushes * sizeof ( *bsp->brushes ) },
+		{ (void **)&bsp->brushSides, bsp->numBrushSides * sizeof ( *bsp->brushSides ) },
+		{ (void **)&bsp->drawVerts, bsp->numDrawVerts * sizeof ( *bsp->drawVerts ) },
+		{ (void **)&bsp->drawIndexes, bsp->numDrawIndexes * sizeof ( *bsp->drawIndexes ) },
+		{ (void **)&bsp->fogs, bsp->numFogs * sizeof ( *bsp->fogs ) },
+		{ (void **)&bsp->surfaces, bsp->numSurfaces * sizeof ( *bsp->surfaces ) },
+		{ (void **)&bsp->lightmapData, bsp->numLightmaps * 128 * 128 * 3 },
+		{ (void **)&bsp->lightGridData, bsp->numGridPoints * 8 },
+		{ (void **)&bsp->lightGridArray, bsp->numGridArrayPoints * sizeof ( *bsp->lightGridArray ) },
+		{ (void **)&bsp->visibility, bsp->visibilityLength }
+	};
+	size_t used;
+	int i;
+
+	if ( !bsp->fileData ) {
+		return;
+	}
+
+	used = 0;
+	for ( i = 0; i < ARRAY_LEN( arrays ); i++ ) {
+		if ( *arrays[i].array && (byte *)*arrays[i].array >= (byte *)bsp->fileData
+			&& (byte *)*arrays[i].array < (byte *)bsp->fileData + bsp->fileLength ) {
+			used += arrays[i].size;
+		}
+	}
+
+	if ( used >= (size_t)bsp->fileLength / 3 * 2 ) {
+		return;
+	}
+
+	for ( i = 0; i < ARRAY_LEN( arrays ); i++ ) {
+		if ( *arrays[i].array && (byte *)*arrays[i].array >= (byte *)bsp->fileData
+			&& (byte *)*arrays[i].array < (byte *)bsp->fileData + bsp->fileLength ) {
+			*arrays[i].array = BSP_CopyArray( *arrays[i].array, arrays[i].size );
+		}
+	}
+
+	bsp->fileData = NULL;
+	bsp->fileLength = 0;
+}
+
 static void BSP_FreeInternal( bspFile_t *bsp ) {
-	free( bsp->entityString );
-	free( bsp->shaders );
-	free( bsp->planes );
-	free( bsp->nodes );
-	free( bsp->leafs );
-	free( bsp->leafSurfaces );
-	free( bsp->leafBrushes );
-	free( bsp->submodels );
-	free( bsp->brushes );
-	free( bsp->brushSides );
-	free( bsp->drawVerts );
-	free( bsp->drawIndexes );
-	free( bsp->fogs );
-	free( bsp->surfaces );
-	free( bsp->lightmapData );
-	free( bsp->lightGridData );
-	free( bsp->visibility );
+	BSP_FreeArray( bsp, bsp->entityString );
+	BSP_FreeArray( bsp, bsp->shaders );
+	BSP_FreeArray( bsp, bsp->planes );
+	BSP_FreeArray( bsp, bsp->nodes );
+	BSP_FreeArray( bsp, bsp->leafs );
+	BSP_FreeArray( bsp, bsp->leafSurfaces );
+	BSP_FreeArray( bsp, bsp->leafBrushes );
+	BSP_FreeArray( bsp, bsp->submodels );
+	BSP_FreeArray( bsp, bsp->brushes );
+	BSP_FreeArray( bsp, bsp->brushSides );
+	BSP_FreeArray( bsp, bsp->drawVerts );
+	BSP_FreeArray( bsp, bsp->drawIndexes );
+	BSP_FreeArray( bsp, bsp->fogs );
+	BSP_FreeArray( bsp, bsp->surfaces );
+	BSP_FreeArray( bsp, bsp->lightmapData );
+	BSP_FreeArray( bsp, bsp->lightGridData );
+	BSP_FreeArray( bsp, bsp->lightGridArray );
+	BSP_FreeArray( bsp, bsp->visibility );
+	BSP_UnmapBspk( bsp );
+	free( bsp->fileData );
 	free( bsp );
 }
 
 void BSP_Free( bspFile_t *bspFile ) {
-	int i;
+	int i, slot, numUnused;
 
 	if ( !bspFile )
 		return;
 
+	pthread_mutex_lock( &bsp_loadedLock );
+
 	bspFile->references--;
-	if ( bspFile->references > 0 )
+	if ( bspFile->references > 0 ) {
+		pthread_mutex_unlock( &bsp_loadedLock );
 		return;
+	}
+
+	numUnused = 0;
+	slot = -1;
 
 	for ( i = 0; i < MAX_BSP_FILES; i++ ) {
 		if ( bspFile == bsp_loadedFiles[i] ) {
-			bsp_loadedFiles[i] = NULL;
-			break;
+			slot = i;
+		} else if ( bsp_loadedFiles[i] && bsp_loadedFiles[i]->references <= 0 ) {
+			numUnused++;
+		}
+	}
+
+	if ( slot != -1 && bsp_keepUnused > 0 ) {
+		// keep it for the next BSP_Load, free the least recently used one instead
+		bsp_lastUsed[slot] = ++bsp_useCount;
+		bspFile = NULL;
+
+		if ( numUnused >= bsp_keepUnused ) {
+			bspFile = BSP_RemoveUnused( &slot );
+		}
+	} else if ( slot != -1 ) {
+		bsp_loadedFiles[slot] = NULL;
+	}
+
+	pthread_mutex_unlock( &bsp_loadedLock );
+
+	if ( bspFile ) {
+		BSP_FreeInternal( bspFile );
+	}
+}
+
+/*
+=================
+BSP_KeepUnused
+
+Keep up to count BSPs loaded after their last reference is freed so that
+BSP_Load doesn't read them again. BSPs loaded this way must not be changed,
+use BSP_Copy.
+=================
+*/
+void BSP_KeepUnused( int count ) {
+	bspFile_t *unused[MAX_BSP_FILES];
+	int i, slot, numUnused, numFree;
+
+	count = MIN( count, MAX_BSP_FILES / 2 );
+	numFree = 0;
+
+	pthread_mutex_lock( &bsp_loadedLock );
+
+	bsp_keepUnused = count;
+
+	numUnused = 0;
+	for ( i = 0; i < MAX_BSP_FILES; i++ ) {
+		if ( bsp_loadedFiles[i] && bsp_loadedFiles[i]->references <= 0 ) {
+			numUnused++;
+		}
+	}
+
+	for ( ; numUnused > count; numUnused-- ) {
+		unused[numFree++] = BSP_RemoveUnused( &slot );
+	}
+
+	pthread_mutex_unlock( &bsp_loadedLock );
+
+	for ( i = 0; i < numFree; i++ ) {
+		BSP_FreeInternal( unused[i] );
+	}
+}
+
+/*
+=================
+BSP_Forget
+
+Don't return the loaded BSP for name from BSP_Load again, such as after the
+file changed. It's freed when it has no references.
+=================
+*/
+void BSP_Forget( const char *name ) {
+	bspFile_t *unused[MAX_BSP_FILES];
+	int i, numFree;
+
+	numFree = 0;
+
+	pthread_mutex_lock( &bsp_loadedLock );
+
+	for ( i = 0; i < MAX_BSP_FILES; i++ ) {
+		if ( !bsp_loadedFiles[i] || Q_stricmp( bsp_loadedFiles[i]->name, name ) ) {
+			continue;
+		}
+
+		if ( bsp_loadedFiles[i]->references <= 0 ) {
+			unused[numFree++] = bsp_loadedFiles[i];
 		}
+		bsp_loadedFiles[i] = NULL;
+	}
+
+	pthread_mutex_unlock( &bsp_loadedLock );
+
+	for ( i = 0; i < numFree; i++ ) {
+		BSP_FreeInternal( unused[i] );
 	}
+}
+
+/*
+=================
+BSP_Copy
 
-	BSP_FreeInternal( bspFile );
+Copy the arrays of bsp so that passes can change them. The copy is not
+shared with BSP_Load, free it using BSP_Free.
+=================
+*/
+bspFile_t *BSP_Copy( const bspFile_t *bsp ) {
+	bspFile_t *copy;
+
+	copy = malloc( sizeof ( bspFile_t ) );
+
+	// other threads may change the references of a loaded BSP
+	pthread_mutex_lock( &bsp_loadedLock );
+	*copy = *bsp;
+	pthread_mutex_unlock( &bsp_loadedLock );
+
+	copy->references = 1;
+	copy->mappedData = NULL;
+	copy->mappedLength = 0;
+	copy->fileData = NULL;
+	copy->fileLength = 0;
+
+	copy->entityString = BSP_CopyArray( bsp->entityString, bsp->entityStringLength );
+	copy->shaders = BSP_CopyArray( bsp->shaders, bsp->numShaders * sizeof ( *bsp->shaders ) );
+	copy->planes = BSP_CopyArray( bsp->planes, bsp->numPlanes * sizeof ( *bsp->planes ) );
+	copy->nodes = BSP_CopyArray( bsp->nodes, bsp->numNodes * sizeof ( *bsp->nodes ) );
+	copy->leafs = BSP_CopyArray( bsp->leafs, bsp->numLeafs * sizeof ( *bsp->leafs ) );
+	copy->leafSurfaces = BSP_CopyArray( bsp->leafSurfaces, bsp->numLeafSurfaces * sizeof ( *bsp->leafSurfaces ) );
+	copy->leafBrushes = BSP_CopyArray( bsp->leafBrushes, bsp->numLeafBrushes * sizeof ( *bsp->leafBrushes ) );
+	copy->submodels = BSP_CopyArray( bsp->submodels, bsp->numSubmodels * sizeof ( *bsp->submodels ) );
+	copy->brushes = BSP_CopyArray( bsp->brushes, bsp->numBrushes * sizeof ( *bsp->brushes ) );
+	copy->brushSides = BSP_CopyArray( bsp->brushSides, bsp->numBrushSides * sizeof ( *bsp->brushSides ) );
+	copy->drawVerts = BSP_CopyArray( bsp->drawVerts, bsp->numDrawVerts * sizeof ( *bsp->drawVerts ) );
+	copy->drawIndexes = BSP_CopyArray( bsp->drawIndexes, bsp->numDrawIndexes * sizeof ( *bsp->drawIndexes ) );
+	copy->fogs = BSP_CopyArray( bsp->fogs, bsp->numFogs * sizeof ( *bsp->fogs ) );
+	copy->surfaces = BSP_CopyArray( bsp->surfaces, bsp->numSurfaces * sizeof ( *bsp->surfaces ) );
+	copy->lightmapData = BSP_CopyArray( bsp->lightmapData, bsp->numLightmaps * 128 * 128 * 3 );
+	copy->lightGridData = BSP_CopyArray( bsp->lightGridData, bsp->numGridPoints * 8 );
+	copy->lightGridArray = BSP_CopyArray( bsp->lightGridArray, bsp->numGridArrayPoints * sizeof ( *bsp->lightGridArray ) );
+	copy->visibility = BSP_CopyArray( bsp->visibility, bsp->visibilityLength );
+
+	return copy;
 }
 
 void BSP_Shutdown( void ) {
@@ -141,9 +141,10 @@ typedef struct {
 } dsurface_t;
 
 typedef struct {
-	char			name[MAX_QPATH];
+	char			name[MAX_OSPATH];	// file name, BSP_Load returns a loaded BSP with the same name
 	int				checksum;
 	int				references;
+	const struct bspFormat_s *format;	// format the BSP was loaded from
 
 	char			*entityString;
 	int				entityStringLength;
@@ -202,29 +203,322 @@ typedef struct {
 	byte			*visibility;
 	int				visibilityLength;
 
+	void			*mappedData;	// .bspk file the arrays point into, see BSP_FreeArray
+	size_t			mappedLength;
+
+	void			*fileData;		// file image the arrays point into, see BSP_LumpArray
+	int				fileLength;
+
 } bspFile_t;
 
+/*
+
+	Abstract BSP lumps, used to select parts of bspFile_t independent of
+	the lump order in each format's dheader_t
+
+*/
+
+typedef enum {
+	BSPLUMP_ENTITIES,
+	BSPLUMP_SHADERS,
+	BSPLUMP_PLANES,
+	BSPLUMP_NODES,
+	BSPLUMP_LEAFS,
+	BSPLUMP_LEAFSURFACES,
+	BSPLUMP_LEAFBRUSHES,
+	BSPLUMP_MODELS,
+	BSPLUMP_BRUSHES,
+	BSPLUMP_BRUSHSIDES,
+	BSPLUMP_DRAWVERTS,
+	BSPLUMP_DRAWINDEXES,
+	BSPLUMP_FOGS,
+	BSPLUMP_SURFACES,
+	BSPLUMP_LIGHTMAPS,
+	BSPLUMP_LIGHTGRID,
+	BSPLUMP_VISIBILITY,
+	BSPLUMP_LIGHTARRAY,
+	BSPLUMP_MAX
+} bspLump_t;
+
+#define BSPLUMP_BIT( lump )		( 1 << ( lump ) )
+#define BSPLUMP_ALL				( BSPLUMP_BIT( BSPLUMP_MAX ) - 1 )
+
+// large enough for the header and lump table of all formats
+#define BSP_MAX_HEADER_LENGTH	1024
+
 //
 bspFile_t *BSP_Load( const char *name );
+bspFile_t *BSP_LoadData( const char *name, const void *data, int length );
+bspFile_t *BSP_LoadLumps( const char *name, int lumpMask );
+const struct bspFormat_s *BSP_FindFormat( const void *data, int length );
+struct bspFormat_s *BSP_FormatForName( const char *formatName );
 void BSP_Free( bspFile_t *bspFile );
+void BSP_KeepUnused( int count );
+void BSP_Forget( const char *name );
+bspFile_t *BSP_Copy( const bspFile_t *bsp );
+void BSP_FreeArray( bspFile_t *bsp, void *array );
+void BSP_ReleaseFileData( bspFile_t *bsp );
 void BSP_Shutdown( void );
 void BSP_SwapBlock( int *dest, const int *src, int size );
 
 
+/*
+
+	Lumps on disk, see bsp_lump.c
+
+*/
+
+typedef struct {
+	int			fileofs, filelen;
+} lump_t;
+
+typedef enum {
+	BF_INT,			// 32-bit integers
+	BF_FLOAT,		// 32-bit floats
+	BF_BYTE,		// bytes, not swapped
+	BF_STRING		// char array, copied with Q_strncpyz
+} bspFieldType_t;
+
+typedef struct {
+	bspFieldType_t type;
+	int			fileofs;		// offset and size in the on disk structure
+	int			filesize;
+	int			ofs;			// offset and size in the abstract structure
+	int			size;
+} bspField_t;
+
+typedef struct {
+	const bspField_t *fields;
+	int			numFields;
+	int			fileSize;		// size of the on disk structure
+	int			size;			// size of the abstract structure
+} bspSchema_t;
+
+// field lists are X-macros that take a field macro and the on disk and
+// abstract structure types, each field is F( D, T, type, fileName, name )
+// where fileName is the member of D and name is the member of T
+#define BSP_FIELD( D, T, type, fileName, name ) \
+	{ type, offsetof( D, fileName ), sizeof ( ((D *)0)->fileName ), offsetof( T, name ), sizeof ( ((T *)0)->name ) },
+
+#define BSP_SCHEMA( schema, D, T, FIELDS ) \
+	static const bspField_t schema##Fields[] = { FIELDS( BSP_FIELD, D, T ) }; \
+	static const bspSchema_t schema = { schema##Fields, ARRAY_LEN( schema##Fields ), sizeof ( D ), sizeof ( T ) }
+
+// fields of the abstract structures, for on disk structures that use the same names
+#define BSP_SHADER_FIELDS( F, D, T ) \
+	F( D, T, BF_STRING, shader, shader ) \
+	F( D, T, BF_INT, surfaceFlags, surfaceFlags ) \
+	F( D, T, BF_INT, contentFlags, contentFlags )
+
+#define BSP_PLANE_FIELDS( F, D, T ) \
+	F( D, T, BF_FLOAT, normal, normal ) \
+	F( D, T, BF_FLOAT, dist, dist )
+
+#define BSP_NODE_FIELDS( F, D, T ) \
+	F( D, T, BF_INT, planeNum, planeNum ) \
+	F( D, T, BF_INT, children, children ) \
+	F( D, T, BF_INT, mins, mins ) \
+	F( D, T, BF_INT, maxs, maxs )
+
+#define BSP_LEAF_FIELDS( F, D, T ) \
+	F( D, T, BF_INT, cluster, cluster ) \
+	F( D, T, BF_INT, area, area ) \
+	F( D, T, BF_INT, mins, mins ) \
+	F( D, T, BF_INT, maxs, maxs ) \
+	F( D, T, BF_INT, firstLeafSurface, firstLeafSurface ) \
+	F( D, T, BF_INT, numLeafSurfaces, numLeafSurfaces ) \
+	F( D, T, BF_INT, firstLeafBrush, firstLeafBrush ) \
+	F( D, T, BF_INT, numLeafBrushes, numLeafBrushes )
+
+#define BSP_MODEL_FIELDS( F, D, T ) \
+	F( D, T, BF_FLOAT, mins, mins ) \
+	F( D, T, BF_FLOAT, maxs, maxs ) \
+	F( D, T, BF_INT, firstSurface, firstSurface ) \
+	F( D, T, BF_INT, numSurfaces, numSurfaces ) \
+	F( D, T, BF_INT, firstBrush, firstBrush ) \
+	F( D, T, BF_INT, numBrushes, numBrushes )
+
+#define BSP_BRUSH_FIELDS( F, D, T ) \
+	F( D, T, BF_INT, firstSide, firstSide ) \
+	F( D, T, BF_INT, numSides, numSides ) \
+	F( D, T, BF_INT, shaderNum, shaderNum )
+
+#define BSP_BRUSHSIDE_FIELDS( F, D, T ) \
+	F( D, T, BF_INT, planeNum, planeNum ) \
+	F( D, T, BF_INT, shaderNum, shaderNum )
+
+#define BSP_DRAWVERT_FIELDS( F, D, T ) \
+	F( D, T, BF_FLOAT, xyz, xyz ) \
+	F( D, T, BF_FLOAT, st, st ) \
+	F( D, T, BF_FLOAT, lightmap, lightmap ) \
+	F( D, T, BF_FLOAT, normal, normal ) \
+	F( D, T, BF_BYTE, color, color )
+
+#define BSP_FOG_FIELDS( F, D, T ) \
+	F( D, T, BF_STRING, shader, shader ) \
+	F( D, T, BF_INT, brushNum, brushNum ) \
+	F( D, T, BF_INT, visibleSide, visibleSide )
+
+#define BSP_SURFACE_FIELDS( F, D, T ) \
+	F( D, T, BF_INT, shaderNum, shaderNum ) \
+	F( D, T, BF_INT, fogNum, fogNum ) \
+	F( D, T, BF_INT, surfaceType, surfaceType ) \
+	F( D, T, BF_INT, firstVert, firstVert ) \
+	F( D, T, BF_INT, numVerts, numVerts ) \
+	F( D, T, BF_INT, firstIndex, firstIndex ) \
+	F( D, T, BF_INT, numIndexes, numIndexes ) \
+	F( D, T, BF_INT, lightmapNum, lightmapNum ) \
+	F( D, T, BF_INT, lightmapX, lightmapX ) \
+	F( D, T, BF_INT, lightmapY, lightmapY ) \
+	F( D, T, BF_INT, lightmapWidth, lightmapWidth ) \
+	F( D, T, BF_INT, lightmapHeight, lightmapHeight ) \
+	F( D, T, BF_FLOAT, lightmapOrigin, lightmapOrigin ) \
+	F( D, T, BF_FLOAT, lightmapVecs, lightmapVecs ) \
+	F( D, T, BF_INT, patchWidth, patchWidth ) \
+	F( D, T, BF_INT, patchHeight, patchHeight )
+
+int BSP_GetLumpElements( const lump_t *lumps, int lump, int size );
+void *BSP_GetLump( const lump_t *lumps, const void *src, int lump );
+void BSP_CopyLump( const lump_t *lumps, int lump, const void *src, void *dest, int size, qboolean swap );
+void BSP_WriteLump( const lump_t *lumps, int lump, void *dest, const void *src, int size, qboolean swap );
+void BSP_AddLump( lump_t *lumps, int *filePos, int lump, int elements, int size );
+void *BSP_LumpArray( bspFile_t *bsp, const lump_t *lumps, int lump, int count, int size, int fileSize );
+qboolean BSP_SameLayout( const bspSchema_t *schema );
+void BSP_DecodeElements( const bspSchema_t *schema, const void *in, void *out, int count );
+void BSP_EncodeElements( const bspSchema_t *schema, const void *in, void *out, int count );
+
+
+/*
+
+	Passes, see bsp_pass.c
+
+*/
+
+// data that is derived from other lumps, a pass that leaves it out of date
+// lists it in invalidates and it's rebuilt before a pass that requires it
+#define BSPDERIVED_BOUNDS		1	// submodel mins and maxs
+#define BSPDERIVED_LEAFLISTS	2	// leaf surface and brush lists, entries may be -1 to remove them
+#define BSPDERIVED_ALL			( BSPDERIVED_BOUNDS | BSPDERIVED_LEAFLISTS )
+
+typedef struct {
+	const char	*name;
+	const char	*description;
+	void		(*passFunc)( bspFile_t *bsp );
+	qboolean	conversion;		// only remaps shader flags, can be used as <conversion>
+	int			lumps;			// BSPLUMP_BITs the pass reads or writes, 0 if it may use any
+	int			requires;		// BSPDERIVED_* that must be up to date
+	int			invalidates;	// BSPDERIVED_* that are out of date afterward
+} bspPass_t;
+
+#define MAX_PIPELINE_PASSES 32
+
+typedef struct {
+	const bspPass_t	*passes[MAX_PIPELINE_PASSES];
+	int				numPasses;
+} bspPipeline_t;
+
+const bspPass_t *BSP_FindPass( const char *name );
+void BSP_ListPasses( void );
+qboolean BSP_AddPass( bspPipeline_t *pipeline, const bspPass_t *pass );
+qboolean BSP_AddPasses( bspPipeline_t *pipeline, const char *list );
+void BSP_RunPasses( const bspPipeline_t *pipeline, bspFile_t *bsp );
+size_t BSP_MemoryUsage( const bspFile_t *bsp );
+
+// optimize_gc.c
+void BSP_CollectGarbage( bspFile_t *bsp );
+
+// optimize_lightmaps.c
+void BSP_RepackLightmaps( bspFile_t *bsp );
+byte *BSP_PackLightmapAtlases( bspFile_t *bsp, int size, int *numAtlases );
+qboolean BSP_WriteLightmapAtlases( const char *bspFilename, const byte *atlasData, int numAtlases, int size );
+
+// optimize_planes.c
+void BSP_MergePlanes( bspFile_t *bsp );
+
+// optimize_shaders.c
+void BSP_DedupeShaders( bspFile_t *bsp );
+
+// optimize_surfaces.c
+void BSP_SortSurfaces( bspFile_t *bsp );
+void BSP_MergeSurfaces( bspFile_t *bsp );
+
+// optimize_tree.c
+void BSP_ReorderTree( bspFile_t *bsp );
+
+// optimize_verts.c
+qboolean BSP_SetWeldTolerances( const char *list );
+void BSP_WeldVerts( bspFile_t *bsp );
+void BSP_OptimizeVertexCache( bspFile_t *bsp );
+
+
 /*
 
 	BSP Formats
 
 */
 
+typedef struct {
+	int			lump;			// index in the format's dheader_t lumps, -1 if the format doesn't have it
+	int			size;			// size of one element on disk
+	int			dependencies;	// BSPLUMP_BITs the loader uses when converting this lump
+	int			extraLumps;		// bits ( 1 << lump ) of other dheader_t lumps the loader reads for it
+} bspLumpDef_t;
+
 typedef struct bspFormat_s {
 	const char *gameName;
 	int			ident;
 	int			version;
-	bspFile_t	*(*loadFunction)( const struct bspFormat_s *format, const char *name, const void *data, int length );
+	int			lumpsOffset;	// offset of the lump table in the file header
+	int			numLumps;		// number of lumps in the file header
+	const bspLumpDef_t *lumpDefs;	// on disk lump for each BSPLUMP_*
+	// keepData means data was allocated with malloc and the BSP may keep it and decode lumps in it, see BSP_LumpArray
+	bspFile_t	*(*loadFunction)( const struct bspFormat_s *format, const char *name, const void *data, int length, qboolean keepData );
 	int			(*saveFunction)( const struct bspFormat_s *format, const char *name, const bspFile_t *bsp, void **dataOut );
+	// rewrite the lumps in lumpMask (BSPLUMP_BIT) of an existing file of this format in place
+	qboolean	(*patchFunction)( const struct bspFormat_s *format, const char *name, const bspFile_t *bsp, int lumpMask );
 } bspFormat_t;
 
+// bsp_inplace.c
+typedef struct {
+	int			lump;		// index in the format's dheader_t lumps
+	const void	*data;
+	int			length;
+} bspLumpPatch_t;
+
+qboolean BSP_PatchLumps( const char *name, int lumpsOffset, int numLumps, const bspLumpPatch_t *patches, int numPatches );
+qboolean BSP_RecoverPatch( const char *name );
+
+// bsp_diff.c
+int BSP_Diff( const void *oldData, int oldLength, const void *newData, int newLength, void **patchOut );
+int BSP_ApplyPatch( const void *oldData, int oldLength, const void *patch, int patchLength, void **dataOut );
+
+// bsp_archive.c
+qboolean BSP_IsArchive( const void *data, int length );
+int BSP_CompressArchive( const void *data, int length, void **archiveOut );
+void *BSP_ExtractArchive( const void *archive, int length, int *lengthOut );
+int BSP_ReadArchiveHeader( int fd, void *header, int size );
+void *BSP_ReadArchiveLumps( int fd, int diskMask, int *lengthOut );
+
+// bsp_bspk.c
+bspFile_t *BSP_LoadBspk( const char *name );
+qboolean BSP_SaveBspk( const bspFile_t *bsp );
+void BSP_UnmapBspk( bspFile_t *bsp );
+
+// bsp_stream.c
+qboolean BSP_CanStream( const char *name, const bspFormat_t *outFormat, const bspPipeline_t *pipeline );
+qboolean BSP_Stream( const char *name, const char *outputName, const bspFormat_t *outFormat, const bspPipeline_t *pipeline, int windowSize );
+
+// bsp_index.c
+qboolean BSP_ScanIndex( const char *dir, const char *indexFile );
+int BSP_QueryIndex( const char *indexFile, const char **filters, int numFilters );
+
+// bsp_daemon.c
+qboolean BSP_Daemon( const char *socketPath, int keepMaps );
+int BSP_DaemonSend( const char *socketPath, const char *requestName, const char **args, int numArgs );
+
+// bsp_watch.c
+qboolean BSP_Watch( const char *srcDir, const char *dstDir, const bspFormat_t *format, const bspPipeline_t *pipeline );
+
 // bsp_q3.c
 extern bspFormat_t quake3BspFormat;
 extern bspFormat_t wolfBspFormat;
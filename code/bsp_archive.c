@@ -0,0 +1,461 @@
+/*
+===========================================================================
+Copyright (C) 2015 Zack Middleton
+
+This file is part of BSP sekai Source Code.
+
+BSP sekai Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+BSP sekai Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with BSP sekai Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, BSP sekai Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+
+
+
+// bsp_archive.c -- compressed BSP container with per-lump random access
+//
+// The BSP header, each lump of the format's dheader_t, and any bytes between
+// lumps are compressed separately with LZ (lz.c). An index of the chunks
+// follows the archive header, so a lump can be read by decompressing only
+// that chunk. Extracting every chunk gives back the original file.
+
+#include "sekai.h"
+#include "bsp.h"
+
+#define ARCHIVE_IDENT	(('Z'<<24)+('P'<<16)+('S'<<8)+'B')
+		// little-endian "BSPZ"
+#define ARCHIVE_VERSION	1
+
+typedef struct {
+	int			ident;
+	int			version;
+	int			fileLength;		// length of the BSP
+	int			lumpsOffset;	// lump table in the BSP header
+	int			numLumps;
+	int			numChunks;
+	uint64_t	hash;			// Com_Hash64 of the BSP
+} archiveHeader_t;
+
+typedef struct {
+	int			lump;			// dheader_t lump, -1 for the header or bytes between lumps
+	int			offset;			// offset in the BSP
+	int			length;
+	int			fileofs;		// offset of the data in the archive
+	int			compressedLength;	// same as length if stored uncompressed
+	int			pad;
+	uint64_t	hash;			// Com_Hash64 of the uncompressed data
+} archiveChunk_t;
+
+typedef struct {
+	int			fd;				// read from fd if data is NULL
+	const byte	*data;
+	int			length;
+
+	archiveHeader_t header;
+	archiveChunk_t *chunks;
+} archiveReader_t;
+
+qboolean BSP_IsArchive( const void *data, int length ) {
+	return length >= sizeof ( archiveHeader_t ) && LittleLong( ((const int *)data)[0] ) == ARCHIVE_IDENT;
+}
+
+/*
+=================
+Archive_AddChunk
+=================
+*/
+static void Archive_AddChunk( archiveChunk_t *chunks, int *numChunks, int lump, int offset, int length ) {
+	archiveChunk_t *chunk = &chunks[(*numChunks)++];
+
+	Com_Memset( chunk, 0, sizeof ( *chunk ) );
+	chunk->lump = lump;
+	chunk->offset = offset;
+	chunk->length = length;
+}
+
+static int Archive_CompareOffsets( const void *a, const void *b ) {
+	return ( (const archiveChunk_t *)a )->offset - ( (const archiveChunk_t *)b )->offset;
+}
+
+/*
+=================
+BSP_CompressArchive
+
+Returns the archive length, or -1 if data is not a supported BSP.
+=================
+*/
+int BSP_CompressArchive( const void *data, int length, void **archiveOut ) {
+	const bspFormat_t	*format;
+	const int			*lumps;
+	archiveHeader_t		*header;
+	archiveChunk_t		*chunks, *sorted;
+	int					numChunks, numLumpChunks, covered;
+	int					i, archiveLength;
+	byte				*archive;
+
+	*archiveOut = NULL;
+
+	format = BSP_FindFormat( data, length );
+	if ( !format ) {
+		Com_Printf( "Error: Unsupported BSP format\n" );
+		return -1;
+	}
+
+	lumps = (const int *)( (const byte *)data + format->lumpsOffset );
+
+	// header, each lump, and at most one gap before each lump and at the end
+	chunks = malloc( ( format->numLumps * 2 + 2 ) * sizeof ( *chunks ) );
+	numChunks = 0;
+
+	Archive_AddChunk( chunks, &numChunks, -1, 0, format->lumpsOffset + format->numLumps * 8 );
+
+	for ( i = 0; i < format->numLumps; i++ ) {
+		int fileofs = LittleLong( lumps[i * 2] );
+		int filelen = LittleLong( lumps[i * 2 + 1] );
+
+		if ( filelen <= 0 ) {
+			continue;
+		}
+
+		if ( fileofs < 0 || fileofs > length || filelen > length - fileofs ) {
+			Com_Printf( "Error: Lump %d is outside of the BSP\n", i );
+			free( chunks );
+			return -1;
+		}
+
+		Archive_AddChunk( chunks, &numChunks, i, fileofs, filelen );
+	}
+
+	// keep bytes that are not part of the header or any lump
+	numLumpChunks = numChunks;
+	sorted = malloc( numLumpChunks * sizeof ( *sorted ) );
+	Com_Memcpy( sorted, chunks, numLumpChunks * sizeof ( *sorted ) );
+	qsort( sorted, numLumpChunks, sizeof ( *sorted ), Archive_CompareOffsets );
+
+	covered = 0;
+	for ( i = 0; i < numLumpChunks; i++ ) {
+		if ( sorted[i].offset > covered ) {
+			Archive_AddChunk( chunks, &numChunks, -1, covered, sorted[i].offset - covered );
+		}
+		covered = MAX( covered, sorted[i].offset + sorted[i].length );
+	}
+
+	if ( covered < length ) {
+		Archive_AddChunk( chunks, &numChunks, -1, covered, length - covered );
+	}
+
+	free( sorted );
+
+	//
+	// compress the chunks
+	//
+	archiveLength = sizeof ( archiveHeader_t ) + numChunks * sizeof ( archiveChunk_t );
+	for ( i = 0; i < numChunks; i++ ) {
+		archiveLength += LZ_CompressBound( chunks[i].length );
+	}
+
+	archive = malloc( archiveLength );
+	archiveLength = sizeof ( archiveHeader_t ) + numChunks * sizeof ( archiveChunk_t );
+
+	for ( i = 0; i < numChunks; i++ ) {
+		const byte *src = (const byte *)data + chunks[i].offset;
+		int compressedLength;
+
+		compressedLength = LZ_Compress( src, chunks[i].length, archive + archiveLength, LZ_CompressBound( chunks[i].length ) );
+
+		if ( compressedLength < 0 || compressedLength >= chunks[i].length ) {
+			Com_Memcpy( archive + archiveLength, src, chunks[i].length );
+			compressedLength = chunks[i].length;
+		}
+
+		chunks[i].fileofs = archiveLength;
+		chunks[i].compressedLength = compressedLength;
+		chunks[i].hash = Com_Hash64( src, chunks[i].length, 0 );
+
+		archiveLength += compressedLength;
+	}
+
+	header = (archiveHeader_t *)archive;
+	header->ident = LittleLong( ARCHIVE_IDENT );
+	header->version = LittleLong( ARCHIVE_VERSION );
+	header->fileLength = LittleLong( length );
+	header->lumpsOffset = LittleLong( format->lumpsOffset );
+	header->numLumps = LittleLong( format->numLumps );
+	header->numChunks = LittleLong( numChunks );
+	header->hash = Com_Hash64( data, length, 0 );
+
+	Com_Memcpy( archive + sizeof ( archiveHeader_t ), chunks, numChunks * sizeof ( archiveChunk_t ) );
+	free( chunks );
+
+	*archiveOut = archive;
+	return archiveLength;
+}
+
+/*
+=================
+Archive_Read
+=================
+*/
+static qboolean Archive_Read( archiveReader_t *reader, void *buffer, int length, int offset ) {
+	if ( offset < 0 || length < 0 || offset > reader->length || length > reader->length - offset ) {
+		return qfalse;
+	}
+
+	if ( reader->data ) {
+		Com_Memcpy( buffer, reader->data + offset, length );
+		return qtrue;
+	}
+
+	return FS_Pread( reader->fd, buffer, length, offset ) == length;
+}
+
+/*
+=================
+Archive_Open
+
+Read and check the header and chunk index.
+=================
+*/
+static qboolean Archive_Open( archiveReader_t *reader ) {
+	archiveHeader_t *header = &reader->header;
+	int i;
+
+	reader->chunks = NULL;
+
+	if ( !Archive_Read( reader, header, sizeof ( *header ), 0 ) ) {
+		return qfalse;
+	}
+
+	header->ident = LittleLong( header->ident );
+	header->version = LittleLong( header->version );
+	header->fileLength = LittleLong( header->fileLength );
+	header->lumpsOffset = LittleLong( header->lumpsOffset );
+	header->numLumps = LittleLong( header->numLumps );
+	header->numChunks = LittleLong( header->numChunks );
+
+	if ( header->ident != ARCHIVE_IDENT ) {
+		return qfalse;
+	}
+
+	if ( header->version != ARCHIVE_VERSION ) {
+		Com_Printf( "Error: Unsupported BSP archive version %d\n", header->version );
+		return qfalse;
+	}
+
+	if ( header->numLumps <= 0 || header->numLumps > 32 || header->lumpsOffset < 8
+		|| header->lumpsOffset + header->numLumps * 8 > BSP_MAX_HEADER_LENGTH
+		|| header->numChunks < 1 || header->numChunks > header->numLumps * 2 + 2 ) {
+		return qfalse;
+	}
+
+	reader->chunks = malloc( header->numChunks * sizeof ( archiveChunk_t ) );
+
+	if ( !Archive_Read( reader, reader->chunks, header->numChunks * sizeof ( archiveChunk_t ), sizeof ( *header ) ) ) {
+		return qfalse;
+	}
+
+	for ( i = 0; i < header->numChunks; i++ ) {
+		archiveChunk_t *chunk = &reader->chunks[i];
+
+		chunk->lump = LittleLong( chunk->lump );
+		chunk->offset = LittleLong( chunk->offset );
+		chunk->length = LittleLong( chunk->length );
+		chunk->fileofs = LittleLong( chunk->fileofs );
+		chunk->compressedLength = LittleLong( chunk->compressedLength );
+
+		if ( chunk->lump < -1 || chunk->lump >= header->numLumps || chunk->offset < 0 || chunk->length < 0
+			|| chunk->offset > header->fileLength || chunk->length > header->fileLength - chunk->offset
+			|| chunk->compressedLength < 0 || chunk->compressedLength > chunk->length ) {
+			return qfalse;
+		}
+	}
+
+	// the first chunk is the BSP header
+	if ( reader->chunks[0].lump != -1 || reader->chunks[0].offset != 0
+		|| reader->chunks[0].length != header->lumpsOffset + header->numLumps * 8 ) {
+		return qfalse;
+	}
+
+	return qtrue;
+}
+
+/*
+=================
+Archive_ReadChunk
+=================
+*/
+static qboolean Archive_ReadChunk( archiveReader_t *reader, const archiveChunk_t *chunk, byte *dest ) {
+	byte *compressed;
+	qboolean ok;
+
+	if ( chunk->compressedLength == chunk->length ) {
+		ok = Archive_Read( reader, dest, chunk->length, chunk->fileofs );
+	} else {
+		compressed = malloc( chunk->compressedLength );
+
+		ok = Archive_Read( reader, compressed, chunk->compressedLength, chunk->fileofs )
+			&& LZ_Decompress( compressed, chunk->compressedLength, dest, chunk->length ) == chunk->length;
+
+		free( compressed );
+	}
+
+	return ok && Com_Hash64( dest, chunk->length, 0 ) == chunk->hash;
+}
+
+/*
+=================
+BSP_ExtractArchive
+
+Decompress all of an archive in memory, returns NULL if it is corrupt.
+=================
+*/
+void *BSP_ExtractArchive( const void *archive, int length, int *lengthOut ) {
+	archiveReader_t reader;
+	byte *data;
+	int i;
+
+	reader.fd = -1;
+	reader.data = archive;
+	reader.length = length;
+
+	if ( !Archive_Open( &reader ) ) {
+		free( reader.chunks );
+		return NULL;
+	}
+
+	data = malloc( reader.header.fileLength );
+	Com_Memset( data, 0, reader.header.fileLength );
+
+	for ( i = 0; i < reader.header.numChunks; i++ ) {
+		if ( !Archive_ReadChunk( &reader, &reader.chunks[i], data + reader.chunks[i].offset ) ) {
+			break;
+		}
+	}
+
+	if ( i < reader.header.numChunks || Com_Hash64( data, reader.header.fileLength, 0 ) != reader.header.hash ) {
+		free( reader.chunks );
+		free( data );
+		return NULL;
+	}
+
+	free( reader.chunks );
+
+	*lengthOut = reader.header.fileLength;
+	return data;
+}
+
+/*
+=================
+BSP_ReadArchiveHeader
+
+Read the original BSP header from an archive, returns the header length or
+-1 if fd is not a valid archive.
+=================
+*/
+int BSP_ReadArchiveHeader( int fd, void *header, int size ) {
+	archiveReader_t reader;
+	int length;
+
+	reader.fd = fd;
+	reader.data = NULL;
+	reader.length = FS_FileLength( fd );
+
+	if ( !Archive_Open( &reader ) || reader.chunks[0].length > size
+		|| !Archive_ReadChunk( &reader, &reader.chunks[0], header ) ) {
+		free( reader.chunks );
+		return -1;
+	}
+
+	length = reader.chunks[0].length;
+	free( reader.chunks );
+
+	return length;
+}
+
+/*
+=================
+BSP_ReadArchiveLumps
+
+Read the BSP header and the lumps in diskMask ( 1 << lump ) from an archive.
+The lumps are packed after the header and the lump table is updated, other
+lumps are empty. Returns NULL if fd is not a valid archive.
+=================
+*/
+void *BSP_ReadArchiveLumps( int fd, int diskMask, int *lengthOut ) {
+	archiveReader_t reader;
+	byte *image;
+	int *imageLumps;
+	int i, imageLength;
+
+	reader.fd = fd;
+	reader.data = NULL;
+	reader.length = FS_FileLength( fd );
+
+	if ( !Archive_Open( &reader ) ) {
+		free( reader.chunks );
+		return NULL;
+	}
+
+	imageLength = reader.chunks[0].length;
+
+	for ( i = 1; i < reader.header.numChunks; i++ ) {
+		if ( reader.chunks[i].lump >= 0 && ( diskMask & ( 1 << reader.chunks[i].lump ) ) ) {
+			imageLength += ( reader.chunks[i].length + 3 ) & ~3;
+		}
+	}
+
+	image = malloc( imageLength );
+	Com_Memset( image, 0, imageLength );
+
+	if ( !Archive_ReadChunk( &reader, &reader.chunks[0], image ) ) {
+		free( reader.chunks );
+		free( image );
+		return NULL;
+	}
+
+	imageLumps = (int *)( image + reader.header.lumpsOffset );
+	Com_Memset( imageLumps, 0, reader.header.numLumps * 8 );
+	imageLength = reader.chunks[0].length;
+
+	for ( i = 1; i < reader.header.numChunks; i++ ) {
+		const archiveChunk_t *chunk = &reader.chunks[i];
+
+		if ( chunk->lump < 0 || !( diskMask & ( 1 << chunk->lump ) ) ) {
+			continue;
+		}
+
+		if ( !Archive_ReadChunk( &reader, chunk, image + imageLength ) ) {
+			Com_Printf( "Error: Could not read lump %d of BSP archive\n", chunk->lump );
+			free( reader.chunks );
+			free( image );
+			return NULL;
+		}
+
+		imageLumps[chunk->lump * 2] = LittleLong( imageLength );
+		imageLumps[chunk->lump * 2 + 1] = LittleLong( chunk->length );
+		imageLength += ( chunk->length + 3 ) & ~3;
+	}
+
+	free( reader.chunks );
+
+	*lengthOut = imageLength;
+	return image;
+}
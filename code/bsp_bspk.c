@@ -0,0 +1,450 @@
+/*
+===========================================================================
+Copyright (C) 2015 Zack Middleton
+
+This file is part of BSP sekai Source Code.
+
+BSP sekai Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+BSP sekai Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with BSP sekai Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, BSP sekai Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+
+
+
+// bsp_bspk.c -- memory mappable copy of a loaded BSP
+//
+// A .bspk file is written next to a BSP and holds the arrays of bspFile_t as
+// they are after loading (converted to the abstract structures, including
+// data the loader generates such as terrain or fan surfaces). Each array is
+// aligned so the file can be mapped and used without parsing. The cache is
+// only used while the source BSP has the same size and modification time,
+// and the element sizes of this build match the ones it was written with.
+
+#include "sekai.h"
+#include "bsp.h"
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define BSPK_IDENT		(('K'<<24)+('P'<<16)+('S'<<8)+'B')
+		// little-endian "BSPK"
+#define BSPK_VERSION	1
+#define BSPK_ALIGN		64
+
+extern bspFormat_t *bspFormats[];
+extern const int numBspFormats;
+
+typedef struct {
+	int			fileofs;
+	int			count;
+} bspkArray_t;
+
+typedef struct {
+	int			ident;
+	int			version;
+	int			headerLength;
+	int			fileLength;
+
+	int64_t		sourceLength;
+	int64_t		sourceTime;		// nanoseconds
+
+	char		gameName[64];
+	int			formatIdent;
+	int			formatVersion;
+
+	int			checksum;
+	float		defaultLightGridSize[3];
+	int			numClusters;
+	int			clusterBytes;
+
+	int			elementSizes[BSPLUMP_MAX];
+	bspkArray_t	arrays[BSPLUMP_MAX];
+} bspkHeader_t;
+
+typedef struct {
+	size_t		array;			// offset of the pointer in bspFile_t
+	size_t		count;			// offset of the element count in bspFile_t
+	int			size;			// size of one element
+} bspkArrayDef_t;
+
+static const bspkArrayDef_t bspkArrays[BSPLUMP_MAX] = {
+	{ offsetof( bspFile_t, entityString ), offsetof( bspFile_t, entityStringLength ), 1 },
+	{ offsetof( bspFile_t, shaders ), offsetof( bspFile_t, numShaders ), sizeof ( dshader_t ) },
+	{ offsetof( bspFile_t, planes ), offsetof( bspFile_t, numPlanes ), sizeof ( dplane_t ) },
+	{ offsetof( bspFile_t, nodes ), offsetof( bspFile_t, numNodes ), sizeof ( dnode_t ) },
+	{ offsetof( bspFile_t, leafs ), offsetof( bspFile_t, numLeafs ), sizeof ( dleaf_t ) },
+	{ offsetof( bspFile_t, leafSurfaces ), offsetof( bspFile_t, numLeafSurfaces ), sizeof ( int ) },
+	{ offsetof( bspFile_t, leafBrushes ), offsetof( bspFile_t, numLeafBrushes ), sizeof ( int ) },
+	{ offsetof( bspFile_t, submodels ), offsetof( bspFile_t, numSubmodels ), sizeof ( dmodel_t ) },
+	{ offsetof( bspFile_t, brushes ), offsetof( bspFile_t, numBrushes ), sizeof ( dbrush_t ) },
+	{ offsetof( bspFile_t, brushSides ), offsetof( bspFile_t, numBrushSides ), sizeof ( dbrushside_t ) },
+	{ offsetof( bspFile_t, drawVerts ), offsetof( bspFile_t, numDrawVerts ), sizeof ( drawVert_t ) },
+	{ offsetof( bspFile_t, drawIndexes ), offsetof( bspFile_t, numDrawIndexes ), sizeof ( int ) },
+	{ offsetof( bspFile_t, fogs ), offsetof( bspFile_t, numFogs ), sizeof ( dfog_t ) },
+	{ offsetof( bspFile_t, surfaces ), offsetof( bspFile_t, numSurfaces ), sizeof ( dsurface_t ) },
+	{ offsetof( bspFile_t, lightmapData ), offsetof( bspFile_t, numLightmaps ), 128 * 128 * 3 },
+	{ offsetof( bspFile_t, lightGridData ), offsetof( bspFile_t, numGridPoints ), 8 },
+	{ offsetof( bspFile_t, visibility ), offsetof( bspFile_t, visibilityLength ), 1 },
+	{ offsetof( bspFile_t, lightGridArray ), offsetof( bspFile_t, numGridArrayPoints ), sizeof ( unsigned short ) },
+};
+
+#define BSPK_ARRAY( bsp, lump )	( *(void **)( (byte *)(bsp) + bspkArrays[lump].array ) )
+#define BSPK_COUNT( bsp, lump )	( *(int *)( (byte *)(bsp) + bspkArrays[lump].count ) )
+
+/*
+=================
+BSPK_Name
+=================
+*/
+static void BSPK_Name( const char *name, char *out, int outSize ) {
+	int length = strlen( name );
+
+	if ( length > 4 && !Q_stricmp( name + length - 4, ".bsp" ) ) {
+		snprintf( out, outSize, "%sk", name );
+	} else {
+		snprintf( out, outSize, "%s.bspk", name );
+	}
+}
+
+/*
+=================
+BSPK_SourceStat
+=================
+*/
+static qboolean BSPK_SourceStat( const char *name, int64_t *length, int64_t *mtime ) {
+	struct stat st;
+
+	if ( stat( name, &st ) != 0 ) {
+		return qfalse;
+	}
+
+	*length = st.st_size;
+#if defined( __APPLE__ )
+	*mtime = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#elif defined( _WIN32 )
+	*mtime = (int64_t)st.st_mtime * 1000000000;
+#else
+	*mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+
+	return qtrue;
+}
+
+/*
+=================
+BSPK_FindFormat
+=================
+*/
+static const bspFormat_t *BSPK_FindFormat( const bspkHeader_t *header ) {
+	int i;
+
+	for ( i = 0; i < numBspFormats; i++ ) {
+		if ( bspFormats[i]->ident == header->formatIdent && bspFormats[i]->version == header->formatVersion
+			&& !strncmp( bspFormats[i]->gameName, header->gameName, sizeof ( header->gameName ) ) ) {
+			return bspFormats[i];
+		}
+	}
+
+	return NULL;
+}
+
+/*
+=================
+BSPK_Validate
+
+Check that a mapped file was written for the current source BSP by a build
+with the same structures and that every array is inside the file.
+=================
+*/
+static qboolean BSPK_Validate( const bspkHeader_t *header, long length, const char *name ) {
+	int64_t sourceLength, sourceTime;
+	int i;
+
+	if ( length < (long)sizeof ( bspkHeader_t ) || header->ident != BSPK_IDENT || header->version != BSPK_VERSION
+		|| header->headerLength != sizeof ( bspkHeader_t ) || header->fileLength != length ) {
+		return qfalse;
+	}
+
+	if ( !BSPK_SourceStat( name, &sourceLength, &sourceTime )
+		|| sourceLength != header->sourceLength || sourceTime != header->sourceTime ) {
+		return qfalse;
+	}
+
+	for ( i = 0; i < BSPLUMP_MAX; i++ ) {
+		const bspkArray_t *array = &header->arrays[i];
+
+		if ( header->elementSizes[i] != bspkArrays[i].size ) {
+			return qfalse;
+		}
+
+		if ( array->count == 0 ) {
+			continue;
+		}
+
+		if ( array->count < 0 || array->fileofs < header->headerLength || ( array->fileofs & ( BSPK_ALIGN - 1 ) )
+			|| array->fileofs + (int64_t)array->count * bspkArrays[i].size > length ) {
+			return qfalse;
+		}
+	}
+
+	return qtrue;
+}
+
+/*
+=================
+BSPK_Map
+=================
+*/
+static void *BSPK_Map( const char *filename, long *length ) {
+	void *data;
+
+#ifdef _WIN32
+	*length = FS_ReadFile( filename, &data );
+#else
+	struct stat st;
+	int fd;
+
+	data = NULL;
+	*length = 0;
+
+	fd = open( filename, O_RDONLY );
+	if ( fd == -1 ) {
+		return NULL;
+	}
+
+	if ( fstat( fd, &st ) == 0 && st.st_size > 0 ) {
+		// private writable mapping, conversions modify some arrays in place
+		data = mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+
+		if ( data == MAP_FAILED ) {
+			data = NULL;
+		} else {
+			*length = st.st_size;
+		}
+	}
+
+	close( fd );
+#endif
+
+	return data;
+}
+
+/*
+=================
+BSP_UnmapBspk
+=================
+*/
+void BSP_UnmapBspk( bspFile_t *bsp ) {
+	if ( !bsp->mappedData ) {
+		return;
+	}
+
+#ifdef _WIN32
+	FS_FreeFile( bsp->mappedData );
+#else
+	munmap( bsp->mappedData, bsp->mappedLength );
+#endif
+
+	bsp->mappedData = NULL;
+	bsp->mappedLength = 0;
+}
+
+/*
+=================
+BSP_LoadBspk
+
+Returns NULL if there is no .bspk file for name or it is out of date.
+=================
+*/
+bspFile_t *BSP_LoadBspk( const char *name ) {
+	char				filename[1024];
+	const bspkHeader_t	*header;
+	const bspFormat_t	*format;
+	bspFile_t			*bsp;
+	long				length;
+	byte				*data;
+	int					i;
+
+	BSPK_Name( name, filename, sizeof ( filename ) );
+
+	data = BSPK_Map( filename, &length );
+	if ( !data ) {
+		return NULL;
+	}
+
+	header = (const bspkHeader_t *)data;
+	format = NULL;
+
+	if ( BSPK_Validate( header, length, name ) ) {
+		format = BSPK_FindFormat( header );
+	}
+
+	if ( !format ) {
+		Com_Printf( "Ignoring out of date '%s'\n", filename );
+#ifdef _WIN32
+		FS_FreeFile( data );
+#else
+		munmap( data, length );
+#endif
+		return NULL;
+	}
+
+	bsp = malloc( sizeof ( bspFile_t ) );
+	Com_Memset( bsp, 0, sizeof ( bspFile_t ) );
+
+	Q_strncpyz( bsp->name, name, sizeof ( bsp->name ) );
+	bsp->format = format;
+	bsp->checksum = header->checksum;
+	bsp->defaultLightGridSize[0] = header->defaultLightGridSize[0];
+	bsp->defaultLightGridSize[1] = header->defaultLightGridSize[1];
+	bsp->defaultLightGridSize[2] = header->defaultLightGridSize[2];
+	bsp->numClusters = header->numClusters;
+	bsp->clusterBytes = header->clusterBytes;
+
+	for ( i = 0; i < BSPLUMP_MAX; i++ ) {
+		BSPK_COUNT( bsp, i ) = header->arrays[i].count;
+
+		if ( header->arrays[i].count ) {
+			BSPK_ARRAY( bsp, i ) = data + header->arrays[i].fileofs;
+		}
+	}
+
+	bsp->mappedData = data;
+	bsp->mappedLength = length;
+
+	return bsp;
+}
+
+/*
+=================
+BSP_SaveBspk
+
+Write the .bspk file for a BSP loaded from its source file.
+=================
+*/
+qboolean BSP_SaveBspk( const bspFile_t *bsp ) {
+	static const byte	padding[BSPK_ALIGN] = {0};
+	char				filename[1024], tempname[1100];
+	bspkHeader_t		header;
+	FILE				*f;
+	int64_t				fileofs;
+	int					i;
+	qboolean			ok;
+
+	Com_Memset( &header, 0, sizeof ( header ) );
+
+	if ( !BSPK_SourceStat( bsp->name, &header.sourceLength, &header.sourceTime ) ) {
+		return qfalse;
+	}
+
+	header.ident = BSPK_IDENT;
+	header.version = BSPK_VERSION;
+	header.headerLength = sizeof ( header );
+
+	Q_strncpyz( header.gameName, bsp->format->gameName, sizeof ( header.gameName ) );
+	header.formatIdent = bsp->format->ident;
+	header.formatVersion = bsp->format->version;
+
+	header.checksum = bsp->checksum;
+	header.defaultLightGridSize[0] = bsp->defaultLightGridSize[0];
+	header.defaultLightGridSize[1] = bsp->defaultLightGridSize[1];
+	header.defaultLightGridSize[2] = bsp->defaultLightGridSize[2];
+	header.numClusters = bsp->numClusters;
+	header.clusterBytes = bsp->clusterBytes;
+
+	fileofs = ( sizeof ( header ) + BSPK_ALIGN - 1 ) & ~( BSPK_ALIGN - 1 );
+
+	for ( i = 0; i < BSPLUMP_MAX; i++ ) {
+		int count = BSPK_COUNT( bsp, i );
+
+		header.elementSizes[i] = bspkArrays[i].size;
+		header.arrays[i].count = count;
+
+		if ( count <= 0 ) {
+			continue;
+		}
+
+		header.arrays[i].fileofs = fileofs;
+		fileofs += (int64_t)count * bspkArrays[i].size;
+		fileofs = ( fileofs + BSPK_ALIGN - 1 ) & ~( BSPK_ALIGN - 1 );
+	}
+
+	if ( fileofs > 0x7fffffff ) {
+		Com_Printf( "Error: BSP '%s' is too large for a .bspk file\n", bsp->name );
+		return qfalse;
+	}
+
+	header.fileLength = fileofs;
+
+	BSPK_Name( bsp->name, filename, sizeof ( filename ) );
+	snprintf( tempname, sizeof ( tempname ), "%s.tmp", filename );
+
+	f = fopen( tempname, "wb" );
+	if ( !f ) {
+		Com_Printf( "Error: Could not write file '%s'\n", tempname );
+		return qfalse;
+	}
+
+	ok = fwrite( &header, sizeof ( header ), 1, f ) == 1;
+	fileofs = sizeof ( header );
+
+	for ( i = 0; i < BSPLUMP_MAX && ok; i++ ) {
+		int length = header.arrays[i].count * bspkArrays[i].size;
+
+		if ( length <= 0 ) {
+			continue;
+		}
+
+		if ( header.arrays[i].fileofs > fileofs ) {
+			ok = fwrite( padding, header.arrays[i].fileofs - fileofs, 1, f ) == 1;
+		}
+
+		ok = ok && fwrite( BSPK_ARRAY( bsp, i ), length, 1, f ) == 1;
+		fileofs = header.arrays[i].fileofs + length;
+	}
+
+	if ( ok && header.fileLength > fileofs ) {
+		ok = fwrite( padding, header.fileLength - fileofs, 1, f ) == 1;
+	}
+
+	if ( fclose( f ) != 0 ) {
+		ok = qfalse;
+	}
+
+	if ( ok ) {
+		remove( filename );
+		ok = rename( tempname, filename ) == 0;
+	}
+
+	if ( !ok ) {
+		Com_Printf( "Error: Could not write file '%s'\n", filename );
+		remove( tempname );
+		return qfalse;
+	}
+
+	return qtrue;
+}
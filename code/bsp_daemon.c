@@ -0,0 +1,637 @@
+/*
+===========================================================================
+Copyright (C) 2015 Zack Middleton
+
+This file is part of BSP sekai Source Code.
+
+BSP sekai Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+BSP sekai Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with BSP sekai Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, BSP sekai Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+
+
+
+/*
+	Daemon mode
+
+	Requests are read from a UNIX domain socket so that a service converting
+	many maps doesn't start a process for each one. Maps stay loaded between
+	requests (see BSP_KeepUnused) and are loaded again when the file changes.
+
+	Each request and response is a header of two little-endian ints followed
+	by length bytes:
+
+	request:  type, length, null terminated arguments
+	response: status (0 for success), length, text
+
+	A connection may send any number of requests, each worker thread serves
+	one connection at a time.
+*/
+
+#include "sekai.h"
+#include "bsp.h"
+
+#ifndef _WIN32
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define MAX_DAEMON_THREADS	16
+#define MAX_DAEMON_REQUEST	( 64 * 1024 )
+#define MAX_DAEMON_ARGS		8
+#define MAX_DAEMON_MAPS		64
+#define DAEMON_REPLY_LENGTH	4096
+
+typedef enum {
+	DAEMON_LOAD = 1,		// <BSP>
+	DAEMON_CONVERT,			// <conversion> <pass>,... <BSP> <format> <output-BSP>
+	DAEMON_SAVE,			// <BSP> <format> <output-BSP>
+	DAEMON_QUERY			// <BSP>
+} daemonRequest_t;
+
+static const char *daemonRequestNames[] = {
+	NULL,
+	"load",
+	"convert",
+	"save",
+	"query",
+};
+
+typedef struct {
+	int			type;
+	int			length;
+} daemonHeader_t;
+
+// file size and time of a map when it was loaded
+typedef struct {
+	char		name[MAX_OSPATH];
+	int64_t		size;
+	int64_t		mtime;
+} daemonMap_t;
+
+typedef struct {
+	int				fd;
+
+	daemonMap_t		maps[MAX_DAEMON_MAPS];
+	int				nextMap;
+	pthread_mutex_t	lock;
+} daemonState_t;
+
+static qboolean Daemon_Read( int fd, void *buffer, int length ) {
+	byte *out = buffer;
+	ssize_t r;
+
+	while ( length > 0 ) {
+		r = recv( fd, out, length, 0 );
+
+		if ( r == -1 && errno == EINTR ) {
+			continue;
+		}
+
+		if ( r <= 0 ) {
+			return qfalse;
+		}
+
+		out += r;
+		length -= r;
+	}
+
+	return qtrue;
+}
+
+static qboolean Daemon_Write( int fd, const void *buffer, int length ) {
+	const byte *in = buffer;
+	ssize_t r;
+
+	while ( length > 0 ) {
+		// don't get SIGPIPE if the client went away
+		r = send( fd, in, length, MSG_NOSIGNAL );
+
+		if ( r == -1 && errno == EINTR ) {
+			continue;
+		}
+
+		if ( r <= 0 ) {
+			return qfalse;
+		}
+
+		in += r;
+		length -= r;
+	}
+
+	return qtrue;
+}
+
+/*
+=================
+Daemon_Load
+
+BSP_Load that doesn't return a loaded map if the file changed since it was
+loaded.
+=================
+*/
+static bspFile_t *Daemon_Load( daemonState_t *state, const char *name ) {
+	daemonMap_t	*map;
+	struct stat	st;
+	int			i;
+
+	if ( stat( name, &st ) != 0 ) {
+		return NULL;
+	}
+
+	pthread_mutex_lock( &state->lock );
+
+	map = NULL;
+	for ( i = 0; i < MAX_DAEMON_MAPS; i++ ) {
+		if ( !Q_stricmp( state->maps[i].name, name ) ) {
+			map = &state->maps[i];
+			break;
+		}
+	}
+
+	if ( map && ( map->size != st.st_size || map->mtime != st.st_mtime ) ) {
+		BSP_Forget( name );
+	}
+
+	if ( !map ) {
+		// the oldest map is forgotten, it's only looked up again by BSP_Load
+		map = &state->maps[state->nextMap];
+		state->nextMap = ( state->nextMap + 1 ) % MAX_DAEMON_MAPS;
+		BSP_Forget( map->name );
+		Q_strncpyz( map->name, name, sizeof ( map->name ) );
+	}
+
+	map->size = st.st_size;
+	map->mtime = st.st_mtime;
+
+	pthread_mutex_unlock( &state->lock );
+
+	return BSP_Load( name );
+}
+
+static qboolean Daemon_BuildPipeline( bspPipeline_t *pipeline, const char *conversionName, const char *passList, char *reply ) {
+	const bspPass_t *conversion;
+
+	Com_Memset( pipeline, 0, sizeof ( *pipeline ) );
+
+	if ( Q_stricmp( conversionName, "none" ) != 0 ) {
+		conversion = BSP_FindPass( conversionName );
+
+		if ( !conversion || !conversion->conversion ) {
+			snprintf( reply, DAEMON_REPLY_LENGTH, "Unknown conversion '%s'.", conversionName );
+			return qfalse;
+		}
+
+		BSP_AddPass( pipeline, conversion );
+	}
+
+	if ( passList[0] && !BSP_AddPasses( pipeline, passList ) ) {
+		snprintf( reply, DAEMON_REPLY_LENGTH, "Unknown pass in '%s'.", passList );
+		return qfalse;
+	}
+
+	return qtrue;
+}
+
+// saves the BSP using the conversion and passes, loaded maps are copied before running passes
+static qboolean Daemon_Convert( daemonState_t *state, const char *conversionName, const char *passList,
+		const char *name, const char *formatName, const char *outputName, char *reply ) {
+	bspPipeline_t	pipeline;
+	bspFormat_t		*format;
+	bspFile_t		*bsp, *copy;
+	void			*saveData;
+	int				saveLength;
+	qboolean		saved;
+
+	if ( !Daemon_BuildPipeline( &pipeline, conversionName, passList, reply ) ) {
+		return qfalse;
+	}
+
+	format = BSP_FormatForName( formatName );
+
+	if ( !format || !format->saveFunction ) {
+		snprintf( reply, DAEMON_REPLY_LENGTH, "Unknown format '%s'.", formatName );
+		return qfalse;
+	}
+
+	if ( !Q_stricmp( name, outputName ) ) {
+		snprintf( reply, DAEMON_REPLY_LENGTH, "Same input and output file '%s'.", name );
+		return qfalse;
+	}
+
+	bsp = Daemon_Load( state, name );
+
+	if ( !bsp ) {
+		snprintf( reply, DAEMON_REPLY_LENGTH, "Could not read file '%s'.", name );
+		return qfalse;
+	}
+
+	// passes change the BSP, other requests use the loaded one
+	if ( pipeline.numPasses ) {
+		copy = BSP_Copy( bsp );
+		BSP_Free( bsp );
+		bsp = copy;
+
+		BSP_RunPasses( &pipeline, bsp );
+	}
+
+	saveData = NULL;
+	saveLength = format->saveFunction( format, outputName, bsp, &saveData );
+
+	BSP_Free( bsp );
+
+	// output may be a hard link to a cache entry, don't write through it
+	remove( outputName );
+
+	saved = ( saveData && FS_WriteFile( outputName, saveData, saveLength ) == saveLength );
+	free( saveData );
+
+	if ( !saved ) {
+		snprintf( reply, DAEMON_REPLY_LENGTH, "Saving BSP '%s' failed.", outputName );
+		return qfalse;
+	}
+
+	snprintf( reply, DAEMON_REPLY_LENGTH, "Saved BSP '%s' successfully.", outputName );
+	return qtrue;
+}
+
+static qboolean Daemon_Query( daemonState_t *state, const char *name, char *reply ) {
+	bspFile_t *bsp;
+
+	bsp = Daemon_Load( state, name );
+
+	if ( !bsp ) {
+		snprintf( reply, DAEMON_REPLY_LENGTH, "Could not read file '%s'.", name );
+		return qfalse;
+	}
+
+	snprintf( reply, DAEMON_REPLY_LENGTH,
+			"format %s\nchecksum %d\nentities %d\nshaders %d\nplanes %d\nnodes %d\nleafs %d\n"
+			"leafsurfaces %d\nleafbrushes %d\nmodels %d\nbrushes %d\nbrushsides %d\ndrawverts %d\n"
+			"drawindexes %d\nfogs %d\nsurfaces %d\nlightmaps %d\nlightgrid %d\nvisibility %d\nlightarray %d",
+			bsp->format->gameName, bsp->checksum, bsp->entityStringLength, bsp->numShaders, bsp->numPlanes,
+			bsp->numNodes, bsp->numLeafs, bsp->numLeafSurfaces, bsp->numLeafBrushes, bsp->numSubmodels,
+			bsp->numBrushes, bsp->numBrushSides, bsp->numDrawVerts, bsp->numDrawIndexes, bsp->numFogs,
+			bsp->numSurfaces, bsp->numLightmaps, bsp->numGridPoints, bsp->visibilityLength,
+			bsp->numGridArrayPoints );
+
+	BSP_Free( bsp );
+	return qtrue;
+}
+
+/*
+=================
+Daemon_Handle
+
+Run a request, reply is set to the response text.
+=================
+*/
+static qboolean Daemon_Handle( daemonState_t *state, int type, const char **args, int numArgs, char *reply ) {
+	bspFile_t *bsp;
+
+	switch ( type ) {
+		case DAEMON_LOAD:
+			if ( numArgs != 1 ) {
+				break;
+			}
+
+			bsp = Daemon_Load( state, args[0] );
+
+			if ( !bsp ) {
+				snprintf( reply, DAEMON_REPLY_LENGTH, "Could not read file '%s'.", args[0] );
+				return qfalse;
+			}
+
+			snprintf( reply, DAEMON_REPLY_LENGTH, "Loaded BSP '%s' successfully.", args[0] );
+			BSP_Free( bsp );
+			return qtrue;
+
+		case DAEMON_CONVERT:
+			if ( numArgs != 5 ) {
+				break;
+			}
+
+			return Daemon_Convert( state, args[0], args[1], args[2], args[3], args[4], reply );
+
+		case DAEMON_SAVE:
+			if ( numArgs != 3 ) {
+				break;
+			}
+
+			return Daemon_Convert( state, "none", "", args[0], args[1], args[2], reply );
+
+		case DAEMON_QUERY:
+			if ( numArgs != 1 ) {
+				break;
+			}
+
+			return Daemon_Query( state, args[0], reply );
+
+		default:
+			snprintf( reply, DAEMON_REPLY_LENGTH, "Unknown request %d.", type );
+			return qfalse;
+	}
+
+	snprintf( reply, DAEMON_REPLY_LENGTH, "Wrong number of arguments for %s.", daemonRequestNames[type] );
+	return qfalse;
+}
+
+// read requests from a client until it closes the connection
+static void Daemon_Serve( daemonState_t *state, int client, char *request ) {
+	daemonHeader_t	header, response;
+	const char		*args[MAX_DAEMON_ARGS];
+	char			reply[DAEMON_REPLY_LENGTH];
+	int				numArgs, i;
+	int64_t			start;
+	qboolean		success;
+
+	while ( Daemon_Read( client, &header, sizeof ( header ) ) ) {
+		header.type = LittleLong( header.type );
+		header.length = LittleLong( header.length );
+
+		if ( header.length < 0 || header.length > MAX_DAEMON_REQUEST
+			|| !Daemon_Read( client, request, header.length ) ) {
+			return;
+		}
+
+		start = Sys_Microseconds();
+
+		// split the null terminated arguments
+		request[header.length] = '\0';
+		numArgs = 0;
+
+		for ( i = 0; i < header.length; i += strlen( request + i ) + 1 ) {
+			if ( numArgs == MAX_DAEMON_ARGS ) {
+				break;
+			}
+			args[numArgs++] = request + i;
+		}
+
+		success = Daemon_Handle( state, header.type, args, numArgs, reply );
+
+		if ( header.type > 0 && header.type < ARRAY_LEN( daemonRequestNames ) ) {
+			Com_Printf( "%-7s %s %9.3f ms\n", daemonRequestNames[header.type], success ? "ok    " : "failed",
+					( Sys_Microseconds() - start ) / 1000.0 );
+		}
+
+		response.type = LittleLong( success ? 0 : 1 );
+		response.length = LittleLong( (int)strlen( reply ) );
+
+		if ( !Daemon_Write( client, &response, sizeof ( response ) )
+			|| !Daemon_Write( client, reply, strlen( reply ) ) ) {
+			return;
+		}
+	}
+}
+
+static void *Daemon_Worker( void *arg ) {
+	daemonState_t	*state = arg;
+	char			*request;
+	int				client;
+
+	request = malloc( MAX_DAEMON_REQUEST + 1 );
+
+	while ( 1 ) {
+		client = accept( state->fd, NULL, NULL );
+
+		if ( client == -1 ) {
+			continue;
+		}
+
+		Daemon_Serve( state, client, request );
+		close( client );
+	}
+
+	return NULL;
+}
+
+static int Daemon_Connect( const char *socketPath ) {
+	struct sockaddr_un	addr;
+	int					fd;
+
+	fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if ( fd == -1 ) {
+		return -1;
+	}
+
+	Com_Memset( &addr, 0, sizeof ( addr ) );
+	addr.sun_family = AF_UNIX;
+	Q_strncpyz( addr.sun_path, socketPath, sizeof ( addr.sun_path ) );
+
+	if ( connect( fd, (struct sockaddr *)&addr, sizeof ( addr ) ) != 0 ) {
+		close( fd );
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+=================
+BSP_Daemon
+
+Serve requests on socketPath, up to keepMaps maps without references stay
+loaded. Returns when there is an error or bspsekai is told to quit.
+=================
+*/
+qboolean BSP_Daemon( const char *socketPath, int keepMaps ) {
+	daemonState_t		state;
+	struct sockaddr_un	addr;
+	pthread_t			thread;
+	int					numThreads, i, fd;
+
+	if ( strlen( socketPath ) >= sizeof ( addr.sun_path ) ) {
+		Com_Printf( "Error: socket path '%s' is too long.\n", socketPath );
+		return qfalse;
+	}
+
+	// a socket left by a daemon that exited is replaced
+	fd = Daemon_Connect( socketPath );
+	if ( fd != -1 ) {
+		Com_Printf( "Error: a daemon is already listening on '%s'.\n", socketPath );
+		close( fd );
+		return qfalse;
+	}
+
+	unlink( socketPath );
+
+	Com_Memset( &state, 0, sizeof ( state ) );
+	pthread_mutex_init( &state.lock, NULL );
+
+	state.fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if ( state.fd == -1 ) {
+		Com_Printf( "Error: Could not create socket: %s\n", strerror( errno ) );
+		return qfalse;
+	}
+
+	Com_Memset( &addr, 0, sizeof ( addr ) );
+	addr.sun_family = AF_UNIX;
+	Q_strncpyz( addr.sun_path, socketPath, sizeof ( addr.sun_path ) );
+
+	if ( bind( state.fd, (struct sockaddr *)&addr, sizeof ( addr ) ) != 0 || listen( state.fd, 64 ) != 0 ) {
+		Com_Printf( "Error: Could not listen on '%s': %s\n", socketPath, strerror( errno ) );
+		close( state.fd );
+		return qfalse;
+	}
+
+	BSP_KeepUnused( keepMaps );
+
+	// show each request when the output is piped to a log
+	setvbuf( stdout, NULL, _IOLBF, 0 );
+
+	// workers wait for a connection, idle connections hold a worker
+	numThreads = MIN( MAX( Com_NumCPUs(), 4 ), MAX_DAEMON_THREADS );
+	for ( i = 0; i < numThreads; i++ ) {
+		if ( pthread_create( &thread, NULL, Daemon_Worker, &state ) != 0 ) {
+			break;
+		}
+		pthread_detach( thread );
+	}
+
+	if ( !i ) {
+		Com_Printf( "Error: Could not start worker threads.\n" );
+		close( state.fd );
+		return qfalse;
+	}
+
+	Com_Printf( "Listening on '%s' with %d workers.\n", socketPath, i );
+
+	Sys_CatchQuit();
+
+	// the workers serve all requests
+	while ( !Sys_QuitRequested() ) {
+		pause();
+	}
+
+	close( state.fd );
+	unlink( socketPath );
+
+	return qtrue;
+}
+
+/*
+=================
+BSP_DaemonSend
+
+Send a request to the daemon on socketPath and print the response. Returns
+0 if the request succeeded.
+=================
+*/
+int BSP_DaemonSend( const char *socketPath, const char *requestName, const char **args, int numArgs ) {
+	daemonHeader_t	header;
+	char			*request, *reply;
+	int				length, fd, i, status;
+
+	for ( i = 1; i < ARRAY_LEN( daemonRequestNames ); i++ ) {
+		if ( !Q_stricmp( daemonRequestNames[i], requestName ) ) {
+			break;
+		}
+	}
+
+	if ( i == ARRAY_LEN( daemonRequestNames ) ) {
+		Com_Printf( "Error: Unknown request '%s'.\n", requestName );
+		return 1;
+	}
+
+	header.type = LittleLong( i );
+
+	length = 0;
+	for ( i = 0; i < numArgs; i++ ) {
+		length += strlen( args[i] ) + 1;
+	}
+
+	if ( length > MAX_DAEMON_REQUEST ) {
+		Com_Printf( "Error: request is too long.\n" );
+		return 1;
+	}
+
+	request = malloc( length + 1 );
+	header.length = LittleLong( length );
+
+	length = 0;
+	for ( i = 0; i < numArgs; i++ ) {
+		strcpy( request + length, args[i] );
+		length += strlen( args[i] ) + 1;
+	}
+
+	fd = Daemon_Connect( socketPath );
+
+	if ( fd == -1 ) {
+		Com_Printf( "Error: Could not connect to '%s'.\n", socketPath );
+		free( request );
+		return 1;
+	}
+
+	if ( !Daemon_Write( fd, &header, sizeof ( header ) ) || !Daemon_Write( fd, request, length )
+		|| !Daemon_Read( fd, &header, sizeof ( header ) ) ) {
+		Com_Printf( "Error: Lost connection to '%s'.\n", socketPath );
+		free( request );
+		close( fd );
+		return 1;
+	}
+
+	free( request );
+
+	status = LittleLong( header.type );
+	length = LittleLong( header.length );
+
+	if ( length < 0 || length > MAX_DAEMON_REQUEST ) {
+		close( fd );
+		return 1;
+	}
+
+	reply = malloc( length + 1 );
+
+	if ( !Daemon_Read( fd, reply, length ) ) {
+		Com_Printf( "Error: Lost connection to '%s'.\n", socketPath );
+		free( reply );
+		close( fd );
+		return 1;
+	}
+
+	reply[length] = '\0';
+	Com_Printf( "%s\n", reply );
+
+	free( reply );
+	close( fd );
+
+	return status ? 1 : 0;
+}
+
+#else
+
+qboolean BSP_Daemon( const char *socketPath, int keepMaps ) {
+	Com_Printf( "Error: daemon is not supported on Windows.\n" );
+	return qfalse;
+}
+
+int BSP_DaemonSend( const char *socketPath, const char *requestName, const char **args, int numArgs ) {
+	Com_Printf( "Error: daemon is not supported on Windows.\n" );
+	return 1;
+}
+
+#endif
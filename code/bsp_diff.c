@@ -0,0 +1,665 @@
+/*
+===========================================================================
+Copyright (C) 2015 Zack Middleton
+
+This file is part of BSP sekai Source Code.
+
+BSP sekai Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+BSP sekai Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with BSP sekai Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, BSP sekai Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+
+
+// bsp_diff.c -- binary patches between two versions of a BSP file
+
+#include "sekai.h"
+#include "bsp.h"
+
+// A patch describes the new file as a list of segments in file order. The
+// header (including the lump table) and the gaps between lumps are stored
+// as raw bytes or zero fill. Each lump is either copied unchanged from the
+// lump with the same index in the old file, stored raw, or delta encoded
+// against the old lump as a list of copy / insert operations.
+//
+// Hashes of the old and new file are kept in the patch so applying it to
+// the wrong file, or a bad patch, is detected.
+
+#define PATCH_IDENT		(('D'<<24)+('P'<<16)+('S'<<8)+'B')
+		// little-endian "BSPD"
+#define PATCH_VERSION	1
+
+#define SEG_RAW			0	// length, data
+#define SEG_ZERO		1	// length
+#define SEG_LUMP		2	// length, old lump
+#define SEG_DELTA		3	// length, old lump, numOps, ops
+
+#define OP_COPY			0	// old offset, length
+#define OP_INSERT		1	// length, data
+
+// lumps smaller than this are not delta encoded
+#define DELTA_MIN_LENGTH	4096
+#define DELTA_BLOCK			32
+
+typedef struct {
+	byte	*data;
+	int		length;
+	int		size;
+} patchBuffer_t;
+
+typedef struct {
+	const byte	*data;
+	int			length;
+	int			ofs;
+	qboolean	overflow;
+} patchReader_t;
+
+typedef struct {
+	unsigned int	hash;
+	int				offset;		// -1 if empty
+} deltaBlock_t;
+
+/*
+==============================================================================
+
+Patch buffer
+
+==============================================================================
+*/
+
+static void Patch_Reserve( patchBuffer_t *buf, int length ) {
+	if ( buf->length + length <= buf->size ) {
+		return;
+	}
+
+	while ( buf->length + length > buf->size ) {
+		buf->size = buf->size ? buf->size * 2 : 65536;
+	}
+
+	buf->data = realloc( buf->data, buf->size );
+}
+
+static void Patch_WriteData( patchBuffer_t *buf, const void *data, int length ) {
+	Patch_Reserve( buf, length );
+	Com_Memcpy( buf->data + buf->length, data, length );
+	buf->length += length;
+}
+
+static void Patch_WriteInt( patchBuffer_t *buf, int value ) {
+	value = LittleLong( value );
+	Patch_WriteData( buf, &value, 4 );
+}
+
+static int Patch_ReadInt( patchReader_t *reader ) {
+	int value;
+
+	if ( reader->ofs + 4 > reader->length ) {
+		reader->overflow = qtrue;
+		return 0;
+	}
+
+	Com_Memcpy( &value, reader->data + reader->ofs, 4 );
+	reader->ofs += 4;
+
+	return LittleLong( value );
+}
+
+static const byte *Patch_ReadData( patchReader_t *reader, int length ) {
+	const byte *data;
+
+	if ( length < 0 || length > reader->length - reader->ofs ) {
+		reader->overflow = qtrue;
+		return NULL;
+	}
+
+	data = reader->data + reader->ofs;
+	reader->ofs += length;
+
+	return data;
+}
+
+/*
+==============================================================================
+
+Delta encoding
+
+==============================================================================
+*/
+
+#define ROLL_MULT	0x01000193
+
+static unsigned int BlockHash( const byte *data ) {
+	unsigned int	hash;
+	int				i;
+
+	hash = 0;
+	for ( i = 0; i < DELTA_BLOCK; i++ ) {
+		hash = hash * ROLL_MULT + data[i];
+	}
+
+	return hash;
+}
+
+static void FlushInsert( patchBuffer_t *buf, const byte *data, int length, int *numOps ) {
+	if ( length <= 0 ) {
+		return;
+	}
+
+	Patch_WriteInt( buf, OP_INSERT );
+	Patch_WriteInt( buf, length );
+	Patch_WriteData( buf, data, length );
+	(*numOps)++;
+}
+
+/*
+=================
+DeltaEncode
+
+Write copy / insert operations that rebuild newData from oldData. Blocks of
+the old lump are hashed, the new lump is scanned with a rolling hash and
+each match is extended in both directions. Returns the number of operations.
+=================
+*/
+static int DeltaEncode( patchBuffer_t *buf, const byte *oldData, int oldLength, const byte *newData, int newLength ) {
+	deltaBlock_t	*table;
+	int				tableSize, mask;
+	unsigned int	hash, outMult;
+	int				pos, literal, numOps;
+	int				i, j;
+
+	numOps = 0;
+
+	if ( oldLength < DELTA_BLOCK || newLength < DELTA_BLOCK ) {
+		FlushInsert( buf, newData, newLength, &numOps );
+		return numOps;
+	}
+
+	tableSize = 1024;
+	while ( tableSize < ( oldLength / DELTA_BLOCK ) * 2 ) {
+		tableSize <<= 1;
+	}
+	mask = tableSize - 1;
+
+	table = malloc( tableSize * sizeof ( *table ) );
+	for ( i = 0; i < tableSize; i++ ) {
+		table[i].offset = -1;
+	}
+
+	// index old blocks, keeping the first of identical blocks
+	for ( i = 0; i + DELTA_BLOCK <= oldLength; i += DELTA_BLOCK ) {
+		hash = BlockHash( oldData + i );
+
+		for ( j = hash & mask; table[j].offset != -1; j = ( j + 1 ) & mask ) {
+			if ( table[j].hash == hash && !memcmp( oldData + table[j].offset, oldData + i, DELTA_BLOCK ) ) {
+				break;
+			}
+		}
+
+		if ( table[j].offset == -1 ) {
+			table[j].hash = hash;
+			table[j].offset = i;
+		}
+	}
+
+	// ROLL_MULT ^ ( DELTA_BLOCK - 1 ), to remove the byte leaving the window
+	outMult = 1;
+	for ( i = 0; i < DELTA_BLOCK - 1; i++ ) {
+		outMult *= ROLL_MULT;
+	}
+
+	pos = 0;
+	literal = 0;
+	hash = BlockHash( newData );
+
+	while ( pos + DELTA_BLOCK <= newLength ) {
+		int match = -1;
+		int start, oldStart, end, oldEnd;
+
+		for ( j = hash & mask; table[j].offset != -1; j = ( j + 1 ) & mask ) {
+			if ( table[j].hash == hash && !memcmp( oldData + table[j].offset, newData + pos, DELTA_BLOCK ) ) {
+				match = table[j].offset;
+				break;
+			}
+		}
+
+		if ( match == -1 ) {
+			if ( pos + DELTA_BLOCK < newLength ) {
+				hash = ( hash - newData[pos] * outMult ) * ROLL_MULT + newData[pos + DELTA_BLOCK];
+			}
+			pos++;
+			continue;
+		}
+
+		start = pos;
+		oldStart = match;
+		while ( start > literal && oldStart > 0 && newData[start - 1] == oldData[oldStart - 1] ) {
+			start--;
+			oldStart--;
+		}
+
+		end = pos + DELTA_BLOCK;
+		oldEnd = match + DELTA_BLOCK;
+		while ( end < newLength && oldEnd < oldLength && newData[end] == oldData[oldEnd] ) {
+			end++;
+			oldEnd++;
+		}
+
+		FlushInsert( buf, newData + literal, start - literal, &numOps );
+
+		Patch_WriteInt( buf, OP_COPY );
+		Patch_WriteInt( buf, oldStart );
+		Patch_WriteInt( buf, end - start );
+		numOps++;
+
+		pos = literal = end;
+
+		if ( pos + DELTA_BLOCK <= newLength ) {
+			hash = BlockHash( newData + pos );
+		}
+	}
+
+	FlushInsert( buf, newData + literal, newLength - literal, &numOps );
+
+	free( table );
+
+	return numOps;
+}
+
+static qboolean DeltaDecode( patchReader_t *reader, const byte *oldData, int oldLength, byte *out, int length ) {
+	int		numOps, pos, i;
+
+	numOps = Patch_ReadInt( reader );
+	pos = 0;
+
+	for ( i = 0; i < numOps && !reader->overflow; i++ ) {
+		int op = Patch_ReadInt( reader );
+
+		if ( op == OP_COPY ) {
+			int ofs = Patch_ReadInt( reader );
+			int len = Patch_ReadInt( reader );
+
+			if ( ofs < 0 || len < 0 || ofs > oldLength - len || len > length - pos ) {
+				return qfalse;
+			}
+
+			Com_Memcpy( out + pos, oldData + ofs, len );
+			pos += len;
+		} else if ( op == OP_INSERT ) {
+			int len = Patch_ReadInt( reader );
+			const byte *data;
+
+			if ( len < 0 || len > length - pos ) {
+				return qfalse;
+			}
+
+			data = Patch_ReadData( reader, len );
+			if ( !data ) {
+				return qfalse;
+			}
+
+			Com_Memcpy( out + pos, data, len );
+			pos += len;
+		} else {
+			return qfalse;
+		}
+	}
+
+	return !reader->overflow && pos == length;
+}
+
+/*
+==============================================================================
+
+Diff
+
+==============================================================================
+*/
+
+static void GetLumps( const bspFormat_t *format, const void *data, int length, lump_t *lumps ) {
+	int i;
+
+	Com_Memcpy( lumps, (const byte *)data + format->lumpsOffset, format->numLumps * sizeof ( lump_t ) );
+
+	for ( i = 0; i < format->numLumps; i++ ) {
+		lumps[i].fileofs = LittleLong( lumps[i].fileofs );
+		lumps[i].filelen = LittleLong( lumps[i].filelen );
+
+		if ( lumps[i].fileofs < 0 || lumps[i].filelen < 0 || lumps[i].fileofs > length - lumps[i].filelen ) {
+			lumps[i].fileofs = lumps[i].filelen = 0;
+		}
+	}
+}
+
+static void WriteGap( patchBuffer_t *buf, const byte *data, int length, int *numSegments ) {
+	int i;
+
+	if ( length <= 0 ) {
+		return;
+	}
+
+	for ( i = 0; i < length; i++ ) {
+		if ( data[i] ) {
+			break;
+		}
+	}
+
+	if ( i == length ) {
+		Patch_WriteInt( buf, SEG_ZERO );
+		Patch_WriteInt( buf, length );
+	} else {
+		Patch_WriteInt( buf, SEG_RAW );
+		Patch_WriteInt( buf, length );
+		Patch_WriteData( buf, data, length );
+	}
+
+	(*numSegments)++;
+}
+
+static int Diff_CompareLumps( const void *a, const void *b ) {
+	const lump_t *la = *(const lump_t **)a;
+	const lump_t *lb = *(const lump_t **)b;
+
+	return la->fileofs - lb->fileofs;
+}
+
+/*
+=================
+BSP_Diff
+
+Both files must use the same BSP format. Returns patch length or -1.
+=================
+*/
+int BSP_Diff( const void *oldData, int oldLength, const void *newData, int newLength, void **patchOut ) {
+	const bspFormat_t	*format, *newFormat;
+	lump_t			*oldLumps, *newLumps;
+	lump_t			**sorted;
+	patchBuffer_t	buf;
+	uint64_t		hash;
+	int				numSegmentsOfs, numSegments;
+	int				headerLength, pos;
+	int				numUnchanged, numDelta, numRaw;
+	int				i;
+
+	*patchOut = NULL;
+
+	format = BSP_FindFormat( oldData, oldLength );
+	newFormat = BSP_FindFormat( newData, newLength );
+
+	if ( !format || !newFormat ) {
+		Com_Printf( "ERROR: Unsupported BSP format.\n" );
+		return -1;
+	}
+
+	if ( format->lumpsOffset != newFormat->lumpsOffset || format->numLumps != newFormat->numLumps ) {
+		Com_Printf( "ERROR: Cannot diff %s BSP against %s BSP.\n", format->gameName, newFormat->gameName );
+		return -1;
+	}
+
+	oldLumps = malloc( format->numLumps * sizeof ( lump_t ) * 2 );
+	newLumps = oldLumps + format->numLumps;
+	sorted = malloc( format->numLumps * sizeof ( *sorted ) );
+
+	GetLumps( format, oldData, oldLength, oldLumps );
+	GetLumps( format, newData, newLength, newLumps );
+
+	Com_Memset( &buf, 0, sizeof ( buf ) );
+
+	Patch_WriteInt( &buf, PATCH_IDENT );
+	Patch_WriteInt( &buf, PATCH_VERSION );
+	Patch_WriteInt( &buf, oldLength );
+	Patch_WriteInt( &buf, newLength );
+
+	hash = Com_Hash64( oldData, oldLength, 0 );
+	Patch_WriteInt( &buf, (int)( hash & 0xffffffff ) );
+	Patch_WriteInt( &buf, (int)( hash >> 32 ) );
+	hash = Com_Hash64( newData, newLength, 0 );
+	Patch_WriteInt( &buf, (int)( hash & 0xffffffff ) );
+	Patch_WriteInt( &buf, (int)( hash >> 32 ) );
+
+	numSegmentsOfs = buf.length;
+	Patch_WriteInt( &buf, 0 );
+	numSegments = 0;
+
+	numUnchanged = numDelta = numRaw = 0;
+
+	// header and lump table
+	headerLength = format->lumpsOffset + format->numLumps * sizeof ( lump_t );
+	Patch_WriteInt( &buf, SEG_RAW );
+	Patch_WriteInt( &buf, headerLength );
+	Patch_WriteData( &buf, newData, headerLength );
+	numSegments++;
+
+	for ( i = 0; i < format->numLumps; i++ ) {
+		sorted[i] = &newLumps[i];
+	}
+	qsort( sorted, format->numLumps, sizeof ( *sorted ), Diff_CompareLumps );
+
+	pos = headerLength;
+
+	for ( i = 0; i < format->numLumps; i++ ) {
+		const lump_t	*newLump = sorted[i];
+		const lump_t	*oldLump = &oldLumps[ newLump - newLumps ];
+		const byte		*lumpData;
+		int				start, length;
+
+		// skip empty lumps and lumps sharing data with the previous one
+		if ( !newLump->filelen || newLump->fileofs + newLump->filelen <= pos ) {
+			continue;
+		}
+
+		start = newLump->fileofs;
+		if ( start < pos ) {
+			// partially overlapping, store the rest raw
+			WriteGap( &buf, (const byte *)newData + pos, start + newLump->filelen - pos, &numSegments );
+			pos = start + newLump->filelen;
+			numRaw++;
+			continue;
+		}
+
+		WriteGap( &buf, (const byte *)newData + pos, start - pos, &numSegments );
+
+		lumpData = (const byte *)newData + start;
+		length = newLump->filelen;
+
+		if ( length == oldLump->filelen && !memcmp( lumpData, (const byte *)oldData + oldLump->fileofs, length ) ) {
+			Patch_WriteInt( &buf, SEG_LUMP );
+			Patch_WriteInt( &buf, length );
+			Patch_WriteInt( &buf, newLump - newLumps );
+			numUnchanged++;
+		} else if ( length >= DELTA_MIN_LENGTH && oldLump->filelen >= DELTA_MIN_LENGTH ) {
+			int segmentOfs, numOpsOfs, numOps;
+
+			segmentOfs = buf.length;
+
+			Patch_WriteInt( &buf, SEG_DELTA );
+			Patch_WriteInt( &buf, length );
+			Patch_WriteInt( &buf, newLump - newLumps );
+			numOpsOfs = buf.length;
+			Patch_WriteInt( &buf, 0 );
+
+			numOps = DeltaEncode( &buf, (const byte *)oldData + oldLump->fileofs, oldLump->filelen, lumpData, length );
+
+			if ( buf.length - segmentOfs >= length + 8 ) {
+				// delta is no smaller than the lump
+				buf.length = segmentOfs;
+				Patch_WriteInt( &buf, SEG_RAW );
+				Patch_WriteInt( &buf, length );
+				Patch_WriteData( &buf, lumpData, length );
+				numRaw++;
+			} else {
+				numOps = LittleLong( numOps );
+				Com_Memcpy( buf.data + numOpsOfs, &numOps, 4 );
+				numDelta++;
+			}
+		} else {
+			Patch_WriteInt( &buf, SEG_RAW );
+			Patch_WriteInt( &buf, length );
+			Patch_WriteData( &buf, lumpData, length );
+			numRaw++;
+		}
+
+		numSegments++;
+		pos = start + length;
+	}
+
+	WriteGap( &buf, (const byte *)newData + pos, newLength - pos, &numSegments );
+
+	numSegments = LittleLong( numSegments );
+	Com_Memcpy( buf.data + numSegmentsOfs, &numSegments, 4 );
+
+	free( oldLumps );
+	free( sorted );
+
+	Com_Printf( "Lumps: %d unchanged, %d delta encoded, %d replaced.\n", numUnchanged, numDelta, numRaw );
+
+	*patchOut = buf.data;
+	return buf.length;
+}
+
+/*
+=================
+BSP_ApplyPatch
+
+Returns length of the new file or -1.
+=================
+*/
+int BSP_ApplyPatch( const void *oldData, int oldLength, const void *patch, int patchLength, void **dataOut ) {
+	const bspFormat_t	*format;
+	patchReader_t	reader;
+	lump_t			*oldLumps;
+	uint64_t		oldHash, newHash;
+	byte			*out;
+	int				newLength, numSegments, pos;
+	int				i;
+
+	*dataOut = NULL;
+
+	reader.data = patch;
+	reader.length = patchLength;
+	reader.ofs = 0;
+	reader.overflow = qfalse;
+
+	if ( Patch_ReadInt( &reader ) != PATCH_IDENT || Patch_ReadInt( &reader ) != PATCH_VERSION ) {
+		Com_Printf( "ERROR: Not a BSP patch.\n" );
+		return -1;
+	}
+
+	if ( Patch_ReadInt( &reader ) != oldLength ) {
+		Com_Printf( "ERROR: Patch does not match the BSP file.\n" );
+		return -1;
+	}
+
+	newLength = Patch_ReadInt( &reader );
+	oldHash = (unsigned int)Patch_ReadInt( &reader );
+	oldHash |= (uint64_t)(unsigned int)Patch_ReadInt( &reader ) << 32;
+	newHash = (unsigned int)Patch_ReadInt( &reader );
+	newHash |= (uint64_t)(unsigned int)Patch_ReadInt( &reader ) << 32;
+	numSegments = Patch_ReadInt( &reader );
+
+	if ( reader.overflow || newLength < 0 ) {
+		Com_Printf( "ERROR: Patch is corrupt.\n" );
+		return -1;
+	}
+
+	if ( Com_Hash64( oldData, oldLength, 0 ) != oldHash ) {
+		Com_Printf( "ERROR: Patch does not match the BSP file.\n" );
+		return -1;
+	}
+
+	format = BSP_FindFormat( oldData, oldLength );
+	if ( !format ) {
+		Com_Printf( "ERROR: Unsupported BSP format.\n" );
+		return -1;
+	}
+
+	oldLumps = malloc( format->numLumps * sizeof ( lump_t ) );
+	GetLumps( format, oldData, oldLength, oldLumps );
+
+	out = malloc( newLength + 1 );
+	pos = 0;
+
+	for ( i = 0; i < numSegments; i++ ) {
+		int type, length, lump;
+		const byte *data;
+
+		type = Patch_ReadInt( &reader );
+		length = Patch_ReadInt( &reader );
+
+		if ( reader.overflow || length < 0 || length > newLength - pos ) {
+			goto corrupt;
+		}
+
+		switch ( type ) {
+			case SEG_RAW:
+				data = Patch_ReadData( &reader, length );
+				if ( !data ) {
+					goto corrupt;
+				}
+				Com_Memcpy( out + pos, data, length );
+				break;
+			case SEG_ZERO:
+				Com_Memset( out + pos, 0, length );
+				break;
+			case SEG_LUMP:
+			case SEG_DELTA:
+				lump = Patch_ReadInt( &reader );
+				if ( lump < 0 || lump >= format->numLumps ) {
+					goto corrupt;
+				}
+
+				if ( type == SEG_LUMP ) {
+					if ( length != oldLumps[lump].filelen ) {
+						goto corrupt;
+					}
+					Com_Memcpy( out + pos, (const byte *)oldData + oldLumps[lump].fileofs, length );
+				} else if ( !DeltaDecode( &reader, (const byte *)oldData + oldLumps[lump].fileofs, oldLumps[lump].filelen, out + pos, length ) ) {
+					goto corrupt;
+				}
+				break;
+			default:
+				goto corrupt;
+		}
+
+		pos += length;
+	}
+
+	if ( pos != newLength ) {
+		goto corrupt;
+	}
+
+	if ( Com_Hash64( out, newLength, 0 ) != newHash ) {
+		Com_Printf( "ERROR: Patched BSP does not match the expected file.\n" );
+		free( oldLumps );
+		free( out );
+		return -1;
+	}
+
+	free( oldLumps );
+
+	*dataOut = out;
+	return newLength;
+
+corrupt:
+	Com_Printf( "ERROR: Patch is corrupt.\n" );
+	free( oldLumps );
+	free( out );
+	return -1;
+}
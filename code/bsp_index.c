@@ -0,0 +1,874 @@
+/*
+===========================================================================
+Copyright (C) 2015 Zack Middleton
+
+This file is part of BSP sekai Source Code.
+
+BSP sekai Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+BSP sekai Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with BSP sekai Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, BSP sekai Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+
+
+// bsp_index.c -- scan directories of BSP files into an index that can be queried
+
+#include "sekai.h"
+#include "bsp.h"
+
+#include <ctype.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <pthread.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+// Only the file header and the shader and surface lumps are read to fill in
+// an index entry, the rest of the file is only read to compute the content
+// hash.
+// Entries are reused when a file's modification time and size did not
+// change since the previous scan.
+
+#define INDEX_IDENT		(('X'<<24)+('I'<<16)+('S'<<8)+'B')
+		// little-endian "BSIX"
+#define INDEX_VERSION	2
+
+#define MAX_SCAN_THREADS	32
+#define HASH_CHUNK			( 1024 * 1024 )
+
+typedef struct {
+	char		*path;
+	int64_t		mtime;
+	int64_t		size;
+	uint64_t	hash;
+	char		format[32];
+	int			lumpSizes[BSPLUMP_MAX];
+	int			lumpCounts[BSPLUMP_MAX];
+	int			surfaceTypes[MST_MAX];	// number of surfaces of each type
+	int			numShaders;
+	char		*shaderNames;		// numShaders null terminated names
+	int			shaderNamesLength;
+} indexEntry_t;
+
+typedef struct {
+	indexEntry_t	*entries;
+	int				numEntries;
+	int				maxEntries;
+} bspIndex_t;
+
+typedef struct {
+	// directories and files waiting to be scanned
+	char			**jobs;
+	int				numJobs;
+	int				maxJobs;
+	int				numActive;		// workers currently handling a job
+
+	const bspIndex_t	*oldIndex;
+	bspIndex_t		newIndex;
+
+	int				numScanned;
+	int				numReused;
+	int				numFailed;
+
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+} scanState_t;
+
+static const char *surfaceTypeNames[MST_MAX] = {
+	"bad",
+	"planar",
+	"patch",
+	"trisoup",
+	"flare",
+	"foliage",
+	"terrain",
+};
+
+static const char *lumpNames[BSPLUMP_MAX] = {
+	"entities",
+	"shaders",
+	"planes",
+	"nodes",
+	"leafs",
+	"leafsurfaces",
+	"leafbrushes",
+	"models",
+	"brushes",
+	"brushsides",
+	"drawverts",
+	"drawindexes",
+	"fogs",
+	"surfaces",
+	"lightmaps",
+	"lightgrid",
+	"visibility",
+	"lightarray",
+};
+
+/*
+==============================================================================
+
+Index file
+
+==============================================================================
+*/
+
+static void Index_AddEntry( bspIndex_t *index, const indexEntry_t *entry ) {
+	if ( index->numEntries == index->maxEntries ) {
+		index->maxEntries = index->maxEntries ? index->maxEntries * 2 : 256;
+		index->entries = realloc( index->entries, index->maxEntries * sizeof ( *index->entries ) );
+	}
+
+	index->entries[index->numEntries++] = *entry;
+}
+
+static void Index_Free( bspIndex_t *index ) {
+	int i;
+
+	for ( i = 0; i < index->numEntries; i++ ) {
+		free( index->entries[i].path );
+		free( index->entries[i].shaderNames );
+	}
+
+	free( index->entries );
+	Com_Memset( index, 0, sizeof ( *index ) );
+}
+
+static int Index_CompareEntries( const void *a, const void *b ) {
+	return strcmp( ((const indexEntry_t *)a)->path, ((const indexEntry_t *)b)->path );
+}
+
+static const indexEntry_t *Index_FindEntry( const bspIndex_t *index, const char *path ) {
+	indexEntry_t key;
+
+	if ( !index->numEntries ) {
+		return NULL;
+	}
+
+	key.path = (char *)path;
+	return bsearch( &key, index->entries, index->numEntries, sizeof ( indexEntry_t ), Index_CompareEntries );
+}
+
+static void Index_WriteInt( FILE *f, int value ) {
+	value = LittleLong( value );
+	fwrite( &value, 4, 1, f );
+}
+
+static void Index_WriteData( FILE *f, const void *data, int length ) {
+	static const byte pad[4] = { 0, 0, 0, 0 };
+
+	Index_WriteInt( f, length );
+	fwrite( data, 1, length, f );
+	if ( length & 3 ) {
+		fwrite( pad, 1, 4 - ( length & 3 ), f );
+	}
+}
+
+static qboolean Index_Write( const bspIndex_t *index, const char *filename ) {
+	char		temp[1100];
+	FILE		*f;
+	int			i, j;
+
+	snprintf( temp, sizeof ( temp ), "%s.tmp", filename );
+
+	f = fopen( temp, "wb" );
+	if ( !f ) {
+		return qfalse;
+	}
+
+	Index_WriteInt( f, INDEX_IDENT );
+	Index_WriteInt( f, INDEX_VERSION );
+	Index_WriteInt( f, index->numEntries );
+
+	for ( i = 0; i < index->numEntries; i++ ) {
+		const indexEntry_t *entry = &index->entries[i];
+
+		Index_WriteData( f, entry->path, strlen( entry->path ) );
+		Index_WriteInt( f, (int)( entry->mtime & 0xffffffff ) );
+		Index_WriteInt( f, (int)( entry->mtime >> 32 ) );
+		Index_WriteInt( f, (int)( entry->size & 0xffffffff ) );
+		Index_WriteInt( f, (int)( entry->size >> 32 ) );
+		Index_WriteInt( f, (int)( entry->hash & 0xffffffff ) );
+		Index_WriteInt( f, (int)( entry->hash >> 32 ) );
+		Index_WriteData( f, entry->format, strlen( entry->format ) );
+
+		for ( j = 0; j < BSPLUMP_MAX; j++ ) {
+			Index_WriteInt( f, entry->lumpSizes[j] );
+			Index_WriteInt( f, entry->lumpCounts[j] );
+		}
+
+		for ( j = 0; j < MST_MAX; j++ ) {
+			Index_WriteInt( f, entry->surfaceTypes[j] );
+		}
+
+		Index_WriteInt( f, entry->numShaders );
+		Index_WriteData( f, entry->shaderNames, entry->shaderNamesLength );
+	}
+
+	if ( ferror( f ) ) {
+		fclose( f );
+		remove( temp );
+		return qfalse;
+	}
+
+	fclose( f );
+
+#ifdef _WIN32
+	remove( filename );
+#endif
+	if ( rename( temp, filename ) != 0 ) {
+		remove( temp );
+		return qfalse;
+	}
+
+	return qtrue;
+}
+
+typedef struct {
+	const byte	*data;
+	int			length;
+	int			ofs;
+	qboolean	overflow;
+} indexReader_t;
+
+static int Index_ReadInt( indexReader_t *reader ) {
+	int value;
+
+	if ( reader->ofs + 4 > reader->length ) {
+		reader->overflow = qtrue;
+		return 0;
+	}
+
+	Com_Memcpy( &value, reader->data + reader->ofs, 4 );
+	reader->ofs += 4;
+
+	return LittleLong( value );
+}
+
+static int64_t Index_ReadInt64( indexReader_t *reader ) {
+	uint64_t value;
+
+	value = (unsigned int)Index_ReadInt( reader );
+	value |= (uint64_t)(unsigned int)Index_ReadInt( reader ) << 32;
+
+	return (int64_t)value;
+}
+
+// returns a copy of the data with a null terminator
+static char *Index_ReadData( indexReader_t *reader, int *lengthOut ) {
+	char	*data;
+	int		length;
+
+	length = Index_ReadInt( reader );
+
+	if ( length < 0 || ( ( length + 3 ) & ~3 ) > reader->length - reader->ofs ) {
+		reader->overflow = qtrue;
+		return NULL;
+	}
+
+	data = malloc( length + 1 );
+	Com_Memcpy( data, reader->data + reader->ofs, length );
+	data[length] = '\0';
+	reader->ofs += ( length + 3 ) & ~3;
+
+	if ( lengthOut ) {
+		*lengthOut = length;
+	}
+
+	return data;
+}
+
+static qboolean Index_Read( bspIndex_t *index, const char *filename ) {
+	indexReader_t	reader;
+	void			*buffer;
+	long			length;
+	int				numEntries;
+	int				i, j;
+
+	Com_Memset( index, 0, sizeof ( *index ) );
+
+	length = FS_ReadFile( filename, &buffer );
+	if ( !buffer ) {
+		return qfalse;
+	}
+
+	reader.data = buffer;
+	reader.length = length;
+	reader.ofs = 0;
+	reader.overflow = qfalse;
+
+	if ( Index_ReadInt( &reader ) != INDEX_IDENT ) {
+		Com_Printf( "WARNING: '%s' is not a BSP index.\n", filename );
+		FS_FreeFile( buffer );
+		return qfalse;
+	}
+
+	if ( Index_ReadInt( &reader ) != INDEX_VERSION ) {
+		Com_Printf( "WARNING: BSP index '%s' is from a different version of bspsekai.\n", filename );
+		FS_FreeFile( buffer );
+		return qfalse;
+	}
+
+	numEntries = Index_ReadInt( &reader );
+
+	for ( i = 0; i < numEntries && !reader.overflow; i++ ) {
+		indexEntry_t	entry;
+		char			*format;
+
+		Com_Memset( &entry, 0, sizeof ( entry ) );
+
+		entry.path = Index_ReadData( &reader, NULL );
+		entry.mtime = Index_ReadInt64( &reader );
+		entry.size = Index_ReadInt64( &reader );
+		entry.hash = (uint64_t)Index_ReadInt64( &reader );
+
+		format = Index_ReadData( &reader, NULL );
+		if ( format ) {
+			Q_strncpyz( entry.format, format, sizeof ( entry.format ) );
+			free( format );
+		}
+
+		for ( j = 0; j < BSPLUMP_MAX; j++ ) {
+			entry.lumpSizes[j] = Index_ReadInt( &reader );
+			entry.lumpCounts[j] = Index_ReadInt( &reader );
+		}
+
+		for ( j = 0; j < MST_MAX; j++ ) {
+			entry.surfaceTypes[j] = Index_ReadInt( &reader );
+		}
+
+		entry.numShaders = Index_ReadInt( &reader );
+		entry.shaderNames = Index_ReadData( &reader, &entry.shaderNamesLength );
+
+		if ( reader.overflow ) {
+			free( entry.path );
+			free( entry.shaderNames );
+			break;
+		}
+
+		Index_AddEntry( index, &entry );
+	}
+
+	FS_FreeFile( buffer );
+
+	if ( reader.overflow ) {
+		Com_Printf( "WARNING: BSP index '%s' is truncated.\n", filename );
+	}
+
+	qsort( index->entries, index->numEntries, sizeof ( indexEntry_t ), Index_CompareEntries );
+
+	return qtrue;
+}
+
+/*
+==============================================================================
+
+Scanning
+
+==============================================================================
+*/
+
+static qboolean IsBspFile( const char *path ) {
+	size_t length = strlen( path );
+
+	return ( length > 4 && Q_stricmp( path + length - 4, ".bsp" ) == 0 )
+		|| ( length > 5 && Q_stricmp( path + length - 5, ".bspz" ) == 0 );
+}
+
+/*
+=================
+ScanFile
+
+Fill in entry from the file header and shader lump.
+=================
+*/
+static qboolean ScanFile( const char *path, const struct stat *st, indexEntry_t *entry ) {
+	const bspFormat_t	*format;
+	const bspLumpDef_t	*def;
+	bspFile_t	*bsp;
+	byte		header[BSP_MAX_HEADER_LENGTH];
+	byte		*buffer;
+	long		headerLength, ofs;
+	int			fd, i;
+
+	fd = FS_Open( path, qfalse );
+	if ( fd == -1 ) {
+		Com_Printf( "WARNING: Could not open '%s'.\n", path );
+		return qfalse;
+	}
+
+	headerLength = FS_Pread( fd, header, sizeof ( header ), 0 );
+
+	// lump sizes of an archive are from the original BSP
+	if ( BSP_IsArchive( header, headerLength ) ) {
+		headerLength = BSP_ReadArchiveHeader( fd, header, sizeof ( header ) );
+	}
+
+	format = BSP_FindFormat( header, headerLength );
+
+	if ( !format ) {
+		Com_Printf( "WARNING: Unsupported BSP '%s'.\n", path );
+		FS_Close( fd );
+		return qfalse;
+	}
+
+	Com_Memset( entry, 0, sizeof ( *entry ) );
+	entry->path = strdup( path );
+	entry->mtime = st->st_mtime;
+	entry->size = st->st_size;
+	Q_strncpyz( entry->format, format->gameName, sizeof ( entry->format ) );
+
+	for ( i = 0; i < BSPLUMP_MAX; i++ ) {
+		int filelen;
+
+		def = &format->lumpDefs[i];
+		if ( def->lump < 0 ) {
+			continue;
+		}
+
+		Com_Memcpy( &filelen, header + format->lumpsOffset + def->lump * 8 + 4, 4 );
+		entry->lumpSizes[i] = LittleLong( filelen );
+		entry->lumpCounts[i] = entry->lumpSizes[i] / def->size;
+	}
+
+	//
+	// shader names and surface types, decoded by the format's loader
+	//
+	bsp = BSP_LoadLumps( path, BSPLUMP_BIT( BSPLUMP_SHADERS ) | BSPLUMP_BIT( BSPLUMP_SURFACES ) );
+
+	if ( bsp ) {
+		char *out;
+
+		entry->shaderNames = out = malloc( bsp->numShaders * MAX_QPATH + 1 );
+
+		for ( i = 0; i < bsp->numShaders; i++ ) {
+			Q_strncpyz( out, bsp->shaders[i].shader, MAX_QPATH );
+			out += strlen( out ) + 1;
+		}
+		*out = '\0';
+
+		entry->numShaders = bsp->numShaders;
+		entry->shaderNamesLength = out - entry->shaderNames;
+
+		for ( i = 0; i < bsp->numSurfaces; i++ ) {
+			if ( bsp->surfaces[i].surfaceType >= 0 && bsp->surfaces[i].surfaceType < MST_MAX ) {
+				entry->surfaceTypes[bsp->surfaces[i].surfaceType]++;
+			}
+		}
+
+		BSP_Free( bsp );
+	} else {
+		Com_Printf( "WARNING: Could not read shaders and surfaces of '%s'.\n", path );
+	}
+
+	//
+	// content hash
+	//
+	buffer = malloc( HASH_CHUNK );
+	entry->hash = 0;
+
+	for ( ofs = 0; ofs < entry->size; ofs += HASH_CHUNK ) {
+		long length = FS_Pread( fd, buffer, HASH_CHUNK, ofs );
+
+		if ( length <= 0 ) {
+			break;
+		}
+
+		entry->hash = Com_Hash64( buffer, length, entry->hash );
+	}
+
+	free( buffer );
+	FS_Close( fd );
+
+	return qtrue;
+}
+
+static void Scan_PushJob( scanState_t *state, const char *path ) {
+	pthread_mutex_lock( &state->lock );
+
+	if ( state->numJobs == state->maxJobs ) {
+		state->maxJobs = state->maxJobs ? state->maxJobs * 2 : 256;
+		state->jobs = realloc( state->jobs, state->maxJobs * sizeof ( *state->jobs ) );
+	}
+
+	state->jobs[state->numJobs++] = strdup( path );
+
+	pthread_cond_signal( &state->cond );
+	pthread_mutex_unlock( &state->lock );
+}
+
+static void Scan_Directory( scanState_t *state, const char *path ) {
+	DIR				*dir;
+	struct dirent	*ent;
+	char			filename[1024];
+
+	dir = opendir( path );
+	if ( !dir ) {
+		Com_Printf( "WARNING: Could not open directory '%s'.\n", path );
+		return;
+	}
+
+	while ( ( ent = readdir( dir ) ) != NULL ) {
+		if ( !strcmp( ent->d_name, "." ) || !strcmp( ent->d_name, ".." ) ) {
+			continue;
+		}
+
+		snprintf( filename, sizeof ( filename ), "%s/%s", path, ent->d_name );
+		Scan_PushJob( state, filename );
+	}
+
+	closedir( dir );
+}
+
+static void Scan_Path( scanState_t *state, const char *path ) {
+	const indexEntry_t	*old;
+	indexEntry_t		entry;
+	struct stat			st;
+
+	if ( stat( path, &st ) != 0 ) {
+		return;
+	}
+
+	if ( S_ISDIR( st.st_mode ) ) {
+		Scan_Directory( state, path );
+		return;
+	}
+
+	if ( !S_ISREG( st.st_mode ) || !IsBspFile( path ) ) {
+		return;
+	}
+
+	old = Index_FindEntry( state->oldIndex, path );
+
+	if ( old && old->mtime == st.st_mtime && old->size == st.st_size ) {
+		entry = *old;
+		entry.path = strdup( old->path );
+		entry.shaderNames = malloc( old->shaderNamesLength + 1 );
+		Com_Memcpy( entry.shaderNames, old->shaderNames, old->shaderNamesLength + 1 );
+
+		pthread_mutex_lock( &state->lock );
+		Index_AddEntry( &state->newIndex, &entry );
+		state->numReused++;
+		pthread_mutex_unlock( &state->lock );
+		return;
+	}
+
+	if ( !ScanFile( path, &st, &entry ) ) {
+		pthread_mutex_lock( &state->lock );
+		state->numFailed++;
+		pthread_mutex_unlock( &state->lock );
+		return;
+	}
+
+	pthread_mutex_lock( &state->lock );
+	Index_AddEntry( &state->newIndex, &entry );
+	state->numScanned++;
+	pthread_mutex_unlock( &state->lock );
+}
+
+static void *Scan_Worker( void *arg ) {
+	scanState_t	*state = arg;
+	char		*path;
+
+	pthread_mutex_lock( &state->lock );
+
+	while ( 1 ) {
+		while ( !state->numJobs && state->numActive ) {
+			pthread_cond_wait( &state->cond, &state->lock );
+		}
+
+		if ( !state->numJobs ) {
+			// nothing queued and no one is adding more
+			break;
+		}
+
+		path = state->jobs[--state->numJobs];
+		state->numActive++;
+		pthread_mutex_unlock( &state->lock );
+
+		Scan_Path( state, path );
+		free( path );
+
+		pthread_mutex_lock( &state->lock );
+		state->numActive--;
+
+		if ( !state->numJobs && !state->numActive ) {
+			pthread_cond_broadcast( &state->cond );
+		}
+	}
+
+	pthread_mutex_unlock( &state->lock );
+
+	return NULL;
+}
+
+static int Scan_NumThreads( void ) {
+	return MIN( Com_NumCPUs(), MAX_SCAN_THREADS );
+}
+
+/*
+=================
+BSP_ScanIndex
+
+Scan BSP files in dir and its sub-directories into indexFile. Entries of
+files that did not change since indexFile was written are reused.
+=================
+*/
+qboolean BSP_ScanIndex( const char *scanDir, const char *indexFile ) {
+	scanState_t	state;
+	bspIndex_t	oldIndex;
+	pthread_t	threads[MAX_SCAN_THREADS];
+	char		dir[1024];
+	size_t		dirLength;
+	int			numThreads, numRemoved;
+	int			i;
+	qboolean	success;
+
+	Q_strncpyz( dir, scanDir, sizeof ( dir ) );
+	dirLength = strlen( dir );
+	while ( dirLength > 1 && dir[dirLength - 1] == '/' ) {
+		dir[--dirLength] = '\0';
+	}
+
+	Index_Read( &oldIndex, indexFile );
+
+	Com_Memset( &state, 0, sizeof ( state ) );
+	state.oldIndex = &oldIndex;
+	pthread_mutex_init( &state.lock, NULL );
+	pthread_cond_init( &state.cond, NULL );
+
+	Scan_PushJob( &state, dir );
+
+	numThreads = Scan_NumThreads();
+	for ( i = 0; i < numThreads; i++ ) {
+		if ( pthread_create( &threads[i], NULL, Scan_Worker, &state ) != 0 ) {
+			break;
+		}
+	}
+	numThreads = i;
+
+	if ( !numThreads ) {
+		Scan_Worker( &state );
+	}
+
+	for ( i = 0; i < numThreads; i++ ) {
+		pthread_join( threads[i], NULL );
+	}
+
+	pthread_cond_destroy( &state.cond );
+	pthread_mutex_destroy( &state.lock );
+	free( state.jobs );
+
+	qsort( state.newIndex.entries, state.newIndex.numEntries, sizeof ( indexEntry_t ), Index_CompareEntries );
+
+	// entries from the old index that are outside of dir are kept
+	numRemoved = 0;
+	for ( i = 0; i < oldIndex.numEntries; i++ ) {
+		indexEntry_t *old = &oldIndex.entries[i];
+
+		if ( Index_FindEntry( &state.newIndex, old->path ) ) {
+			continue;
+		}
+
+		if ( !strncmp( old->path, dir, dirLength ) && ( old->path[dirLength] == '/' || old->path[dirLength] == '\0' ) ) {
+			numRemoved++;
+			continue;
+		}
+
+		Index_AddEntry( &state.newIndex, old );
+		old->path = NULL;
+		old->shaderNames = NULL;
+	}
+
+	qsort( state.newIndex.entries, state.newIndex.numEntries, sizeof ( indexEntry_t ), Index_CompareEntries );
+
+	success = Index_Write( &state.newIndex, indexFile );
+
+	if ( success ) {
+		Com_Printf( "Indexed %d BSPs: %d scanned, %d unchanged, %d removed, %d failed.\n",
+					state.newIndex.numEntries, state.numScanned, state.numReused, numRemoved, state.numFailed );
+	} else {
+		Com_Printf( "ERROR: Could not write BSP index '%s'.\n", indexFile );
+	}
+
+	Index_Free( &oldIndex );
+	Index_Free( &state.newIndex );
+
+	return success;
+}
+
+/*
+==============================================================================
+
+Queries
+
+==============================================================================
+*/
+
+static qboolean StringContains( const char *string, const char *find ) {
+	size_t length = strlen( find );
+
+	for ( ; *string; string++ ) {
+		if ( !Q_stricmpn( string, find, length ) ) {
+			return qtrue;
+		}
+	}
+
+	return !length;
+}
+
+/*
+=================
+MatchFilter
+
+Filters are format=<name>, shader=<text>, hash=<hex>, size<op><bytes>,
+<lump><op><count>, or <surface type><op><count> where op is <, >, or =.
+=================
+*/
+static qboolean MatchFilter( const indexEntry_t *entry, const char *filter, qboolean *valid ) {
+	char		name[32];
+	const char	*op;
+	int64_t		value, number;
+	int			i;
+
+	*valid = qtrue;
+
+	op = strpbrk( filter, "<>=" );
+	if ( !op || op == filter || op - filter >= (int)sizeof ( name ) ) {
+		*valid = qfalse;
+		return qfalse;
+	}
+
+	Com_Memcpy( name, filter, op - filter );
+	name[op - filter] = '\0';
+
+	if ( *op == '=' ) {
+		if ( !Q_stricmp( name, "format" ) ) {
+			return StringContains( entry->format, op + 1 );
+		}
+
+		if ( !Q_stricmp( name, "shader" ) ) {
+			const char *shader = entry->shaderNames;
+
+			for ( i = 0; i < entry->numShaders; i++, shader += strlen( shader ) + 1 ) {
+				if ( StringContains( shader, op + 1 ) ) {
+					return qtrue;
+				}
+			}
+			return qfalse;
+		}
+
+		if ( !Q_stricmp( name, "hash" ) ) {
+			return entry->hash == strtoull( op + 1, NULL, 16 );
+		}
+	}
+
+	if ( !Q_stricmp( name, "size" ) ) {
+		value = entry->size;
+	} else {
+		for ( i = 0; i < BSPLUMP_MAX; i++ ) {
+			if ( !Q_stricmp( name, lumpNames[i] ) ) {
+				break;
+			}
+		}
+
+		if ( i < BSPLUMP_MAX ) {
+			value = entry->lumpCounts[i];
+		} else {
+			for ( i = 0; i < MST_MAX; i++ ) {
+				if ( !Q_stricmp( name, surfaceTypeNames[i] ) ) {
+					break;
+				}
+			}
+
+			if ( i == MST_MAX ) {
+				*valid = qfalse;
+				return qfalse;
+			}
+
+			value = entry->surfaceTypes[i];
+		}
+	}
+
+	number = strtoll( op + 1, NULL, 10 );
+
+	switch ( *op ) {
+		case '<':
+			return value < number;
+		case '>':
+			return value > number;
+		default:
+			return value == number;
+	}
+}
+
+/*
+=================
+BSP_QueryIndex
+
+Print BSPs in indexFile that match all filters.
+=================
+*/
+int BSP_QueryIndex( const char *indexFile, const char **filters, int numFilters ) {
+	bspIndex_t	index;
+	int			numMatches;
+	int			i, j;
+
+	if ( !Index_Read( &index, indexFile ) ) {
+		Com_Printf( "ERROR: Could not read BSP index '%s'.\n", indexFile );
+		return -1;
+	}
+
+	numMatches = 0;
+
+	for ( i = 0; i < index.numEntries; i++ ) {
+		const indexEntry_t *entry = &index.entries[i];
+		qboolean valid = qtrue;
+
+		for ( j = 0; j < numFilters; j++ ) {
+			if ( !MatchFilter( entry, filters[j], &valid ) ) {
+				break;
+			}
+		}
+
+		if ( !valid ) {
+			Com_Printf( "ERROR: Invalid filter '%s'.\n", filters[j] );
+			Index_Free( &index );
+			return -1;
+		}
+
+		if ( j < numFilters ) {
+			continue;
+		}
+
+		Com_Printf( "%s (%s, %d surfaces, %d shaders, %016llx)\n", entry->path, entry->format,
+					entry->lumpCounts[BSPLUMP_SURFACES], entry->numShaders, (unsigned long long)entry->hash );
+		numMatches++;
+	}
+
+	Com_Printf( "%d of %d BSPs matched.\n", numMatches, index.numEntries );
+
+	Index_Free( &index );
+
+	return numMatches;
+}
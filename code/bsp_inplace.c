@@ -0,0 +1,410 @@
+/*
+===========================================================================
+Copyright (C) 2015 Zack Middleton
+
+This file is part of BSP sekai Source Code.
+
+BSP sekai Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+BSP sekai Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with BSP sekai Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, BSP sekai Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+
+// bsp_inplace.c -- rewrite individual lumps of an existing BSP file
+
+#include "sekai.h"
+#include "bsp.h"
+
+// Lumps that keep their size (or shrink) are overwritten at their current
+// offset, lumps that grow are appended to the end of the file. The lump
+// table is written last.
+//
+// Before anything in the BSP is touched the original lump table, the
+// original file length, and every byte range that is about to be
+// overwritten are saved to "<name>.journal". If the process dies while
+// patching, BSP_RecoverPatch() restores the original file from it.
+
+#define JOURNAL_IDENT	(('1'<<24)+('J'<<16)+('S'<<8)+'B')
+		// little-endian "BSJ1"
+
+typedef struct {
+	int		offset;
+	int		length;
+	byte	*data;
+} journalRegion_t;
+
+static void JournalName( const char *name, char *journal, size_t size ) {
+	snprintf( journal, size, "%s.journal", name );
+}
+
+/*
+=================
+BSP_RecoverPatch
+
+Returns qfalse if there was a journal that could not be applied.
+=================
+*/
+qboolean BSP_RecoverPatch( const char *name ) {
+	char		journal[1024];
+	union {
+		int			*i;
+		void		*v;
+	} buf;
+	long		length;
+	byte		*p, *end;
+	int			originalLength, lumpsOffset, numLumps, numRegions;
+	int			i, fd;
+
+	JournalName( name, journal, sizeof ( journal ) );
+
+	if ( !FS_FileExists( journal ) ) {
+		return qtrue;
+	}
+
+	length = FS_ReadFile( journal, &buf.v );
+
+	// the BSP is not modified until the journal is complete, so an incomplete journal can simply be dropped
+	if ( !buf.v || length < 6 * 4 || LittleLong( buf.i[0] ) != JOURNAL_IDENT
+		|| LittleLong( buf.i[ length / 4 - 1 ] ) != JOURNAL_IDENT || ( length & 3 ) ) {
+		Com_Printf( "Removing incomplete journal '%s'.\n", journal );
+		FS_FreeFile( buf.v );
+		remove( journal );
+		return qtrue;
+	}
+
+	originalLength = LittleLong( buf.i[1] );
+	lumpsOffset = LittleLong( buf.i[2] );
+	numLumps = LittleLong( buf.i[3] );
+
+	p = (byte *)&buf.i[4];
+	end = (byte *)buf.v + length - 4;
+
+	fd = FS_Open( name, qtrue );
+	if ( fd == -1 ) {
+		Com_Printf( "ERROR: Cannot open '%s' to apply journal '%s'.\n", name, journal );
+		FS_FreeFile( buf.v );
+		return qfalse;
+	}
+
+	if ( p + numLumps * sizeof ( lump_t ) + 4 > end ) {
+		goto corrupt;
+	}
+
+	if ( FS_Pwrite( fd, p, numLumps * sizeof ( lump_t ), lumpsOffset ) != numLumps * sizeof ( lump_t ) ) {
+		goto corrupt;
+	}
+	p += numLumps * sizeof ( lump_t );
+
+	numRegions = LittleLong( *(int *)p );
+	p += 4;
+
+	for ( i = 0; i < numRegions; i++ ) {
+		int offset, regionLength;
+
+		if ( p + 8 > end ) {
+			goto corrupt;
+		}
+
+		offset = LittleLong( ((int *)p)[0] );
+		regionLength = LittleLong( ((int *)p)[1] );
+		p += 8;
+
+		if ( regionLength < 0 || p + regionLength > end ) {
+			goto corrupt;
+		}
+
+		if ( FS_Pwrite( fd, p, regionLength, offset ) != regionLength ) {
+			goto corrupt;
+		}
+		p += ( regionLength + 3 ) & ~3;
+	}
+
+	if ( !FS_Truncate( fd, originalLength ) || !FS_Sync( fd ) ) {
+		goto corrupt;
+	}
+
+	FS_Close( fd );
+	FS_FreeFile( buf.v );
+	remove( journal );
+
+	Com_Printf( "Restored '%s' from journal of an interrupted in-place update.\n", name );
+	return qtrue;
+
+corrupt:
+	Com_Printf( "ERROR: Failed to restore '%s' from journal '%s'.\n", name, journal );
+	FS_Close( fd );
+	FS_FreeFile( buf.v );
+	return qfalse;
+}
+
+static qboolean WriteJournal( const char *journal, int originalLength, int lumpsOffset, int numLumps,
+								const lump_t *lumps, const journalRegion_t *regions, int numRegions ) {
+	static const byte	pad[4] = { 0, 0, 0, 0 };
+	int					header[4];
+	int					pos, value, i, fd;
+
+	remove( journal );
+
+	fd = FS_Open( journal, qtrue );
+	if ( fd == -1 ) {
+		return qfalse;
+	}
+
+	header[0] = LittleLong( JOURNAL_IDENT );
+	header[1] = LittleLong( originalLength );
+	header[2] = LittleLong( lumpsOffset );
+	header[3] = LittleLong( numLumps );
+
+	pos = 0;
+	if ( FS_Pwrite( fd, header, sizeof ( header ), pos ) != sizeof ( header ) ) {
+		goto fail;
+	}
+	pos += sizeof ( header );
+
+	// lump table is kept as raw file bytes
+	if ( FS_Pwrite( fd, lumps, numLumps * sizeof ( lump_t ), pos ) != numLumps * sizeof ( lump_t ) ) {
+		goto fail;
+	}
+	pos += numLumps * sizeof ( lump_t );
+
+	value = LittleLong( numRegions );
+	if ( FS_Pwrite( fd, &value, 4, pos ) != 4 ) {
+		goto fail;
+	}
+	pos += 4;
+
+	for ( i = 0; i < numRegions; i++ ) {
+		int regionHeader[2];
+
+		regionHeader[0] = LittleLong( regions[i].offset );
+		regionHeader[1] = LittleLong( regions[i].length );
+
+		if ( FS_Pwrite( fd, regionHeader, 8, pos ) != 8 ) {
+			goto fail;
+		}
+		pos += 8;
+
+		if ( FS_Pwrite( fd, regions[i].data, regions[i].length, pos ) != regions[i].length ) {
+			goto fail;
+		}
+		pos += regions[i].length;
+
+		if ( regions[i].length & 3 ) {
+			if ( FS_Pwrite( fd, pad, 4 - ( regions[i].length & 3 ), pos ) != 4 - ( regions[i].length & 3 ) ) {
+				goto fail;
+			}
+			pos += 4 - ( regions[i].length & 3 );
+		}
+	}
+
+	// must be synced before the trailing ident marks the journal as complete
+	if ( !FS_Sync( fd ) ) {
+		goto fail;
+	}
+
+	value = LittleLong( JOURNAL_IDENT );
+	if ( FS_Pwrite( fd, &value, 4, pos ) != 4 || !FS_Sync( fd ) ) {
+		goto fail;
+	}
+
+	FS_Close( fd );
+	return qtrue;
+
+fail:
+	FS_Close( fd );
+	remove( journal );
+	return qfalse;
+}
+
+/*
+=================
+BSP_PatchLumps
+
+lumpsOffset is the offset of the lump table in the format's dheader_t.
+=================
+*/
+qboolean BSP_PatchLumps( const char *name, int lumpsOffset, int numLumps, const bspLumpPatch_t *patches, int numPatches ) {
+	char			journal[1024];
+	lump_t			*lumps, *newLumps;
+	journalRegion_t	*regions;
+	int				numRegions;
+	int				*writeOffsets;
+	int				numWrites;
+	int				fileLength, appendOffset;
+	int				i, fd;
+	int				bytesWritten;
+	qboolean		success;
+
+	if ( !BSP_RecoverPatch( name ) ) {
+		return qfalse;
+	}
+
+	fd = FS_Open( name, qtrue );
+	if ( fd == -1 ) {
+		Com_Printf( "ERROR: Cannot open '%s' for writing.\n", name );
+		return qfalse;
+	}
+
+	lumps = malloc( numLumps * sizeof ( lump_t ) * 2 );
+	newLumps = lumps + numLumps;
+	regions = malloc( numPatches * sizeof ( *regions ) );
+	Com_Memset( regions, 0, numPatches * sizeof ( *regions ) );
+	writeOffsets = malloc( numPatches * sizeof ( *writeOffsets ) );
+	numRegions = 0;
+	numWrites = 0;
+	bytesWritten = 0;
+	success = qfalse;
+
+	fileLength = FS_FileLength( fd );
+
+	if ( FS_Pread( fd, lumps, numLumps * sizeof ( lump_t ), lumpsOffset ) != numLumps * sizeof ( lump_t ) ) {
+		Com_Printf( "ERROR: Cannot read lump table of '%s'.\n", name );
+		goto done;
+	}
+
+	for ( i = 0; i < numLumps; i++ ) {
+		newLumps[i].fileofs = LittleLong( lumps[i].fileofs );
+		newLumps[i].filelen = LittleLong( lumps[i].filelen );
+	}
+
+	appendOffset = ( fileLength + 3 ) & ~3;
+
+	//
+	// plan writes, keeping the bytes that will be overwritten for the journal
+	//
+	for ( i = 0; i < numPatches; i++ ) {
+		lump_t *lump;
+
+		writeOffsets[i] = -1;
+
+		if ( patches[i].lump < 0 || patches[i].lump >= numLumps ) {
+			Com_Printf( "ERROR: Invalid lump %d for '%s'.\n", patches[i].lump, name );
+			goto done;
+		}
+
+		lump = &newLumps[ patches[i].lump ];
+
+		if ( lump->fileofs < 0 || lump->filelen < 0 || lump->fileofs + lump->filelen > fileLength ) {
+			Com_Printf( "ERROR: Lump %d of '%s' is out of bounds.\n", patches[i].lump, name );
+			goto done;
+		}
+
+		if ( patches[i].length <= lump->filelen ) {
+			journalRegion_t *region = &regions[numRegions];
+
+			region->offset = lump->fileofs;
+			region->length = patches[i].length;
+			region->data = malloc( region->length + 1 );
+
+			if ( FS_Pread( fd, region->data, region->length, region->offset ) != region->length ) {
+				Com_Printf( "ERROR: Cannot read lump %d of '%s'.\n", patches[i].lump, name );
+				free( region->data );
+				goto done;
+			}
+
+			if ( patches[i].length == lump->filelen && !memcmp( region->data, patches[i].data, region->length ) ) {
+				// unchanged
+				free( region->data );
+				continue;
+			}
+
+			lump->filelen = patches[i].length;
+			numRegions++;
+		} else {
+			lump->fileofs = appendOffset;
+			lump->filelen = patches[i].length;
+
+			appendOffset = ( appendOffset + patches[i].length + 3 ) & ~3;
+		}
+
+		writeOffsets[i] = lump->fileofs;
+		numWrites++;
+	}
+
+	if ( !numWrites ) {
+		Com_Printf( "'%s' is already up to date.\n", name );
+		success = qtrue;
+		goto done;
+	}
+
+	JournalName( name, journal, sizeof ( journal ) );
+
+	if ( !WriteJournal( journal, fileLength, lumpsOffset, numLumps, lumps, regions, numRegions ) ) {
+		Com_Printf( "ERROR: Cannot write journal '%s'.\n", journal );
+		goto done;
+	}
+
+	//
+	// write lump data, then the lump table
+	//
+	for ( i = 0; i < numPatches; i++ ) {
+		if ( writeOffsets[i] == -1 ) {
+			continue;
+		}
+
+		if ( FS_Pwrite( fd, patches[i].data, patches[i].length, writeOffsets[i] ) != patches[i].length ) {
+			Com_Printf( "ERROR: Failed writing lump %d of '%s'.\n", patches[i].lump, name );
+			goto rollback;
+		}
+
+		bytesWritten += patches[i].length;
+
+		Com_Printf( "%s lump %d (%d bytes) at offset %d.\n", ( writeOffsets[i] < fileLength ) ? "Rewrote" : "Appended",
+					patches[i].lump, patches[i].length, writeOffsets[i] );
+	}
+
+	if ( !FS_Sync( fd ) ) {
+		goto rollback;
+	}
+
+	for ( i = 0; i < numLumps; i++ ) {
+		newLumps[i].fileofs = LittleLong( newLumps[i].fileofs );
+		newLumps[i].filelen = LittleLong( newLumps[i].filelen );
+	}
+
+	if ( FS_Pwrite( fd, newLumps, numLumps * sizeof ( lump_t ), lumpsOffset ) != numLumps * sizeof ( lump_t ) || !FS_Sync( fd ) ) {
+		goto rollback;
+	}
+
+	bytesWritten += numLumps * sizeof ( lump_t );
+
+	remove( journal );
+
+	Com_Printf( "Updated '%s' in place (%d bytes written).\n", name, bytesWritten );
+	success = qtrue;
+	goto done;
+
+rollback:
+	FS_Close( fd );
+	fd = -1;
+	BSP_RecoverPatch( name );
+
+done:
+	for ( i = 0; i < numRegions; i++ ) {
+		free( regions[i].data );
+	}
+	free( regions );
+	free( writeOffsets );
+	free( lumps );
+	FS_Close( fd );
+
+	return success;
+}
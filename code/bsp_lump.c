@@ -0,0 +1,359 @@
+/*
+===========================================================================
+Copyright (C) 1999-2010 id Software LLC, a ZeniMax Media company.
+
+This file is part of Spearmint Source Code.
+
+Spearmint Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+Spearmint Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Spearmint Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, Spearmint Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+
+// bsp_lump.c -- reading and writing lumps shared by the BSP formats
+//
+// Lumps of structures are converted using a schema of the fields that are
+// the same in the on disk and abstract structures (see BSP_SCHEMA). Fields
+// at the same offset in both structures are copied as a block, large lumps
+// are split between threads. Lumps in the file image kept by the loader are
+// decoded in place (see BSP_LumpArray).
+
+#include "q_shared.h"
+#include "qcommon.h"
+#include "bsp.h"
+
+#include <pthread.h>
+
+#define MAX_LUMP_THREADS		8
+#define MIN_THREAD_BYTES		( 1024 * 1024 )	// lump bytes per thread
+#define IN_PLACE_BYTES			( 64 * 1024 )	// lump bytes copied out at a time when decoding in place
+
+typedef struct {
+	const bspSchema_t	*schema;
+	qboolean			decode;
+	const byte			*in;
+	byte				*out;
+	int					count;
+} lumpJob_t;
+
+int BSP_GetLumpElements( const lump_t *lumps, int lump, int size ) {
+	if ( lump < 0 ) {
+		return 0;
+	}
+
+	/* check for odd size */
+	if ( lumps[ lump ].filelen % size ) {
+		Com_Printf( "GetLumpElements: odd lump size (%d) in lump %d\n", lumps[ lump ].filelen, lump );
+		return 0;
+	}
+
+#ifdef BSP_DEBUG
+	Com_Printf( "GetLumpElements: lump %d has %d elements\n", lump, lumps[ lump ].filelen / size );
+#endif
+
+	/* return element count */
+	return lumps[ lump ].filelen / size;
+}
+
+void *BSP_GetLump( const lump_t *lumps, const void *src, int lump ) {
+	return (void*)( (byte*) src + lumps[ lump ].fileofs );
+}
+
+// Read data from lump
+void BSP_CopyLump( const lump_t *lumps, int lump, const void *src, void *dest, int size, qboolean swap ) {
+	int length;
+
+	length = BSP_GetLumpElements( lumps, lump, size ) * size;
+
+	/* handle erroneous cases, or dest is the lump, see BSP_LumpArray */
+	if ( length <= 0 || dest == (byte*) src + lumps[lump].fileofs ) {
+		return;
+	}
+
+	if ( swap ) {
+		BSP_SwapBlock( dest, (int *)((byte*) src + lumps[lump].fileofs), length );
+	} else {
+		Com_Memcpy( dest, (byte*) src + lumps[lump].fileofs, length );
+	}
+}
+
+// Write data to lump
+void BSP_WriteLump( const lump_t *lumps, int lump, void *dest, const void *src, int size, qboolean swap ) {
+	int length;
+
+	length = BSP_GetLumpElements( lumps, lump, size ) * size;
+
+	/* handle erroneous cases */
+	if ( length <= 0 ) {
+		return;
+	}
+
+	if ( swap ) {
+		BSP_SwapBlock( (int *)((byte*) dest + lumps[lump].fileofs), src, length );
+	} else {
+		Com_Memcpy( (byte*) dest + lumps[lump].fileofs, src, length );
+	}
+}
+
+void BSP_AddLump( lump_t *lumps, int *filePos, int lump, int elements, int size ) {
+	lumps[lump].fileofs = *filePos;
+	lumps[lump].filelen = elements * size;
+
+	*filePos += elements * size;
+}
+
+/*
+=================
+BSP_SchemaCopyLength
+
+Length of the fields at the start of both structures that have the same
+layout and can be copied as a block.
+FIXME: assumes host is little endian, like LittleLong
+=================
+*/
+static int BSP_SchemaCopyLength( const bspSchema_t *schema ) {
+	const bspField_t *field;
+	qboolean found;
+	int i, length;
+
+	length = 0;
+
+	do {
+		found = qfalse;
+
+		for ( i = 0, field = schema->fields; i < schema->numFields; i++, field++ ) {
+			if ( field->type != BF_STRING && field->fileofs == length && field->ofs == length
+				&& field->filesize == field->size ) {
+				length += field->size;
+				found = qtrue;
+			}
+		}
+	} while ( found );
+
+	return length;
+}
+
+/*
+=================
+BSP_SameLayout
+
+True if the on disk and abstract structures of schema are the same.
+=================
+*/
+qboolean BSP_SameLayout( const bspSchema_t *schema ) {
+	int length = BSP_SchemaCopyLength( schema );
+
+	return ( length == schema->fileSize && length == schema->size );
+}
+
+/*
+=================
+BSP_LumpArray
+
+Returns the array for count elements of lump. If the BSP kept the file
+image (bsp->fileData) and an element in memory (size) is not larger than
+on disk (fileSize) the array is the lump in the file image and the lump is
+decoded in place (or copying it is skipped), otherwise a new array is
+allocated.
+=================
+*/
+void *BSP_LumpArray( bspFile_t *bsp, const lump_t *lumps, int lump, int count, int size, int fileSize ) {
+	int fileofs;
+
+	if ( bsp->fileData && size <= fileSize && count > 0 && lump >= 0 ) {
+		fileofs = lumps[lump].fileofs;
+
+		if ( fileofs >= 0 && ( size == 1 || !( fileofs & 3 ) ) && fileofs + count * fileSize <= bsp->fileLength ) {
+			return (byte *)bsp->fileData + fileofs;
+		}
+	}
+
+	return malloc( count * size );
+}
+
+/*
+=================
+BSP_ConvertField
+=================
+*/
+static void BSP_ConvertField( bspFieldType_t type, const byte *in, byte *out, int size ) {
+	int i;
+
+	switch ( type ) {
+		case BF_INT:
+			for ( i = 0; i < size / 4; i++ ) {
+				((int *)out)[i] = LittleLong( ((const int *)in)[i] );
+			}
+			break;
+		case BF_FLOAT:
+			for ( i = 0; i < size / 4; i++ ) {
+				((float *)out)[i] = LittleFloat( ((const float *)in)[i] );
+			}
+			break;
+		case BF_BYTE:
+			Com_Memcpy( out, in, size );
+			break;
+		case BF_STRING: {
+			char *string = (char *)out;
+
+			Q_strncpyz( string, (const char *)in, size );
+			break;
+		}
+	}
+}
+
+/*
+=================
+BSP_ConvertElements
+=================
+*/
+static void BSP_ConvertElements( const bspSchema_t *schema, qboolean decode, const byte *in, byte *out, int count ) {
+	const bspField_t *field;
+	int inSize, outSize, copyLength;
+	int i, j;
+
+	inSize = decode ? schema->fileSize : schema->size;
+	outSize = decode ? schema->size : schema->fileSize;
+	copyLength = BSP_SchemaCopyLength( schema );
+
+	// structures are the same
+	if ( copyLength == inSize && copyLength == outSize ) {
+		Com_Memcpy( out, in, count * copyLength );
+		return;
+	}
+
+	for ( i = 0; i < count; i++, in += inSize, out += outSize ) {
+		Com_Memcpy( out, in, copyLength );
+
+		for ( j = 0, field = schema->fields; j < schema->numFields; j++, field++ ) {
+			// already copied
+			if ( field->type != BF_STRING && field->fileofs == field->ofs && field->ofs + field->size <= copyLength ) {
+				continue;
+			}
+
+			if ( decode ) {
+				BSP_ConvertField( field->type, in + field->fileofs, out + field->ofs, field->size );
+			} else {
+				BSP_ConvertField( field->type, in + field->ofs, out + field->fileofs, field->filesize );
+			}
+		}
+	}
+}
+
+static void *BSP_ConvertThread( void *arg ) {
+	lumpJob_t *job = arg;
+
+	BSP_ConvertElements( job->schema, job->decode, job->in, job->out, job->count );
+
+	return NULL;
+}
+
+/*
+=================
+BSP_ConvertLump
+=================
+*/
+static void BSP_ConvertLump( const bspSchema_t *schema, qboolean decode, const void *in, void *out, int count ) {
+	lumpJob_t	jobs[MAX_LUMP_THREADS];
+	pthread_t	threads[MAX_LUMP_THREADS];
+	int			inSize, outSize, numThreads, first;
+	int			i;
+
+	if ( count <= 0 ) {
+		return;
+	}
+
+	inSize = decode ? schema->fileSize : schema->size;
+	outSize = decode ? schema->size : schema->fileSize;
+
+	numThreads = MIN( MIN( Com_NumCPUs(), MAX_LUMP_THREADS ), (int)( (int64_t)count * inSize / MIN_THREAD_BYTES ) );
+
+	if ( numThreads <= 1 ) {
+		BSP_ConvertElements( schema, decode, in, out, count );
+		return;
+	}
+
+	first = 0;
+	for ( i = 0; i < numThreads; i++ ) {
+		jobs[i].schema = schema;
+		jobs[i].decode = decode;
+		jobs[i].in = (const byte *)in + (size_t)first * inSize;
+		jobs[i].out = (byte *)out + (size_t)first * outSize;
+		jobs[i].count = (int)( (int64_t)count * ( i + 1 ) / numThreads ) - first;
+		first += jobs[i].count;
+
+		if ( pthread_create( &threads[i], NULL, BSP_ConvertThread, &jobs[i] ) != 0 ) {
+			// convert the rest on this thread
+			jobs[i].count = count - ( first - jobs[i].count );
+			BSP_ConvertElements( schema, decode, jobs[i].in, jobs[i].out, jobs[i].count );
+			break;
+		}
+	}
+
+	numThreads = i;
+	for ( i = 0; i < numThreads; i++ ) {
+		pthread_join( threads[i], NULL );
+	}
+}
+
+/*
+=================
+BSP_DecodeInPlace
+
+Decode count elements that are not larger in memory than on disk over the
+lump. Elements are copied out IN_PLACE_BYTES at a time before decoding them,
+an element is only written over its own and earlier elements on disk.
+=================
+*/
+static void BSP_DecodeInPlace( const bspSchema_t *schema, byte *data, int count ) {
+	byte	*elements;
+	int		chunk, first, num;
+
+	chunk = MAX( 1, IN_PLACE_BYTES / schema->fileSize );
+	elements = malloc( chunk * schema->fileSize );
+
+	for ( first = 0; first < count; first += num ) {
+		num = MIN( chunk, count - first );
+
+		Com_Memcpy( elements, data + (size_t)first * schema->fileSize, num * schema->fileSize );
+		BSP_ConvertElements( schema, qtrue, elements, data + (size_t)first * schema->size, num );
+	}
+
+	free( elements );
+}
+
+// convert count on disk structures to abstract structures
+void BSP_DecodeElements( const bspSchema_t *schema, const void *in, void *out, int count ) {
+	// out is the lump, see BSP_LumpArray
+	if ( in == out ) {
+		if ( count > 0 && !BSP_SameLayout( schema ) ) {
+			BSP_DecodeInPlace( schema, out, count );
+		}
+		return;
+	}
+
+	BSP_ConvertLump( schema, qtrue, in, out, count );
+}
+
+// convert count abstract structures to on disk structures
+void BSP_EncodeElements( const bspSchema_t *schema, const void *in, void *out, int count ) {
+	BSP_ConvertLump( schema, qfalse, in, out, count );
+}
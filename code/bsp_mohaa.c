@@ -42,10 +42,6 @@ Suite 120, Rockville, Maryland 20850 USA.
 
 #define BSP_VERSION	19
 
-typedef struct {
-	int		fileofs, filelen;
-} lump_t;
-
 #define	LUMP_SHADERS		0
 #define	LUMP_PLANES			1
 #define	LUMP_LIGHTMAPS		2
@@ -198,6 +194,14 @@ typedef struct {
 	float		subdivisions;
 } realDsurface_t;
 
+BSP_SCHEMA( shaderSchema, realDshader_t, dshader_t, BSP_SHADER_FIELDS );
+BSP_SCHEMA( planeSchema, realDplane_t, dplane_t, BSP_PLANE_FIELDS );
+BSP_SCHEMA( nodeSchema, realDnode_t, dnode_t, BSP_NODE_FIELDS );
+BSP_SCHEMA( leafSchema, realDleaf_t, dleaf_t, BSP_LEAF_FIELDS );
+BSP_SCHEMA( modelSchema, realDmodel_t, dmodel_t, BSP_MODEL_FIELDS );
+BSP_SCHEMA( brushSchema, realDbrush_t, dbrush_t, BSP_BRUSH_FIELDS );
+BSP_SCHEMA( drawVertSchema, realDrawVert_t, drawVert_t, BSP_DRAWVERT_FIELDS );
+
 // IneQuation was here
 typedef struct dterPatch_s {
 	byte			flags;
@@ -266,39 +270,7 @@ typedef struct {
 /****************************************************
 */
 
-static int GetLumpElements( dheader_t *header, int lump, int size ) {
-	/* check for odd size */
-	if ( header->lumps[ lump ].filelen % size ) {
-		Com_Printf( "GetLumpElements: odd lump size (%d) in lump %d\n", header->lumps[ lump ].filelen, lump );
-		return 0;
-	}
-
-	/* return element count */
-	return header->lumps[ lump ].filelen / size;
-}
-
-static void CopyLump( dheader_t *header, int lump, const void *src, void *dest, int size, qboolean swap ) {
-	int length;
-
-	length = GetLumpElements( header, lump, size ) * size;
-
-	/* handle erroneous cases */
-	if ( length <= 0 ) {
-		return;
-	}
-
-	if ( swap ) {
-		BSP_SwapBlock( dest, (int *)((byte*) src + header->lumps[lump].fileofs), length );
-	} else {
-		Com_Memcpy( dest, (byte*) src + header->lumps[lump].fileofs, length );
-	}
-}
-
-static void *GetLump( dheader_t *header, const void *src, int lump ) {
-	return (void*)( (byte*) src + header->lumps[ lump ].fileofs );
-}
-
-bspFile_t *BSP_LoadMOHAA( const bspFormat_t *format, const char *name, const void *data, int length ) {
+bspFile_t *BSP_LoadMOHAA( const bspFormat_t *format, const char *name, const void *data, int length, qboolean keepData ) {
 	int				i, j, k;
 	dheader_t		header;
 	bspFile_t		*bsp;
@@ -313,6 +285,12 @@ bspFile_t *BSP_LoadMOHAA( const bspFormat_t *format, const char *name, const voi
 	bsp = malloc( sizeof ( bspFile_t ) );
 	Com_Memset( bsp, 0, sizeof ( bspFile_t ) );
 
+	// lumps that are not larger in memory are decoded in place in data, see BSP_LumpArray
+	if ( keepData ) {
+		bsp->fileData = (void *)data;
+		bsp->fileLength = length;
+	}
+
 	// ...
 	bsp->checksum = header.checksum;
 	bsp->defaultLightGridSize[0] = LIGHTING_GRIDSIZE_X;
@@ -323,202 +301,116 @@ bspFile_t *BSP_LoadMOHAA( const bspFormat_t *format, const char *name, const voi
 	//
 	// count and alloc
 	//
-	bsp->entityStringLength = GetLumpElements( &header, LUMP_ENTITIES, 1 );
-	bsp->entityString = malloc( bsp->entityStringLength );
+	TRACE_BEGIN( "count lumps" );
+	bsp->entityStringLength = BSP_GetLumpElements( header.lumps, LUMP_ENTITIES, 1 );
+	bsp->entityString = BSP_LumpArray( bsp, header.lumps, LUMP_ENTITIES, bsp->entityStringLength, 1, 1 );
 
-	bsp->numShaders = GetLumpElements( &header, LUMP_SHADERS, sizeof ( realDshader_t ) );
-	bsp->shaders = malloc( bsp->numShaders * sizeof ( *bsp->shaders ) );
+	bsp->numShaders = BSP_GetLumpElements( header.lumps, LUMP_SHADERS, sizeof ( realDshader_t ) );
+	bsp->shaders = BSP_LumpArray( bsp, header.lumps, LUMP_SHADERS, bsp->numShaders, sizeof ( *bsp->shaders ), sizeof ( realDshader_t ) );
 
-	bsp->numPlanes = GetLumpElements( &header, LUMP_PLANES, sizeof ( realDplane_t ) );
-	bsp->planes = malloc( bsp->numPlanes * sizeof ( *bsp->planes ) );
+	bsp->numPlanes = BSP_GetLumpElements( header.lumps, LUMP_PLANES, sizeof ( realDplane_t ) );
+	bsp->planes = BSP_LumpArray( bsp, header.lumps, LUMP_PLANES, bsp->numPlanes, sizeof ( *bsp->planes ), sizeof ( realDplane_t ) );
 
-	bsp->numNodes = GetLumpElements( &header, LUMP_NODES, sizeof ( realDnode_t ) );
-	bsp->nodes = malloc( bsp->numNodes * sizeof ( *bsp->nodes ) );
+	bsp->numNodes = BSP_GetLumpElements( header.lumps, LUMP_NODES, sizeof ( realDnode_t ) );
+	bsp->nodes = BSP_LumpArray( bsp, header.lumps, LUMP_NODES, bsp->numNodes, sizeof ( *bsp->nodes ), sizeof ( realDnode_t ) );
 
-	bsp->numLeafs = GetLumpElements( &header, LUMP_LEAFS, sizeof ( realDleaf_t ) );
-	bsp->leafs = malloc( bsp->numLeafs * sizeof ( *bsp->leafs ) );
+	bsp->numLeafs = BSP_GetLumpElements( header.lumps, LUMP_LEAFS, sizeof ( realDleaf_t ) );
+	bsp->leafs = BSP_LumpArray( bsp, header.lumps, LUMP_LEAFS, bsp->numLeafs, sizeof ( *bsp->leafs ), sizeof ( realDleaf_t ) );
 
-	bsp->numLeafSurfaces = GetLumpElements( &header, LUMP_LEAFSURFACES, sizeof ( int ) );
-	bsp->leafSurfaces = malloc( bsp->numLeafSurfaces * sizeof ( *bsp->leafSurfaces ) );
+	bsp->numLeafSurfaces = BSP_GetLumpElements( header.lumps, LUMP_LEAFSURFACES, sizeof ( int ) );
+	bsp->leafSurfaces = BSP_LumpArray( bsp, header.lumps, LUMP_LEAFSURFACES, bsp->numLeafSurfaces, sizeof ( *bsp->leafSurfaces ), sizeof ( int ) );
 
-	bsp->numLeafBrushes = GetLumpElements( &header, LUMP_LEAFBRUSHES, sizeof ( int ) );
-	bsp->leafBrushes = malloc( bsp->numLeafBrushes * sizeof ( *bsp->leafBrushes ) );
+	bsp->numLeafBrushes = BSP_GetLumpElements( header.lumps, LUMP_LEAFBRUSHES, sizeof ( int ) );
+	bsp->leafBrushes = BSP_LumpArray( bsp, header.lumps, LUMP_LEAFBRUSHES, bsp->numLeafBrushes, sizeof ( *bsp->leafBrushes ), sizeof ( int ) );
 
-	bsp->numSubmodels = GetLumpElements( &header, LUMP_MODELS, sizeof ( realDmodel_t ) );
-	bsp->submodels = malloc( bsp->numSubmodels * sizeof ( *bsp->submodels ) );
+	bsp->numSubmodels = BSP_GetLumpElements( header.lumps, LUMP_MODELS, sizeof ( realDmodel_t ) );
+	bsp->submodels = BSP_LumpArray( bsp, header.lumps, LUMP_MODELS, bsp->numSubmodels, sizeof ( *bsp->submodels ), sizeof ( realDmodel_t ) );
 
-	bsp->numBrushes = GetLumpElements( &header, LUMP_BRUSHES, sizeof ( realDbrush_t ) );
-	bsp->brushes = malloc( bsp->numBrushes * sizeof ( *bsp->brushes ) );
+	bsp->numBrushes = BSP_GetLumpElements( header.lumps, LUMP_BRUSHES, sizeof ( realDbrush_t ) );
+	bsp->brushes = BSP_LumpArray( bsp, header.lumps, LUMP_BRUSHES, bsp->numBrushes, sizeof ( *bsp->brushes ), sizeof ( realDbrush_t ) );
 
-	bsp->numBrushSides = GetLumpElements( &header, LUMP_BRUSHSIDES, sizeof ( realDbrushside_t ) );
-	bsp->brushSides = malloc( bsp->numBrushSides * sizeof ( *bsp->brushSides ) );
+	bsp->numBrushSides = BSP_GetLumpElements( header.lumps, LUMP_BRUSHSIDES, sizeof ( realDbrushside_t ) );
+	bsp->brushSides = BSP_LumpArray( bsp, header.lumps, LUMP_BRUSHSIDES, bsp->numBrushSides, sizeof ( *bsp->brushSides ), sizeof ( realDbrushside_t ) );
 
-	numTerSurfaces = GetLumpElements( &header, LUMP_TERRAIN, sizeof ( realDterPatch_t ) );
+	numTerSurfaces = BSP_GetLumpElements( header.lumps, LUMP_TERRAIN, sizeof ( realDterPatch_t ) );
 	numTerVerts = numTerSurfaces * 9 * 9;
 	numTerIndexes = numTerSurfaces * 8 * 8 * 6;
 
-	bsp->numDrawVerts = GetLumpElements( &header, LUMP_DRAWVERTS, sizeof ( realDrawVert_t ) );
+	bsp->numDrawVerts = BSP_GetLumpElements( header.lumps, LUMP_DRAWVERTS, sizeof ( realDrawVert_t ) );
 	bsp->drawVerts = malloc( ( bsp->numDrawVerts + numTerVerts ) * sizeof ( *bsp->drawVerts ) );
 
-	bsp->numDrawIndexes = GetLumpElements( &header, LUMP_DRAWINDEXES, sizeof ( int ) );
+	bsp->numDrawIndexes = BSP_GetLumpElements( header.lumps, LUMP_DRAWINDEXES, sizeof ( int ) );
 	bsp->drawIndexes = malloc( ( bsp->numDrawIndexes + numTerIndexes ) * sizeof ( *bsp->drawIndexes ) );
 
-	bsp->numFogs = 0; //GetLumpElements( &header, LUMP_FOGS, sizeof ( realDfog_t ) );
+	bsp->numFogs = 0; //BSP_GetLumpElements( header.lumps, LUMP_FOGS, sizeof ( realDfog_t ) );
 	bsp->fogs = NULL; //malloc( bsp->numFogs * sizeof ( *bsp->fogs ) );
 
-	bsp->numSurfaces = GetLumpElements( &header, LUMP_SURFACES, sizeof ( realDsurface_t ) );
+	bsp->numSurfaces = BSP_GetLumpElements( header.lumps, LUMP_SURFACES, sizeof ( realDsurface_t ) );
 	bsp->surfaces = malloc( ( bsp->numSurfaces + numTerSurfaces ) * sizeof ( *bsp->surfaces ) );
 
-	bsp->numLightmaps = GetLumpElements( &header, LUMP_LIGHTMAPS, 128 * 128 * 3 );
-	bsp->lightmapData = malloc( bsp->numLightmaps * 128 * 128 * 3 );
+	bsp->numLightmaps = BSP_GetLumpElements( header.lumps, LUMP_LIGHTMAPS, 128 * 128 * 3 );
+	bsp->lightmapData = BSP_LumpArray( bsp, header.lumps, LUMP_LIGHTMAPS, bsp->numLightmaps * 128 * 128 * 3, 1, 1 );
 
 #if 0 // ZTM: TODO: get light grid code from OpenMoHAA
-	bsp->numGridPoints = GetLumpElements( &header, LUMP_LIGHTGRID, 8 );
+	bsp->numGridPoints = BSP_GetLumpElements( header.lumps, LUMP_LIGHTGRID, 8 );
 	bsp->lightGridData = malloc( bsp->numGridPoints * 8 );
 #endif
 
-	bsp->visibilityLength = GetLumpElements( &header, LUMP_VISIBILITY, 1 ) - VIS_HEADER;
-	if ( bsp->visibilityLength > 0 )
-		bsp->visibility = malloc( bsp->visibilityLength );
-	else
+	bsp->visibilityLength = BSP_GetLumpElements( header.lumps, LUMP_VISIBILITY, 1 ) - VIS_HEADER;
+	if ( bsp->visibilityLength > 0 ) {
+		if ( bsp->fileData ) {
+			bsp->visibility = (byte *)BSP_GetLump( header.lumps, data, LUMP_VISIBILITY ) + VIS_HEADER;
+		} else {
+			bsp->visibility = malloc( bsp->visibilityLength );
+		}
+	} else {
 		bsp->visibilityLength = 0;
+	}
+
+	TRACE_END( "count lumps" );
 
 	//
 	// copy and swap and convert data
 	//
-	CopyLump( &header, LUMP_ENTITIES, data, (void *) bsp->entityString, sizeof ( *bsp->entityString ), qfalse ); /* NO SWAP */
-
-	{
-		realDshader_t *in = GetLump( &header, data, LUMP_SHADERS );
-		dshader_t *out = bsp->shaders;
-
-		for ( i = 0; i < bsp->numShaders; i++, in++, out++ ) {
-			Q_strncpyz( out->shader, in->shader, sizeof ( out->shader ) );
-			out->contentFlags = LittleLong( in->contentFlags );
-			out->surfaceFlags = LittleLong( in->surfaceFlags );
-		}
-	}
-
-	{
-		realDplane_t *in = GetLump( &header, data, LUMP_PLANES );
-		dplane_t *out = bsp->planes;
-
-		for ( i = 0; i < bsp->numPlanes; i++, in++, out++) {
-			for (j=0 ; j<3 ; j++) {
-				out->normal[j] = LittleFloat (in->normal[j]);
-			}
-
-			out->dist = LittleFloat (in->dist);
-		}
-	}
-
-	{
-		realDnode_t *in = GetLump( &header, data, LUMP_NODES );
-		dnode_t *out = bsp->nodes;
+	TRACE_BEGIN( "decode lumps" );
+	BSP_CopyLump( header.lumps, LUMP_ENTITIES, data, (void *) bsp->entityString, sizeof ( *bsp->entityString ), qfalse ); /* NO SWAP */
 
-		for ( i = 0; i < bsp->numNodes; i++, in++, out++ ) {
-			out->planeNum = LittleLong( in->planeNum );
+	BSP_DecodeElements( &shaderSchema, BSP_GetLump( header.lumps, data, LUMP_SHADERS ), bsp->shaders, bsp->numShaders );
 
-			for ( j = 0; j < 2; j++ ) {
-				out->children[j] = LittleLong( in->children[j] );
-			}
-
-			for ( j = 0; j < 3; j++ ) {
-				out->mins[j] = LittleLong( in->mins[j] );
-				out->maxs[j] = LittleLong( in->maxs[j] );
-			}
-		}
-	}
-
-	{
-		realDleaf_t *in = GetLump( &header, data, LUMP_LEAFS );
-		dleaf_t *out = bsp->leafs;
+	BSP_DecodeElements( &planeSchema, BSP_GetLump( header.lumps, data, LUMP_PLANES ), bsp->planes, bsp->numPlanes );
 
-		for ( i = 0; i < bsp->numLeafs; i++, in++, out++ ) {
-			out->cluster = LittleLong (in->cluster);
-			out->area = LittleLong (in->area);
+	BSP_DecodeElements( &nodeSchema, BSP_GetLump( header.lumps, data, LUMP_NODES ), bsp->nodes, bsp->numNodes );
 
-			for ( j = 0; j < 3; j++ ) {
-				out->mins[j] = LittleLong( in->mins[j] );
-				out->maxs[j] = LittleLong( in->maxs[j] );
-			}
-
-			out->firstLeafBrush = LittleLong (in->firstLeafBrush);
-			out->numLeafBrushes = LittleLong (in->numLeafBrushes);
-			out->firstLeafSurface = LittleLong (in->firstLeafSurface);
-			out->numLeafSurfaces = LittleLong (in->numLeafSurfaces);
-		}
-	}
-
-	CopyLump( &header, LUMP_LEAFSURFACES, data, (void *) bsp->leafSurfaces, sizeof ( *bsp->leafSurfaces ), qtrue );
-	CopyLump( &header, LUMP_LEAFBRUSHES, data, (void *) bsp->leafBrushes, sizeof ( *bsp->leafBrushes ), qtrue );
-
-	{
-		realDmodel_t *in = GetLump( &header, data, LUMP_MODELS );
-		dmodel_t *out = bsp->submodels;
-
-		for ( i = 0; i < bsp->numSubmodels; i++, in++, out++ ) {
-			for ( j = 0; j < 3; j++ ) {
-				out->mins[j] = LittleFloat( in->mins[j] );
-				out->maxs[j] = LittleFloat( in->maxs[j] );
-			}
+	BSP_DecodeElements( &leafSchema, BSP_GetLump( header.lumps, data, LUMP_LEAFS ), bsp->leafs, bsp->numLeafs );
 
-			out->firstSurface = LittleLong (in->firstSurface);
-			out->numSurfaces = LittleLong (in->numSurfaces);
-			out->firstBrush = LittleLong (in->firstBrush);
-			out->numBrushes = LittleLong (in->numBrushes);
-		}
-	}
+	BSP_CopyLump( header.lumps, LUMP_LEAFSURFACES, data, (void *) bsp->leafSurfaces, sizeof ( *bsp->leafSurfaces ), qtrue );
+	BSP_CopyLump( header.lumps, LUMP_LEAFBRUSHES, data, (void *) bsp->leafBrushes, sizeof ( *bsp->leafBrushes ), qtrue );
 
-	{
-		realDbrush_t *in = GetLump( &header, data, LUMP_BRUSHES );
-		dbrush_t *out = bsp->brushes;
+	BSP_DecodeElements( &modelSchema, BSP_GetLump( header.lumps, data, LUMP_MODELS ), bsp->submodels, bsp->numSubmodels );
 
-		for ( i = 0; i < bsp->numBrushes; i++, in++, out++ )
-		{
-			out->firstSide = LittleLong (in->firstSide);
-			out->numSides = LittleLong (in->numSides);
-			out->shaderNum = LittleLong (in->shaderNum);
-		}
-	}
+	BSP_DecodeElements( &brushSchema, BSP_GetLump( header.lumps, data, LUMP_BRUSHES ), bsp->brushes, bsp->numBrushes );
 
 	{
-		realDbrushside_t *in = GetLump( &header, data, LUMP_BRUSHSIDES );
+		realDbrushside_t *lump = BSP_GetLump( header.lumps, data, LUMP_BRUSHSIDES );
+		realDbrushside_t element, *in = &element;
 		dbrushside_t *out = bsp->brushSides;
 
-		for ( i = 0; i < bsp->numBrushSides; i++, in++, out++ ) {
+		// out may be the lump, copy the element before decoding it
+		for ( i = 0; i < bsp->numBrushSides; i++, out++ ) {
+			Com_Memcpy( &element, &lump[i], sizeof ( element ) );
 			out->planeNum = LittleLong (in->planeNum);
 			out->shaderNum = LittleLong (in->shaderNum);
 			out->surfaceNum = -1;
 		}
 	}
 
-	{
-		realDrawVert_t *in = GetLump( &header, data, LUMP_DRAWVERTS );
-		drawVert_t *out = bsp->drawVerts;
+	BSP_DecodeElements( &drawVertSchema, BSP_GetLump( header.lumps, data, LUMP_DRAWVERTS ), bsp->drawVerts, bsp->numDrawVerts );
 
-		for ( i = 0; i < bsp->numDrawVerts; i++, in++, out++ ) {
-			for ( j = 0 ; j < 3 ; j++ ) {
-				out->xyz[j] = LittleFloat( in->xyz[j] );
-				out->normal[j] = LittleFloat( in->normal[j] );
-			}
-			for ( j = 0 ; j < 2 ; j++ ) {
-				out->st[j] = LittleFloat( in->st[j] );
-				out->lightmap[j] = LittleFloat( in->lightmap[j] );
-			}
-
-			/* NO SWAP */
-			for ( j = 0; j < 4; j++ ) {
-				out->color[j] = in->color[j];
-			}
-		}
-	}
-
-	CopyLump( &header, LUMP_DRAWINDEXES, data, (void *) bsp->drawIndexes, sizeof ( *bsp->drawIndexes ), qtrue );
+	BSP_CopyLump( header.lumps, LUMP_DRAWINDEXES, data, (void *) bsp->drawIndexes, sizeof ( *bsp->drawIndexes ), qtrue );
 
 #if 0
 	{
-		realDfog_t *in = GetLump( &header, data, LUMP_FOGS );
+		realDfog_t *in = BSP_GetLump( header.lumps, data, LUMP_FOGS );
 		dfog_t *out = bsp->fogs;
 
 		for ( i = 0; i < bsp->numFogs; i++, in++, out++ ) {
@@ -530,7 +422,7 @@ bspFile_t *BSP_LoadMOHAA( const bspFormat_t *format, const char *name, const voi
 #endif
 
 	{
-		realDsurface_t *in = GetLump( &header, data, LUMP_SURFACES );
+		realDsurface_t *in = BSP_GetLump( header.lumps, data, LUMP_SURFACES );
 		dsurface_t *out = bsp->surfaces;
 
 		for ( i = 0; i < bsp->numSurfaces; i++, in++, out++ ) {
@@ -566,7 +458,7 @@ bspFile_t *BSP_LoadMOHAA( const bspFormat_t *format, const char *name, const voi
 #define LIGHTMAP_SIZE 128
 #define TERRAIN_LM_LENGTH		(16.f / LIGHTMAP_SIZE)
 	{
-		realDterPatch_t *in = GetLump( &header, data, LUMP_TERRAIN );
+		realDterPatch_t *in = BSP_GetLump( header.lumps, data, LUMP_TERRAIN );
 		dsurface_t *out = &bsp->surfaces[ bsp->numSurfaces ];
 		drawVert_t *vert;
 		int x, y, ndx;
@@ -701,21 +593,27 @@ bspFile_t *BSP_LoadMOHAA( const bspFormat_t *format, const char *name, const voi
 		bsp->numDrawIndexes += numTerSurfaces * 8 * 8 * 6;
 	}
 
-	CopyLump( &header, LUMP_LIGHTMAPS, data, (void *) bsp->lightmapData, sizeof ( *bsp->lightmapData ), qfalse ); /* NO SWAP */
+	BSP_CopyLump( header.lumps, LUMP_LIGHTMAPS, data, (void *) bsp->lightmapData, sizeof ( *bsp->lightmapData ), qfalse ); /* NO SWAP */
 #if 0
-	CopyLump( &header, LUMP_LIGHTGRID, data, (void *) bsp->lightGridData, sizeof ( *bsp->lightGridData ), qfalse ); /* NO SWAP */
+	BSP_CopyLump( header.lumps, LUMP_LIGHTGRID, data, (void *) bsp->lightGridData, sizeof ( *bsp->lightGridData ), qfalse ); /* NO SWAP */
 #endif
 
 	if ( bsp->visibilityLength )
 	{
-		byte *in = GetLump( &header, data, LUMP_VISIBILITY );
+		byte *in = BSP_GetLump( header.lumps, data, LUMP_VISIBILITY );
 
 		bsp->numClusters = LittleLong( ((int *)in)[0] );
 		bsp->clusterBytes = LittleLong( ((int *)in)[1] );
 
-		Com_Memcpy( bsp->visibility, in + VIS_HEADER, bsp->visibilityLength ); /* NO SWAP */
+		if ( bsp->visibility != in + VIS_HEADER ) {
+			Com_Memcpy( bsp->visibility, in + VIS_HEADER, bsp->visibilityLength ); /* NO SWAP */
+		}
 	}
 
+	BSP_ReleaseFileData( bsp );
+
+	TRACE_END( "decode lumps" );
+
 	return bsp;
 }
 
@@ -723,10 +621,35 @@ bspFile_t *BSP_LoadMOHAA( const bspFormat_t *format, const char *name, const voi
 /****************************************************
 */
 
+// terrain patches are converted to surfaces
+static const bspLumpDef_t mohaaLumpDefs[BSPLUMP_MAX] = {
+	{ LUMP_ENTITIES, 1 },
+	{ LUMP_SHADERS, sizeof ( realDshader_t ) },
+	{ LUMP_PLANES, sizeof ( realDplane_t ) },
+	{ LUMP_NODES, sizeof ( realDnode_t ) },
+	{ LUMP_LEAFS, sizeof ( realDleaf_t ) },
+	{ LUMP_LEAFSURFACES, sizeof ( int ) },
+	{ LUMP_LEAFBRUSHES, sizeof ( int ) },
+	{ LUMP_MODELS, sizeof ( realDmodel_t ) },
+	{ LUMP_BRUSHES, sizeof ( realDbrush_t ) },
+	{ LUMP_BRUSHSIDES, sizeof ( realDbrushside_t ) },
+	{ LUMP_DRAWVERTS, sizeof ( realDrawVert_t ) },
+	{ LUMP_DRAWINDEXES, sizeof ( int ) },
+	{ -1, 0 },	// no fogs lump
+	{ LUMP_SURFACES, sizeof ( realDsurface_t ), 0, ( 1 << LUMP_TERRAIN ) },
+	{ LUMP_LIGHTMAPS, 128 * 128 * 3 },
+	{ -1, 0 },	// no lightgrid lump
+	{ LUMP_VISIBILITY, 1 },
+	{ -1, 0 },	// no lightarray lump
+};
+
 bspFormat_t mohaaBspFormat = {
 	"MOHAA",
 	BSP_IDENT,
 	BSP_VERSION,
+	offsetof( dheader_t, lumps ),
+	HEADER_LUMPS,
+	mohaaLumpDefs,
 	BSP_LoadMOHAA,
 };
 
@@ -0,0 +1,401 @@
+/*
+===========================================================================
+Copyright (C) 2015 Zack Middleton
+
+This file is part of BSP sekai Source Code.
+
+BSP sekai Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+BSP sekai Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with BSP sekai Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, BSP sekai Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+
+
+#include "sekai.h"
+#include "bsp.h"
+
+// convert_nsco.c
+void ConvertNscoToNscoET( bspFile_t *bsp );
+void ConvertNscoETToNsco( bspFile_t *bsp );
+
+static const bspPass_t bspPasses[] = {
+	{ "nsco2et",	"Convert Navy SEALS: Covert Operation surface/content flags to ET values.", ConvertNscoToNscoET, qtrue, BSPLUMP_BIT( BSPLUMP_SHADERS ), 0, 0 },
+	{ "et2nsco",	"Convert ET surface/content flags to Navy SEALS: Covert Operation values.", ConvertNscoETToNsco, qtrue, BSPLUMP_BIT( BSPLUMP_SHADERS ), 0, 0 },
+	{ "shaders",	"Merge shaders with the same name and flags.", BSP_DedupeShaders, qfalse,
+		BSPLUMP_BIT( BSPLUMP_SHADERS ) | BSPLUMP_BIT( BSPLUMP_BRUSHES ) | BSPLUMP_BIT( BSPLUMP_BRUSHSIDES ) | BSPLUMP_BIT( BSPLUMP_SURFACES ), 0, 0 },
+	{ "weld",		"Weld duplicate vertexes of triangle surfaces, see -weld.", BSP_WeldVerts, qfalse,
+		BSPLUMP_BIT( BSPLUMP_DRAWVERTS ) | BSPLUMP_BIT( BSPLUMP_DRAWINDEXES ) | BSPLUMP_BIT( BSPLUMP_SURFACES ), 0, BSPDERIVED_BOUNDS },
+	{ "vcache",		"Reorder triangles and vertexes of triangle surfaces for the vertex cache.", BSP_OptimizeVertexCache, qfalse,
+		BSPLUMP_BIT( BSPLUMP_DRAWVERTS ) | BSPLUMP_BIT( BSPLUMP_DRAWINDEXES ) | BSPLUMP_BIT( BSPLUMP_SURFACES ), 0, 0 },
+	{ "planes",		"Snap almost axial planes and merge duplicate planes.", BSP_MergePlanes, qfalse,
+		BSPLUMP_BIT( BSPLUMP_PLANES ) | BSPLUMP_BIT( BSPLUMP_NODES ) | BSPLUMP_BIT( BSPLUMP_BRUSHSIDES ), 0, BSPDERIVED_BOUNDS },
+	{ "gc",			"Remove surfaces, brushes, planes, shaders, vertexes, lightmaps, etc that aren't used.", BSP_CollectGarbage, qfalse, 0, 0, BSPDERIVED_LEAFLISTS | BSPDERIVED_BOUNDS },
+	{ "sortsurfs",	"Sort surfaces by shader, lightmap, fog, and position.", BSP_SortSurfaces, qfalse,
+		BSPLUMP_BIT( BSPLUMP_SURFACES ) | BSPLUMP_BIT( BSPLUMP_MODELS ) | BSPLUMP_BIT( BSPLUMP_LEAFS ) | BSPLUMP_BIT( BSPLUMP_LEAFSURFACES )
+		| BSPLUMP_BIT( BSPLUMP_BRUSHSIDES ) | BSPLUMP_BIT( BSPLUMP_DRAWVERTS ), BSPDERIVED_BOUNDS, 0 },
+	{ "merge",		"Merge planar surfaces with the same shader, lightmap, fog, plane, and leafs.", BSP_MergeSurfaces, qfalse,
+		BSPLUMP_BIT( BSPLUMP_SURFACES ) | BSPLUMP_BIT( BSPLUMP_MODELS ) | BSPLUMP_BIT( BSPLUMP_LEAFS ) | BSPLUMP_BIT( BSPLUMP_LEAFSURFACES )
+		| BSPLUMP_BIT( BSPLUMP_BRUSHSIDES ) | BSPLUMP_BIT( BSPLUMP_DRAWVERTS ) | BSPLUMP_BIT( BSPLUMP_DRAWINDEXES ), 0, BSPDERIVED_LEAFLISTS },
+	{ "tree",		"Reorder nodes depth first and leafs by cluster.", BSP_ReorderTree, qfalse,
+		BSPLUMP_BIT( BSPLUMP_NODES ) | BSPLUMP_BIT( BSPLUMP_LEAFS ), 0, 0 },
+	{ "lightmaps",	"Repack the used parts of lightmaps onto fewer pages, sharing identical parts.", BSP_RepackLightmaps, qfalse,
+		BSPLUMP_BIT( BSPLUMP_LIGHTMAPS ) | BSPLUMP_BIT( BSPLUMP_SURFACES ) | BSPLUMP_BIT( BSPLUMP_DRAWVERTS ), 0, 0 },
+};
+
+static const int numBspPasses = ARRAY_LEN( bspPasses );
+
+/*
+=================
+BSP_FindPass
+=================
+*/
+const bspPass_t *BSP_FindPass( const char *name ) {
+	int i;
+
+	for ( i = 0; i < numBspPasses; i++ ) {
+		if ( Q_stricmp( bspPasses[i].name, name ) == 0 ) {
+			return &bspPasses[i];
+		}
+	}
+
+	return NULL;
+}
+
+/*
+=================
+BSP_ListPasses
+=================
+*/
+void BSP_ListPasses( void ) {
+	int i;
+
+	for ( i = 0; i < numBspPasses; i++ ) {
+		Com_Printf( "  %-9s - %s\n", bspPasses[i].name, bspPasses[i].description );
+	}
+}
+
+/*
+=================
+BSP_AddPass
+=================
+*/
+qboolean BSP_AddPass( bspPipeline_t *pipeline, const bspPass_t *pass ) {
+	if ( pipeline->numPasses >= MAX_PIPELINE_PASSES ) {
+		Com_Printf( "Error: too many passes (max %d).\n", MAX_PIPELINE_PASSES );
+		return qfalse;
+	}
+
+	pipeline->passes[pipeline->numPasses++] = pass;
+	return qtrue;
+}
+
+/*
+=================
+BSP_AddPasses
+
+Add a comma separated list of passes.
+=================
+*/
+qboolean BSP_AddPasses( bspPipeline_t *pipeline, const char *list ) {
+	const bspPass_t *pass;
+	char name[MAX_QPATH];
+	const char *p, *end;
+	int length;
+
+	for ( p = list; *p; p = end ) {
+		end = strchr( p, ',' );
+		if ( !end ) {
+			end = p + strlen( p );
+		}
+
+		length = MIN( end - p, (int)sizeof ( name ) - 1 );
+		Com_Memcpy( name, p, length );
+		name[length] = '\0';
+
+		if ( *end ) {
+			end++;
+		}
+
+		if ( !name[0] ) {
+			continue;
+		}
+
+		pass = BSP_FindPass( name );
+
+		if ( !pass ) {
+			Com_Printf( "Error: Unknown pass '%s'.\n", name );
+			return qfalse;
+		}
+
+		if ( !BSP_AddPass( pipeline, pass ) ) {
+			return qfalse;
+		}
+	}
+
+	return qtrue;
+}
+
+/*
+=================
+BSP_MemoryUsage
+
+Bytes used by the arrays of the BSP.
+=================
+*/
+size_t BSP_MemoryUsage( const bspFile_t *bsp ) {
+	size_t size = 0;
+
+	size += bsp->entityStringLength;
+	size += bsp->numShaders * sizeof ( *bsp->shaders );
+	size += bsp->numPlanes * sizeof ( *bsp->planes );
+	size += bsp->numNodes * sizeof ( *bsp->nodes );
+	size += bsp->numLeafs * sizeof ( *bsp->leafs );
+	size += bsp->numLeafSurfaces * sizeof ( *bsp->leafSurfaces );
+	size += bsp->numLeafBrushes * sizeof ( *bsp->leafBrushes );
+	size += bsp->numSubmodels * sizeof ( *bsp->submodels );
+	size += bsp->numBrushes * sizeof ( *bsp->brushes );
+	size += bsp->numBrushSides * sizeof ( *bsp->brushSides );
+	size += bsp->numDrawVerts * sizeof ( *bsp->drawVerts );
+	size += bsp->numDrawIndexes * sizeof ( *bsp->drawIndexes );
+	size += bsp->numFogs * sizeof ( *bsp->fogs );
+	size += bsp->numSurfaces * sizeof ( *bsp->surfaces );
+	size += bsp->numLightmaps * 128 * 128 * 3;
+	size += bsp->numGridPoints * 8;
+	size += bsp->numGridArrayPoints * sizeof ( *bsp->lightGridArray );
+	size += bsp->visibilityLength;
+
+	return size;
+}
+
+static void AddPointToBounds( const vec3_t v, vec3_t mins, vec3_t maxs ) {
+	int i;
+
+	for ( i = 0; i < 3; i++ ) {
+		if ( v[i] < mins[i] ) {
+			mins[i] = v[i];
+		}
+		if ( v[i] > maxs[i] ) {
+			maxs[i] = v[i];
+		}
+	}
+}
+
+/*
+=================
+BSP_UpdateBounds
+
+Recompute submodel bounds from the axial sides of their brushes and the
+vertexes of their surfaces. Axes without either keep their old bounds.
+=================
+*/
+static void BSP_UpdateBounds( bspFile_t *bsp ) {
+	dmodel_t *model;
+	const dbrush_t *brush;
+	const dbrushside_t *side;
+	const dplane_t *plane;
+	const dsurface_t *surface;
+	vec3_t mins, maxs;
+	int i, j, k, axis;
+
+	for ( i = 0, model = bsp->submodels; i < bsp->numSubmodels; i++, model++ ) {
+		VectorSet( mins, 999999, 999999, 999999 );
+		VectorSet( maxs, -999999, -999999, -999999 );
+
+		for ( j = MAX( model->firstBrush, 0 ); j < model->firstBrush + model->numBrushes && j < bsp->numBrushes; j++ ) {
+			brush = &bsp->brushes[j];
+
+			for ( k = MAX( brush->firstSide, 0 ); k < brush->firstSide + brush->numSides && k < bsp->numBrushSides; k++ ) {
+				side = &bsp->brushSides[k];
+
+				if ( side->planeNum < 0 || side->planeNum >= bsp->numPlanes ) {
+					continue;
+				}
+
+				plane = &bsp->planes[side->planeNum];
+
+				for ( axis = 0; axis < 3; axis++ ) {
+					if ( plane->normal[axis] == 1 ) {
+						maxs[axis] = MAX( maxs[axis], plane->dist );
+					} else if ( plane->normal[axis] == -1 ) {
+						mins[axis] = MIN( mins[axis], -plane->dist );
+					}
+				}
+			}
+		}
+
+		for ( j = MAX( model->firstSurface, 0 ); j < model->firstSurface + model->numSurfaces && j < bsp->numSurfaces; j++ ) {
+			surface = &bsp->surfaces[j];
+
+			if ( surface->surfaceType == MST_FLARE || surface->firstVert < 0 || surface->firstVert + surface->numVerts > bsp->numDrawVerts ) {
+				continue;
+			}
+
+			for ( k = 0; k < surface->numVerts; k++ ) {
+				AddPointToBounds( bsp->drawVerts[surface->firstVert + k].xyz, mins, maxs );
+			}
+		}
+
+		for ( axis = 0; axis < 3; axis++ ) {
+			if ( mins[axis] <= maxs[axis] ) {
+				model->mins[axis] = mins[axis];
+				model->maxs[axis] = maxs[axis];
+			}
+		}
+	}
+}
+
+/*
+=================
+BSP_CompactList
+
+Remove -1 and out of range entries from a list in place. keptBefore[i] is
+set to the number of entries before i that were kept, so a range first,
+num becomes keptBefore[first], keptBefore[first+num] - keptBefore[first].
+=================
+*/
+static int BSP_CompactList( int *list, int numList, int maxValue, int *keptBefore ) {
+	int i, numKept;
+
+	for ( i = 0, numKept = 0; i < numList; i++ ) {
+		keptBefore[i] = numKept;
+
+		if ( list[i] >= 0 && list[i] < maxValue ) {
+			list[numKept++] = list[i];
+		}
+	}
+	keptBefore[numList] = numKept;
+
+	return numKept;
+}
+
+static void BSP_RemapRange( const int *keptBefore, int numList, int *first, int *num ) {
+	if ( *first < 0 || *num <= 0 || *first + *num > numList ) {
+		*first = 0;
+		*num = 0;
+		return;
+	}
+
+	*num = keptBefore[*first + *num] - keptBefore[*first];
+	*first = keptBefore[*first];
+}
+
+/*
+=================
+BSP_UpdateLeafLists
+
+Remove entries that passes set to -1 (or that are out of range) from the
+leaf surface and brush lists and update the leafs that use them.
+=================
+*/
+static void BSP_UpdateLeafLists( bspFile_t *bsp ) {
+	int *keptBefore;
+	int i, numKept;
+
+	keptBefore = malloc( ( MAX( bsp->numLeafSurfaces, bsp->numLeafBrushes ) + 1 ) * sizeof ( *keptBefore ) );
+
+	numKept = BSP_CompactList( bsp->leafSurfaces, bsp->numLeafSurfaces, bsp->numSurfaces, keptBefore );
+	for ( i = 0; i < bsp->numLeafs; i++ ) {
+		BSP_RemapRange( keptBefore, bsp->numLeafSurfaces, &bsp->leafs[i].firstLeafSurface, &bsp->leafs[i].numLeafSurfaces );
+	}
+	bsp->numLeafSurfaces = numKept;
+
+	numKept = BSP_CompactList( bsp->leafBrushes, bsp->numLeafBrushes, bsp->numBrushes, keptBefore );
+	for ( i = 0; i < bsp->numLeafs; i++ ) {
+		BSP_RemapRange( keptBefore, bsp->numLeafBrushes, &bsp->leafs[i].firstLeafBrush, &bsp->leafs[i].numLeafBrushes );
+	}
+	bsp->numLeafBrushes = numKept;
+
+	free( keptBefore );
+}
+
+/*
+=================
+BSP_UpdateDerived
+
+Rebuild the BSPDERIVED_* data in invalid.
+=================
+*/
+static void BSP_UpdateDerived( bspFile_t *bsp, int invalid ) {
+	if ( invalid & BSPDERIVED_LEAFLISTS ) {
+		BSP_UpdateLeafLists( bsp );
+	}
+
+	// after leaf lists, in case a pass removed brushes or surfaces
+	if ( invalid & BSPDERIVED_BOUNDS ) {
+		BSP_UpdateBounds( bsp );
+	}
+}
+
+/*
+=================
+BSP_RunPasses
+
+Run the passes in order and print the time and memory change of each.
+Derived data that a pass invalidates is rebuilt before a later pass that
+requires it and after the last pass.
+=================
+*/
+void BSP_RunPasses( const bspPipeline_t *pipeline, bspFile_t *bsp ) {
+	const bspPass_t *pass;
+	int64_t start, totalTime;
+	size_t memory, newMemory;
+	int invalid;
+	int i;
+
+	invalid = 0;
+	totalTime = 0;
+
+	for ( i = 0; i < pipeline->numPasses; i++ ) {
+		pass = pipeline->passes[i];
+
+		if ( invalid & pass->requires ) {
+			TRACE_BEGIN( "BSP_UpdateDerived" );
+			BSP_UpdateDerived( bsp, invalid & pass->requires );
+			TRACE_END( "BSP_UpdateDerived" );
+			invalid &= ~pass->requires;
+		}
+
+		memory = BSP_MemoryUsage( bsp );
+		start = Sys_Microseconds();
+
+		TRACE_BEGIN( pass->name );
+		pass->passFunc( bsp );
+		TRACE_END( pass->name );
+
+		start = Sys_Microseconds() - start;
+		totalTime += start;
+		newMemory = BSP_MemoryUsage( bsp );
+
+		invalid |= pass->invalidates;
+
+		Com_Printf( "Pass %-9s %9.2f ms %+10ld bytes\n", pass->name, start / 1000.0, (long)newMemory - (long)memory );
+	}
+
+	if ( invalid ) {
+		TRACE_BEGIN( "BSP_UpdateDerived" );
+		BSP_UpdateDerived( bsp, invalid );
+		TRACE_END( "BSP_UpdateDerived" );
+	}
+
+	if ( pipeline->numPasses > 1 ) {
+		Com_Printf( "Passes total  %9.2f ms\n", totalTime / 1000.0 );
+	}
+}
@@ -41,10 +41,6 @@ Suite 120, Rockville, Maryland 20850 USA.
 #define WARLORD_BSP_VERSION		48 // Iron Grip: Warlord
 #define DARKS_BSP_VERSION		666 // Dark Salvation
 
-typedef struct {
-	int		fileofs, filelen;
-} lump_t;
-
 #define	LUMP_ENTITIES		0
 #define	LUMP_SHADERS		1
 #define	LUMP_PLANES			2
@@ -184,72 +180,26 @@ typedef struct {
 
 #define	SUBDIVIDE_DISTANCE	16	//4	// never more than this units away from curve
 
+BSP_SCHEMA( shaderSchema, realDshader_t, dshader_t, BSP_SHADER_FIELDS );
+BSP_SCHEMA( planeSchema, realDplane_t, dplane_t, BSP_PLANE_FIELDS );
+BSP_SCHEMA( nodeSchema, realDnode_t, dnode_t, BSP_NODE_FIELDS );
+BSP_SCHEMA( leafSchema, realDleaf_t, dleaf_t, BSP_LEAF_FIELDS );
+BSP_SCHEMA( modelSchema, realDmodel_t, dmodel_t, BSP_MODEL_FIELDS );
+BSP_SCHEMA( brushSchema, realDbrush_t, dbrush_t, BSP_BRUSH_FIELDS );
+BSP_SCHEMA( brushSideSchema, realDbrushside_t, dbrushside_t, BSP_BRUSHSIDE_FIELDS );
+BSP_SCHEMA( warlordBrushSideSchema, realDbrushside_warlord_t, dbrushside_t, BSP_BRUSHSIDE_FIELDS );
+BSP_SCHEMA( drawVertSchema, realDrawVert_t, drawVert_t, BSP_DRAWVERT_FIELDS );
+BSP_SCHEMA( fogSchema, realDfog_t, dfog_t, BSP_FOG_FIELDS );
+BSP_SCHEMA( surfaceSchema, realDsurface_t, dsurface_t, BSP_SURFACE_FIELDS );
+
 /****************************************************
 */
 
-static int GetLumpElements( dheader_t *header, int lump, int size ) {
-	/* check for odd size */
-	if ( header->lumps[ lump ].filelen % size ) {
-		Com_Printf( "GetLumpElements: odd lump size (%d) in lump %d\n", header->lumps[ lump ].filelen, lump );
-		return 0;
-	}
-
-	/* return element count */
-	return header->lumps[ lump ].filelen / size;
-}
-
-// Read data from lump
-static void CopyLump( dheader_t *header, int lump, const void *src, void *dest, int size, qboolean swap ) {
-	int length;
-
-	length = GetLumpElements( header, lump, size ) * size;
-
-	/* handle erroneous cases */
-	if ( length <= 0 ) {
-		return;
-	}
-
-	if ( swap ) {
-		BSP_SwapBlock( dest, (int *)((byte*) src + header->lumps[lump].fileofs), length );
-	} else {
-		Com_Memcpy( dest, (byte*) src + header->lumps[lump].fileofs, length );
-	}
-}
-
-// Write data to lump
-static void WriteLump( dheader_t *header, int lump, void *dest, const void *src, int size, qboolean swap ) {
-	int length;
-
-	length = GetLumpElements( header, lump, size ) * size;
-
-	/* handle erroneous cases */
-	if ( length <= 0 ) {
-		return;
-	}
-
-	if ( swap ) {
-		BSP_SwapBlock( (int *)((byte*) dest + header->lumps[lump].fileofs), src, length );
-	} else {
-		Com_Memcpy( (byte*) dest + header->lumps[lump].fileofs, src, length );
-	}
-}
-
-static void AddLump( dheader_t *header, int *filePos, int lump, int elements, int size ) {
-	header->lumps[lump].fileofs = *filePos;
-	header->lumps[lump].filelen = elements * size;
-
-	*filePos += elements * size;
-}
-
-static void *GetLump( dheader_t *header, const void *src, int lump ) {
-	return (void*)( (byte*) src + header->lumps[ lump ].fileofs );
-}
-
 /****************************************************
 */
 
-bspFile_t *BSP_LoadQ3( const bspFormat_t *format, const char *name, const void *data, int length ) {
-	int				i, j, k;
+bspFile_t *BSP_LoadQ3( const bspFormat_t *format, const char *name, const void *data, int length, qboolean keepData ) {
+	int				i;
 	dheader_t		header;
 	bspFile_t		*bsp;
 
@@ -262,6 +212,12 @@ bspFile_t *BSP_LoadQ3( const bspFormat_t *format, const char *name, const void *
 	bsp = malloc( sizeof ( bspFile_t ) );
 	Com_Memset( bsp, 0, sizeof ( bspFile_t ) );
 
+	// lumps that are not larger in memory are decoded in place in data, see BSP_LumpArray
+	if ( keepData ) {
+		bsp->fileData = (void *)data;
+		bsp->fileLength = length;
+	}
+
 	// ...
 	bsp->checksum = LittleLong (Com_BlockChecksum (data, length));
 	bsp->defaultLightGridSize[0] = LIGHTING_GRIDSIZE_X;
@@ -272,269 +228,141 @@ bspFile_t *BSP_LoadQ3( const bspFormat_t *format, const char *name, const void *
 	//
 	// count and alloc
 	//
-	bsp->entityStringLength = GetLumpElements( &header, LUMP_ENTITIES, 1 );
-	bsp->entityString = malloc( bsp->entityStringLength );
+	TRACE_BEGIN( "count lumps" );
+	bsp->entityStringLength = BSP_GetLumpElements( header.lumps, LUMP_ENTITIES, 1 );
+	bsp->entityString = BSP_LumpArray( bsp, header.lumps, LUMP_ENTITIES, bsp->entityStringLength, 1, 1 );
 
-	bsp->numShaders = GetLumpElements( &header, LUMP_SHADERS, sizeof ( realDshader_t ) );
-	bsp->shaders = malloc( bsp->numShaders * sizeof ( *bsp->shaders ) );
+	bsp->numShaders = BSP_GetLumpElements( header.lumps, LUMP_SHADERS, sizeof ( realDshader_t ) );
+	bsp->shaders = BSP_LumpArray( bsp, header.lumps, LUMP_SHADERS, bsp->numShaders, sizeof ( *bsp->shaders ), shaderSchema.fileSize );
 
-	bsp->numPlanes = GetLumpElements( &header, LUMP_PLANES, sizeof ( realDplane_t ) );
-	bsp->planes = malloc( bsp->numPlanes * sizeof ( *bsp->planes ) );
+	bsp->numPlanes = BSP_GetLumpElements( header.lumps, LUMP_PLANES, sizeof ( realDplane_t ) );
+	bsp->planes = BSP_LumpArray( bsp, header.lumps, LUMP_PLANES, bsp->numPlanes, sizeof ( *bsp->planes ), planeSchema.fileSize );
 
-	bsp->numNodes = GetLumpElements( &header, LUMP_NODES, sizeof ( realDnode_t ) );
-	bsp->nodes = malloc( bsp->numNodes * sizeof ( *bsp->nodes ) );
+	bsp->numNodes = BSP_GetLumpElements( header.lumps, LUMP_NODES, sizeof ( realDnode_t ) );
+	bsp->nodes = BSP_LumpArray( bsp, header.lumps, LUMP_NODES, bsp->numNodes, sizeof ( *bsp->nodes ), nodeSchema.fileSize );
 
-	bsp->numLeafs = GetLumpElements( &header, LUMP_LEAFS, sizeof ( realDleaf_t ) );
-	bsp->leafs = malloc( bsp->numLeafs * sizeof ( *bsp->leafs ) );
+	bsp->numLeafs = BSP_GetLumpElements( header.lumps, LUMP_LEAFS, sizeof ( realDleaf_t ) );
+	bsp->leafs = BSP_LumpArray( bsp, header.lumps, LUMP_LEAFS, bsp->numLeafs, sizeof ( *bsp->leafs ), leafSchema.fileSize );
 
-	bsp->numLeafSurfaces = GetLumpElements( &header, LUMP_LEAFSURFACES, sizeof ( int ) );
-	bsp->leafSurfaces = malloc( bsp->numLeafSurfaces * sizeof ( *bsp->leafSurfaces ) );
+	bsp->numLeafSurfaces = BSP_GetLumpElements( header.lumps, LUMP_LEAFSURFACES, sizeof ( int ) );
+	bsp->leafSurfaces = BSP_LumpArray( bsp, header.lumps, LUMP_LEAFSURFACES, bsp->numLeafSurfaces, sizeof ( *bsp->leafSurfaces ), sizeof ( int ) );
 
-	bsp->numLeafBrushes = GetLumpElements( &header, LUMP_LEAFBRUSHES, sizeof ( int ) );
-	bsp->leafBrushes = malloc( bsp->numLeafBrushes * sizeof ( *bsp->leafBrushes ) );
+	bsp->numLeafBrushes = BSP_GetLumpElements( header.lumps, LUMP_LEAFBRUSHES, sizeof ( int ) );
+	bsp->leafBrushes = BSP_LumpArray( bsp, header.lumps, LUMP_LEAFBRUSHES, bsp->numLeafBrushes, sizeof ( *bsp->leafBrushes ), sizeof ( int ) );
 
-	bsp->numSubmodels = GetLumpElements( &header, LUMP_MODELS, sizeof ( realDmodel_t ) );
-	bsp->submodels = malloc( bsp->numSubmodels * sizeof ( *bsp->submodels ) );
+	bsp->numSubmodels = BSP_GetLumpElements( header.lumps, LUMP_MODELS, sizeof ( realDmodel_t ) );
+	bsp->submodels = BSP_LumpArray( bsp, header.lumps, LUMP_MODELS, bsp->numSubmodels, sizeof ( *bsp->submodels ), modelSchema.fileSize );
 
-	bsp->numBrushes = GetLumpElements( &header, LUMP_BRUSHES, sizeof ( realDbrush_t ) );
-	bsp->brushes = malloc( bsp->numBrushes * sizeof ( *bsp->brushes ) );
+	bsp->numBrushes = BSP_GetLumpElements( header.lumps, LUMP_BRUSHES, sizeof ( realDbrush_t ) );
+	bsp->brushes = BSP_LumpArray( bsp, header.lumps, LUMP_BRUSHES, bsp->numBrushes, sizeof ( *bsp->brushes ), brushSchema.fileSize );
 
 	if ( format->version == WARLORD_BSP_VERSION ) {
-		bsp->numBrushSides = GetLumpElements( &header, LUMP_BRUSHSIDES, sizeof ( realDbrushside_warlord_t ) );
+		bsp->numBrushSides = BSP_GetLumpElements( header.lumps, LUMP_BRUSHSIDES, sizeof ( realDbrushside_warlord_t ) );
 	} else {
-		bsp->numBrushSides = GetLumpElements( &header, LUMP_BRUSHSIDES, sizeof ( realDbrushside_t ) );
+		bsp->numBrushSides = BSP_GetLumpElements( header.lumps, LUMP_BRUSHSIDES, sizeof ( realDbrushside_t ) );
 	}
 	bsp->brushSides = malloc( bsp->numBrushSides * sizeof ( *bsp->brushSides ) );
 
-	bsp->numDrawVerts = GetLumpElements( &header, LUMP_DRAWVERTS, sizeof ( realDrawVert_t ) );
-	bsp->drawVerts = malloc( bsp->numDrawVerts * sizeof ( *bsp->drawVerts ) );
+	bsp->numDrawVerts = BSP_GetLumpElements( header.lumps, LUMP_DRAWVERTS, sizeof ( realDrawVert_t ) );
+	bsp->drawVerts = BSP_LumpArray( bsp, header.lumps, LUMP_DRAWVERTS, bsp->numDrawVerts, sizeof ( *bsp->drawVerts ), drawVertSchema.fileSize );
 
-	bsp->numDrawIndexes = GetLumpElements( &header, LUMP_DRAWINDEXES, sizeof ( int ) );
-	bsp->drawIndexes = malloc( bsp->numDrawIndexes * sizeof ( *bsp->drawIndexes ) );
+	bsp->numDrawIndexes = BSP_GetLumpElements( header.lumps, LUMP_DRAWINDEXES, sizeof ( int ) );
+	bsp->drawIndexes = BSP_LumpArray( bsp, header.lumps, LUMP_DRAWINDEXES, bsp->numDrawIndexes, sizeof ( *bsp->drawIndexes ), sizeof ( int ) );
 
-	bsp->numFogs = GetLumpElements( &header, LUMP_FOGS, sizeof ( realDfog_t ) );
-	bsp->fogs = malloc( bsp->numFogs * sizeof ( *bsp->fogs ) );
+	bsp->numFogs = BSP_GetLumpElements( header.lumps, LUMP_FOGS, sizeof ( realDfog_t ) );
+	bsp->fogs = BSP_LumpArray( bsp, header.lumps, LUMP_FOGS, bsp->numFogs, sizeof ( *bsp->fogs ), fogSchema.fileSize );
 
-	bsp->numSurfaces = GetLumpElements( &header, LUMP_SURFACES, sizeof ( realDsurface_t ) );
-	bsp->surfaces = malloc( bsp->numSurfaces * sizeof ( *bsp->surfaces ) );
+	bsp->numSurfaces = BSP_GetLumpElements( header.lumps, LUMP_SURFACES, sizeof ( realDsurface_t ) );
+	bsp->surfaces = BSP_LumpArray( bsp, header.lumps, LUMP_SURFACES, bsp->numSurfaces, sizeof ( *bsp->surfaces ), surfaceSchema.fileSize );
 
-	bsp->numLightmaps = GetLumpElements( &header, LUMP_LIGHTMAPS, 128 * 128 * 3 );
-	bsp->lightmapData = malloc( bsp->numLightmaps * 128 * 128 * 3 );
+	bsp->numLightmaps = BSP_GetLumpElements( header.lumps, LUMP_LIGHTMAPS, 128 * 128 * 3 );
+	bsp->lightmapData = BSP_LumpArray( bsp, header.lumps, LUMP_LIGHTMAPS, bsp->numLightmaps * 128 * 128 * 3, 1, 1 );
 
-	bsp->numGridPoints = GetLumpElements( &header, LUMP_LIGHTGRID, 8 );
-	bsp->lightGridData = malloc( bsp->numGridPoints * 8 );
+	bsp->numGridPoints = BSP_GetLumpElements( header.lumps, LUMP_LIGHTGRID, 8 );
+	bsp->lightGridData = BSP_LumpArray( bsp, header.lumps, LUMP_LIGHTGRID, bsp->numGridPoints * 8, 1, 1 );
 
-	bsp->visibilityLength = GetLumpElements( &header, LUMP_VISIBILITY, 1 ) - VIS_HEADER;
-	if ( bsp->visibilityLength > 0 )
-		bsp->visibility = malloc( bsp->visibilityLength );
-	else
+	bsp->visibilityLength = BSP_GetLumpElements( header.lumps, LUMP_VISIBILITY, 1 ) - VIS_HEADER;
+	if ( bsp->visibilityLength > 0 ) {
+		if ( bsp->fileData ) {
+			bsp->visibility = (byte *)BSP_GetLump( header.lumps, data, LUMP_VISIBILITY ) + VIS_HEADER;
+		} else {
+			bsp->visibility = malloc( bsp->visibilityLength );
+		}
+	} else {
 		bsp->visibilityLength = 0;
+	}
+
+	TRACE_END( "count lumps" );
 
 	//
 	// copy and swap and convert data
 	//
-	CopyLump( &header, LUMP_ENTITIES, data, (void *) bsp->entityString, sizeof ( *bsp->entityString ), qfalse ); /* NO SWAP */
-
-	{
-		realDshader_t *in = GetLump( &header, data, LUMP_SHADERS );
-		dshader_t *out = bsp->shaders;
-
-		for ( i = 0; i < bsp->numShaders; i++, in++, out++ ) {
-			Q_strncpyz( out->shader, in->shader, sizeof ( out->shader ) );
-			out->contentFlags = LittleLong( in->contentFlags );
-			out->surfaceFlags = LittleLong( in->surfaceFlags );
-		}
-	}
-
-	{
-		realDplane_t *in = GetLump( &header, data, LUMP_PLANES );
-		dplane_t *out = bsp->planes;
-
-		for ( i = 0; i < bsp->numPlanes; i++, in++, out++) {
-			for (j=0 ; j<3 ; j++) {
-				out->normal[j] = LittleFloat (in->normal[j]);
-			}
-
-			out->dist = LittleFloat (in->dist);
-		}
-	}
-
-	{
-		realDnode_t *in = GetLump( &header, data, LUMP_NODES );
-		dnode_t *out = bsp->nodes;
+	TRACE_BEGIN( "decode lumps" );
+	BSP_CopyLump( header.lumps, LUMP_ENTITIES, data, (void *) bsp->entityString, sizeof ( *bsp->entityString ), qfalse ); /* NO SWAP */
 
-		for ( i = 0; i < bsp->numNodes; i++, in++, out++ ) {
-			out->planeNum = LittleLong( in->planeNum );
+	BSP_DecodeElements( &shaderSchema, BSP_GetLump( header.lumps, data, LUMP_SHADERS ), bsp->shaders, bsp->numShaders );
 
-			for ( j = 0; j < 2; j++ ) {
-				out->children[j] = LittleLong( in->children[j] );
-			}
+	BSP_DecodeElements( &planeSchema, BSP_GetLump( header.lumps, data, LUMP_PLANES ), bsp->planes, bsp->numPlanes );
 
-			for ( j = 0; j < 3; j++ ) {
-				out->mins[j] = LittleLong( in->mins[j] );
-				out->maxs[j] = LittleLong( in->maxs[j] );
-			}
-		}
-	}
+	BSP_DecodeElements( &nodeSchema, BSP_GetLump( header.lumps, data, LUMP_NODES ), bsp->nodes, bsp->numNodes );
 
-	{
-		realDleaf_t *in = GetLump( &header, data, LUMP_LEAFS );
-		dleaf_t *out = bsp->leafs;
-
-		for ( i = 0; i < bsp->numLeafs; i++, in++, out++ ) {
-			out->cluster = LittleLong (in->cluster);
-			out->area = LittleLong (in->area);
-
-			for ( j = 0; j < 3; j++ ) {
-				out->mins[j] = LittleLong( in->mins[j] );
-				out->maxs[j] = LittleLong( in->maxs[j] );
-			}
-
-			out->firstLeafBrush = LittleLong (in->firstLeafBrush);
-			out->numLeafBrushes = LittleLong (in->numLeafBrushes);
-			out->firstLeafSurface = LittleLong (in->firstLeafSurface);
-			out->numLeafSurfaces = LittleLong (in->numLeafSurfaces);
-		}
-	}
+	BSP_DecodeElements( &leafSchema, BSP_GetLump( header.lumps, data, LUMP_LEAFS ), bsp->leafs, bsp->numLeafs );
 
-	CopyLump( &header, LUMP_LEAFSURFACES, data, (void *) bsp->leafSurfaces, sizeof ( *bsp->leafSurfaces ), qtrue );
-	CopyLump( &header, LUMP_LEAFBRUSHES, data, (void *) bsp->leafBrushes, sizeof ( *bsp->leafBrushes ), qtrue );
+	BSP_CopyLump( header.lumps, LUMP_LEAFSURFACES, data, (void *) bsp->leafSurfaces, sizeof ( *bsp->leafSurfaces ), qtrue );
+	BSP_CopyLump( header.lumps, LUMP_LEAFBRUSHES, data, (void *) bsp->leafBrushes, sizeof ( *bsp->leafBrushes ), qtrue );
 
-	{
-		realDmodel_t *in = GetLump( &header, data, LUMP_MODELS );
-		dmodel_t *out = bsp->submodels;
-
-		for ( i = 0; i < bsp->numSubmodels; i++, in++, out++ ) {
-			for ( j = 0; j < 3; j++ ) {
-				out->mins[j] = LittleFloat( in->mins[j] );
-				out->maxs[j] = LittleFloat( in->maxs[j] );
-			}
-
-			out->firstSurface = LittleLong (in->firstSurface);
-			out->numSurfaces = LittleLong (in->numSurfaces);
-			out->firstBrush = LittleLong (in->firstBrush);
-			out->numBrushes = LittleLong (in->numBrushes);
-		}
-	}
+	BSP_DecodeElements( &modelSchema, BSP_GetLump( header.lumps, data, LUMP_MODELS ), bsp->submodels, bsp->numSubmodels );
 
-	{
-		realDbrush_t *in = GetLump( &header, data, LUMP_BRUSHES );
-		dbrush_t *out = bsp->brushes;
-
-		for ( i = 0; i < bsp->numBrushes; i++, in++, out++ )
-		{
-			out->firstSide = LittleLong (in->firstSide);
-			out->numSides = LittleLong (in->numSides);
-			out->shaderNum = LittleLong (in->shaderNum);
-		}
-	}
+	BSP_DecodeElements( &brushSchema, BSP_GetLump( header.lumps, data, LUMP_BRUSHES ), bsp->brushes, bsp->numBrushes );
 
 	if ( format->version == WARLORD_BSP_VERSION ) {
-		realDbrushside_warlord_t *in = GetLump( &header, data, LUMP_BRUSHSIDES );
-		dbrushside_t *out = bsp->brushSides;
-
-		for ( i = 0; i < bsp->numBrushSides; i++, in++, out++ ) {
-			out->planeNum = LittleLong (in->planeNum);
-			out->shaderNum = LittleLong (in->shaderNum);
-			out->surfaceNum = -1;
-		}
+		BSP_DecodeElements( &warlordBrushSideSchema, BSP_GetLump( header.lumps, data, LUMP_BRUSHSIDES ), bsp->brushSides, bsp->numBrushSides );
 	} else {
-		realDbrushside_t *in = GetLump( &header, data, LUMP_BRUSHSIDES );
-		dbrushside_t *out = bsp->brushSides;
-
-		for ( i = 0; i < bsp->numBrushSides; i++, in++, out++ ) {
-			out->planeNum = LittleLong (in->planeNum);
-			out->shaderNum = LittleLong (in->shaderNum);
-			out->surfaceNum = -1;
-		}
+		BSP_DecodeElements( &brushSideSchema, BSP_GetLump( header.lumps, data, LUMP_BRUSHSIDES ), bsp->brushSides, bsp->numBrushSides );
 	}
 
-	{
-		realDrawVert_t *in = GetLump( &header, data, LUMP_DRAWVERTS );
-		drawVert_t *out = bsp->drawVerts;
-
-		for ( i = 0; i < bsp->numDrawVerts; i++, in++, out++ ) {
-			for ( j = 0 ; j < 3 ; j++ ) {
-				out->xyz[j] = LittleFloat( in->xyz[j] );
-				out->normal[j] = LittleFloat( in->normal[j] );
-			}
-			for ( j = 0 ; j < 2 ; j++ ) {
-				out->st[j] = LittleFloat( in->st[j] );
-				out->lightmap[j] = LittleFloat( in->lightmap[j] );
-			}
-
-			/* NO SWAP */
-			for ( j = 0; j < 4; j++ ) {
-				out->color[j] = in->color[j];
-			}
-		}
+	for ( i = 0; i < bsp->numBrushSides; i++ ) {
+		bsp->brushSides[i].surfaceNum = -1;
 	}
 
-	CopyLump( &header, LUMP_DRAWINDEXES, data, (void *) bsp->drawIndexes, sizeof ( *bsp->drawIndexes ), qtrue );
+	BSP_DecodeElements( &drawVertSchema, BSP_GetLump( header.lumps, data, LUMP_DRAWVERTS ), bsp->drawVerts, bsp->numDrawVerts );
 
-	{
-		realDfog_t *in = GetLump( &header, data, LUMP_FOGS );
-		dfog_t *out = bsp->fogs;
+	BSP_CopyLump( header.lumps, LUMP_DRAWINDEXES, data, (void *) bsp->drawIndexes, sizeof ( *bsp->drawIndexes ), qtrue );
 
-		for ( i = 0; i < bsp->numFogs; i++, in++, out++ ) {
-			Q_strncpyz( out->shader, in->shader, sizeof ( out->shader ) );
-			out->brushNum = LittleLong (in->brushNum);
-			out->visibleSide = LittleLong (in->visibleSide);
-		}
-	}
+	BSP_DecodeElements( &fogSchema, BSP_GetLump( header.lumps, data, LUMP_FOGS ), bsp->fogs, bsp->numFogs );
 
-	{
-		realDsurface_t *in = GetLump( &header, data, LUMP_SURFACES );
-		dsurface_t *out = bsp->surfaces;
-
-		for ( i = 0; i < bsp->numSurfaces; i++, in++, out++ ) {
-			out->shaderNum = LittleLong (in->shaderNum);
-			out->fogNum = LittleLong (in->fogNum);
-			out->surfaceType = LittleLong (in->surfaceType);
-			out->firstVert = LittleLong (in->firstVert);
-			out->numVerts = LittleLong (in->numVerts);
-			out->firstIndex = LittleLong (in->firstIndex);
-			out->numIndexes = LittleLong (in->numIndexes);
-			out->lightmapNum = LittleLong (in->lightmapNum);
-			out->lightmapX = LittleLong (in->lightmapX);
-			out->lightmapY = LittleLong (in->lightmapY);
-			out->lightmapWidth = LittleLong (in->lightmapWidth);
-			out->lightmapHeight = LittleLong (in->lightmapHeight);
-
-			for ( j = 0; j < 3; j++ ) {
-				out->lightmapOrigin[j] = LittleFloat( in->lightmapOrigin[j] );
-				for ( k = 0; k < 3; k++ ) {
-					out->lightmapVecs[j][k] = LittleFloat( in->lightmapVecs[j][k] );
-				}
-			}
-
-			out->patchWidth = LittleLong (in->patchWidth);
-			out->patchHeight = LittleLong (in->patchHeight);
-
-			out->subdivisions = SUBDIVIDE_DISTANCE;
-		}
+	BSP_DecodeElements( &surfaceSchema, BSP_GetLump( header.lumps, data, LUMP_SURFACES ), bsp->surfaces, bsp->numSurfaces );
+
+	for ( i = 0; i < bsp->numSurfaces; i++ ) {
+		bsp->surfaces[i].subdivisions = SUBDIVIDE_DISTANCE;
 	}
 
-	CopyLump( &header, LUMP_LIGHTMAPS, data, (void *) bsp->lightmapData, sizeof ( *bsp->lightmapData ), qfalse ); /* NO SWAP */
-	CopyLump( &header, LUMP_LIGHTGRID, data, (void *) bsp->lightGridData, sizeof ( *bsp->lightGridData ), qfalse ); /* NO SWAP */
+	BSP_CopyLump( header.lumps, LUMP_LIGHTMAPS, data, (void *) bsp->lightmapData, sizeof ( *bsp->lightmapData ), qfalse ); /* NO SWAP */
+	BSP_CopyLump( header.lumps, LUMP_LIGHTGRID, data, (void *) bsp->lightGridData, sizeof ( *bsp->lightGridData ), qfalse ); /* NO SWAP */
 
 	if ( bsp->visibilityLength )
 	{
-		byte *in = GetLump( &header, data, LUMP_VISIBILITY );
+		byte *in = BSP_GetLump( header.lumps, data, LUMP_VISIBILITY );
 
 		bsp->numClusters = LittleLong( ((int *)in)[0] );
 		bsp->clusterBytes = LittleLong( ((int *)in)[1] );
 
-		Com_Memcpy( bsp->visibility, in + VIS_HEADER, bsp->visibilityLength ); /* NO SWAP */
+		if ( bsp->visibility != in + VIS_HEADER ) {
+			Com_Memcpy( bsp->visibility, in + VIS_HEADER, bsp->visibilityLength ); /* NO SWAP */
+		}
 	}
 
+	BSP_ReleaseFileData( bsp );
+
+	TRACE_END( "decode lumps" );
+
 	return bsp;
 }
 
 // convert internal BSP format to BSP for saving to disk
 // ZTM: TODO: convert ET foliage surfaces if Q3 format? how to check if Q3 or RTCW and not ET?
 int BSP_SaveQ3( const bspFormat_t *format, const char *name, const bspFile_t *bsp, void **dataOut ) {
-	int				i, j, k;
+	int				i;
 	dheader_t		header;
 	byte			*data;
 	int				dataLength;
@@ -577,24 +405,24 @@ int BSP_SaveQ3( const bspFormat_t *format, const char *name, const bspFile_t *bs
 
 	dataLength = sizeof( dheader_t );
 
-	AddLump( &header, &dataLength, LUMP_ENTITIES, bsp->entityStringLength + worldspawnExtraLength, 1 );
-	AddLump( &header, &dataLength, LUMP_SHADERS, bsp->numShaders, sizeof ( realDshader_t ) );
-	AddLump( &header, &dataLength, LUMP_PLANES, bsp->numPlanes, sizeof ( realDplane_t ) );
-	AddLump( &header, &dataLength, LUMP_NODES, bsp->numNodes, sizeof ( realDnode_t ) );
-	AddLump( &header, &dataLength, LUMP_LEAFS, bsp->numLeafs, sizeof ( realDleaf_t ) );
-	AddLump( &header, &dataLength, LUMP_LEAFSURFACES, bsp->numLeafSurfaces, sizeof ( int ) );
-	AddLump( &header, &dataLength, LUMP_LEAFBRUSHES, bsp->numLeafBrushes, sizeof ( int ) );
-	AddLump( &header, &dataLength, LUMP_MODELS, bsp->numSubmodels, sizeof ( realDmodel_t ) );
-	AddLump( &header, &dataLength, LUMP_BRUSHES, bsp->numBrushes, sizeof ( realDbrush_t ) );
-	AddLump( &header, &dataLength, LUMP_BRUSHSIDES, bsp->numBrushSides, sizeof ( realDbrushside_t ) );
-	AddLump( &header, &dataLength, LUMP_DRAWVERTS, bsp->numDrawVerts, sizeof ( realDrawVert_t ) );
-	AddLump( &header, &dataLength, LUMP_DRAWINDEXES, bsp->numDrawIndexes, sizeof ( int ) );
-	AddLump( &header, &dataLength, LUMP_FOGS, bsp->numFogs, sizeof ( realDfog_t ) );
-	AddLump( &header, &dataLength, LUMP_SURFACES, bsp->numSurfaces, sizeof ( realDsurface_t ) );
-	AddLump( &header, &dataLength, LUMP_LIGHTMAPS, bsp->numLightmaps, 128 * 128 * 3 );
-	AddLump( &header, &dataLength, LUMP_LIGHTGRID, numGridPoints, 8 );
+	BSP_AddLump( header.lumps, &dataLength, LUMP_ENTITIES, bsp->entityStringLength + worldspawnExtraLength, 1 );
+	BSP_AddLump( header.lumps, &dataLength, LUMP_SHADERS, bsp->numShaders, sizeof ( realDshader_t ) );
+	BSP_AddLump( header.lumps, &dataLength, LUMP_PLANES, bsp->numPlanes, sizeof ( realDplane_t ) );
+	BSP_AddLump( header.lumps, &dataLength, LUMP_NODES, bsp->numNodes, sizeof ( realDnode_t ) );
+	BSP_AddLump( header.lumps, &dataLength, LUMP_LEAFS, bsp->numLeafs, sizeof ( realDleaf_t ) );
+	BSP_AddLump( header.lumps, &dataLength, LUMP_LEAFSURFACES, bsp->numLeafSurfaces, sizeof ( int ) );
+	BSP_AddLump( header.lumps, &dataLength, LUMP_LEAFBRUSHES, bsp->numLeafBrushes, sizeof ( int ) );
+	BSP_AddLump( header.lumps, &dataLength, LUMP_MODELS, bsp->numSubmodels, sizeof ( realDmodel_t ) );
+	BSP_AddLump( header.lumps, &dataLength, LUMP_BRUSHES, bsp->numBrushes, sizeof ( realDbrush_t ) );
+	BSP_AddLump( header.lumps, &dataLength, LUMP_BRUSHSIDES, bsp->numBrushSides, sizeof ( realDbrushside_t ) );
+	BSP_AddLump( header.lumps, &dataLength, LUMP_DRAWVERTS, bsp->numDrawVerts, sizeof ( realDrawVert_t ) );
+	BSP_AddLump( header.lumps, &dataLength, LUMP_DRAWINDEXES, bsp->numDrawIndexes, sizeof ( int ) );
+	BSP_AddLump( header.lumps, &dataLength, LUMP_FOGS, bsp->numFogs, sizeof ( realDfog_t ) );
+	BSP_AddLump( header.lumps, &dataLength, LUMP_SURFACES, bsp->numSurfaces, sizeof ( realDsurface_t ) );
+	BSP_AddLump( header.lumps, &dataLength, LUMP_LIGHTMAPS, bsp->numLightmaps, 128 * 128 * 3 );
+	BSP_AddLump( header.lumps, &dataLength, LUMP_LIGHTGRID, numGridPoints, 8 );
 	if ( bsp->visibilityLength ) {
-		AddLump( &header, &dataLength, LUMP_VISIBILITY, bsp->visibilityLength + VIS_HEADER, 1 );
+		BSP_AddLump( header.lumps, &dataLength, LUMP_VISIBILITY, bsp->visibilityLength + VIS_HEADER, 1 );
 	}
 
 	data = malloc( dataLength );
@@ -602,8 +430,9 @@ int BSP_SaveQ3( const bspFormat_t *format, const char *name, const bspFile_t *bs
 	//
 	// copy and swap and convert data
 	//
+	TRACE_BEGIN( "encode lumps" );
 	if ( worldspawnExtraLength && bsp->entityString[0] == '{' && bsp->entityString[1] == '\n' ) {
-		char *out = GetLump( &header, data, LUMP_ENTITIES );
+		char *out = BSP_GetLump( header.lumps, data, LUMP_ENTITIES );
 
 		*out++ = '{';
 		*out++ = '\n';
@@ -615,200 +444,50 @@ int BSP_SaveQ3( const bspFormat_t *format, const char *name, const bspFile_t *bs
 	} else if ( worldspawnExtraLength ) {
 		Com_Printf( "ERROR: Unable to add light grid size override. Entity data doesn't start with '{<newline>'!\n" );
 	} else {
-		WriteLump( &header, LUMP_ENTITIES, data, (void *) bsp->entityString, sizeof ( *bsp->entityString ), qfalse ); /* NO SWAP */
+		BSP_WriteLump( header.lumps, LUMP_ENTITIES, data, (void *) bsp->entityString, sizeof ( *bsp->entityString ), qfalse ); /* NO SWAP */
 	}
 
-	{
-		realDshader_t *out = GetLump( &header, data, LUMP_SHADERS );
-		dshader_t *in = bsp->shaders;
+	BSP_EncodeElements( &shaderSchema, bsp->shaders, BSP_GetLump( header.lumps, data, LUMP_SHADERS ), bsp->numShaders );
 
-		for ( i = 0; i < bsp->numShaders; i++, in++, out++ ) {
-			Q_strncpyz( out->shader, in->shader, sizeof ( out->shader ) );
-			out->contentFlags = LittleLong( in->contentFlags );
-			out->surfaceFlags = LittleLong( in->surfaceFlags );
-		}
-	}
-
-	{
-		realDplane_t *out = GetLump( &header, data, LUMP_PLANES );
-		dplane_t *in = bsp->planes;
-
-		for ( i = 0; i < bsp->numPlanes; i++, in++, out++) {
-			for (j=0 ; j<3 ; j++) {
-				out->normal[j] = LittleFloat (in->normal[j]);
-			}
-
-			out->dist = LittleFloat (in->dist);
-		}
-	}
-
-	{
-		realDnode_t *out = GetLump( &header, data, LUMP_NODES );
-		dnode_t *in = bsp->nodes;
-
-		for ( i = 0; i < bsp->numNodes; i++, in++, out++ ) {
-			out->planeNum = LittleLong( in->planeNum );
+	BSP_EncodeElements( &planeSchema, bsp->planes, BSP_GetLump( header.lumps, data, LUMP_PLANES ), bsp->numPlanes );
 
-			for ( j = 0; j < 2; j++ ) {
-				out->children[j] = LittleLong( in->children[j] );
-			}
+	BSP_EncodeElements( &nodeSchema, bsp->nodes, BSP_GetLump( header.lumps, data, LUMP_NODES ), bsp->numNodes );
 
-			for ( j = 0; j < 3; j++ ) {
-				out->mins[j] = LittleLong( in->mins[j] );
-				out->maxs[j] = LittleLong( in->maxs[j] );
-			}
-		}
-	}
+	BSP_EncodeElements( &leafSchema, bsp->leafs, BSP_GetLump( header.lumps, data, LUMP_LEAFS ), bsp->numLeafs );
 
-	{
-		realDleaf_t *out = GetLump( &header, data, LUMP_LEAFS );
-		dleaf_t *in = bsp->leafs;
-
-		for ( i = 0; i < bsp->numLeafs; i++, in++, out++ ) {
-			out->cluster = LittleLong (in->cluster);
-			out->area = LittleLong (in->area);
-
-			for ( j = 0; j < 3; j++ ) {
-				out->mins[j] = LittleLong( in->mins[j] );
-				out->maxs[j] = LittleLong( in->maxs[j] );
-			}
-
-			out->firstLeafBrush = LittleLong (in->firstLeafBrush);
-			out->numLeafBrushes = LittleLong (in->numLeafBrushes);
-			out->firstLeafSurface = LittleLong (in->firstLeafSurface);
-			out->numLeafSurfaces = LittleLong (in->numLeafSurfaces);
-		}
-	}
+	BSP_WriteLump( header.lumps, LUMP_LEAFSURFACES, data, (void *) bsp->leafSurfaces, sizeof ( *bsp->leafSurfaces ), qtrue );
+	BSP_WriteLump( header.lumps, LUMP_LEAFBRUSHES, data, (void *) bsp->leafBrushes, sizeof ( *bsp->leafBrushes ), qtrue );
 
-	WriteLump( &header, LUMP_LEAFSURFACES, data, (void *) bsp->leafSurfaces, sizeof ( *bsp->leafSurfaces ), qtrue );
-	WriteLump( &header, LUMP_LEAFBRUSHES, data, (void *) bsp->leafBrushes, sizeof ( *bsp->leafBrushes ), qtrue );
+	BSP_EncodeElements( &modelSchema, bsp->submodels, BSP_GetLump( header.lumps, data, LUMP_MODELS ), bsp->numSubmodels );
 
-	{
-		realDmodel_t *out = GetLump( &header, data, LUMP_MODELS );
-		dmodel_t *in = bsp->submodels;
-
-		for ( i = 0; i < bsp->numSubmodels; i++, in++, out++ ) {
-			for ( j = 0; j < 3; j++ ) {
-				out->mins[j] = LittleFloat( in->mins[j] );
-				out->maxs[j] = LittleFloat( in->maxs[j] );
-			}
-
-			out->firstSurface = LittleLong (in->firstSurface);
-			out->numSurfaces = LittleLong (in->numSurfaces);
-			out->firstBrush = LittleLong (in->firstBrush);
-			out->numBrushes = LittleLong (in->numBrushes);
-		}
-	}
+	BSP_EncodeElements( &brushSchema, bsp->brushes, BSP_GetLump( header.lumps, data, LUMP_BRUSHES ), bsp->numBrushes );
 
-	{
-		realDbrush_t *out = GetLump( &header, data, LUMP_BRUSHES );
-		dbrush_t *in = bsp->brushes;
-
-		for ( i = 0; i < bsp->numBrushes; i++, in++, out++ )
-		{
-			out->firstSide = LittleLong (in->firstSide);
-			out->numSides = LittleLong (in->numSides);
-			out->shaderNum = LittleLong (in->shaderNum);
-		}
-	}
+	BSP_EncodeElements( &brushSideSchema, bsp->brushSides, BSP_GetLump( header.lumps, data, LUMP_BRUSHSIDES ), bsp->numBrushSides );
 
-	{
-		realDbrushside_t *out = GetLump( &header, data, LUMP_BRUSHSIDES );
-		dbrushside_t *in = bsp->brushSides;
-
-		for ( i = 0; i < bsp->numBrushSides; i++, in++, out++ ) {
-			out->planeNum = LittleLong (in->planeNum);
-			out->shaderNum = LittleLong (in->shaderNum);
-#if 0 // NOT_SAVED
-			out->surfaceNum = -1;
-#endif
-		}
-	}
+	BSP_EncodeElements( &drawVertSchema, bsp->drawVerts, BSP_GetLump( header.lumps, data, LUMP_DRAWVERTS ), bsp->numDrawVerts );
 
-	{
-		realDrawVert_t *out = GetLump( &header, data, LUMP_DRAWVERTS );
-		drawVert_t *in = bsp->drawVerts;
-
-		for ( i = 0; i < bsp->numDrawVerts; i++, in++, out++ ) {
-			for ( j = 0 ; j < 3 ; j++ ) {
-				out->xyz[j] = LittleFloat( in->xyz[j] );
-				out->normal[j] = LittleFloat( in->normal[j] );
-			}
-			for ( j = 0 ; j < 2 ; j++ ) {
-				out->st[j] = LittleFloat( in->st[j] );
-				out->lightmap[j] = LittleFloat( in->lightmap[j] );
-			}
-
-			/* NO SWAP */
-			for ( j = 0; j < 4; j++ ) {
-				out->color[j] = in->color[j];
-			}
-		}
-	}
+	BSP_WriteLump( header.lumps, LUMP_DRAWINDEXES, data, (void *) bsp->drawIndexes, sizeof ( *bsp->drawIndexes ), qtrue );
 
-	WriteLump( &header, LUMP_DRAWINDEXES, data, (void *) bsp->drawIndexes, sizeof ( *bsp->drawIndexes ), qtrue );
+	BSP_EncodeElements( &fogSchema, bsp->fogs, BSP_GetLump( header.lumps, data, LUMP_FOGS ), bsp->numFogs );
 
-	{
-		realDfog_t *out = GetLump( &header, data, LUMP_FOGS );
-		dfog_t *in = bsp->fogs;
+	BSP_EncodeElements( &surfaceSchema, bsp->surfaces, BSP_GetLump( header.lumps, data, LUMP_SURFACES ), bsp->numSurfaces );
 
-		for ( i = 0; i < bsp->numFogs; i++, in++, out++ ) {
-			Q_strncpyz( out->shader, in->shader, sizeof ( out->shader ) );
-			out->brushNum = LittleLong (in->brushNum);
-			out->visibleSide = LittleLong (in->visibleSide);
-		}
-	}
-
-	{
-		realDsurface_t *out = GetLump( &header, data, LUMP_SURFACES );
-		dsurface_t *in = bsp->surfaces;
-
-		for ( i = 0; i < bsp->numSurfaces; i++, in++, out++ ) {
-			out->shaderNum = LittleLong (in->shaderNum);
-			out->fogNum = LittleLong (in->fogNum);
-			out->surfaceType = LittleLong (in->surfaceType);
-			out->firstVert = LittleLong (in->firstVert);
-			out->numVerts = LittleLong (in->numVerts);
-			out->firstIndex = LittleLong (in->firstIndex);
-			out->numIndexes = LittleLong (in->numIndexes);
-			out->lightmapNum = LittleLong (in->lightmapNum);
-			out->lightmapX = LittleLong (in->lightmapX);
-			out->lightmapY = LittleLong (in->lightmapY);
-			out->lightmapWidth = LittleLong (in->lightmapWidth);
-			out->lightmapHeight = LittleLong (in->lightmapHeight);
-
-			for ( j = 0; j < 3; j++ ) {
-				out->lightmapOrigin[j] = LittleFloat( in->lightmapOrigin[j] );
-				for ( k = 0; k < 3; k++ ) {
-					out->lightmapVecs[j][k] = LittleFloat( in->lightmapVecs[j][k] );
-				}
-			}
-
-			out->patchWidth = LittleLong (in->patchWidth);
-			out->patchHeight = LittleLong (in->patchHeight);
-
-#if 0 // NOT_SAVED
-			out->subdivisions = SUBDIVIDE_DISTANCE;
-#endif
-		}
-	}
-
-	WriteLump( &header, LUMP_LIGHTMAPS, data, (void *) bsp->lightmapData, sizeof ( *bsp->lightmapData ), qfalse ); /* NO SWAP */
+	BSP_WriteLump( header.lumps, LUMP_LIGHTMAPS, data, (void *) bsp->lightmapData, sizeof ( *bsp->lightmapData ), qfalse ); /* NO SWAP */
 
 	if ( bsp->numGridArrayPoints ) {
-		byte *out = GetLump( &header, data, LUMP_LIGHTGRID );
+		byte *out = BSP_GetLump( header.lumps, data, LUMP_LIGHTGRID );
 		unsigned short *in = bsp->lightGridArray;
 
 		for ( i = 0; i < bsp->numGridArrayPoints; i++, in++, out += 8 ) {
 			Com_Memcpy( out, (byte*)&bsp->lightGridData[(*in) * 8], 8 ); /* NO SWAP */
 		}
 	} else {
-		WriteLump( &header, LUMP_LIGHTGRID, data, (void *) bsp->lightGridData, sizeof ( *bsp->lightGridData ), qfalse ); /* NO SWAP */
+		BSP_WriteLump( header.lumps, LUMP_LIGHTGRID, data, (void *) bsp->lightGridData, sizeof ( *bsp->lightGridData ), qfalse ); /* NO SWAP */
 	}
 
 	if ( bsp->visibilityLength )
 	{
-		byte *out = GetLump( &header, data, LUMP_VISIBILITY );
+		byte *out = BSP_GetLump( header.lumps, data, LUMP_VISIBILITY );
 
 		((int *)out)[0] = LittleLong( bsp->numClusters );
 		((int *)out)[1] = LittleLong( bsp->clusterBytes );
@@ -818,21 +497,139 @@ int BSP_SaveQ3( const bspFormat_t *format, const char *name, const bspFile_t *bs
 
 	BSP_SwapBlock( (int *)data, (int *)&header, sizeof ( dheader_t ) );
 
+	TRACE_END( "encode lumps" );
+
 	*dataOut = data;
 	return dataLength;
 }
 
 
+// rewrite shader and/or entity lumps of an existing BSP of the same format
+qboolean BSP_PatchQ3( const bspFormat_t *format, const char *name, const bspFile_t *bsp, int lumpMask ) {
+	int				i;
+	dheader_t		header;
+	bspLumpPatch_t	patches[2];
+	int				numPatches;
+	realDshader_t	*shaders;
+	qboolean		success;
+	int				fd;
+
+	if ( lumpMask & ~( BSPLUMP_BIT( BSPLUMP_ENTITIES ) | BSPLUMP_BIT( BSPLUMP_SHADERS ) ) ) {
+		Com_Printf( "ERROR: Only entities and shaders can be updated in place.\n" );
+		return qfalse;
+	}
+
+	fd = FS_Open( name, qfalse );
+	if ( fd == -1 ) {
+		return qfalse;
+	}
+
+	if ( FS_Pread( fd, &header, sizeof ( header ), 0 ) != sizeof ( header ) ) {
+		FS_Close( fd );
+		return qfalse;
+	}
+
+	FS_Close( fd );
+
+	BSP_SwapBlock( (int *) &header, (int *) &header, sizeof ( dheader_t ) );
+
+	if ( header.ident != format->ident || header.version != format->version ) {
+		Com_Printf( "ERROR: '%s' is not a %s BSP.\n", name, format->gameName );
+		return qfalse;
+	}
+
+	numPatches = 0;
+	shaders = NULL;
+
+	if ( lumpMask & BSPLUMP_BIT( BSPLUMP_ENTITIES ) ) {
+		patches[numPatches].lump = LUMP_ENTITIES;
+		patches[numPatches].data = bsp->entityString;
+		patches[numPatches].length = bsp->entityStringLength;
+		numPatches++;
+	}
+
+	if ( lumpMask & BSPLUMP_BIT( BSPLUMP_SHADERS ) ) {
+		realDshader_t *out;
+		dshader_t *in = bsp->shaders;
+
+		shaders = out = malloc( bsp->numShaders * sizeof ( realDshader_t ) );
+		Com_Memset( shaders, 0, bsp->numShaders * sizeof ( realDshader_t ) );
+
+		for ( i = 0; i < bsp->numShaders; i++, in++, out++ ) {
+			Q_strncpyz( out->shader, in->shader, sizeof ( out->shader ) );
+			out->contentFlags = LittleLong( in->contentFlags );
+			out->surfaceFlags = LittleLong( in->surfaceFlags );
+		}
+
+		patches[numPatches].lump = LUMP_SHADERS;
+		patches[numPatches].data = shaders;
+		patches[numPatches].length = bsp->numShaders * sizeof ( realDshader_t );
+		numPatches++;
+	}
+
+	success = BSP_PatchLumps( name, offsetof( dheader_t, lumps ), HEADER_LUMPS, patches, numPatches );
+
+	free( shaders );
+	return success;
+}
+
+
 /****************************************************
 */
 
+static const bspLumpDef_t q3LumpDefs[BSPLUMP_MAX] = {
+	{ LUMP_ENTITIES, 1 },
+	{ LUMP_SHADERS, sizeof ( realDshader_t ) },
+	{ LUMP_PLANES, sizeof ( realDplane_t ) },
+	{ LUMP_NODES, sizeof ( realDnode_t ) },
+	{ LUMP_LEAFS, sizeof ( realDleaf_t ) },
+	{ LUMP_LEAFSURFACES, sizeof ( int ) },
+	{ LUMP_LEAFBRUSHES, sizeof ( int ) },
+	{ LUMP_MODELS, sizeof ( realDmodel_t ) },
+	{ LUMP_BRUSHES, sizeof ( realDbrush_t ) },
+	{ LUMP_BRUSHSIDES, sizeof ( realDbrushside_t ) },
+	{ LUMP_DRAWVERTS, sizeof ( realDrawVert_t ) },
+	{ LUMP_DRAWINDEXES, sizeof ( int ) },
+	{ LUMP_FOGS, sizeof ( realDfog_t ) },
+	{ LUMP_SURFACES, sizeof ( realDsurface_t ) },
+	{ LUMP_LIGHTMAPS, 128 * 128 * 3 },
+	{ LUMP_LIGHTGRID, 8 },
+	{ LUMP_VISIBILITY, 1 },
+	{ -1, 0 },	// no lightarray lump
+};
+
+static const bspLumpDef_t warlordLumpDefs[BSPLUMP_MAX] = {
+	{ LUMP_ENTITIES, 1 },
+	{ LUMP_SHADERS, sizeof ( realDshader_t ) },
+	{ LUMP_PLANES, sizeof ( realDplane_t ) },
+	{ LUMP_NODES, sizeof ( realDnode_t ) },
+	{ LUMP_LEAFS, sizeof ( realDleaf_t ) },
+	{ LUMP_LEAFSURFACES, sizeof ( int ) },
+	{ LUMP_LEAFBRUSHES, sizeof ( int ) },
+	{ LUMP_MODELS, sizeof ( realDmodel_t ) },
+	{ LUMP_BRUSHES, sizeof ( realDbrush_t ) },
+	{ LUMP_BRUSHSIDES, sizeof ( realDbrushside_warlord_t ) },
+	{ LUMP_DRAWVERTS, sizeof ( realDrawVert_t ) },
+	{ LUMP_DRAWINDEXES, sizeof ( int ) },
+	{ LUMP_FOGS, sizeof ( realDfog_t ) },
+	{ LUMP_SURFACES, sizeof ( realDsurface_t ) },
+	{ LUMP_LIGHTMAPS, 128 * 128 * 3 },
+	{ LUMP_LIGHTGRID, 8 },
+	{ LUMP_VISIBILITY, 1 },
+	{ -1, 0 },	// no lightarray lump
+};
+
 // Q3, Elite Force, and other games
 bspFormat_t quake3BspFormat = {
 	"Quake3",
 	BSP_IDENT,
 	Q3_BSP_VERSION,
+	offsetof( dheader_t, lumps ),
+	HEADER_LUMPS,
+	q3LumpDefs,
 	BSP_LoadQ3,
 	BSP_SaveQ3,
+	BSP_PatchQ3,
 };
 
 // RTCW, ET, QuakeLive
@@ -840,8 +637,12 @@ bspFormat_t wolfBspFormat = {
 	"RTCW/ET",
 	BSP_IDENT,
 	WOLF_BSP_VERSION,
+	offsetof( dheader_t, lumps ),
+	HEADER_LUMPS,
+	q3LumpDefs,
 	BSP_LoadQ3,
 	BSP_SaveQ3,
+	BSP_PatchQ3,
 };
 
 // Dark Salvation
@@ -849,8 +650,12 @@ bspFormat_t darksBspFormat = {
 	"DarkSalvation",
 	BSP_IDENT,
 	DARKS_BSP_VERSION,
+	offsetof( dheader_t, lumps ),
+	HEADER_LUMPS,
+	q3LumpDefs,
 	BSP_LoadQ3,
 	BSP_SaveQ3,
+	BSP_PatchQ3,
 };
 
 // Iron Grip: Warlord
@@ -859,6 +664,9 @@ bspFormat_t warlordBspFormat = {
 	"IronGripWarlord",
 	BSP_IDENT,
 	WARLORD_BSP_VERSION,
+	offsetof( dheader_t, lumps ),
+	HEADER_LUMPS,
+	warlordLumpDefs,
 	BSP_LoadQ3,
 	NULL,
 };
@@ -31,7 +31,7 @@ Suite 120, Rockville, Maryland 20850 USA.
 
 // Left unfinished Feb 11 2015
 // Got rendering working on May 12, 2020 on the first day after resuming working on it.
-// TODO: De-duplicate bsp->shaders. I made a separate one for each brush, brushside, and surface...
+// NOTE: A separate shader is made for each brush, brushside, and surface and then duplicates are merged.
 // TODO: Fix cg_drawShaderInfo 1? Shouldn't it work since I set brushSide surfaceNum? Ah, it wants the same shaderNum for brushSide and surface...
 // FIXME: Portal rendering doesn't work. No idea.
 
@@ -46,10 +46,6 @@ Suite 120, Rockville, Maryland 20850 USA.
 
 #define BSP_VERSION			44
 
-typedef struct {
-	int		fileofs, filelen;
-} lump_t;
-
 #define	LUMP_ENTITIES		0
 #define	LUMP_PLANES			1
 #define	LUMP_NODES			2
@@ -180,63 +176,7 @@ typedef struct {
 /****************************************************
 */
 
-static int GetLumpElements( dheader_t *header, int lump, int size ) {
-#ifdef BSP_DEBUG
-	int i;
-
-	if ( 0 && size > 1 && ( lump < 0 || ( header->lumps[ lump ].filelen % size ) ) ) {
-		if ( lump < 0 )
-			Com_Printf( "Logical lump %d (element size %d) matches physical lumps...\n", lump, size );
-		else
-			Com_Printf( "Logical lump %d (element size %d) size %d matches physical lumps...\n", lump, size, header->lumps[ lump ].filelen );
-
-		for ( i = 0; i < HEADER_LUMPS; i++ ) {
-			if ( ( header->lumps[ i ].filelen % size ) == 0 ) {
-				Com_Printf( "   lump %d, size %d\n", i, header->lumps[ i ].filelen );
-			}
-		}
-	}
-
-	if ( lump < 0 )
-		return 0;
-#endif
-
-	/* check for odd size */
-	if ( header->lumps[ lump ].filelen % size ) {
-		Com_Printf( "GetLumpElements: odd lump size (%d) in lump %d\n", header->lumps[ lump ].filelen, lump );
-		return 0;
-	}
-
-#ifdef BSP_DEBUG
-	Com_Printf( "GetLumpElements: lump %d has %d elements\n", lump, header->lumps[ lump ].filelen / size );
-#endif
-
-	/* return element count */
-	return header->lumps[ lump ].filelen / size;
-}
-
-static void CopyLump( dheader_t *header, int lump, const void *src, void *dest, int size, qboolean swap ) {
-	int length;
-
-	length = GetLumpElements( header, lump, size ) * size;
-
-	/* handle erroneous cases */
-	if ( length <= 0 ) {
-		return;
-	}
-
-	if ( swap ) {
-		BSP_SwapBlock( dest, (int *)((byte*) src + header->lumps[lump].fileofs), length );
-	} else {
-		Com_Memcpy( dest, (byte*) src + header->lumps[lump].fileofs, length );
-	}
-}
-
-static void *GetLump( dheader_t *header, const void *src, int lump ) {
-	return (void*)( (byte*) src + header->lumps[ lump ].fileofs );
-}
-
-bspFile_t *BSP_LoadQ3Test103( const bspFormat_t *format, const char *name, const void *data, int length ) {
+bspFile_t *BSP_LoadQ3Test103( const bspFormat_t *format, const char *name, const void *data, int length, qboolean keepData ) {
 	int				i, j, k;
 	dheader_t		header;
 	bspFile_t		*bsp;
@@ -250,6 +190,12 @@ bspFile_t *BSP_LoadQ3Test103( const bspFormat_t *format, const char *name, const
 	bsp = malloc( sizeof ( bspFile_t ) );
 	Com_Memset( bsp, 0, sizeof ( bspFile_t ) );
 
+	// lumps that are not larger in memory are decoded in place in data, see BSP_LumpArray
+	if ( keepData ) {
+		bsp->fileData = (void *)data;
+		bsp->fileLength = length;
+	}
+
 	// ...
 	bsp->checksum = LittleLong (Com_BlockChecksum (data, length));
 	bsp->defaultLightGridSize[0] = LIGHTING_GRIDSIZE_X;
@@ -260,78 +206,90 @@ bspFile_t *BSP_LoadQ3Test103( const bspFormat_t *format, const char *name, const
 	//
 	// count and alloc
 	//
-	bsp->entityStringLength = GetLumpElements( &header, LUMP_ENTITIES, 1 );
-	bsp->entityString = malloc( bsp->entityStringLength );
+	TRACE_BEGIN( "count lumps" );
+	bsp->entityStringLength = BSP_GetLumpElements( header.lumps, LUMP_ENTITIES, 1 );
+	bsp->entityString = BSP_LumpArray( bsp, header.lumps, LUMP_ENTITIES, bsp->entityStringLength, 1, 1 );
 
 	bsp->numShaders = 0;
 	bsp->shaders = NULL;
 
-	bsp->numPlanes = GetLumpElements( &header, LUMP_PLANES, sizeof ( realDplane_t ) );
-	bsp->planes = malloc( bsp->numPlanes * sizeof ( *bsp->planes ) );
+	bsp->numPlanes = BSP_GetLumpElements( header.lumps, LUMP_PLANES, sizeof ( realDplane_t ) );
+	bsp->planes = BSP_LumpArray( bsp, header.lumps, LUMP_PLANES, bsp->numPlanes, sizeof ( *bsp->planes ), sizeof ( realDplane_t ) );
 
-	bsp->numNodes = GetLumpElements( &header, LUMP_NODES, sizeof ( realDnode_t ) );
-	bsp->nodes = malloc( bsp->numNodes * sizeof ( *bsp->nodes ) );
+	bsp->numNodes = BSP_GetLumpElements( header.lumps, LUMP_NODES, sizeof ( realDnode_t ) );
+	bsp->nodes = BSP_LumpArray( bsp, header.lumps, LUMP_NODES, bsp->numNodes, sizeof ( *bsp->nodes ), sizeof ( realDnode_t ) );
 
-	bsp->numLeafs = GetLumpElements( &header, LUMP_LEAFS, sizeof ( realDleaf_t ) );
-	bsp->leafs = malloc( bsp->numLeafs * sizeof ( *bsp->leafs ) );
+	bsp->numLeafs = BSP_GetLumpElements( header.lumps, LUMP_LEAFS, sizeof ( realDleaf_t ) );
+	bsp->leafs = BSP_LumpArray( bsp, header.lumps, LUMP_LEAFS, bsp->numLeafs, sizeof ( *bsp->leafs ), sizeof ( realDleaf_t ) );
 
-	bsp->numLeafSurfaces = GetLumpElements( &header, LUMP_LEAFSURFACES, sizeof ( int ) );
-	bsp->leafSurfaces = malloc( bsp->numLeafSurfaces * sizeof ( *bsp->leafSurfaces ) );
+	bsp->numLeafSurfaces = BSP_GetLumpElements( header.lumps, LUMP_LEAFSURFACES, sizeof ( int ) );
+	bsp->leafSurfaces = BSP_LumpArray( bsp, header.lumps, LUMP_LEAFSURFACES, bsp->numLeafSurfaces, sizeof ( *bsp->leafSurfaces ), sizeof ( int ) );
 
-	bsp->numLeafBrushes = GetLumpElements( &header, LUMP_LEAFBRUSHES, sizeof ( int ) );
-	bsp->leafBrushes = malloc( bsp->numLeafBrushes * sizeof ( *bsp->leafBrushes ) );
+	bsp->numLeafBrushes = BSP_GetLumpElements( header.lumps, LUMP_LEAFBRUSHES, sizeof ( int ) );
+	bsp->leafBrushes = BSP_LumpArray( bsp, header.lumps, LUMP_LEAFBRUSHES, bsp->numLeafBrushes, sizeof ( *bsp->leafBrushes ), sizeof ( int ) );
 
-	bsp->numSubmodels = GetLumpElements( &header, LUMP_MODELS, sizeof ( realDmodel_t ) );
-	bsp->submodels = malloc( bsp->numSubmodels * sizeof ( *bsp->submodels ) );
+	bsp->numSubmodels = BSP_GetLumpElements( header.lumps, LUMP_MODELS, sizeof ( realDmodel_t ) );
+	bsp->submodels = BSP_LumpArray( bsp, header.lumps, LUMP_MODELS, bsp->numSubmodels, sizeof ( *bsp->submodels ), sizeof ( realDmodel_t ) );
 
-	bsp->numBrushes = GetLumpElements( &header, LUMP_BRUSHES, sizeof ( realDbrush_t ) );
-	bsp->brushes = malloc( bsp->numBrushes * sizeof ( *bsp->brushes ) );
+	bsp->numBrushes = BSP_GetLumpElements( header.lumps, LUMP_BRUSHES, sizeof ( realDbrush_t ) );
+	bsp->brushes = BSP_LumpArray( bsp, header.lumps, LUMP_BRUSHES, bsp->numBrushes, sizeof ( *bsp->brushes ), sizeof ( realDbrush_t ) );
 
-	bsp->numBrushSides = GetLumpElements( &header, LUMP_BRUSHSIDES, sizeof ( realDbrushside_t ) );
-	bsp->brushSides = malloc( bsp->numBrushSides * sizeof ( *bsp->brushSides ) );
+	bsp->numBrushSides = BSP_GetLumpElements( header.lumps, LUMP_BRUSHSIDES, sizeof ( realDbrushside_t ) );
+	bsp->brushSides = BSP_LumpArray( bsp, header.lumps, LUMP_BRUSHSIDES, bsp->numBrushSides, sizeof ( *bsp->brushSides ), sizeof ( realDbrushside_t ) );
 
-	bsp->numDrawVerts = GetLumpElements( &header, LUMP_DRAWVERTS, sizeof ( realDrawVert_t ) );
-	bsp->drawVerts = malloc( bsp->numDrawVerts * sizeof ( *bsp->drawVerts ) );
+	bsp->numDrawVerts = BSP_GetLumpElements( header.lumps, LUMP_DRAWVERTS, sizeof ( realDrawVert_t ) );
+	bsp->drawVerts = BSP_LumpArray( bsp, header.lumps, LUMP_DRAWVERTS, bsp->numDrawVerts, sizeof ( *bsp->drawVerts ), sizeof ( realDrawVert_t ) );
 
 	// These are increased / realloced to handle generated triangle fans for MST_PLANAR.
-	bsp->numDrawIndexes = GetLumpElements( &header, LUMP_DRAWINDEXES, sizeof ( int ) );
+	bsp->numDrawIndexes = BSP_GetLumpElements( header.lumps, LUMP_DRAWINDEXES, sizeof ( int ) );
 	bsp->drawIndexes = malloc( bsp->numDrawIndexes * sizeof ( *bsp->drawIndexes ) );
 
-	bsp->numFogs = GetLumpElements( &header, LUMP_FOGS, sizeof ( realDfog_t ) );
-	bsp->fogs = malloc( bsp->numFogs * sizeof ( *bsp->fogs ) );
+	bsp->numFogs = BSP_GetLumpElements( header.lumps, LUMP_FOGS, sizeof ( realDfog_t ) );
+	bsp->fogs = BSP_LumpArray( bsp, header.lumps, LUMP_FOGS, bsp->numFogs, sizeof ( *bsp->fogs ), sizeof ( realDfog_t ) );
 
-	bsp->numSurfaces = GetLumpElements( &header, LUMP_SURFACES, sizeof ( realDsurface_t ) );
-	bsp->surfaces = malloc( bsp->numSurfaces * sizeof ( *bsp->surfaces ) );
+	bsp->numSurfaces = BSP_GetLumpElements( header.lumps, LUMP_SURFACES, sizeof ( realDsurface_t ) );
+	bsp->surfaces = BSP_LumpArray( bsp, header.lumps, LUMP_SURFACES, bsp->numSurfaces, sizeof ( *bsp->surfaces ), sizeof ( realDsurface_t ) );
 
-	bsp->numLightmaps = GetLumpElements( &header, LUMP_LIGHTMAPS, 128 * 128 * 3 );
-	bsp->lightmapData = malloc( bsp->numLightmaps * 128 * 128 * 3 );
+	bsp->numLightmaps = BSP_GetLumpElements( header.lumps, LUMP_LIGHTMAPS, 128 * 128 * 3 );
+	bsp->lightmapData = BSP_LumpArray( bsp, header.lumps, LUMP_LIGHTMAPS, bsp->numLightmaps * 128 * 128 * 3, 1, 1 );
 
 	bsp->numGridPoints = 0;
 	bsp->lightGridData = NULL;
 
-	bsp->visibilityLength = GetLumpElements( &header, LUMP_VISIBILITY, 1 ) - VIS_HEADER;
-	if ( bsp->visibilityLength > 0 )
-		bsp->visibility = malloc( bsp->visibilityLength );
-	else
+	bsp->visibilityLength = BSP_GetLumpElements( header.lumps, LUMP_VISIBILITY, 1 ) - VIS_HEADER;
+	if ( bsp->visibilityLength > 0 ) {
+		if ( bsp->fileData ) {
+			bsp->visibility = (byte *)BSP_GetLump( header.lumps, data, LUMP_VISIBILITY ) + VIS_HEADER;
+		} else {
+			bsp->visibility = malloc( bsp->visibilityLength );
+		}
+	} else {
 		bsp->visibilityLength = 0;
+	}
+
+	TRACE_END( "count lumps" );
 
 	//
 	// copy and swap and convert data
 	//
-	CopyLump( &header, LUMP_ENTITIES, data, (void *) bsp->entityString, sizeof ( *bsp->entityString ), qfalse ); /* NO SWAP */
+	TRACE_BEGIN( "decode lumps" );
+	BSP_CopyLump( header.lumps, LUMP_ENTITIES, data, (void *) bsp->entityString, sizeof ( *bsp->entityString ), qfalse ); /* NO SWAP */
 
 	{
-		// ZTM: TODO: Ideally duplicates would be merged... but then it needs to be dynamically increased.
+		// Duplicates are merged by BSP_DedupeShaders after loading.
 		bsp->numShaders = bsp->numBrushes + bsp->numBrushSides + bsp->numSurfaces;
 		bsp->shaders = malloc( bsp->numShaders * sizeof ( *bsp->shaders ) );
 		Com_Memset( bsp->shaders, 0, bsp->numShaders * sizeof ( *bsp->shaders ) );
 	}
 
 	{
-		realDplane_t *in = GetLump( &header, data, LUMP_PLANES );
+		realDplane_t *lump = BSP_GetLump( header.lumps, data, LUMP_PLANES );
+		realDplane_t element, *in = &element;
 		dplane_t *out = bsp->planes;
 
-		for ( i = 0; i < bsp->numPlanes; i++, in++, out++) {
+		// out may be the lump, copy the element before decoding it
+		for ( i = 0; i < bsp->numPlanes; i++, out++ ) {
+			Com_Memcpy( &element, &lump[i], sizeof ( element ) );
 			for (j=0 ; j<3 ; j++) {
 				out->normal[j] = LittleFloat (in->normal[j]);
 			}
@@ -348,10 +306,13 @@ bspFile_t *BSP_LoadQ3Test103( const bspFormat_t *format, const char *name, const
 	}
 
 	{
-		realDnode_t *in = GetLump( &header, data, LUMP_NODES );
+		realDnode_t *lump = BSP_GetLump( header.lumps, data, LUMP_NODES );
+		realDnode_t element, *in = &element;
 		dnode_t *out = bsp->nodes;
 
-		for ( i = 0; i < bsp->numNodes; i++, in++, out++ ) {
+		// out may be the lump, copy the element before decoding it
+		for ( i = 0; i < bsp->numNodes; i++, out++ ) {
+			Com_Memcpy( &element, &lump[i], sizeof ( element ) );
 			out->planeNum = LittleLong( in->planeNum );
 
 			for ( j = 0; j < 2; j++ ) {
@@ -373,14 +334,15 @@ bspFile_t *BSP_LoadQ3Test103( const bspFormat_t *format, const char *name, const
 		}
 	}
 
-	CopyLump( &header, LUMP_LEAFSURFACES, data, (void *) bsp->leafSurfaces, sizeof ( *bsp->leafSurfaces ), qtrue );
-	CopyLump( &header, LUMP_LEAFBRUSHES, data, (void *) bsp->leafBrushes, sizeof ( *bsp->leafBrushes ), qtrue );
+	BSP_CopyLump( header.lumps, LUMP_LEAFSURFACES, data, (void *) bsp->leafSurfaces, sizeof ( *bsp->leafSurfaces ), qtrue );
+	BSP_CopyLump( header.lumps, LUMP_LEAFBRUSHES, data, (void *) bsp->leafBrushes, sizeof ( *bsp->leafBrushes ), qtrue );
 
 #ifdef BSP_DEBUG
 	int maxUsedCluster = 0;
 #endif
 	{
-		realDleaf_t *in = GetLump( &header, data, LUMP_LEAFS );
+		realDleaf_t *lump = BSP_GetLump( header.lumps, data, LUMP_LEAFS );
+		realDleaf_t element, *in = &element;
 		dleaf_t *out = bsp->leafs;
 #ifdef BSP_DEBUG
 		int maxUsedLeafBrush = 0, maxUsedLeafSurface = 0;
@@ -388,7 +350,9 @@ bspFile_t *BSP_LoadQ3Test103( const bspFormat_t *format, const char *name, const
 		Com_Printf("DEBUG: Num leafs %d, leaf brushes %d, leaf surfaces %d\n", bsp->numLeafs, bsp->numLeafBrushes, bsp->numLeafSurfaces );
 #endif
 
-		for ( i = 0; i < bsp->numLeafs; i++, in++, out++ ) {
+		// out may be the lump, copy the element before decoding it
+		for ( i = 0; i < bsp->numLeafs; i++, out++ ) {
+			Com_Memcpy( &element, &lump[i], sizeof ( element ) );
 			out->cluster = LittleLong (in->cluster);
 			out->area = LittleLong (in->area);
 
@@ -439,14 +403,17 @@ bspFile_t *BSP_LoadQ3Test103( const bspFormat_t *format, const char *name, const
 	}
 
 	{
-		realDmodel_t *in = GetLump( &header, data, LUMP_MODELS );
+		realDmodel_t *lump = BSP_GetLump( header.lumps, data, LUMP_MODELS );
+		realDmodel_t element, *in = &element;
 		dmodel_t *out = bsp->submodels;
 #ifdef BSP_DEBUG
 		int maxUsedSurface = 0, maxUsedBrush = 0;
 
 		Com_Printf("DEBUG: Num BSP models %d\n", bsp->numSubmodels );
 #endif
-		for ( i = 0; i < bsp->numSubmodels; i++, in++, out++ ) {
+		// out may be the lump, copy the element before decoding it
+		for ( i = 0; i < bsp->numSubmodels; i++, out++ ) {
+			Com_Memcpy( &element, &lump[i], sizeof ( element ) );
 			for ( j = 0; j < 3; j++ ) {
 				out->mins[j] = LittleFloat( in->mins[j] );
 				out->maxs[j] = LittleFloat( in->maxs[j] );
@@ -562,7 +529,8 @@ bspFile_t *BSP_LoadQ3Test103( const bspFormat_t *format, const char *name, const
 	}
 
 	{
-		realDbrush_t *in = GetLump( &header, data, LUMP_BRUSHES );
+		realDbrush_t *lump = BSP_GetLump( header.lumps, data, LUMP_BRUSHES );
+		realDbrush_t element, *in = &element;
 		dbrush_t *out = bsp->brushes;
 #ifdef BSP_DEBUG
 		int maxUsedSide = 0;
@@ -570,11 +538,13 @@ bspFile_t *BSP_LoadQ3Test103( const bspFormat_t *format, const char *name, const
 		Com_Printf("DEBUG: Num BSP brushes %d\n", bsp->numBrushes );
 #endif
 
-		for ( i = 0; i < bsp->numBrushes; i++, in++, out++ )
+		// out may be the lump, copy the element before decoding it
+		for ( i = 0; i < bsp->numBrushes; i++, out++ )
 		{
+			Com_Memcpy( &element, &lump[i], sizeof ( element ) );
 			out->firstSide = LittleLong (in->firstSide);
 			out->numSides = LittleLong (in->numSides);
-			out->shaderNum = i; // TODO: less shaders please
+			out->shaderNum = i;
 			int contentFlags = LittleLong (in->contentFlags);
 
 			strcpy( bsp->shaders[out->shaderNum].shader, "*default" );
@@ -583,7 +553,7 @@ bspFile_t *BSP_LoadQ3Test103( const bspFormat_t *format, const char *name, const
 
 			// Fill in contents for brush sides
 			for ( j = 0; j < out->numSides; j++ ) {
-				int shaderNum = bsp->numBrushes + out->firstSide + j; // TODO: less shaders please
+				int shaderNum = bsp->numBrushes + out->firstSide + j;
 
 				// TODO: could XOR all side surface flags to brush surfaceFlags? I'm not sure what q3map2 does.
 
@@ -609,7 +579,8 @@ bspFile_t *BSP_LoadQ3Test103( const bspFormat_t *format, const char *name, const
 	}
 
 	{
-		realDbrushside_t *in = GetLump( &header, data, LUMP_BRUSHSIDES );
+		realDbrushside_t *lump = BSP_GetLump( header.lumps, data, LUMP_BRUSHSIDES );
+		realDbrushside_t element, *in = &element;
 		dbrushside_t *out = bsp->brushSides;
 #ifdef BSP_DEBUG
 		int maxUsedPlane = 0;
@@ -617,9 +588,11 @@ bspFile_t *BSP_LoadQ3Test103( const bspFormat_t *format, const char *name, const
 		Com_Printf("DEBUG: Num BSP brush sides %d\n", bsp->numBrushSides );
 #endif
 
-		for ( i = 0; i < bsp->numBrushSides; i++, in++, out++ ) {
+		// out may be the lump, copy the element before decoding it
+		for ( i = 0; i < bsp->numBrushSides; i++, out++ ) {
+			Com_Memcpy( &element, &lump[i], sizeof ( element ) );
 			out->planeNum = LittleLong (in->planeNum);
-			out->shaderNum = bsp->numBrushes + i; // TODO: less shaders please
+			out->shaderNum = bsp->numBrushes + i;
 			out->surfaceNum = -1;
 
 			int surfaceFlags = LittleLong (in->surfaceFlags);
@@ -647,14 +620,17 @@ bspFile_t *BSP_LoadQ3Test103( const bspFormat_t *format, const char *name, const
 	}
 
 	{
-		realDrawVert_t *in = GetLump( &header, data, LUMP_DRAWVERTS );
+		realDrawVert_t *lump = BSP_GetLump( header.lumps, data, LUMP_DRAWVERTS );
+		realDrawVert_t element, *in = &element;
 		drawVert_t *out = bsp->drawVerts;
 
 #ifdef BSP_DEBUG
 		Com_Printf("DEBUG: Num BSP draw verts %d\n", bsp->numDrawVerts );
 #endif
 
-		for ( i = 0; i < bsp->numDrawVerts; i++, in++, out++ ) {
+		// out may be the lump, copy the element before decoding it
+		for ( i = 0; i < bsp->numDrawVerts; i++, out++ ) {
+			Com_Memcpy( &element, &lump[i], sizeof ( element ) );
 			for ( j = 0 ; j < 3 ; j++ ) {
 				out->xyz[j] = LittleFloat( in->xyz[j] );
 				out->normal[j] = LittleFloat( in->normal[j] );
@@ -678,17 +654,20 @@ bspFile_t *BSP_LoadQ3Test103( const bspFormat_t *format, const char *name, const
 		}
 	}
 
-	CopyLump( &header, LUMP_DRAWINDEXES, data, (void *) bsp->drawIndexes, sizeof ( *bsp->drawIndexes ), qtrue );
+	BSP_CopyLump( header.lumps, LUMP_DRAWINDEXES, data, (void *) bsp->drawIndexes, sizeof ( *bsp->drawIndexes ), qtrue );
 
 	{
-		realDfog_t *in = GetLump( &header, data, LUMP_FOGS );
+		realDfog_t *lump = BSP_GetLump( header.lumps, data, LUMP_FOGS );
+		realDfog_t element, *in = &element;
 		dfog_t *out = bsp->fogs;
 
 #ifdef BSP_DEBUG
 		Com_Printf("DEBUG: Num BSP fogs %d\n", bsp->numFogs );
 #endif
 
-		for ( i = 0; i < bsp->numFogs; i++, in++, out++ ) {
+		// out may be the lump, copy the element before decoding it
+		for ( i = 0; i < bsp->numFogs; i++, out++ ) {
+			Com_Memcpy( &element, &lump[i], sizeof ( element ) );
 			Q_strncpyz( out->shader, in->shader, sizeof ( out->shader ) );
 			out->brushNum = LittleLong (in->brushNum);
 			// ZTM: FIXME: Hard code visibleSide to top. I'm unsure if this is the correct handling.
@@ -704,7 +683,8 @@ bspFile_t *BSP_LoadQ3Test103( const bspFormat_t *format, const char *name, const
 	}
 
 	{
-		realDsurface_t *in = GetLump( &header, data, LUMP_SURFACES );
+		realDsurface_t *lump = BSP_GetLump( header.lumps, data, LUMP_SURFACES );
+		realDsurface_t element, *in = &element;
 		dsurface_t *out = bsp->surfaces;
 #ifdef BSP_DEBUG
 		int maxUsedSide = 0;
@@ -712,7 +692,9 @@ bspFile_t *BSP_LoadQ3Test103( const bspFormat_t *format, const char *name, const
 		Com_Printf("DEBUG: Num BSP surfaces %d, num lightmaps %d\n", bsp->numSurfaces, bsp->numLightmaps );
 #endif
 
-		for ( i = 0; i < bsp->numSurfaces; i++, in++, out++ ) {
+		// out may be the lump, copy the element before decoding it
+		for ( i = 0; i < bsp->numSurfaces; i++, out++ ) {
+			Com_Memcpy( &element, &lump[i], sizeof ( element ) );
 			//out->shaderNum = 0;
 			out->fogNum = LittleLong (in->fogNum);
 			//out->surfaceType = MST_BAD;
@@ -787,7 +769,7 @@ bspFile_t *BSP_LoadQ3Test103( const bspFormat_t *format, const char *name, const
 				out->surfaceType = MST_PLANAR;
 			}
 
-			out->shaderNum = bsp->numBrushes + bsp->numBrushSides + i; // TODO: less shaders please
+			out->shaderNum = bsp->numBrushes + bsp->numBrushSides + i;
 			strncpy( bsp->shaders[out->shaderNum].shader, in->shader, 64 );
 
 			if ( brushSideNum >= 0 && brushSideNum <= bsp->numBrushSides ) {
@@ -918,11 +900,11 @@ bspFile_t *BSP_LoadQ3Test103( const bspFormat_t *format, const char *name, const
 #endif
 	}
 
-	CopyLump( &header, LUMP_LIGHTMAPS, data, (void *) bsp->lightmapData, sizeof ( *bsp->lightmapData ), qfalse ); /* NO SWAP */
+	BSP_CopyLump( header.lumps, LUMP_LIGHTMAPS, data, (void *) bsp->lightmapData, sizeof ( *bsp->lightmapData ), qfalse ); /* NO SWAP */
 
 	if ( bsp->visibilityLength )
 	{
-		byte *in = GetLump( &header, data, LUMP_VISIBILITY );
+		byte *in = BSP_GetLump( header.lumps, data, LUMP_VISIBILITY );
 
 		bsp->numClusters = LittleLong( ((int *)in)[0] );
 		bsp->clusterBytes = LittleLong( ((int *)in)[1] );
@@ -931,7 +913,9 @@ bspFile_t *BSP_LoadQ3Test103( const bspFormat_t *format, const char *name, const
 		Com_Printf( "DEBUG: visability numClusters %d, clusterBytes %d, length %d (max leaf cluster %d)\n", bsp->numClusters, bsp->clusterBytes, bsp->visibilityLength, maxUsedCluster );
 #endif
 
-		Com_Memcpy( bsp->visibility, in + VIS_HEADER, bsp->visibilityLength ); /* NO SWAP */
+		if ( bsp->visibility != in + VIS_HEADER ) {
+			Com_Memcpy( bsp->visibility, in + VIS_HEADER, bsp->visibilityLength ); /* NO SWAP */
+		}
 	}
 
 	// Generate triangle fan indexes.
@@ -968,6 +952,12 @@ bspFile_t *BSP_LoadQ3Test103( const bspFormat_t *format, const char *name, const
 		}
 	}
 
+	BSP_ReleaseFileData( bsp );
+
+	TRACE_END( "decode lumps" );
+
+	BSP_DedupeShaders( bsp );
+
 	return bsp;
 }
 
@@ -975,10 +965,38 @@ bspFile_t *BSP_LoadQ3Test103( const bspFormat_t *format, const char *name, const
 /****************************************************
 */
 
+// shaders and surfaces are made from brushes, brush sides, surfaces, draw verts, and draw indexes
+#define SURFACE_DEPENDENCIES ( BSPLUMP_BIT( BSPLUMP_BRUSHES ) | BSPLUMP_BIT( BSPLUMP_BRUSHSIDES ) | BSPLUMP_BIT( BSPLUMP_SURFACES ) \
+								| BSPLUMP_BIT( BSPLUMP_DRAWVERTS ) | BSPLUMP_BIT( BSPLUMP_DRAWINDEXES ) )
+
+static const bspLumpDef_t q3Test103LumpDefs[BSPLUMP_MAX] = {
+	{ LUMP_ENTITIES, 1 },
+	{ -1, 0, SURFACE_DEPENDENCIES },	// made from brushes, brush sides, and surfaces
+	{ LUMP_PLANES, sizeof ( realDplane_t ) },
+	{ LUMP_NODES, sizeof ( realDnode_t ) },
+	{ LUMP_LEAFS, sizeof ( realDleaf_t ) },
+	{ LUMP_LEAFSURFACES, sizeof ( int ) },
+	{ LUMP_LEAFBRUSHES, sizeof ( int ) },
+	{ LUMP_MODELS, sizeof ( realDmodel_t ), SURFACE_DEPENDENCIES | BSPLUMP_BIT( BSPLUMP_LEAFS ) | BSPLUMP_BIT( BSPLUMP_LEAFSURFACES ) | BSPLUMP_BIT( BSPLUMP_LEAFBRUSHES ) },
+	{ LUMP_BRUSHES, sizeof ( realDbrush_t ), SURFACE_DEPENDENCIES },
+	{ LUMP_BRUSHSIDES, sizeof ( realDbrushside_t ), SURFACE_DEPENDENCIES },
+	{ LUMP_DRAWVERTS, sizeof ( realDrawVert_t ) },
+	{ LUMP_DRAWINDEXES, sizeof ( int ), SURFACE_DEPENDENCIES },
+	{ LUMP_FOGS, sizeof ( realDfog_t ) },
+	{ LUMP_SURFACES, sizeof ( realDsurface_t ), SURFACE_DEPENDENCIES },
+	{ LUMP_LIGHTMAPS, 128 * 128 * 3 },
+	{ -1, 0 },	// no lightgrid lump
+	{ LUMP_VISIBILITY, 1 },
+	{ -1, 0 },	// no lightarray lump
+};
+
 bspFormat_t q3Test103BspFormat = {
 	"Q3Test 1.03/1.05",
 	BSP_IDENT,
 	BSP_VERSION,
+	offsetof( dheader_t, lumps ),
+	HEADER_LUMPS,
+	q3Test103LumpDefs,
 	BSP_LoadQ3Test103,
 };
 
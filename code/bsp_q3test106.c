@@ -39,10 +39,6 @@ Suite 120, Rockville, Maryland 20850 USA.
 #define BSP_VERSION			45
 #define S3Q3_BSP_VERSION	-46
 
-typedef struct {
-	int		fileofs, filelen;
-} lump_t;
-
 #define	LUMP_ENTITIES		0
 #define	LUMP_SHADERS		1
 #define	LUMP_PLANES			2
@@ -171,6 +167,15 @@ typedef struct {
 	int			patchHeight; // ydnar: num foliage mesh verts
 } realDsurface_t;
 
+BSP_SCHEMA( shaderSchema, realDshader_t, dshader_t, BSP_SHADER_FIELDS );
+BSP_SCHEMA( planeSchema, realDplane_t, dplane_t, BSP_PLANE_FIELDS );
+BSP_SCHEMA( nodeSchema, realDnode_t, dnode_t, BSP_NODE_FIELDS );
+BSP_SCHEMA( leafSchema, realDleaf_t, dleaf_t, BSP_LEAF_FIELDS );
+BSP_SCHEMA( modelSchema, realDmodel_t, dmodel_t, BSP_MODEL_FIELDS );
+BSP_SCHEMA( brushSchema, realDbrush_t, dbrush_t, BSP_BRUSH_FIELDS );
+BSP_SCHEMA( drawVertSchema, realDrawVert_t, drawVert_t, BSP_DRAWVERT_FIELDS );
+BSP_SCHEMA( surfaceSchema, realDsurface_t, dsurface_t, BSP_SURFACE_FIELDS );
+
 #define VIS_HEADER 8
 
 #define LIGHTING_GRIDSIZE_X 64
@@ -182,40 +187,8 @@ typedef struct {
 /****************************************************
 */
 
-static int GetLumpElements( dheader_t *header, int lump, int size ) {
-	/* check for odd size */
-	if ( header->lumps[ lump ].filelen % size ) {
-		Com_Printf( "GetLumpElements: odd lump size (%d) in lump %d\n", header->lumps[ lump ].filelen, lump );
-		return 0;
-	}
-
-	/* return element count */
-	return header->lumps[ lump ].filelen / size;
-}
-
-static void CopyLump( dheader_t *header, int lump, const void *src, void *dest, int size, qboolean swap ) {
-	int length;
-
-	length = GetLumpElements( header, lump, size ) * size;
-
-	/* handle erroneous cases */
-	if ( length <= 0 ) {
-		return;
-	}
-
-	if ( swap ) {
-		BSP_SwapBlock( dest, (int *)((byte*) src + header->lumps[lump].fileofs), length );
-	} else {
-		Com_Memcpy( dest, (byte*) src + header->lumps[lump].fileofs, length );
-	}
-}
-
-static void *GetLump( dheader_t *header, const void *src, int lump ) {
-	return (void*)( (byte*) src + header->lumps[ lump ].fileofs );
-}
-
-bspFile_t *BSP_LoadQ3Test106( const bspFormat_t *format, const char *name, const void *data, int length ) {
-	int				i, j, k;
+bspFile_t *BSP_LoadQ3Test106( const bspFormat_t *format, const char *name, const void *data, int length, qboolean keepData ) {
+	int				i;
 	dheader_t		header;
 	bspFile_t		*bsp;
 
@@ -228,6 +201,12 @@ bspFile_t *BSP_LoadQ3Test106( const bspFormat_t *format, const char *name, const
 	bsp = malloc( sizeof ( bspFile_t ) );
 	Com_Memset( bsp, 0, sizeof ( bspFile_t ) );
 
+	// lumps that are not larger in memory are decoded in place in data, see BSP_LumpArray
+	if ( keepData ) {
+		bsp->fileData = (void *)data;
+		bsp->fileLength = length;
+	}
+
 	// ...
 	bsp->checksum = LittleLong (Com_BlockChecksum (data, length));
 	bsp->defaultLightGridSize[0] = LIGHTING_GRIDSIZE_X;
@@ -238,198 +217,115 @@ bspFile_t *BSP_LoadQ3Test106( const bspFormat_t *format, const char *name, const
 	//
 	// count and alloc
 	//
-	bsp->entityStringLength = GetLumpElements( &header, LUMP_ENTITIES, 1 );
-	bsp->entityString = malloc( bsp->entityStringLength );
+	TRACE_BEGIN( "count lumps" );
+	bsp->entityStringLength = BSP_GetLumpElements( header.lumps, LUMP_ENTITIES, 1 );
+	bsp->entityString = BSP_LumpArray( bsp, header.lumps, LUMP_ENTITIES, bsp->entityStringLength, 1, 1 );
 
-	bsp->numShaders = GetLumpElements( &header, LUMP_SHADERS, sizeof ( realDshader_t ) );
-	bsp->shaders = malloc( bsp->numShaders * sizeof ( *bsp->shaders ) );
+	bsp->numShaders = BSP_GetLumpElements( header.lumps, LUMP_SHADERS, sizeof ( realDshader_t ) );
+	bsp->shaders = BSP_LumpArray( bsp, header.lumps, LUMP_SHADERS, bsp->numShaders, sizeof ( *bsp->shaders ), sizeof ( realDshader_t ) );
 
-	bsp->numPlanes = GetLumpElements( &header, LUMP_PLANES, sizeof ( realDplane_t ) );
-	bsp->planes = malloc( bsp->numPlanes * sizeof ( *bsp->planes ) );
+	bsp->numPlanes = BSP_GetLumpElements( header.lumps, LUMP_PLANES, sizeof ( realDplane_t ) );
+	bsp->planes = BSP_LumpArray( bsp, header.lumps, LUMP_PLANES, bsp->numPlanes, sizeof ( *bsp->planes ), sizeof ( realDplane_t ) );
 
-	bsp->numNodes = GetLumpElements( &header, LUMP_NODES, sizeof ( realDnode_t ) );
-	bsp->nodes = malloc( bsp->numNodes * sizeof ( *bsp->nodes ) );
+	bsp->numNodes = BSP_GetLumpElements( header.lumps, LUMP_NODES, sizeof ( realDnode_t ) );
+	bsp->nodes = BSP_LumpArray( bsp, header.lumps, LUMP_NODES, bsp->numNodes, sizeof ( *bsp->nodes ), sizeof ( realDnode_t ) );
 
-	bsp->numLeafs = GetLumpElements( &header, LUMP_LEAFS, sizeof ( realDleaf_t ) );
-	bsp->leafs = malloc( bsp->numLeafs * sizeof ( *bsp->leafs ) );
+	bsp->numLeafs = BSP_GetLumpElements( header.lumps, LUMP_LEAFS, sizeof ( realDleaf_t ) );
+	bsp->leafs = BSP_LumpArray( bsp, header.lumps, LUMP_LEAFS, bsp->numLeafs, sizeof ( *bsp->leafs ), sizeof ( realDleaf_t ) );
 
-	bsp->numLeafSurfaces = GetLumpElements( &header, LUMP_LEAFSURFACES, sizeof ( int ) );
-	bsp->leafSurfaces = malloc( bsp->numLeafSurfaces * sizeof ( *bsp->leafSurfaces ) );
+	bsp->numLeafSurfaces = BSP_GetLumpElements( header.lumps, LUMP_LEAFSURFACES, sizeof ( int ) );
+	bsp->leafSurfaces = BSP_LumpArray( bsp, header.lumps, LUMP_LEAFSURFACES, bsp->numLeafSurfaces, sizeof ( *bsp->leafSurfaces ), sizeof ( int ) );
 
-	bsp->numLeafBrushes = GetLumpElements( &header, LUMP_LEAFBRUSHES, sizeof ( int ) );
-	bsp->leafBrushes = malloc( bsp->numLeafBrushes * sizeof ( *bsp->leafBrushes ) );
+	bsp->numLeafBrushes = BSP_GetLumpElements( header.lumps, LUMP_LEAFBRUSHES, sizeof ( int ) );
+	bsp->leafBrushes = BSP_LumpArray( bsp, header.lumps, LUMP_LEAFBRUSHES, bsp->numLeafBrushes, sizeof ( *bsp->leafBrushes ), sizeof ( int ) );
 
-	bsp->numSubmodels = GetLumpElements( &header, LUMP_MODELS, sizeof ( realDmodel_t ) );
-	bsp->submodels = malloc( bsp->numSubmodels * sizeof ( *bsp->submodels ) );
+	bsp->numSubmodels = BSP_GetLumpElements( header.lumps, LUMP_MODELS, sizeof ( realDmodel_t ) );
+	bsp->submodels = BSP_LumpArray( bsp, header.lumps, LUMP_MODELS, bsp->numSubmodels, sizeof ( *bsp->submodels ), sizeof ( realDmodel_t ) );
 
-	bsp->numBrushes = GetLumpElements( &header, LUMP_BRUSHES, sizeof ( realDbrush_t ) );
-	bsp->brushes = malloc( bsp->numBrushes * sizeof ( *bsp->brushes ) );
+	bsp->numBrushes = BSP_GetLumpElements( header.lumps, LUMP_BRUSHES, sizeof ( realDbrush_t ) );
+	bsp->brushes = BSP_LumpArray( bsp, header.lumps, LUMP_BRUSHES, bsp->numBrushes, sizeof ( *bsp->brushes ), sizeof ( realDbrush_t ) );
 
-	bsp->numBrushSides = GetLumpElements( &header, LUMP_BRUSHSIDES, sizeof ( realDbrushside_t ) );
-	bsp->brushSides = malloc( bsp->numBrushSides * sizeof ( *bsp->brushSides ) );
+	bsp->numBrushSides = BSP_GetLumpElements( header.lumps, LUMP_BRUSHSIDES, sizeof ( realDbrushside_t ) );
+	bsp->brushSides = BSP_LumpArray( bsp, header.lumps, LUMP_BRUSHSIDES, bsp->numBrushSides, sizeof ( *bsp->brushSides ), sizeof ( realDbrushside_t ) );
 
-	bsp->numDrawVerts = GetLumpElements( &header, LUMP_DRAWVERTS, sizeof ( realDrawVert_t ) );
-	bsp->drawVerts = malloc( bsp->numDrawVerts * sizeof ( *bsp->drawVerts ) );
+	bsp->numDrawVerts = BSP_GetLumpElements( header.lumps, LUMP_DRAWVERTS, sizeof ( realDrawVert_t ) );
+	bsp->drawVerts = BSP_LumpArray( bsp, header.lumps, LUMP_DRAWVERTS, bsp->numDrawVerts, sizeof ( *bsp->drawVerts ), sizeof ( realDrawVert_t ) );
 
-	bsp->numDrawIndexes = GetLumpElements( &header, LUMP_DRAWINDEXES, sizeof ( int ) );
-	bsp->drawIndexes = malloc( bsp->numDrawIndexes * sizeof ( *bsp->drawIndexes ) );
+	bsp->numDrawIndexes = BSP_GetLumpElements( header.lumps, LUMP_DRAWINDEXES, sizeof ( int ) );
+	bsp->drawIndexes = BSP_LumpArray( bsp, header.lumps, LUMP_DRAWINDEXES, bsp->numDrawIndexes, sizeof ( *bsp->drawIndexes ), sizeof ( int ) );
 
-	bsp->numFogs = GetLumpElements( &header, LUMP_FOGS, sizeof ( realDfog_t ) );
-	bsp->fogs = malloc( bsp->numFogs * sizeof ( *bsp->fogs ) );
+	bsp->numFogs = BSP_GetLumpElements( header.lumps, LUMP_FOGS, sizeof ( realDfog_t ) );
+	bsp->fogs = BSP_LumpArray( bsp, header.lumps, LUMP_FOGS, bsp->numFogs, sizeof ( *bsp->fogs ), sizeof ( realDfog_t ) );
 
-	bsp->numSurfaces = GetLumpElements( &header, LUMP_SURFACES, sizeof ( realDsurface_t ) );
-	bsp->surfaces = malloc( bsp->numSurfaces * sizeof ( *bsp->surfaces ) );
+	bsp->numSurfaces = BSP_GetLumpElements( header.lumps, LUMP_SURFACES, sizeof ( realDsurface_t ) );
+	bsp->surfaces = BSP_LumpArray( bsp, header.lumps, LUMP_SURFACES, bsp->numSurfaces, sizeof ( *bsp->surfaces ), sizeof ( realDsurface_t ) );
 
-	bsp->numLightmaps = GetLumpElements( &header, LUMP_LIGHTMAPS, 128 * 128 * 3 );
-	bsp->lightmapData = malloc( bsp->numLightmaps * 128 * 128 * 3 );
+	bsp->numLightmaps = BSP_GetLumpElements( header.lumps, LUMP_LIGHTMAPS, 128 * 128 * 3 );
+	bsp->lightmapData = BSP_LumpArray( bsp, header.lumps, LUMP_LIGHTMAPS, bsp->numLightmaps * 128 * 128 * 3, 1, 1 );
 
-	bsp->numGridPoints = GetLumpElements( &header, LUMP_LIGHTGRID, 8 );
-	bsp->lightGridData = malloc( bsp->numGridPoints * 8 );
+	bsp->numGridPoints = BSP_GetLumpElements( header.lumps, LUMP_LIGHTGRID, 8 );
+	bsp->lightGridData = BSP_LumpArray( bsp, header.lumps, LUMP_LIGHTGRID, bsp->numGridPoints, 8, 8 );
 
-	bsp->visibilityLength = GetLumpElements( &header, LUMP_VISIBILITY, 1 ) - VIS_HEADER;
-	if ( bsp->visibilityLength > 0 )
-		bsp->visibility = malloc( bsp->visibilityLength );
-	else
+	bsp->visibilityLength = BSP_GetLumpElements( header.lumps, LUMP_VISIBILITY, 1 ) - VIS_HEADER;
+	if ( bsp->visibilityLength > 0 ) {
+		if ( bsp->fileData ) {
+			bsp->visibility = (byte *)BSP_GetLump( header.lumps, data, LUMP_VISIBILITY ) + VIS_HEADER;
+		} else {
+			bsp->visibility = malloc( bsp->visibilityLength );
+		}
+	} else {
 		bsp->visibilityLength = 0;
+	}
+
+	TRACE_END( "count lumps" );
 
 	//
 	// copy and swap and convert data
 	//
-	CopyLump( &header, LUMP_ENTITIES, data, (void *) bsp->entityString, sizeof ( *bsp->entityString ), qfalse ); /* NO SWAP */
+	TRACE_BEGIN( "decode lumps" );
+	BSP_CopyLump( header.lumps, LUMP_ENTITIES, data, (void *) bsp->entityString, sizeof ( *bsp->entityString ), qfalse ); /* NO SWAP */
 
-	{
-		realDshader_t *in = GetLump( &header, data, LUMP_SHADERS );
-		dshader_t *out = bsp->shaders;
+	BSP_DecodeElements( &shaderSchema, BSP_GetLump( header.lumps, data, LUMP_SHADERS ), bsp->shaders, bsp->numShaders );
 
-		for ( i = 0; i < bsp->numShaders; i++, in++, out++ ) {
-			Q_strncpyz( out->shader, in->shader, sizeof ( out->shader ) );
-			out->contentFlags = LittleLong( in->contentFlags );
-			out->surfaceFlags = LittleLong( in->surfaceFlags );
-		}
-	}
+	BSP_DecodeElements( &planeSchema, BSP_GetLump( header.lumps, data, LUMP_PLANES ), bsp->planes, bsp->numPlanes );
 
-	{
-		realDplane_t *in = GetLump( &header, data, LUMP_PLANES );
-		dplane_t *out = bsp->planes;
+	BSP_DecodeElements( &nodeSchema, BSP_GetLump( header.lumps, data, LUMP_NODES ), bsp->nodes, bsp->numNodes );
 
-		for ( i = 0; i < bsp->numPlanes; i++, in++, out++) {
-			for (j=0 ; j<3 ; j++) {
-				out->normal[j] = LittleFloat (in->normal[j]);
-			}
+	BSP_DecodeElements( &leafSchema, BSP_GetLump( header.lumps, data, LUMP_LEAFS ), bsp->leafs, bsp->numLeafs );
 
-			out->dist = LittleFloat (in->dist);
-		}
-	}
+	BSP_CopyLump( header.lumps, LUMP_LEAFSURFACES, data, (void *) bsp->leafSurfaces, sizeof ( *bsp->leafSurfaces ), qtrue );
+	BSP_CopyLump( header.lumps, LUMP_LEAFBRUSHES, data, (void *) bsp->leafBrushes, sizeof ( *bsp->leafBrushes ), qtrue );
 
-	{
-		realDnode_t *in = GetLump( &header, data, LUMP_NODES );
-		dnode_t *out = bsp->nodes;
+	BSP_DecodeElements( &modelSchema, BSP_GetLump( header.lumps, data, LUMP_MODELS ), bsp->submodels, bsp->numSubmodels );
 
-		for ( i = 0; i < bsp->numNodes; i++, in++, out++ ) {
-			out->planeNum = LittleLong( in->planeNum );
-
-			for ( j = 0; j < 2; j++ ) {
-				out->children[j] = LittleLong( in->children[j] );
-			}
-
-			for ( j = 0; j < 3; j++ ) {
-				out->mins[j] = LittleLong( in->mins[j] );
-				out->maxs[j] = LittleLong( in->maxs[j] );
-			}
-		}
-	}
-
-	{
-		realDleaf_t *in = GetLump( &header, data, LUMP_LEAFS );
-		dleaf_t *out = bsp->leafs;
-
-		for ( i = 0; i < bsp->numLeafs; i++, in++, out++ ) {
-			out->cluster = LittleLong (in->cluster);
-			out->area = LittleLong (in->area);
-
-			for ( j = 0; j < 3; j++ ) {
-				out->mins[j] = LittleLong( in->mins[j] );
-				out->maxs[j] = LittleLong( in->maxs[j] );
-			}
-
-			out->firstLeafBrush = LittleLong (in->firstLeafBrush);
-			out->numLeafBrushes = LittleLong (in->numLeafBrushes);
-			out->firstLeafSurface = LittleLong (in->firstLeafSurface);
-			out->numLeafSurfaces = LittleLong (in->numLeafSurfaces);
-		}
-	}
-
-	CopyLump( &header, LUMP_LEAFSURFACES, data, (void *) bsp->leafSurfaces, sizeof ( *bsp->leafSurfaces ), qtrue );
-	CopyLump( &header, LUMP_LEAFBRUSHES, data, (void *) bsp->leafBrushes, sizeof ( *bsp->leafBrushes ), qtrue );
-
-	{
-		realDmodel_t *in = GetLump( &header, data, LUMP_MODELS );
-		dmodel_t *out = bsp->submodels;
-
-		for ( i = 0; i < bsp->numSubmodels; i++, in++, out++ ) {
-			for ( j = 0; j < 3; j++ ) {
-				out->mins[j] = LittleFloat( in->mins[j] );
-				out->maxs[j] = LittleFloat( in->maxs[j] );
-			}
-
-			out->firstSurface = LittleLong (in->firstSurface);
-			out->numSurfaces = LittleLong (in->numSurfaces);
-			out->firstBrush = LittleLong (in->firstBrush);
-			out->numBrushes = LittleLong (in->numBrushes);
-		}
-	}
-
-	{
-		realDbrush_t *in = GetLump( &header, data, LUMP_BRUSHES );
-		dbrush_t *out = bsp->brushes;
-
-		for ( i = 0; i < bsp->numBrushes; i++, in++, out++ )
-		{
-			out->firstSide = LittleLong (in->firstSide);
-			out->numSides = LittleLong (in->numSides);
-			out->shaderNum = LittleLong (in->shaderNum);
-		}
-	}
+	BSP_DecodeElements( &brushSchema, BSP_GetLump( header.lumps, data, LUMP_BRUSHES ), bsp->brushes, bsp->numBrushes );
 
 	{
-		realDbrushside_t *in = GetLump( &header, data, LUMP_BRUSHSIDES );
+		realDbrushside_t *lump = BSP_GetLump( header.lumps, data, LUMP_BRUSHSIDES );
+		realDbrushside_t element, *in = &element;
 		dbrushside_t *out = bsp->brushSides;
 
-		for ( i = 0; i < bsp->numBrushSides; i++, in++, out++ ) {
+		// out may be the lump, copy the element before decoding it
+		for ( i = 0; i < bsp->numBrushSides; i++, out++ ) {
+			Com_Memcpy( &element, &lump[i], sizeof ( element ) );
 			out->planeNum = LittleLong (in->planeNum);
 			out->shaderNum = LittleLong (in->shaderNum);
 			out->surfaceNum = -1;
 		}
 	}
 
-	{
-		realDrawVert_t *in = GetLump( &header, data, LUMP_DRAWVERTS );
-		drawVert_t *out = bsp->drawVerts;
-
-		for ( i = 0; i < bsp->numDrawVerts; i++, in++, out++ ) {
-			for ( j = 0 ; j < 3 ; j++ ) {
-				out->xyz[j] = LittleFloat( in->xyz[j] );
-				out->normal[j] = LittleFloat( in->normal[j] );
-			}
-			for ( j = 0 ; j < 2 ; j++ ) {
-				out->st[j] = LittleFloat( in->st[j] );
-				out->lightmap[j] = LittleFloat( in->lightmap[j] );
-			}
-
-			/* NO SWAP */
-			for ( j = 0; j < 4; j++ ) {
-				out->color[j] = in->color[j];
-			}
-		}
-	}
+	BSP_DecodeElements( &drawVertSchema, BSP_GetLump( header.lumps, data, LUMP_DRAWVERTS ), bsp->drawVerts, bsp->numDrawVerts );
 
-	CopyLump( &header, LUMP_DRAWINDEXES, data, (void *) bsp->drawIndexes, sizeof ( *bsp->drawIndexes ), qtrue );
+	BSP_CopyLump( header.lumps, LUMP_DRAWINDEXES, data, (void *) bsp->drawIndexes, sizeof ( *bsp->drawIndexes ), qtrue );
 
 	{
-		realDfog_t *in = GetLump( &header, data, LUMP_FOGS );
+		realDfog_t *lump = BSP_GetLump( header.lumps, data, LUMP_FOGS );
+		realDfog_t element, *in = &element;
 		dfog_t *out = bsp->fogs;
 
-		for ( i = 0; i < bsp->numFogs; i++, in++, out++ ) {
+		// out may be the lump, copy the element before decoding it
+		for ( i = 0; i < bsp->numFogs; i++, out++ ) {
+			Com_Memcpy( &element, &lump[i], sizeof ( element ) );
 			Q_strncpyz( out->shader, in->shader, sizeof ( out->shader ) );
 			out->brushNum = LittleLong (in->brushNum);
 			// ZTM: Hard code visibleSide to top. I'm unsure if this is the correct handling.
@@ -437,51 +333,31 @@ bspFile_t *BSP_LoadQ3Test106( const bspFormat_t *format, const char *name, const
 		}
 	}
 
-	{
-		realDsurface_t *in = GetLump( &header, data, LUMP_SURFACES );
-		dsurface_t *out = bsp->surfaces;
+	BSP_DecodeElements( &surfaceSchema, BSP_GetLump( header.lumps, data, LUMP_SURFACES ), bsp->surfaces, bsp->numSurfaces );
 
-		for ( i = 0; i < bsp->numSurfaces; i++, in++, out++ ) {
-			out->shaderNum = LittleLong (in->shaderNum);
-			out->fogNum = LittleLong (in->fogNum);
-			out->surfaceType = LittleLong (in->surfaceType);
-			out->firstVert = LittleLong (in->firstVert);
-			out->numVerts = LittleLong (in->numVerts);
-			out->firstIndex = LittleLong (in->firstIndex);
-			out->numIndexes = LittleLong (in->numIndexes);
-			out->lightmapNum = LittleLong (in->lightmapNum);
-			out->lightmapX = LittleLong (in->lightmapX);
-			out->lightmapY = LittleLong (in->lightmapY);
-			out->lightmapWidth = LittleLong (in->lightmapWidth);
-			out->lightmapHeight = LittleLong (in->lightmapHeight);
-
-			for ( j = 0; j < 3; j++ ) {
-				out->lightmapOrigin[j] = LittleFloat( in->lightmapOrigin[j] );
-				for ( k = 0; k < 3; k++ ) {
-					out->lightmapVecs[j][k] = LittleFloat( in->lightmapVecs[j][k] );
-				}
-			}
-
-			out->patchWidth = LittleLong (in->patchWidth);
-			out->patchHeight = LittleLong (in->patchHeight);
-
-			out->subdivisions = SUBDIVIDE_DISTANCE;
-		}
+	for ( i = 0; i < bsp->numSurfaces; i++ ) {
+		bsp->surfaces[i].subdivisions = SUBDIVIDE_DISTANCE;
 	}
 
-	CopyLump( &header, LUMP_LIGHTMAPS, data, (void *) bsp->lightmapData, sizeof ( *bsp->lightmapData ), qfalse ); /* NO SWAP */
-	CopyLump( &header, LUMP_LIGHTGRID, data, (void *) bsp->lightGridData, sizeof ( *bsp->lightGridData ), qfalse ); /* NO SWAP */
+	BSP_CopyLump( header.lumps, LUMP_LIGHTMAPS, data, (void *) bsp->lightmapData, sizeof ( *bsp->lightmapData ), qfalse ); /* NO SWAP */
+	BSP_CopyLump( header.lumps, LUMP_LIGHTGRID, data, (void *) bsp->lightGridData, sizeof ( *bsp->lightGridData ), qfalse ); /* NO SWAP */
 
 	if ( bsp->visibilityLength )
 	{
-		byte *in = GetLump( &header, data, LUMP_VISIBILITY );
+		byte *in = BSP_GetLump( header.lumps, data, LUMP_VISIBILITY );
 
 		bsp->numClusters = LittleLong( ((int *)in)[0] );
 		bsp->clusterBytes = LittleLong( ((int *)in)[1] );
 
-		Com_Memcpy( bsp->visibility, in + VIS_HEADER, bsp->visibilityLength ); /* NO SWAP */
+		if ( bsp->visibility != in + VIS_HEADER ) {
+			Com_Memcpy( bsp->visibility, in + VIS_HEADER, bsp->visibilityLength ); /* NO SWAP */
+		}
 	}
 
+	BSP_ReleaseFileData( bsp );
+
+	TRACE_END( "decode lumps" );
+
 	return bsp;
 }
 
@@ -489,10 +365,34 @@ bspFile_t *BSP_LoadQ3Test106( const bspFormat_t *format, const char *name, const
 /****************************************************
 */
 
+static const bspLumpDef_t q3Test106LumpDefs[BSPLUMP_MAX] = {
+	{ LUMP_ENTITIES, 1 },
+	{ LUMP_SHADERS, sizeof ( realDshader_t ) },
+	{ LUMP_PLANES, sizeof ( realDplane_t ) },
+	{ LUMP_NODES, sizeof ( realDnode_t ) },
+	{ LUMP_LEAFS, sizeof ( realDleaf_t ) },
+	{ LUMP_LEAFSURFACES, sizeof ( int ) },
+	{ LUMP_LEAFBRUSHES, sizeof ( int ) },
+	{ LUMP_MODELS, sizeof ( realDmodel_t ) },
+	{ LUMP_BRUSHES, sizeof ( realDbrush_t ) },
+	{ LUMP_BRUSHSIDES, sizeof ( realDbrushside_t ) },
+	{ LUMP_DRAWVERTS, sizeof ( realDrawVert_t ) },
+	{ LUMP_DRAWINDEXES, sizeof ( int ) },
+	{ LUMP_FOGS, sizeof ( realDfog_t ) },
+	{ LUMP_SURFACES, sizeof ( realDsurface_t ) },
+	{ LUMP_LIGHTMAPS, 128 * 128 * 3 },
+	{ LUMP_LIGHTGRID, 8 },
+	{ LUMP_VISIBILITY, 1 },
+	{ -1, 0 },	// no lightarray lump
+};
+
 bspFormat_t q3Test106BspFormat = {
 	"Q3Test 1.06/1.07/1.08",
 	BSP_IDENT,
 	BSP_VERSION,
+	offsetof( dheader_t, lumps ),
+	HEADER_LUMPS,
+	q3Test106LumpDefs,
 	BSP_LoadQ3Test106,
 };
 
@@ -501,6 +401,9 @@ bspFormat_t s3quake3BspFormat = {
 	"S3Quake3",
 	BSP_IDENT,
 	S3Q3_BSP_VERSION,
+	offsetof( dheader_t, lumps ),
+	HEADER_LUMPS,
+	q3Test106LumpDefs,
 	BSP_LoadQ3Test106,
 };
 
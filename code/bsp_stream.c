@@ -0,0 +1,271 @@
+/*
+===========================================================================
+Copyright (C) 2015 Zack Middleton
+
+This file is part of BSP sekai Source Code.
+
+BSP sekai Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+BSP sekai Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with BSP sekai Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, BSP sekai Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+
+
+/*
+	Streaming conversion
+
+	Formats that share lumpDefs (such as Quake 3, RTCW/ET, and Dark Salvation)
+	store lumps the same way, loading and saving a lump that no pass changes
+	gives back the same bytes. So a conversion between them can copy lumps from
+	the input file to the output file a window at a time instead of loading the
+	whole BSP. Lumps that the passes use are loaded by themselves, changed, and
+	written over the copied lump using the output format's patchFunction.
+*/
+
+#include "sekai.h"
+#include "bsp.h"
+
+#define VIS_HEADER 8
+
+/*
+=================
+BSP_StreamLumps
+
+Returns the BSPLUMP_BITs the passes use, or -1 if they can't be streamed.
+=================
+*/
+static int BSP_StreamLumps( const bspPipeline_t *pipeline ) {
+	const bspPass_t *pass;
+	int i, lumps;
+
+	lumps = 0;
+
+	for ( i = 0; i < pipeline->numPasses; i++ ) {
+		pass = pipeline->passes[i];
+
+		if ( !pass->lumps || pass->requires || pass->invalidates ) {
+			return -1;
+		}
+
+		lumps |= pass->lumps;
+	}
+
+	// the lumps that patchFunction can write
+	if ( lumps & ~( BSPLUMP_BIT( BSPLUMP_ENTITIES ) | BSPLUMP_BIT( BSPLUMP_SHADERS ) ) ) {
+		return -1;
+	}
+
+	return lumps;
+}
+
+/*
+=================
+BSP_ReadStreamHeader
+=================
+*/
+static const bspFormat_t *BSP_ReadStreamHeader( int fd, byte *header, int size ) {
+	int headerLength;
+
+	headerLength = FS_Pread( fd, header, size, 0 );
+
+	if ( BSP_IsArchive( header, headerLength ) ) {
+		return NULL;
+	}
+
+	return BSP_FindFormat( header, headerLength );
+}
+
+/*
+=================
+BSP_CanStream
+=================
+*/
+qboolean BSP_CanStream( const char *name, const bspFormat_t *outFormat, const bspPipeline_t *pipeline ) {
+	const bspFormat_t *format;
+	byte header[BSP_MAX_HEADER_LENGTH];
+	int fd;
+
+	if ( BSP_StreamLumps( pipeline ) == -1 ) {
+		Com_Printf( "Passes need the whole BSP, loading '%s'.\n", name );
+		return qfalse;
+	}
+
+	fd = FS_Open( name, qfalse );
+	if ( fd == -1 ) {
+		return qfalse;
+	}
+
+	format = BSP_ReadStreamHeader( fd, header, sizeof ( header ) );
+	FS_Close( fd );
+
+	if ( !format ) {
+		return qfalse;
+	}
+
+	if ( format->lumpDefs != outFormat->lumpDefs || format->ident != outFormat->ident
+		|| format->lumpsOffset != outFormat->lumpsOffset || format->numLumps != outFormat->numLumps
+		|| !outFormat->saveFunction || !outFormat->patchFunction ) {
+		Com_Printf( "%s and %s BSPs are stored differently, loading '%s'.\n", format->gameName, outFormat->gameName, name );
+		return qfalse;
+	}
+
+	return qtrue;
+}
+
+/*
+=================
+BSP_Stream
+
+Convert name to outputName without loading the whole BSP, BSP_CanStream
+must be true. Lumps are copied windowSize bytes at a time.
+=================
+*/
+qboolean BSP_Stream( const char *name, const char *outputName, const bspFormat_t *outFormat, const bspPipeline_t *pipeline, int windowSize ) {
+	const bspFormat_t *format;
+	byte header[BSP_MAX_HEADER_LENGTH];
+	byte outHeader[BSP_MAX_HEADER_LENGTH];
+	const lump_t *lumps;
+	lump_t *outLumps;
+	const bspLumpDef_t *lumpDef;
+	byte *window;
+	int headerLength, filePos, length, offset, chunk;
+	int fd, outFd;
+	int passLumps;
+	int i, j;
+	bspFile_t *bsp;
+	qboolean success;
+
+	passLumps = BSP_StreamLumps( pipeline );
+
+	fd = FS_Open( name, qfalse );
+	if ( fd == -1 ) {
+		Com_Printf( "Error: Could not read file '%s'\n", name );
+		return qfalse;
+	}
+
+	format = BSP_ReadStreamHeader( fd, header, sizeof ( header ) );
+
+	if ( !format || passLumps == -1 ) {
+		FS_Close( fd );
+		return qfalse;
+	}
+
+	lumps = (const lump_t *)( header + format->lumpsOffset );
+
+	headerLength = outFormat->lumpsOffset + outFormat->numLumps * sizeof ( lump_t );
+
+	Com_Memset( outHeader, 0, headerLength );
+	((int *)outHeader)[0] = LittleLong( outFormat->ident );
+	((int *)outHeader)[1] = LittleLong( outFormat->version );
+
+	outLumps = (lump_t *)( outHeader + outFormat->lumpsOffset );
+
+	// lay out the lumps the same way as saveFunction
+	filePos = headerLength;
+
+	for ( i = 0; i < outFormat->numLumps; i++ ) {
+		lumpDef = NULL;
+
+		for ( j = 0; j < BSPLUMP_MAX; j++ ) {
+			if ( outFormat->lumpDefs[j].lump == i ) {
+				lumpDef = &outFormat->lumpDefs[j];
+				break;
+			}
+		}
+
+		// lumps the loader doesn't read are not saved
+		if ( !lumpDef ) {
+			continue;
+		}
+
+		length = BSP_GetLumpElements( lumps, i, lumpDef->size ) * lumpDef->size;
+
+		// the loader drops visibility without data after the header
+		if ( j == BSPLUMP_VISIBILITY && length <= VIS_HEADER ) {
+			length = 0;
+		}
+
+		outLumps[i].fileofs = LittleLong( filePos );
+		outLumps[i].filelen = LittleLong( length );
+		filePos += length;
+	}
+
+	// output may be a hard link to a cache entry, don't write through it
+	remove( outputName );
+
+	outFd = FS_Open( outputName, qtrue );
+	if ( outFd == -1 ) {
+		Com_Printf( "Error: Could not write file '%s'\n", outputName );
+		FS_Close( fd );
+		return qfalse;
+	}
+
+	window = malloc( windowSize );
+	success = ( FS_Pwrite( outFd, outHeader, headerLength, 0 ) == headerLength );
+
+	for ( i = 0; i < outFormat->numLumps && success; i++ ) {
+		length = LittleLong( outLumps[i].filelen );
+
+		for ( offset = 0; offset < length && success; offset += chunk ) {
+			chunk = MIN( windowSize, length - offset );
+
+			success = ( FS_Pread( fd, window, chunk, LittleLong( lumps[i].fileofs ) + offset ) == chunk )
+				&& ( FS_Pwrite( outFd, window, chunk, LittleLong( outLumps[i].fileofs ) + offset ) == chunk );
+		}
+	}
+
+	free( window );
+	FS_Close( fd );
+
+	success = success && FS_Truncate( outFd, filePos );
+	FS_Close( outFd );
+
+	if ( !success ) {
+		Com_Printf( "Saving BSP '%s' failed.\n", outputName );
+		remove( outputName );
+		return qfalse;
+	}
+
+	if ( !passLumps ) {
+		return qtrue;
+	}
+
+	// run the passes on only the lumps they use and write them over the copies
+	bsp = BSP_LoadLumps( name, passLumps );
+
+	if ( !bsp ) {
+		remove( outputName );
+		return qfalse;
+	}
+
+	BSP_RunPasses( pipeline, bsp );
+
+	success = outFormat->patchFunction( outFormat, outputName, bsp, passLumps );
+
+	BSP_Free( bsp );
+
+	if ( !success ) {
+		Com_Printf( "Saving BSP '%s' failed.\n", outputName );
+		remove( outputName );
+	}
+
+	return success;
+}
@@ -0,0 +1,668 @@
+/*
+===========================================================================
+Copyright (C) 2015 Zack Middleton
+
+This file is part of BSP sekai Source Code.
+
+BSP sekai Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+BSP sekai Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with BSP sekai Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, BSP sekai Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+
+
+
+/*
+	Watch mode
+
+	A directory is watched with inotify and BSPs written to it (or its
+	sub-directories) are converted to the same path in another directory.
+	Compilers write a BSP in several steps, so a file is converted once its
+	writer closed it and it was not changed for WATCH_DEBOUNCE_MSEC. Files that
+	don't start with a supported BSP header are ignored, and a file with the
+	same contents as its last conversion is skipped.
+
+	Worker threads keep their file buffer between conversions so that a map
+	that is rebuilt over and over isn't reallocated each time.
+*/
+
+#include "sekai.h"
+#include "bsp.h"
+
+#ifdef __linux__
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define MAX_WATCH_THREADS	8
+#define WATCH_DEBOUNCE_MSEC	300
+#define WATCH_EVENT_BUFFER	( 64 * 1024 )
+
+#define WATCH_EVENTS	( IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR )
+
+typedef struct {
+	int			wd;
+	char		*path;		// relative to srcDir, "" for srcDir
+} watchDir_t;
+
+typedef struct {
+	char		*path;		// relative to srcDir
+	int64_t		firstChange;	// first change that wasn't converted yet, 0 if none
+	int64_t		lastChange;
+	qboolean	closed;		// the writer closed the file after the last change
+	qboolean	busy;		// queued or being converted
+	qboolean	converted;	// hash is from the last conversion
+	uint64_t	hash;
+} watchFile_t;
+
+typedef struct {
+	int			fileNum;
+	int64_t		firstChange;
+} watchJob_t;
+
+typedef struct {
+	const char			*srcDir;
+	const char			*dstDir;
+	const bspFormat_t	*format;
+	const bspPipeline_t	*pipeline;
+
+	int				fd;
+	watchDir_t		*dirs;
+	int				numDirs;
+	int				maxDirs;
+
+	// files and jobs are shared with the workers
+	watchFile_t		*files;
+	int				numFiles;
+	int				maxFiles;
+	watchJob_t		*jobs;
+	int				numJobs;
+	int				maxJobs;
+
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+} watchState_t;
+
+/*
+=================
+Watch_MakeDirs
+
+Create the directories leading up to the last '/' of path.
+=================
+*/
+static void Watch_MakeDirs( const char *path ) {
+	char	dir[PATH_MAX];
+	char	*s;
+
+	Q_strncpyz( dir, path, sizeof ( dir ) );
+
+	for ( s = dir + 1; *s; s++ ) {
+		if ( *s != '/' ) {
+			continue;
+		}
+
+		*s = '\0';
+		mkdir( dir, 0755 );
+		*s = '/';
+	}
+}
+
+// returns qfalse if the path is too long, a truncated path could name another file
+static qboolean Watch_SourcePath( const watchState_t *state, const char *path, char *out, int outSize ) {
+	int length;
+
+	if ( path[0] ) {
+		length = snprintf( out, outSize, "%s/%s", state->srcDir, path );
+	} else {
+		length = snprintf( out, outSize, "%s", state->srcDir );
+	}
+
+	if ( length < 0 || length >= outSize ) {
+		Com_Printf( "WARNING: Skipping '%s/%s', the path is too long.\n", state->srcDir, path );
+		return qfalse;
+	}
+
+	return qtrue;
+}
+
+// archives are written as plain BSPs. returns qfalse if the path is too long.
+static qboolean Watch_OutputPath( const watchState_t *state, const char *path, char *out, int outSize ) {
+	int length;
+
+	length = snprintf( out, outSize, "%s/%s", state->dstDir, path );
+
+	if ( length < 0 || length >= outSize ) {
+		Com_Printf( "WARNING: Skipping '%s/%s', the path is too long.\n", state->dstDir, path );
+		return qfalse;
+	}
+
+	if ( length > 5 && Q_stricmp( out + length - 5, ".bspz" ) == 0 ) {
+		out[length - 1] = '\0';
+	}
+
+	return qtrue;
+}
+
+// returns the file, it's added if needed. state->lock must be held.
+static watchFile_t *Watch_GetFile( watchState_t *state, const char *path ) {
+	watchFile_t *file;
+	int i;
+
+	for ( i = 0; i < state->numFiles; i++ ) {
+		if ( !strcmp( state->files[i].path, path ) ) {
+			return &state->files[i];
+		}
+	}
+
+	if ( state->numFiles == state->maxFiles ) {
+		state->maxFiles = state->maxFiles ? state->maxFiles * 2 : 64;
+		state->files = realloc( state->files, state->maxFiles * sizeof ( *state->files ) );
+	}
+
+	file = &state->files[state->numFiles++];
+	Com_Memset( file, 0, sizeof ( *file ) );
+	file->path = strdup( path );
+
+	return file;
+}
+
+static void Watch_Changed( watchState_t *state, const char *path, qboolean closed ) {
+	watchFile_t *file;
+	int64_t now = Sys_Microseconds();
+
+	pthread_mutex_lock( &state->lock );
+
+	file = Watch_GetFile( state, path );
+
+	if ( !file->firstChange ) {
+		file->firstChange = now;
+	}
+	file->lastChange = now;
+	file->closed = closed;
+
+	pthread_mutex_unlock( &state->lock );
+}
+
+/*
+=================
+Watch_AddDir
+
+Watch the directory and its sub-directories. Files that are newer than their
+output (or have no output) are converted.
+=================
+*/
+static void Watch_AddDir( watchState_t *state, const char *path ) {
+	char			srcPath[PATH_MAX], filePath[PATH_MAX], outPath[PATH_MAX];
+	struct stat		st, outSt;
+	struct dirent	*ent;
+	DIR				*dir;
+	watchDir_t		*watchDir;
+	int				wd, length;
+
+	if ( !Watch_SourcePath( state, path, srcPath, sizeof ( srcPath ) ) ) {
+		return;
+	}
+
+	wd = inotify_add_watch( state->fd, srcPath, WATCH_EVENTS );
+	if ( wd == -1 ) {
+		Com_Printf( "WARNING: Could not watch directory '%s'.\n", srcPath );
+		return;
+	}
+
+	if ( state->numDirs == state->maxDirs ) {
+		state->maxDirs = state->maxDirs ? state->maxDirs * 2 : 16;
+		state->dirs = realloc( state->dirs, state->maxDirs * sizeof ( *state->dirs ) );
+	}
+
+	watchDir = &state->dirs[state->numDirs++];
+	watchDir->wd = wd;
+	watchDir->path = strdup( path );
+
+	// files written before the watch was added don't have events
+	dir = opendir( srcPath );
+	if ( !dir ) {
+		return;
+	}
+
+	while ( ( ent = readdir( dir ) ) != NULL ) {
+		if ( !strcmp( ent->d_name, "." ) || !strcmp( ent->d_name, ".." ) ) {
+			continue;
+		}
+
+		if ( path[0] ) {
+			length = snprintf( filePath, sizeof ( filePath ), "%s/%s", path, ent->d_name );
+		} else {
+			length = snprintf( filePath, sizeof ( filePath ), "%s", ent->d_name );
+		}
+
+		if ( length < 0 || length >= (int)sizeof ( filePath ) || !Watch_SourcePath( state, filePath, srcPath, sizeof ( srcPath ) ) ) {
+			continue;
+		}
+
+		if ( stat( srcPath, &st ) != 0 ) {
+			continue;
+		}
+
+		if ( S_ISDIR( st.st_mode ) ) {
+			Watch_AddDir( state, filePath );
+			continue;
+		}
+
+		if ( !S_ISREG( st.st_mode ) ) {
+			continue;
+		}
+
+		if ( !Watch_OutputPath( state, filePath, outPath, sizeof ( outPath ) ) ) {
+			continue;
+		}
+
+		if ( stat( outPath, &outSt ) != 0 || outSt.st_mtime < st.st_mtime ) {
+			Watch_Changed( state, filePath, qtrue );
+		}
+	}
+
+	closedir( dir );
+}
+
+static void Watch_RemoveDir( watchState_t *state, int wd ) {
+	int i;
+
+	for ( i = 0; i < state->numDirs; i++ ) {
+		if ( state->dirs[i].wd == wd ) {
+			free( state->dirs[i].path );
+			state->dirs[i] = state->dirs[--state->numDirs];
+			return;
+		}
+	}
+}
+
+static const watchDir_t *Watch_FindDir( const watchState_t *state, int wd ) {
+	int i;
+
+	for ( i = 0; i < state->numDirs; i++ ) {
+		if ( state->dirs[i].wd == wd ) {
+			return &state->dirs[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void Watch_ReadEvents( watchState_t *state ) {
+	union {
+		struct inotify_event	event;
+		char					buffer[WATCH_EVENT_BUFFER];
+	} events;
+	const struct inotify_event	*event;
+	const watchDir_t	*dir;
+	char				path[PATH_MAX];
+	long				length, ofs;
+	int					pathLength;
+
+	length = read( state->fd, events.buffer, sizeof ( events.buffer ) );
+
+	for ( ofs = 0; ofs < length; ofs += sizeof ( struct inotify_event ) + event->len ) {
+		event = (const struct inotify_event *)( events.buffer + ofs );
+
+		if ( event->mask & IN_IGNORED ) {
+			// directory was removed
+			Watch_RemoveDir( state, event->wd );
+			continue;
+		}
+
+		dir = Watch_FindDir( state, event->wd );
+
+		if ( !dir || !event->len ) {
+			continue;
+		}
+
+		if ( dir->path[0] ) {
+			pathLength = snprintf( path, sizeof ( path ), "%s/%s", dir->path, event->name );
+		} else {
+			pathLength = snprintf( path, sizeof ( path ), "%s", event->name );
+		}
+
+		if ( pathLength < 0 || pathLength >= (int)sizeof ( path ) ) {
+			Com_Printf( "WARNING: Skipping '%s/%s', the path is too long.\n", dir->path, event->name );
+			continue;
+		}
+
+		if ( event->mask & IN_ISDIR ) {
+			if ( event->mask & ( IN_CREATE | IN_MOVED_TO ) ) {
+				Watch_AddDir( state, path );
+			}
+			continue;
+		}
+
+		if ( event->mask & ( IN_CLOSE_WRITE | IN_MOVED_TO ) ) {
+			Watch_Changed( state, path, qtrue );
+		} else if ( event->mask & IN_MODIFY ) {
+			Watch_Changed( state, path, qfalse );
+		}
+	}
+}
+
+/*
+=================
+Watch_QueueReady
+
+Queue files that were closed and not changed for WATCH_DEBOUNCE_MSEC.
+Returns the poll timeout in milliseconds until a file may be ready, or -1.
+=================
+*/
+static int Watch_QueueReady( watchState_t *state ) {
+	watchFile_t *file;
+	int64_t now, wait;
+	int i, timeout;
+
+	now = Sys_Microseconds();
+	timeout = -1;
+
+	pthread_mutex_lock( &state->lock );
+
+	for ( i = 0; i < state->numFiles; i++ ) {
+		file = &state->files[i];
+
+		if ( !file->firstChange || !file->closed ) {
+			continue;
+		}
+
+		wait = WATCH_DEBOUNCE_MSEC - ( now - file->lastChange ) / 1000;
+
+		// a file being converted is checked again after the conversion
+		if ( file->busy ) {
+			wait = WATCH_DEBOUNCE_MSEC;
+		}
+
+		if ( wait > 0 ) {
+			if ( timeout == -1 || wait < timeout ) {
+				timeout = wait;
+			}
+			continue;
+		}
+
+		if ( state->numJobs == state->maxJobs ) {
+			state->maxJobs = state->maxJobs ? state->maxJobs * 2 : 64;
+			state->jobs = realloc( state->jobs, state->maxJobs * sizeof ( *state->jobs ) );
+		}
+
+		state->jobs[state->numJobs].fileNum = i;
+		state->jobs[state->numJobs].firstChange = file->firstChange;
+		state->numJobs++;
+
+		file->firstChange = 0;
+		file->busy = qtrue;
+
+		pthread_cond_signal( &state->cond );
+	}
+
+	pthread_mutex_unlock( &state->lock );
+
+	return timeout;
+}
+
+/*
+=================
+Watch_Convert
+
+Convert path if it's a supported BSP. buffer is kept by the worker between
+conversions.
+=================
+*/
+static void Watch_Convert( watchState_t *state, int fileNum, const char *path, int64_t firstChange, byte **buffer, long *bufferSize ) {
+	char		srcPath[PATH_MAX], outPath[PATH_MAX], tempPath[PATH_MAX + 4];
+	byte		header[BSP_MAX_HEADER_LENGTH];
+	long		headerLength, length;
+	int64_t		start;
+	uint64_t	hash;
+	bspFile_t	*bsp;
+	void		*saveData;
+	int			saveLength, fd;
+	qboolean	skip;
+
+	start = Sys_Microseconds();
+
+	if ( !Watch_SourcePath( state, path, srcPath, sizeof ( srcPath ) ) || !Watch_OutputPath( state, path, outPath, sizeof ( outPath ) ) ) {
+		return;
+	}
+
+	fd = FS_Open( srcPath, qfalse );
+	if ( fd == -1 ) {
+		// removed since it changed
+		return;
+	}
+
+	// only files with the header of a supported format are converted
+	headerLength = FS_Pread( fd, header, sizeof ( header ), 0 );
+
+	if ( BSP_IsArchive( header, headerLength ) ) {
+		headerLength = BSP_ReadArchiveHeader( fd, header, sizeof ( header ) );
+	}
+
+	if ( !BSP_FindFormat( header, headerLength ) ) {
+		FS_Close( fd );
+		return;
+	}
+
+	length = FS_FileLength( fd );
+
+	if ( length > *bufferSize ) {
+		free( *buffer );
+		*buffer = malloc( length );
+		*bufferSize = length;
+	}
+
+	if ( FS_Pread( fd, *buffer, length, 0 ) != length ) {
+		Com_Printf( "Error: Could not read file '%s'\n", srcPath );
+		FS_Close( fd );
+		return;
+	}
+
+	FS_Close( fd );
+
+	hash = Com_Hash64( *buffer, length, 0 );
+
+	pthread_mutex_lock( &state->lock );
+	skip = ( state->files[fileNum].converted && state->files[fileNum].hash == hash );
+	pthread_mutex_unlock( &state->lock );
+
+	if ( skip ) {
+		Com_Printf( "Skipped '%s', contents did not change.\n", srcPath );
+		return;
+	}
+
+	bsp = BSP_LoadData( srcPath, *buffer, length );
+
+	if ( !bsp ) {
+		Com_Printf( "Error: Could not read file '%s'\n", srcPath );
+		return;
+	}
+
+	BSP_RunPasses( state->pipeline, bsp );
+
+	saveData = NULL;
+	saveLength = state->format->saveFunction( state->format, outPath, bsp, &saveData );
+
+	BSP_Free( bsp );
+
+	// the game may load the output while it's written, replace it at once
+	snprintf( tempPath, sizeof ( tempPath ), "%s.tmp", outPath );
+	Watch_MakeDirs( outPath );
+
+	if ( !saveData || FS_WriteFile( tempPath, saveData, saveLength ) != saveLength || rename( tempPath, outPath ) != 0 ) {
+		Com_Printf( "Saving BSP '%s' failed.\n", outPath );
+		remove( tempPath );
+		free( saveData );
+		return;
+	}
+
+	free( saveData );
+
+	pthread_mutex_lock( &state->lock );
+	state->files[fileNum].converted = qtrue;
+	state->files[fileNum].hash = hash;
+	pthread_mutex_unlock( &state->lock );
+
+	Com_Printf( "Saved BSP '%s' in %.1f ms (%.1f ms after the change).\n", outPath,
+			( Sys_Microseconds() - start ) / 1000.0, ( Sys_Microseconds() - firstChange ) / 1000.0 );
+}
+
+static void *Watch_Worker( void *arg ) {
+	watchState_t	*state = arg;
+	watchJob_t		job;
+	const char		*path;
+	byte			*buffer = NULL;
+	long			bufferSize = 0;
+
+	pthread_mutex_lock( &state->lock );
+
+	while ( 1 ) {
+		while ( !state->numJobs ) {
+			pthread_cond_wait( &state->cond, &state->lock );
+		}
+
+		job = state->jobs[0];
+		state->numJobs--;
+		memmove( state->jobs, state->jobs + 1, state->numJobs * sizeof ( *state->jobs ) );
+
+		// the path isn't freed while watching, files may be reallocated
+		path = state->files[job.fileNum].path;
+		pthread_mutex_unlock( &state->lock );
+
+		Watch_Convert( state, job.fileNum, path, job.firstChange, &buffer, &bufferSize );
+
+		pthread_mutex_lock( &state->lock );
+		state->files[job.fileNum].busy = qfalse;
+	}
+
+	return NULL;
+}
+
+/*
+=================
+BSP_Watch
+
+Convert BSPs in srcDir to format in dstDir when they're written, returns
+when there is an error or bspsekai is told to quit.
+=================
+*/
+qboolean BSP_Watch( const char *srcDir, const char *dstDir, const bspFormat_t *format, const bspPipeline_t *pipeline ) {
+	watchState_t	state;
+	pthread_t		thread;
+	struct pollfd	pfd;
+	char			realSrc[PATH_MAX], realDst[PATH_MAX], dstFile[PATH_MAX];
+	size_t			srcLength;
+	int				numThreads, i, timeout;
+
+	// show each conversion when the output is piped to a log
+	setvbuf( stdout, NULL, _IOLBF, 0 );
+
+	// converted files must not be written to the watched directory
+	snprintf( dstFile, sizeof ( dstFile ), "%s/", dstDir );
+	Watch_MakeDirs( dstFile );
+
+	if ( !realpath( srcDir, realSrc ) ) {
+		Com_Printf( "Error: Could not open directory '%s'.\n", srcDir );
+		return qfalse;
+	}
+
+	if ( !realpath( dstDir, realDst ) ) {
+		Com_Printf( "Error: Could not create directory '%s'.\n", dstDir );
+		return qfalse;
+	}
+
+	srcLength = strlen( realSrc );
+	if ( !strncmp( realDst, realSrc, srcLength ) && ( realDst[srcLength] == '/' || realDst[srcLength] == '\0' || srcLength == 1 ) ) {
+		Com_Printf( "Error: output directory '%s' is inside of '%s'.\n", dstDir, srcDir );
+		return qfalse;
+	}
+
+	Com_Memset( &state, 0, sizeof ( state ) );
+	state.srcDir = srcDir;
+	state.dstDir = dstDir;
+	state.format = format;
+	state.pipeline = pipeline;
+	pthread_mutex_init( &state.lock, NULL );
+	pthread_cond_init( &state.cond, NULL );
+
+	state.fd = inotify_init1( IN_CLOEXEC );
+	if ( state.fd == -1 ) {
+		Com_Printf( "Error: Could not watch '%s': %s\n", srcDir, strerror( errno ) );
+		return qfalse;
+	}
+
+	numThreads = MIN( Com_NumCPUs(), MAX_WATCH_THREADS );
+	for ( i = 0; i < numThreads; i++ ) {
+		if ( pthread_create( &thread, NULL, Watch_Worker, &state ) != 0 ) {
+			break;
+		}
+		pthread_detach( thread );
+	}
+
+	if ( !i ) {
+		Com_Printf( "Error: Could not start worker threads.\n" );
+		close( state.fd );
+		return qfalse;
+	}
+
+	Watch_AddDir( &state, "" );
+
+	if ( !state.numDirs ) {
+		close( state.fd );
+		return qfalse;
+	}
+
+	Com_Printf( "Watching '%s' with %d workers, BSPs are saved to '%s'.\n", srcDir, i, dstDir );
+
+	pfd.fd = state.fd;
+	pfd.events = POLLIN;
+
+	Sys_CatchQuit();
+
+	while ( !Sys_QuitRequested() ) {
+		timeout = Watch_QueueReady( &state );
+
+		if ( poll( &pfd, 1, timeout ) > 0 ) {
+			Watch_ReadEvents( &state );
+		}
+	}
+
+	// conversions that are running are stopped at exit
+	close( state.fd );
+
+	return qtrue;
+}
+
+#else
+
+qboolean BSP_Watch( const char *srcDir, const char *dstDir, const bspFormat_t *format, const bspPipeline_t *pipeline ) {
+	Com_Printf( "Error: watch is only supported on Linux.\n" );
+	return qfalse;
+}
+
+#endif
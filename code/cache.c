@@ -0,0 +1,248 @@
+/*
+===========================================================================
+Copyright (C) 2015 Zack Middleton
+
+This file is part of BSP sekai Source Code.
+
+BSP sekai Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+BSP sekai Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with BSP sekai Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, BSP sekai Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+
+// cache.c -- content addressed cache of converted BSPs
+//
+// Entries are named by a hash of the input file and a recipe string
+// (conversion, output format and tool version). A cache hit is placed at
+// the output path as a reflink or hard link when the filesystem allows it,
+// otherwise it's copied. Entries are read-only so a hard linked output
+// cannot be modified by accident.
+
+#include "sekai.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+static void Cache_EntryName( const char *cacheDir, uint64_t key, char *out, size_t size ) {
+	snprintf( out, size, "%s/%016llx.bsp", cacheDir, (unsigned long long) key );
+}
+
+uint64_t Cache_Key( const void *data, long length, const char *recipe ) {
+	uint64_t seed;
+
+	seed = Com_Hash64( recipe, strlen( recipe ), 0 );
+	return Com_Hash64( data, length, seed );
+}
+
+static qboolean Cache_Reflink( const char *src, const char *dest ) {
+#ifdef FICLONE
+	int			in, out;
+	qboolean	success;
+
+	in = FS_Open( src, qfalse );
+	if ( in == -1 ) {
+		return qfalse;
+	}
+
+	out = FS_Open( dest, qtrue );
+	if ( out == -1 ) {
+		FS_Close( in );
+		return qfalse;
+	}
+
+	success = ( ioctl( out, FICLONE, in ) == 0 );
+
+	FS_Close( in );
+	FS_Close( out );
+
+	if ( !success ) {
+		remove( dest );
+	}
+
+	return success;
+#else
+	return qfalse;
+#endif
+}
+
+static qboolean Cache_CopyFile( const char *src, const char *dest ) {
+	int			in, out;
+	long		length, offset;
+	byte		buffer[65536];
+
+	in = FS_Open( src, qfalse );
+	if ( in == -1 ) {
+		return qfalse;
+	}
+
+	out = FS_Open( dest, qtrue );
+	if ( out == -1 ) {
+		FS_Close( in );
+		return qfalse;
+	}
+
+	length = FS_FileLength( in );
+
+	for ( offset = 0; offset < length; ) {
+		long chunk = MIN( length - offset, (long) sizeof ( buffer ) );
+
+		if ( FS_Pread( in, buffer, chunk, offset ) != chunk || FS_Pwrite( out, buffer, chunk, offset ) != chunk ) {
+			break;
+		}
+		offset += chunk;
+	}
+
+	FS_Close( in );
+	FS_Close( out );
+
+	if ( offset != length ) {
+		remove( dest );
+		return qfalse;
+	}
+
+	return qtrue;
+}
+
+qboolean Cache_Fetch( const char *cacheDir, uint64_t key, const char *filename ) {
+	char		entry[1024];
+
+	Cache_EntryName( cacheDir, key, entry, sizeof ( entry ) );
+
+	if ( !FS_FileExists( entry ) ) {
+		return qfalse;
+	}
+
+	remove( filename );
+
+	if ( Cache_Reflink( entry, filename ) ) {
+		return qtrue;
+	}
+
+#ifndef _WIN32
+	if ( link( entry, filename ) == 0 ) {
+		return qtrue;
+	}
+#endif
+
+	return Cache_CopyFile( entry, filename );
+}
+
+static void Cache_CreateDir( const char *cacheDir ) {
+#ifdef _WIN32
+	_mkdir( cacheDir );
+#else
+	mkdir( cacheDir, 0755 );
+#endif
+}
+
+void Cache_Store( const char *cacheDir, uint64_t key, const void *data, long length ) {
+	char		entry[1024];
+	char		temp[1100];
+
+	Cache_CreateDir( cacheDir );
+
+	Cache_EntryName( cacheDir, key, entry, sizeof ( entry ) );
+	snprintf( temp, sizeof ( temp ), "%s.%d.tmp", entry, (int) getpid() );
+
+	// write to a temporary file and rename so other processes never see a partial entry
+	if ( FS_WriteFile( temp, (void *) data, length ) != length ) {
+		Com_Printf( "WARNING: Could not write cache entry '%s'.\n", entry );
+		remove( temp );
+		return;
+	}
+
+	chmod( temp, 0444 );
+
+#ifdef _WIN32
+	remove( entry );
+#endif
+	if ( rename( temp, entry ) != 0 ) {
+		remove( temp );
+	}
+}
+
+// stats.log holds fixed width hit and miss counters that are updated in place,
+// the file is locked while updating so concurrent runs don't lose counts
+void Cache_Stats( const char *cacheDir, qboolean hit ) {
+	char		filename[1024];
+	char		buffer[64];
+	int			hits, misses;
+	int			fd, length;
+#ifndef _WIN32
+	struct flock lock;
+#endif
+
+	Cache_CreateDir( cacheDir );
+
+	snprintf( filename, sizeof ( filename ), "%s/stats.log", cacheDir );
+
+	fd = FS_Open( filename, qtrue );
+	if ( fd < 0 ) {
+		Com_Printf( "Conversion cache %s.\n", hit ? "hit" : "miss" );
+		return;
+	}
+
+#ifndef _WIN32
+	Com_Memset( &lock, 0, sizeof ( lock ) );
+	lock.l_type = F_WRLCK;
+	lock.l_whence = SEEK_SET;
+	fcntl( fd, F_SETLKW, &lock );
+#endif
+
+	length = read( fd, buffer, sizeof ( buffer ) - 1 );
+	buffer[MAX( length, 0 )] = '\0';
+
+	if ( sscanf( buffer, "%d hits %d misses", &hits, &misses ) != 2 ) {
+		hits = misses = 0;
+	}
+
+	if ( hit ) {
+		hits++;
+	} else {
+		misses++;
+	}
+
+	length = snprintf( buffer, sizeof ( buffer ), "%10d hits %10d misses\n", hits, misses );
+
+	if ( lseek( fd, 0, SEEK_SET ) == 0 && write( fd, buffer, length ) != length ) {
+		Com_Printf( "WARNING: Could not update '%s'.\n", filename );
+	}
+
+#ifndef _WIN32
+	lock.l_type = F_UNLCK;
+	fcntl( fd, F_SETLK, &lock );
+#endif
+	FS_Close( fd );
+
+	Com_Printf( "Conversion cache %s (%d hits, %d misses total).\n", hit ? "hit" : "miss", hits, misses );
+}
@@ -0,0 +1,128 @@
+/*
+===========================================================================
+Copyright (C) 2015 Zack Middleton
+
+This file is part of BSP sekai Source Code.
+
+BSP sekai Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+BSP sekai Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with BSP sekai Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, BSP sekai Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+
+// hash.c -- fast 64-bit content hash (same output as XXH64)
+
+#include "q_shared.h"
+#include "qcommon.h"
+
+#define PRIME64_1	0x9E3779B185EBCA87ULL
+#define PRIME64_2	0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3	0x165667B19E3779F9ULL
+#define PRIME64_4	0x85EBCA77C2B2AE63ULL
+#define PRIME64_5	0x27D4EB2F165667C5ULL
+
+#define rotl64(x,s) (((x)<<(s)) | ((x)>>(64-(s))))
+
+// FIXME: assumes host is little endian, like LittleLong
+static uint64_t Read64( const byte *p ) {
+	uint64_t v;
+
+	Com_Memcpy( &v, p, 8 );
+	return v;
+}
+
+static uint32_t Read32( const byte *p ) {
+	uint32_t v;
+
+	Com_Memcpy( &v, p, 4 );
+	return v;
+}
+
+static uint64_t HashRound( uint64_t acc, uint64_t input ) {
+	acc += input * PRIME64_2;
+	acc = rotl64( acc, 31 );
+	acc *= PRIME64_1;
+	return acc;
+}
+
+static uint64_t HashMerge( uint64_t acc, uint64_t val ) {
+	acc ^= HashRound( 0, val );
+	acc = acc * PRIME64_1 + PRIME64_4;
+	return acc;
+}
+
+uint64_t Com_Hash64( const void *buffer, size_t length, uint64_t seed ) {
+	const byte *p = buffer;
+	const byte *end = p + length;
+	uint64_t h;
+
+	if ( length >= 32 ) {
+		const byte *limit = end - 32;
+		uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+		uint64_t v2 = seed + PRIME64_2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - PRIME64_1;
+
+		do {
+			v1 = HashRound( v1, Read64( p ) );
+			v2 = HashRound( v2, Read64( p + 8 ) );
+			v3 = HashRound( v3, Read64( p + 16 ) );
+			v4 = HashRound( v4, Read64( p + 24 ) );
+			p += 32;
+		} while ( p <= limit );
+
+		h = rotl64( v1, 1 ) + rotl64( v2, 7 ) + rotl64( v3, 12 ) + rotl64( v4, 18 );
+		h = HashMerge( h, v1 );
+		h = HashMerge( h, v2 );
+		h = HashMerge( h, v3 );
+		h = HashMerge( h, v4 );
+	} else {
+		h = seed + PRIME64_5;
+	}
+
+	h += (uint64_t) length;
+
+	while ( p + 8 <= end ) {
+		h ^= HashRound( 0, Read64( p ) );
+		h = rotl64( h, 27 ) * PRIME64_1 + PRIME64_4;
+		p += 8;
+	}
+
+	if ( p + 4 <= end ) {
+		h ^= (uint64_t) Read32( p ) * PRIME64_1;
+		h = rotl64( h, 23 ) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+
+	while ( p < end ) {
+		h ^= (*p) * PRIME64_5;
+		h = rotl64( h, 11 ) * PRIME64_1;
+		p++;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+
+	return h;
+}
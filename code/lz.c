@@ -0,0 +1,279 @@
+/*
+===========================================================================
+Copyright (C) 2015 Zack Middleton
+
+This file is part of BSP sekai Source Code.
+
+BSP sekai Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+BSP sekai Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with BSP sekai Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, BSP sekai Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+
+// lz.c -- fast LZ77 block compression (LZ4 style block format)
+//
+// A block is a list of sequences. Each sequence is a token byte (literal
+// count in the high 4 bits, match length - 4 in the low 4 bits), extra
+// literal count bytes if the count is 15, the literals, a 2 byte little
+// endian match offset, and extra match length bytes if the length is 15.
+// Extra length bytes are added until a byte is less than 255. The last
+// sequence only has literals; the last 5 bytes are always literals and the
+// last match starts at least 12 bytes before the end of the block.
+
+#include "q_shared.h"
+#include "qcommon.h"
+
+#define LZ_MIN_MATCH		4
+#define LZ_LAST_LITERALS	5
+#define LZ_MF_LIMIT			12
+#define LZ_MAX_OFFSET		65535
+#define LZ_HASH_LOG			16
+#define LZ_SKIP_TRIGGER		6	// step up after 1 << LZ_SKIP_TRIGGER misses
+
+// FIXME: assumes host is little endian, like LittleLong
+static uint32_t Read32( const byte *p ) {
+	uint32_t v;
+
+	Com_Memcpy( &v, p, 4 );
+	return v;
+}
+
+static int Hash32( uint32_t sequence ) {
+	return ( sequence * 2654435761U ) >> ( 32 - LZ_HASH_LOG );
+}
+
+static byte *WriteLength( byte *op, int length ) {
+	while ( length >= 255 ) {
+		*op++ = 255;
+		length -= 255;
+	}
+
+	*op++ = length;
+	return op;
+}
+
+/*
+=================
+LZ_CompressBound
+
+Largest compressed size of length bytes.
+=================
+*/
+int LZ_CompressBound( int length ) {
+	return length + length / 255 + 16;
+}
+
+/*
+=================
+LZ_Compress
+
+Returns the compressed length, or -1 if it does not fit in destSize.
+=================
+*/
+int LZ_Compress( const void *source, int length, void *dest, int destSize ) {
+	const byte	*src = source;
+	byte		*op = dest;
+	byte		*oend = op + destSize;
+	int			*table;
+	int			ip, anchor, literals;
+
+	ip = 0;
+	anchor = 0;
+
+	if ( length >= LZ_MF_LIMIT ) {
+		int matchLimit = length - LZ_LAST_LITERALS;
+		int misses = 0;
+
+		// positions are stored + 1 so zero is empty
+		table = calloc( 1 << LZ_HASH_LOG, sizeof ( int ) );
+
+		while ( ip < length - LZ_MF_LIMIT ) {
+			uint32_t	sequence = Read32( src + ip );
+			int			h = Hash32( sequence );
+			int			ref = table[h] - 1;
+			int			matchLength;
+
+			table[h] = ip + 1;
+
+			if ( ref < 0 || ip - ref > LZ_MAX_OFFSET || Read32( src + ref ) != sequence ) {
+				ip += 1 + ( misses++ >> LZ_SKIP_TRIGGER );
+				continue;
+			}
+
+			misses = 0;
+
+			// extend the match forward and backward
+			matchLength = LZ_MIN_MATCH;
+			while ( ip + matchLength < matchLimit && src[ref + matchLength] == src[ip + matchLength] ) {
+				matchLength++;
+			}
+
+			while ( ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1] ) {
+				ip--;
+				ref--;
+				matchLength++;
+			}
+
+			literals = ip - anchor;
+
+			if ( op + 1 + literals + literals / 255 + 1 + 2 + matchLength / 255 + 1 > oend ) {
+				free( table );
+				return -1;
+			}
+
+			// token, literals, offset, match length
+			*op = ( MIN( literals, 15 ) << 4 ) | MIN( matchLength - LZ_MIN_MATCH, 15 );
+			op++;
+
+			if ( literals >= 15 ) {
+				op = WriteLength( op, literals - 15 );
+			}
+
+			Com_Memcpy( op, src + anchor, literals );
+			op += literals;
+
+			op[0] = ( ip - ref ) & 0xff;
+			op[1] = ( ip - ref ) >> 8;
+			op += 2;
+
+			if ( matchLength - LZ_MIN_MATCH >= 15 ) {
+				op = WriteLength( op, matchLength - LZ_MIN_MATCH - 15 );
+			}
+
+			ip += matchLength;
+			anchor = ip;
+		}
+
+		free( table );
+	}
+
+	// last literals
+	literals = length - anchor;
+
+	if ( op + 1 + literals + literals / 255 + 1 > oend ) {
+		return -1;
+	}
+
+	*op++ = MIN( literals, 15 ) << 4;
+
+	if ( literals >= 15 ) {
+		op = WriteLength( op, literals - 15 );
+	}
+
+	Com_Memcpy( op, src + anchor, literals );
+	op += literals;
+
+	return op - (byte *)dest;
+}
+
+/*
+=================
+LZ_Decompress
+
+Returns length, or -1 if source is corrupt or does not decompress to
+exactly length bytes.
+=================
+*/
+int LZ_Decompress( const void *source, int sourceLength, void *dest, int length ) {
+	const byte	*ip = source;
+	const byte	*iend = ip + sourceLength;
+	byte		*op = dest;
+	byte		*oend = op + length;
+
+	while ( ip < iend ) {
+		int token = *ip++;
+		int literals = token >> 4;
+		int matchLength = token & 15;
+		int offset;
+
+		if ( literals == 15 ) {
+			int b;
+
+			do {
+				if ( ip >= iend ) {
+					return -1;
+				}
+				b = *ip++;
+				literals += b;
+			} while ( b == 255 );
+		}
+
+		if ( literals > iend - ip || literals > oend - op ) {
+			return -1;
+		}
+
+		Com_Memcpy( op, ip, literals );
+		ip += literals;
+		op += literals;
+
+		// last sequence has no match
+		if ( ip == iend ) {
+			break;
+		}
+
+		if ( iend - ip < 2 ) {
+			return -1;
+		}
+
+		offset = ip[0] | ( ip[1] << 8 );
+		ip += 2;
+
+		if ( offset == 0 || offset > op - (byte *)dest ) {
+			return -1;
+		}
+
+		if ( matchLength == 15 ) {
+			int b;
+
+			do {
+				if ( ip >= iend ) {
+					return -1;
+				}
+				b = *ip++;
+				matchLength += b;
+			} while ( b == 255 );
+		}
+
+		matchLength += LZ_MIN_MATCH;
+
+		if ( matchLength > oend - op ) {
+			return -1;
+		}
+
+		if ( offset >= matchLength ) {
+			Com_Memcpy( op, op - offset, matchLength );
+			op += matchLength;
+		} else {
+			// overlapping match repeats the last offset bytes
+			const byte *match = op - offset;
+
+			while ( matchLength-- ) {
+				*op++ = *match++;
+			}
+		}
+	}
+
+	if ( op != oend ) {
+		return -1;
+	}
+
+	return length;
+}
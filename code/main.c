@@ -31,21 +31,644 @@ Suite 120, Rockville, Maryland 20850 USA.
 #include "sekai.h"
 #include "bsp.h"
 
-// convert_nsco.c
-void ConvertNscoToNscoET( bspFile_t *bsp );
-void ConvertNscoETToNsco( bspFile_t *bsp );
+#include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <time.h>
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+static qboolean GetConversion( const char *conversion, const bspPass_t **pass ) {
+	if ( Q_stricmp( conversion, "none" ) == 0 ) {
+		*pass = NULL;
+		return qtrue;
+	}
+
+	*pass = BSP_FindPass( conversion );
+
+	if ( !*pass || !(*pass)->conversion ) {
+		Com_Printf( "Error: Unknown conversion '%s'.\n", conversion );
+		return qfalse;
+	}
+
+	return qtrue;
+}
+
+static bspFormat_t *GetFormat( const char *formatName ) {
+	bspFormat_t *format = BSP_FormatForName( formatName );
+
+	if ( !format ) {
+		Com_Printf( "Error: Unknown format '%s'.\n", formatName );
+	}
+
+	return format;
+}
+
+#define MAX_OUTPUTS 16
+
+typedef struct {
+	bspFormat_t		*format;
+	const char		*filename;
+	const bspPass_t	*conversion;
+	const char		*conversionName;
+	qboolean		convertShaders;	// conversion isn't in the shared passes, convert a copy of the shaders
+	bspPipeline_t	pipeline;		// conversion and passes, for streaming
+	const bspFile_t	*bsp;
+	uint64_t		cacheKey;
+	qboolean		save;		// not fetched from the cache
+	qboolean		threaded;
+	void			*saveData;
+	int				saveLength;
+	qboolean		saved;
+} output_t;
+
+// saves and writes one output, the BSP is shared with the other outputs and is not modified
+static void *SaveOutput( void *arg ) {
+	output_t *output = arg;
+	bspFile_t converted;
+
+	TRACE_BEGIN_FILE( "SaveOutput", output->filename );
+
+	output->saveData = NULL;
+
+	if ( output->convertShaders ) {
+		// the output's own shader table, the other arrays are shared
+		converted = *output->bsp;
+		converted.shaders = malloc( ( converted.numShaders + 1 ) * sizeof ( *converted.shaders ) );
+		Com_Memcpy( converted.shaders, output->bsp->shaders, converted.numShaders * sizeof ( *converted.shaders ) );
+
+		output->conversion->passFunc( &converted );
+		output->saveLength = output->format->saveFunction( output->format, output->filename, &converted, &output->saveData );
+
+		free( converted.shaders );
+	} else {
+		output->saveLength = output->format->saveFunction( output->format, output->filename, output->bsp, &output->saveData );
+	}
+
+	// output may be a hard link to a cache entry, don't write through it
+	remove( output->filename );
+
+	output->saved = ( output->saveData && FS_WriteFile( output->filename, output->saveData, output->saveLength ) == output->saveLength );
+
+	TRACE_END( "SaveOutput" );
+
+	return NULL;
+}
+
+// bspsekai inplace <conversion> <BSP> [<entity-file>]
+static int InPlace( int argc, char **argv ) {
+	bspFile_t *bsp;
+	char *inputFile, *entityFile;
+	const bspPass_t *conversion;
+	int lumpMask;
+	struct stat st;
+	byte header[64];
+	int fd, headerLength;
+
+	if ( argc < 4 ) {
+		Com_Printf( "bspsekai inplace <conversion> <BSP> [<entity-file>]\n" );
+		return 1;
+	}
+
+	if ( !GetConversion( argv[2], &conversion ) ) {
+		return 1;
+	}
+
+	inputFile = argv[3];
+	entityFile = ( argc > 4 ) ? argv[4] : NULL;
+
+#ifndef _WIN32
+	// a hard link would modify the other copies too (such as a conversion cache entry)
+	if ( stat( inputFile, &st ) == 0 && st.st_nlink > 1 ) {
+		Com_Printf( "Error: '%s' has multiple hard links, copy it before updating in place.\n", inputFile );
+		return 1;
+	}
+#endif
+
+	fd = FS_Open( inputFile, qfalse );
+	if ( fd != -1 ) {
+		headerLength = FS_Pread( fd, header, sizeof ( header ), 0 );
+		FS_Close( fd );
+
+		if ( BSP_IsArchive( header, headerLength ) ) {
+			Com_Printf( "Error: '%s' is a BSP archive, extract it before updating in place.\n", inputFile );
+			return 1;
+		}
+	}
+
+	// finish or roll back an interrupted update before reading the file
+	if ( !BSP_RecoverPatch( inputFile ) ) {
+		return 1;
+	}
+
+	// only entities and shaders can be updated
+	bsp = BSP_LoadLumps( inputFile, BSPLUMP_BIT( BSPLUMP_ENTITIES ) | BSPLUMP_BIT( BSPLUMP_SHADERS ) );
+
+	if ( !bsp ) {
+		Com_Printf( "Error: Could not read file '%s'\n", inputFile );
+		return 1;
+	}
+
+	Com_Printf( "Loaded BSP '%s' successfully.\n", inputFile );
+
+	if ( !bsp->format->patchFunction ) {
+		Com_Printf( "BSP format for '%s' does not support in-place updates.\n", bsp->format->gameName );
+		BSP_Free( bsp );
+		return 1;
+	}
+
+	lumpMask = 0;
+
+	if ( conversion ) {
+		conversion->passFunc( bsp );
+		lumpMask |= BSPLUMP_BIT( BSPLUMP_SHADERS );
+	}
+
+	if ( entityFile ) {
+		void *entities;
+		long length;
+
+		length = FS_ReadFile( entityFile, &entities );
+
+		if ( !entities ) {
+			Com_Printf( "Error: Could not read file '%s'\n", entityFile );
+			BSP_Free( bsp );
+			return 1;
+		}
+
+		// entity string is null terminated in the BSP, it may point into the file image
+		BSP_FreeArray( bsp, bsp->entityString );
+		bsp->entityString = malloc( length + 1 );
+		Com_Memcpy( bsp->entityString, entities, length );
+		bsp->entityStringLength = length;
+		if ( length == 0 || bsp->entityString[length-1] != '\0' ) {
+			bsp->entityString[bsp->entityStringLength++] = '\0';
+		}
+
+		FS_FreeFile( entities );
+
+		lumpMask |= BSPLUMP_BIT( BSPLUMP_ENTITIES );
+	}
+
+	if ( !lumpMask ) {
+		Com_Printf( "Nothing to update.\n" );
+		BSP_Free( bsp );
+		return 0;
+	}
+
+	if ( !bsp->format->patchFunction( bsp->format, inputFile, bsp, lumpMask ) ) {
+		Com_Printf( "Updating BSP '%s' failed.\n", inputFile );
+		BSP_Free( bsp );
+		return 1;
+	}
+
+	BSP_Free( bsp );
+
+	return 0;
+}
+
+// bspsekai diff <old-BSP> <new-BSP> <patch>
+static int Diff( int argc, char **argv ) {
+	void *oldData, *newData, *patchData;
+	long oldLength, newLength;
+	int patchLength;
+
+	if ( argc < 5 ) {
+		Com_Printf( "bspsekai diff <old-BSP> <new-BSP> <patch>\n" );
+		return 1;
+	}
+
+	oldLength = FS_ReadFile( argv[2], &oldData );
+	if ( !oldData ) {
+		Com_Printf( "Error: Could not read file '%s'\n", argv[2] );
+		return 1;
+	}
+
+	newLength = FS_ReadFile( argv[3], &newData );
+	if ( !newData ) {
+		Com_Printf( "Error: Could not read file '%s'\n", argv[3] );
+		FS_FreeFile( oldData );
+		return 1;
+	}
+
+	patchLength = BSP_Diff( oldData, oldLength, newData, newLength, &patchData );
+
+	FS_FreeFile( oldData );
+	FS_FreeFile( newData );
+
+	if ( patchLength < 0 ) {
+		Com_Printf( "Creating patch failed.\n" );
+		return 1;
+	}
+
+	if ( FS_WriteFile( argv[4], patchData, patchLength ) != patchLength ) {
+		Com_Printf( "Error: Could not write file '%s'\n", argv[4] );
+		free( patchData );
+		return 1;
+	}
+
+	Com_Printf( "Saved patch '%s' successfully (%d bytes, %.1f%% of new BSP).\n", argv[4], patchLength,
+				newLength ? patchLength * 100.0f / newLength : 0.0f );
+
+	free( patchData );
+	return 0;
+}
+
+// bspsekai patch <old-BSP> <patch> <new-BSP>
+static int Patch( int argc, char **argv ) {
+	void *oldData, *patchData, *newData;
+	long oldLength, patchLength;
+	int newLength;
+
+	if ( argc < 5 ) {
+		Com_Printf( "bspsekai patch <old-BSP> <patch> <new-BSP>\n" );
+		return 1;
+	}
+
+	oldLength = FS_ReadFile( argv[2], &oldData );
+	if ( !oldData ) {
+		Com_Printf( "Error: Could not read file '%s'\n", argv[2] );
+		return 1;
+	}
+
+	patchLength = FS_ReadFile( argv[3], &patchData );
+	if ( !patchData ) {
+		Com_Printf( "Error: Could not read file '%s'\n", argv[3] );
+		FS_FreeFile( oldData );
+		return 1;
+	}
+
+	newLength = BSP_ApplyPatch( oldData, oldLength, patchData, patchLength, &newData );
+
+	FS_FreeFile( oldData );
+	FS_FreeFile( patchData );
+
+	if ( newLength < 0 ) {
+		Com_Printf( "Applying patch failed.\n" );
+		return 1;
+	}
+
+	// output may be a hard link to a cache entry, don't write through it
+	remove( argv[4] );
+
+	if ( FS_WriteFile( argv[4], newData, newLength ) != newLength ) {
+		Com_Printf( "Error: Could not write file '%s'\n", argv[4] );
+		free( newData );
+		return 1;
+	}
+
+	Com_Printf( "Saved BSP '%s' successfully.\n", argv[4] );
+
+	free( newData );
+	return 0;
+}
+
+// bspsekai scan <directory> <index>
+static int Scan( int argc, char **argv ) {
+	if ( argc < 4 ) {
+		Com_Printf( "bspsekai scan <directory> <index>\n" );
+		return 1;
+	}
+
+	return BSP_ScanIndex( argv[2], argv[3] ) ? 0 : 1;
+}
+
+// bspsekai [-passes <pass>,...] watch <conversion> <source-dir> <format> <output-dir>
+static int Watch( int argc, char **argv, const char *passList ) {
+	const bspPass_t *conversion;
+	bspFormat_t *format;
+	bspPipeline_t pipeline;
+
+	if ( argc < 6 ) {
+		Com_Printf( "bspsekai [-passes <pass>,...] watch <conversion> <source-dir> <format> <output-dir>\n" );
+		return 1;
+	}
+
+	if ( !GetConversion( argv[2], &conversion ) ) {
+		return 1;
+	}
+
+	format = GetFormat( argv[4] );
+	if ( !format ) {
+		return 1;
+	}
+
+	if ( !format->saveFunction ) {
+		Com_Printf( "BSP format for '%s' does not support saving.\n", format->gameName );
+		return 1;
+	}
+
+	Com_Memset( &pipeline, 0, sizeof ( pipeline ) );
+
+	if ( conversion && !BSP_AddPass( &pipeline, conversion ) ) {
+		return 1;
+	}
+
+	if ( passList && !BSP_AddPasses( &pipeline, passList ) ) {
+		return 1;
+	}
+
+	return BSP_Watch( argv[3], argv[5], format, &pipeline ) ? 0 : 1;
+}
+
+// bspsekai daemon <socket> [<maps to keep>]
+static int Daemon( int argc, char **argv ) {
+	if ( argc < 3 ) {
+		Com_Printf( "bspsekai daemon <socket> [<maps to keep>]\n" );
+		return 1;
+	}
+
+	return BSP_Daemon( argv[2], ( argc > 3 ) ? atoi( argv[3] ) : 8 ) ? 0 : 1;
+}
+
+// bspsekai send <socket> <request> [<argument> ...]
+static int Send( int argc, char **argv ) {
+	if ( argc < 4 ) {
+		Com_Printf( "bspsekai send <socket> <request> [<argument> ...]\n" );
+		return 1;
+	}
+
+	return BSP_DaemonSend( argv[2], argv[3], (const char **)&argv[4], argc - 4 );
+}
+
+// bspsekai query <index> [<filter> ...]
+static int Query( int argc, char **argv ) {
+	if ( argc < 3 ) {
+		Com_Printf( "bspsekai query <index> [<filter> ...]\n" );
+		return 1;
+	}
+
+	return BSP_QueryIndex( argv[2], (const char **)&argv[3], argc - 3 ) >= 0 ? 0 : 1;
+}
+
+// bspsekai bspk <BSP> [<BSP> ...]
+static int Bspk( int argc, char **argv ) {
+	bspFile_t *bsp;
+	int i, failed;
+
+	if ( argc < 3 ) {
+		Com_Printf( "bspsekai bspk <BSP> [<BSP> ...]\n" );
+		return 1;
+	}
+
+	failed = 0;
+
+	for ( i = 2; i < argc; i++ ) {
+		bsp = BSP_Load( argv[i] );
+
+		if ( !bsp ) {
+			Com_Printf( "Error: Could not read file '%s'\n", argv[i] );
+			failed++;
+			continue;
+		}
+
+		if ( bsp->mappedData ) {
+			Com_Printf( "'%s' is up to date.\n", argv[i] );
+		} else if ( BSP_SaveBspk( bsp ) ) {
+			Com_Printf( "Saved .bspk for '%s' successfully.\n", argv[i] );
+		} else {
+			failed++;
+		}
+
+		BSP_Free( bsp );
+	}
+
+	return failed ? 1 : 0;
+}
+
+// bspsekai archive <BSP> <archive>
+static int Archive( int argc, char **argv ) {
+	void *data, *archiveData;
+	long length;
+	int archiveLength;
+
+	if ( argc < 4 ) {
+		Com_Printf( "bspsekai archive <BSP> <archive>\n" );
+		return 1;
+	}
+
+	length = FS_ReadFile( argv[2], &data );
+	if ( !data ) {
+		Com_Printf( "Error: Could not read file '%s'\n", argv[2] );
+		return 1;
+	}
+
+	if ( BSP_IsArchive( data, length ) ) {
+		Com_Printf( "Error: '%s' is already a BSP archive\n", argv[2] );
+		FS_FreeFile( data );
+		return 1;
+	}
+
+	archiveLength = BSP_CompressArchive( data, length, &archiveData );
+
+	FS_FreeFile( data );
+
+	if ( archiveLength < 0 ) {
+		Com_Printf( "Creating archive failed.\n" );
+		return 1;
+	}
+
+	remove( argv[3] );
+
+	if ( FS_WriteFile( argv[3], archiveData, archiveLength ) != archiveLength ) {
+		Com_Printf( "Error: Could not write file '%s'\n", argv[3] );
+		free( archiveData );
+		return 1;
+	}
+
+	Com_Printf( "Saved archive '%s' successfully (%d bytes, %.1f%% of BSP).\n", argv[3], archiveLength,
+				length ? archiveLength * 100.0f / length : 0.0f );
+
+	free( archiveData );
+	return 0;
+}
+
+// bspsekai extract <archive> <BSP>
+static int Extract( int argc, char **argv ) {
+	void *archiveData, *data;
+	long archiveLength;
+	int length;
+
+	if ( argc < 4 ) {
+		Com_Printf( "bspsekai extract <archive> <BSP>\n" );
+		return 1;
+	}
+
+	archiveLength = FS_ReadFile( argv[2], &archiveData );
+	if ( !archiveData ) {
+		Com_Printf( "Error: Could not read file '%s'\n", argv[2] );
+		return 1;
+	}
+
+	if ( !BSP_IsArchive( archiveData, archiveLength ) ) {
+		Com_Printf( "Error: '%s' is not a BSP archive\n", argv[2] );
+		FS_FreeFile( archiveData );
+		return 1;
+	}
+
+	data = BSP_ExtractArchive( archiveData, archiveLength, &length );
+
+	FS_FreeFile( archiveData );
+
+	if ( !data ) {
+		Com_Printf( "Error: Corrupt BSP archive '%s'\n", argv[2] );
+		return 1;
+	}
+
+	// output may be a hard link to a cache entry, don't write through it
+	remove( argv[3] );
+
+	if ( FS_WriteFile( argv[3], data, length ) != length ) {
+		Com_Printf( "Error: Could not write file '%s'\n", argv[3] );
+		free( data );
+		return 1;
+	}
+
+	Com_Printf( "Saved BSP '%s' successfully.\n", argv[3] );
+
+	free( data );
+	return 0;
+}
 
 int main( int argc, char **argv ) {
 	bspFile_t *bsp;
-	int saveLength;
-	void *saveData;
-	char *conversion, *inputFile, *formatName, *outputFile;
-	bspFormat_t *outFormat;
-	void (*convertFunc)( bspFile_t *bsp );
+	char *inputFile;
+	char *cacheDir;
+	output_t outputs[MAX_OUTPUTS];
+	pthread_t threads[MAX_OUTPUTS];
+	int numOutputs, numSaves;
+	const bspPass_t *conversion;
+	char *passList;
+	char *weldList;
+	int streamSize;
+	int extLightmapSize;
+	byte *atlasData;
+	int numAtlases;
+	bspPipeline_t pipeline, passes;
+	qboolean writeBspk;
+	int i, j;
+
+	cacheDir = NULL;
+	passList = NULL;
+	weldList = NULL;
+	streamSize = 0;
+	extLightmapSize = 0;
+	writeBspk = qfalse;
+
+	while ( argc >= 3 && argv[1][0] == '-' ) {
+		if ( Q_stricmp( argv[1], "-cache" ) == 0 ) {
+			cacheDir = argv[2];
+			argv++;
+			argc--;
+		} else if ( Q_stricmp( argv[1], "-bspk" ) == 0 ) {
+			writeBspk = qtrue;
+		} else if ( Q_stricmp( argv[1], "-stream" ) == 0 ) {
+			streamSize = atoi( argv[2] );
+			if ( streamSize <= 0 || streamSize > 1024 ) {
+				Com_Printf( "Error: -stream size must be between 1 and 1024 MB.\n" );
+				return 1;
+			}
+			argv++;
+			argc--;
+		} else if ( Q_stricmp( argv[1], "-passes" ) == 0 || Q_stricmp( argv[1], "--passes" ) == 0 ) {
+			passList = argv[2];
+			argv++;
+			argc--;
+		} else if ( Q_stricmp( argv[1], "-weld" ) == 0 ) {
+			weldList = argv[2];
+			if ( !BSP_SetWeldTolerances( weldList ) ) {
+				return 1;
+			}
+			argv++;
+			argc--;
+		} else if ( Q_stricmp( argv[1], "-extlightmaps" ) == 0 ) {
+			extLightmapSize = atoi( argv[2] );
+			if ( extLightmapSize < 128 || extLightmapSize > 4096 || ( extLightmapSize & ( extLightmapSize - 1 ) ) ) {
+				Com_Printf( "Error: -extlightmaps size must be a power of two between 128 and 4096.\n" );
+				return 1;
+			}
+			argv++;
+			argc--;
+		} else if ( Q_stricmp( argv[1], "-trace" ) == 0 ) {
+#ifdef SEKAI_TRACE
+			Trace_Init( argv[2] );
+#else
+			Com_Printf( "WARNING: -trace is ignored, bspsekai was built without SEKAI_TRACE.\n" );
+#endif
+			argv++;
+			argc--;
+		} else {
+			break;
+		}
+
+		argv++;
+		argc--;
+	}
+
+	if ( argc >= 2 && Q_stricmp( argv[1], "inplace" ) == 0 ) {
+		return InPlace( argc, argv );
+	}
+
+	if ( argc >= 2 && Q_stricmp( argv[1], "diff" ) == 0 ) {
+		return Diff( argc, argv );
+	}
+
+	if ( argc >= 2 && Q_stricmp( argv[1], "patch" ) == 0 ) {
+		return Patch( argc, argv );
+	}
+
+	if ( argc >= 2 && Q_stricmp( argv[1], "scan" ) == 0 ) {
+		return Scan( argc, argv );
+	}
+
+	if ( argc >= 2 && Q_stricmp( argv[1], "query" ) == 0 ) {
+		return Query( argc, argv );
+	}
+
+	if ( argc >= 2 && Q_stricmp( argv[1], "watch" ) == 0 ) {
+		return Watch( argc, argv, passList );
+	}
+
+	if ( argc >= 2 && Q_stricmp( argv[1], "daemon" ) == 0 ) {
+		return Daemon( argc, argv );
+	}
+
+	if ( argc >= 2 && Q_stricmp( argv[1], "send" ) == 0 ) {
+		return Send( argc, argv );
+	}
+
+	if ( argc >= 2 && Q_stricmp( argv[1], "bspk" ) == 0 ) {
+		return Bspk( argc, argv );
+	}
+
+	if ( argc >= 2 && Q_stricmp( argv[1], "archive" ) == 0 ) {
+		return Archive( argc, argv );
+	}
+
+	if ( argc >= 2 && Q_stricmp( argv[1], "extract" ) == 0 ) {
+		return Extract( argc, argv );
+	}
 
 	if ( argc < 5 ) {
-		Com_Printf( "bspsekai <conversion> <input-BSP> <format> <output-BSP>\n" );
-		Com_Printf( "BSP sekai - v0.2\n" );
+		Com_Printf( "bspsekai [-cache <dir>] [-bspk] [-passes <pass>,...] [-weld <tolerances>] [-extlightmaps <size>] [-stream <MB>] [-trace <file>] <conversion> <input-BSP> <format> <output-BSP> [<format> <output-BSP> ...]\n" );
+		Com_Printf( "bspsekai inplace <conversion> <BSP> [<entity-file>]\n" );
+		Com_Printf( "bspsekai diff <old-BSP> <new-BSP> <patch>\n" );
+		Com_Printf( "bspsekai patch <old-BSP> <patch> <new-BSP>\n" );
+		Com_Printf( "bspsekai scan <directory> <index>\n" );
+		Com_Printf( "bspsekai query <index> [<filter> ...]\n" );
+		Com_Printf( "bspsekai [-passes <pass>,...] watch <conversion> <source-dir> <format> <output-dir>\n" );
+		Com_Printf( "bspsekai daemon <socket> [<maps to keep>]\n" );
+		Com_Printf( "bspsekai send <socket> <request> [<argument> ...]\n" );
+		Com_Printf( "bspsekai bspk <BSP> [<BSP> ...]\n" );
+		Com_Printf( "bspsekai archive <BSP> <archive>\n" );
+		Com_Printf( "bspsekai extract <archive> <BSP>\n" );
+		Com_Printf( "BSP sekai - v" SEKAI_VERSION "\n" );
 		Com_Printf( "Convert a BSP for use on a different engine\n" );
 		Com_Printf( "BSP conversion can lose data, keep the original BSP!\n" );
 		Com_Printf( "\n" );
@@ -55,6 +678,10 @@ int main( int argc, char **argv ) {
 		Com_Printf( "  nsco2et   - Convert Navy SEALS: Covert Operation surface/content flags to ET values.\n" );
 		Com_Printf( "  et2nsco   - Convert ET surface/content flags to Navy SEALS: Covert Operation values.\n" );
 		Com_Printf( "\n" );
+		Com_Printf( "-passes runs a comma separated list of passes after the conversion.\n" );
+		Com_Printf( "Pass list:\n" );
+		BSP_ListPasses();
+		Com_Printf( "\n" );
 		Com_Printf( "The format of <input-BSP> is automatically determined from the file.\n" );
 		Com_Printf( "Input BSP formats: (not all are fully supported)\n" );
 		Com_Printf( "  Quake 3 (including pre-releases formats), RTCW, ET, EF, EF2, FAKK, Alice, Dark Salvation, MOHAA, SoF2, JK2, JA, Iron-Grid: Warlord\n" );
@@ -71,63 +698,252 @@ int main( int argc, char **argv ) {
 		//Com_Printf( "  alice     - American McGee's Alice.\n" );
 		//Com_Printf( "  ef2       - Elite Force 2.\n" );
 		//Com_Printf( "  mohaa     - Medal of Honor Allied Assult.\n" );
+		Com_Printf( "\n" );
+		Com_Printf( "Several <format> <output-BSP> pairs can be given, <input-BSP> is loaded once and\n" );
+		Com_Printf( "the outputs are saved in parallel. <format>:<conversion> uses a different conversion\n" );
+		Com_Printf( "for one output, such as 'et:nsco2et'.\n" );
+		Com_Printf( "\n" );
+		Com_Printf( "-weld <xyz>,<st>,<lightmap>,<normal>,<color> sets how close vertexes must be\n" );
+		Com_Printf( "for the weld pass to merge them (default 0.001,0.00001,0.00001,0.0001,0).\n" );
+		Com_Printf( "\n" );
+		Com_Printf( "-extlightmaps <size> packs the lightmaps into <size>x<size> atlases (such as 1024\n" );
+		Com_Printf( "or 2048) written to <output-BSP> without its extension/lm_XXXX.tga instead of the BSP.\n" );
+		Com_Printf( "\n" );
+		Com_Printf( "-stream <MB> copies lumps <MB> at a time when <input-BSP> and <format> store them\n" );
+		Com_Printf( "the same way (such as quake3, rtcw, et, and darks) instead of loading the BSP.\n" );
+		Com_Printf( "\n" );
+		Com_Printf( "-trace <file> writes a Chrome trace (for chrome://tracing or ui.perfetto.dev) of\n" );
+		Com_Printf( "the threads when bspsekai exits. Requires building with SEKAI_TRACE.\n" );
+		Com_Printf( "\n" );
+		Com_Printf( "inplace rewrites the shader lump (and entity lump, if <entity-file> is given) of\n" );
+		Com_Printf( "<BSP> without writing the rest of the file. A journal is kept while updating.\n" );
+		Com_Printf( "\n" );
+		Com_Printf( "-cache <dir> keeps converted BSPs in <dir>, keyed by the input file contents,\n" );
+		Com_Printf( "conversion, format, and bspsekai version. Unchanged maps are linked from the cache.\n" );
+		Com_Printf( "\n" );
+		Com_Printf( "diff writes a patch that rebuilds <new-BSP> from <old-BSP>, patch applies it.\n" );
+		Com_Printf( "Both BSPs must use the same format.\n" );
+		Com_Printf( "\n" );
+		Com_Printf( "scan adds BSPs in <directory> to <index>, unchanged files are not read again.\n" );
+		Com_Printf( "query lists BSPs in <index> matching all filters: format=<name>, shader=<text>,\n" );
+		Com_Printf( "hash=<hex>, size<op><bytes>, or <lump><op><count> where op is <, >, or =.\n" );
+		Com_Printf( "\n" );
+		Com_Printf( "watch converts BSPs in <source-dir> to <format> in <output-dir> when they are\n" );
+		Com_Printf( "written (Linux only). Files with the same contents as their last conversion are skipped.\n" );
+		Com_Printf( "\n" );
+		Com_Printf( "daemon serves requests on a UNIX domain socket and keeps up to <maps to keep>\n" );
+		Com_Printf( "(default 8) recently used maps loaded. send makes a request, which is one of:\n" );
+		Com_Printf( "  load <BSP>, query <BSP>, save <BSP> <format> <output-BSP>, or\n" );
+		Com_Printf( "  convert <conversion> <pass>,... <BSP> <format> <output-BSP>\n" );
+		Com_Printf( "\n" );
+		Com_Printf( "bspk writes <BSP>k, a loaded copy of <BSP> that is memory mapped instead of parsed\n" );
+		Com_Printf( "while <BSP> is unchanged. -bspk writes it for <input-BSP> while converting.\n" );
+		Com_Printf( "\n" );
+		Com_Printf( "archive compresses each lump of <BSP> separately, extract restores the BSP.\n" );
+		Com_Printf( "Archives can be used as <input-BSP> without extracting them.\n" );
 		return 0;
 	}
 
-	conversion = argv[1];
 	inputFile = argv[2];
-	formatName = argv[3];
-	outputFile = argv[4];
 
-	if ( Q_stricmp( conversion, "none" ) == 0 ) {
-		convertFunc = NULL;
-	} else if ( Q_stricmp( conversion, "nsco2et" ) == 0 ) {
-		convertFunc = ConvertNscoToNscoET;
-	} else if ( Q_stricmp( conversion, "et2nsco" ) == 0 ) {
-		convertFunc = ConvertNscoETToNsco;
-	} else {
-		Com_Printf( "Error: Unknown conversion '%s'.\n", conversion );
+	if ( ( argc - 3 ) % 2 != 0 ) {
+		Com_Printf( "Error: missing <output-BSP> for format '%s'.\n", argv[argc-1] );
 		return 1;
 	}
 
-	if ( Q_stricmp( formatName, "quake3" ) == 0 ) {
-		outFormat = &quake3BspFormat;
-	} else if ( Q_stricmp( formatName, "rtcw" ) == 0 ) {
-		outFormat = &wolfBspFormat;
-	} else if ( Q_stricmp( formatName, "et" ) == 0 ) {
-		// ZTM: TODO: This need to be a different format than RTCW so that there is a different save function; so that converting et maps to rtcw can convert foliage
-		outFormat = &wolfBspFormat;
-	} else if ( Q_stricmp( formatName, "darks" ) == 0 ) {
-		outFormat = &darksBspFormat;
-	} else if ( Q_stricmp( formatName, "rbsp" ) == 0 ) {
-		outFormat = &sof2BspFormat;
-	} else if ( Q_stricmp( formatName, "fakk" ) == 0 ) {
-		outFormat = &fakkBspFormat;
-	} else if ( Q_stricmp( formatName, "alice" ) == 0 ) {
-		outFormat = &aliceBspFormat;
-	} else if ( Q_stricmp( formatName, "ef2" ) == 0 ) {
-		outFormat = &ef2BspFormat;
-	} else if ( Q_stricmp( formatName, "mohaa" ) == 0 ) {
-		outFormat = &mohaaBspFormat;
-	} else if ( Q_stricmp( formatName, "q3test106" ) == 0 ) {
-		outFormat = &q3Test106BspFormat;
-	} else {
-		Com_Printf( "Error: Unknown format '%s'.\n", formatName );
+	numOutputs = ( argc - 3 ) / 2;
+
+	if ( numOutputs > MAX_OUTPUTS ) {
+		Com_Printf( "Error: too many outputs (max %d).\n", MAX_OUTPUTS );
 		return 1;
 	}
 
-	if ( Q_stricmp( inputFile, "-" ) == 0 || Q_stricmp( outputFile, "-" ) == 0 ) {
-		Com_Printf( "Error: reading / writing to stdout is not supported.\n" );
+	if ( !GetConversion( argv[1], &conversion ) ) {
 		return 1;
 	}
 
-	// this will work, but might result in user overwritting original BSP without backup. so let's baby the user. >.>
-	if ( Q_stricmp( inputFile, outputFile ) == 0 ) {
-		Com_Printf( "Error: same input and output file (exiting to avoid data lose)\n" );
+	Com_Memset( &passes, 0, sizeof ( passes ) );
+
+	if ( passList && !BSP_AddPasses( &passes, passList ) ) {
 		return 1;
 	}
 
-	bsp = BSP_Load( inputFile );
+	Com_Memset( outputs, 0, sizeof ( outputs ) );
+
+	for ( i = 0; i < numOutputs; i++ ) {
+		char *outputConversion;
+
+		// <format>:<conversion> overrides <conversion> for this output
+		outputConversion = strchr( argv[3 + i * 2], ':' );
+		if ( outputConversion ) {
+			*outputConversion++ = '\0';
+		}
+
+		outputs[i].format = GetFormat( argv[3 + i * 2] );
+		outputs[i].filename = argv[4 + i * 2];
+		outputs[i].conversion = conversion;
+		outputs[i].conversionName = argv[1];
+
+		if ( !outputs[i].format ) {
+			return 1;
+		}
+
+		if ( outputConversion ) {
+			if ( !GetConversion( outputConversion, &outputs[i].conversion ) ) {
+				return 1;
+			}
+			outputs[i].conversionName = outputConversion;
+		}
+
+		if ( outputs[i].conversion && !BSP_AddPass( &outputs[i].pipeline, outputs[i].conversion ) ) {
+			return 1;
+		}
+
+		for ( j = 0; j < passes.numPasses; j++ ) {
+			if ( !BSP_AddPass( &outputs[i].pipeline, passes.passes[j] ) ) {
+				return 1;
+			}
+		}
+	}
+
+	// run a conversion that all outputs use once with the passes, otherwise
+	// each output converts its own copy of the shaders after the passes
+	for ( i = 1; i < numOutputs; i++ ) {
+		if ( outputs[i].conversion != outputs[0].conversion ) {
+			break;
+		}
+	}
+
+	if ( i == numOutputs ) {
+		pipeline = outputs[0].pipeline;
+	} else {
+		pipeline = passes;
+
+		for ( i = 0; i < numOutputs; i++ ) {
+			outputs[i].convertShaders = ( outputs[i].conversion != NULL );
+		}
+	}
+
+	if ( Q_stricmp( inputFile, "-" ) == 0 ) {
+		Com_Printf( "Error: reading / writing to stdout is not supported.\n" );
+		return 1;
+	}
+
+	for ( i = 0; i < numOutputs; i++ ) {
+		if ( Q_stricmp( outputs[i].filename, "-" ) == 0 ) {
+			Com_Printf( "Error: reading / writing to stdout is not supported.\n" );
+			return 1;
+		}
+
+		// this will work, but might result in user overwritting original BSP without backup. so let's baby the user. >.>
+		if ( Q_stricmp( inputFile, outputs[i].filename ) == 0 ) {
+			Com_Printf( "Error: same input and output file (exiting to avoid data lose)\n" );
+			return 1;
+		}
+
+		for ( j = 0; j < i; j++ ) {
+			if ( Q_stricmp( outputs[j].filename, outputs[i].filename ) == 0 ) {
+				Com_Printf( "Error: output file '%s' is given more than once.\n", outputs[i].filename );
+				return 1;
+			}
+		}
+	}
+
+	numSaves = 0;
+
+	for ( i = 0; i < numOutputs; i++ ) {
+		if ( !outputs[i].format->saveFunction ) {
+			Com_Printf( "BSP format for '%s' does not support saving.\n", outputs[i].format->gameName );
+		} else {
+			outputs[i].save = qtrue;
+			numSaves++;
+		}
+	}
+
+	if ( !numSaves ) {
+		return 0;
+	}
+
+	// the atlases are written next to the outputs, a cached output wouldn't have them
+	if ( cacheDir && extLightmapSize ) {
+		Com_Printf( "-cache is not used with -extlightmaps.\n" );
+		cacheDir = NULL;
+	}
+
+	// copy lumps between formats that store them the same way without loading the whole BSP
+	if ( streamSize && ( cacheDir || writeBspk || extLightmapSize ) ) {
+		Com_Printf( "-stream is not used with -cache, -bspk, or -extlightmaps, loading '%s'.\n", inputFile );
+	} else if ( streamSize ) {
+		for ( i = 0; i < numOutputs; i++ ) {
+			if ( !outputs[i].save || !BSP_CanStream( inputFile, outputs[i].format, &outputs[i].pipeline ) ) {
+				continue;
+			}
+
+			if ( !BSP_Stream( inputFile, outputs[i].filename, outputs[i].format, &outputs[i].pipeline, streamSize * 1024 * 1024 ) ) {
+				return 1;
+			}
+
+			Com_Printf( "Saved BSP '%s' successfully.\n", outputs[i].filename );
+			outputs[i].save = qfalse;
+			numSaves--;
+		}
+
+		if ( !numSaves ) {
+			return 0;
+		}
+	}
+
+	if ( cacheDir ) {
+		void *inputData;
+		long inputLength;
+		char recipe[1024];
+
+		inputLength = FS_ReadFile( inputFile, &inputData );
+
+		if ( !inputData ) {
+			Com_Printf( "Error: Could not read file '%s'\n", inputFile );
+			return 1;
+		}
+
+		for ( i = 0; i < numOutputs; i++ ) {
+			if ( !outputs[i].save ) {
+				continue;
+			}
+
+			if ( passList && weldList ) {
+				snprintf( recipe, sizeof ( recipe ), "%s %s %s %d %d v%s", outputs[i].conversionName, passList, weldList, outputs[i].format->ident, outputs[i].format->version, SEKAI_VERSION );
+			} else if ( passList ) {
+				snprintf( recipe, sizeof ( recipe ), "%s %s %d %d v%s", outputs[i].conversionName, passList, outputs[i].format->ident, outputs[i].format->version, SEKAI_VERSION );
+			} else {
+				snprintf( recipe, sizeof ( recipe ), "%s %d %d v%s", outputs[i].conversionName, outputs[i].format->ident, outputs[i].format->version, SEKAI_VERSION );
+			}
+			for ( j = 0; recipe[j]; j++ ) {
+				recipe[j] = tolower( recipe[j] );
+			}
+
+			outputs[i].cacheKey = Cache_Key( inputData, inputLength, recipe );
+
+			if ( Cache_Fetch( cacheDir, outputs[i].cacheKey, outputs[i].filename ) ) {
+				Cache_Stats( cacheDir, qtrue );
+				Com_Printf( "Saved BSP '%s' successfully.\n", outputs[i].filename );
+				outputs[i].save = qfalse;
+				numSaves--;
+			} else {
+				Cache_Stats( cacheDir, qfalse );
+			}
+		}
+
+		if ( !numSaves ) {
+			FS_FreeFile( inputData );
+			return 0;
+		}
+
+		bsp = BSP_LoadData( inputFile, inputData, inputLength );
+
+		FS_FreeFile( inputData );
+	} else {
+		bsp = BSP_Load( inputFile );
+	}
 
 	if ( !bsp ) {
 		Com_Printf( "Error: Could not read file '%s'\n", inputFile );
@@ -136,25 +952,66 @@ int main( int argc, char **argv ) {
 
 	Com_Printf( "Loaded BSP '%s' successfully.\n", inputFile );
 
-	if ( outFormat->saveFunction ) {
-		if ( convertFunc ) {
-			convertFunc( bsp );
+	if ( writeBspk && !bsp->mappedData ) {
+		BSP_SaveBspk( bsp );
+	}
+
+	// the passes (and a conversion all outputs use) are run once, the save
+	// functions only read the BSP so it can be shared between the threads
+	BSP_RunPasses( &pipeline, bsp );
+
+	atlasData = NULL;
+	numAtlases = 0;
+
+	if ( extLightmapSize ) {
+		atlasData = BSP_PackLightmapAtlases( bsp, extLightmapSize, &numAtlases );
+	}
+
+	for ( i = 0; i < numOutputs; i++ ) {
+		if ( !outputs[i].save ) {
+			continue;
 		}
 
-		saveData = NULL;
-		saveLength = outFormat->saveFunction( outFormat, outputFile, bsp, &saveData );
+		outputs[i].bsp = bsp;
 
-		if ( saveData && FS_WriteFile( outputFile, saveData, saveLength ) == saveLength ) {
-			Com_Printf( "Saved BSP '%s' successfully.\n", outputFile );
+		// the last output is saved on this thread
+		if ( --numSaves > 0 && pthread_create( &threads[i], NULL, SaveOutput, &outputs[i] ) == 0 ) {
+			outputs[i].threaded = qtrue;
 		} else {
-			Com_Printf( "Saving BSP '%s' failed.\n", outputFile );
+			SaveOutput( &outputs[i] );
 		}
+	}
 
-		if ( saveData ) {
-			free( saveData );
+	for ( i = 0; i < numOutputs; i++ ) {
+		if ( !outputs[i].save ) {
+			continue;
 		}
-	} else {
-		Com_Printf( "BSP format for '%s' does not support saving.\n", outFormat->gameName );
+
+		if ( outputs[i].threaded ) {
+			pthread_join( threads[i], NULL );
+		}
+
+		if ( outputs[i].saved ) {
+			Com_Printf( "Saved BSP '%s' successfully.\n", outputs[i].filename );
+
+			if ( atlasData && BSP_WriteLightmapAtlases( outputs[i].filename, atlasData, numAtlases, extLightmapSize ) ) {
+				Com_Printf( "Saved %d lightmap atlases for '%s'.\n", numAtlases, outputs[i].filename );
+			}
+
+			if ( cacheDir ) {
+				Cache_Store( cacheDir, outputs[i].cacheKey, outputs[i].saveData, outputs[i].saveLength );
+			}
+		} else {
+			Com_Printf( "Saving BSP '%s' failed.\n", outputs[i].filename );
+		}
+
+		if ( outputs[i].saveData ) {
+			free( outputs[i].saveData );
+		}
+	}
+
+	if ( atlasData ) {
+		free( atlasData );
 	}
 
 	BSP_Free( bsp );
@@ -171,13 +1028,18 @@ long FS_WriteFile( const char *filename, void *buf, long length ) {
 		return 0;
 	}
 
+	TRACE_BEGIN_FILE( "FS_WriteFile", filename );
+
 	if ( fwrite( buf, length, 1, f ) != 1 ) {
 		fclose( f );
+		TRACE_END( "FS_WriteFile" );
 		return 0;
 	}
 
 	fclose( f );
 
+	TRACE_END( "FS_WriteFile" );
+
 	return length;
 }
 
@@ -194,6 +1056,8 @@ long FS_ReadFile( const char *filename, void **buffer ) {
 		return 0;
 	}
 
+	TRACE_BEGIN_FILE( "FS_ReadFile", filename );
+
 	fseek( f, 0, SEEK_END );
 	length = ftell( f );
 	fseek( f, 0, SEEK_SET );
@@ -203,11 +1067,14 @@ long FS_ReadFile( const char *filename, void **buffer ) {
 	if ( fread( buf, length, 1, f ) != 1 ) {
 		fclose( f );
 		free( buf );
+		TRACE_END( "FS_ReadFile" );
 		return 0;
 	}
 
 	fclose( f );
 
+	TRACE_END( "FS_ReadFile" );
+
 	*buffer = buf;
 	return length;
 }
@@ -217,3 +1084,145 @@ void FS_FreeFile( void *buffer ) {
 		free( buffer );
 	}
 }
+
+int FS_Open( const char *filename, qboolean write ) {
+	int flags;
+
+	flags = write ? ( O_RDWR | O_CREAT ) : O_RDONLY;
+#ifdef _WIN32
+	flags |= O_BINARY;
+#endif
+
+	return open( filename, flags, 0644 );
+}
+
+void FS_Close( int fd ) {
+	if ( fd != -1 ) {
+		close( fd );
+	}
+}
+
+long FS_Pread( int fd, void *buf, long length, long offset ) {
+	long total = 0;
+
+	while ( total < length ) {
+		long r;
+#ifdef _WIN32
+		if ( _lseek( fd, offset + total, SEEK_SET ) == -1 ) {
+			break;
+		}
+		r = _read( fd, (byte *)buf + total, length - total );
+#else
+		r = pread( fd, (byte *)buf + total, length - total, offset + total );
+#endif
+		if ( r <= 0 ) {
+			break;
+		}
+		total += r;
+	}
+
+	return total;
+}
+
+long FS_Pwrite( int fd, const void *buf, long length, long offset ) {
+	long total = 0;
+
+	while ( total < length ) {
+		long r;
+#ifdef _WIN32
+		if ( _lseek( fd, offset + total, SEEK_SET ) == -1 ) {
+			break;
+		}
+		r = _write( fd, (const byte *)buf + total, length - total );
+#else
+		r = pwrite( fd, (const byte *)buf + total, length - total, offset + total );
+#endif
+		if ( r <= 0 ) {
+			break;
+		}
+		total += r;
+	}
+
+	return total;
+}
+
+long FS_FileLength( int fd ) {
+	struct stat st;
+
+	if ( fstat( fd, &st ) != 0 ) {
+		return -1;
+	}
+
+	return st.st_size;
+}
+
+qboolean FS_Truncate( int fd, long length ) {
+#ifdef _WIN32
+	return _chsize( fd, length ) == 0;
+#else
+	return ftruncate( fd, length ) == 0;
+#endif
+}
+
+qboolean FS_Sync( int fd ) {
+#ifdef _WIN32
+	return _commit( fd ) == 0;
+#else
+	return fsync( fd ) == 0;
+#endif
+}
+
+qboolean FS_FileExists( const char *filename ) {
+	struct stat st;
+
+	return stat( filename, &st ) == 0;
+}
+
+int64_t Sys_Microseconds( void ) {
+#ifdef _WIN32
+	LARGE_INTEGER frequency, counter;
+
+	QueryPerformanceFrequency( &frequency );
+	QueryPerformanceCounter( &counter );
+
+	return counter.QuadPart * 1000000 / frequency.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+int Com_NumCPUs( void ) {
+	int numCPUs = 1;
+
+#ifdef _WIN32
+	SYSTEM_INFO info;
+
+	GetSystemInfo( &info );
+	numCPUs = info.dwNumberOfProcessors;
+#elif defined( _SC_NPROCESSORS_ONLN )
+	numCPUs = sysconf( _SC_NPROCESSORS_ONLN );
+#endif
+
+	return MAX( 1, numCPUs );
+}
+
+static volatile sig_atomic_t sys_quit = 0;
+
+static void Sys_QuitSignal( int sig ) {
+	sys_quit = 1;
+}
+
+// modes that run until they're stopped return from main on SIGINT or SIGTERM
+// so that atexit functions (such as writing the trace) run
+void Sys_CatchQuit( void ) {
+	signal( SIGINT, Sys_QuitSignal );
+	signal( SIGTERM, Sys_QuitSignal );
+}
+
+qboolean Sys_QuitRequested( void ) {
+	return sys_quit ? qtrue : qfalse;
+}
@@ -0,0 +1,329 @@
+/*
+===========================================================================
+Copyright (C) 2015 Zack Middleton
+
+This file is part of BSP sekai Source Code.
+
+BSP sekai Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+BSP sekai Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with BSP sekai Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, BSP sekai Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+
+
+
+// optimize_gc.c -- remove data that nothing uses
+
+#include "sekai.h"
+#include "bsp.h"
+
+typedef struct {
+	byte	*used;
+	int		*keptBefore;	// number of used elements before each one, see GC_Compact
+	int		count;
+	int		removed;
+} gcList_t;
+
+static void GC_Init( gcList_t *list, int count ) {
+	list->used = malloc( count + 1 );
+	Com_Memset( list->used, 0, count + 1 );
+	list->keptBefore = malloc( ( count + 1 ) * sizeof ( *list->keptBefore ) );
+	list->count = count;
+	list->removed = 0;
+}
+
+static void GC_Free( gcList_t *list ) {
+	free( list->used );
+	free( list->keptBefore );
+}
+
+static void GC_Use( gcList_t *list, int num ) {
+	if ( num >= 0 && num < list->count ) {
+		list->used[num] = qtrue;
+	}
+}
+
+static void GC_UseRange( gcList_t *list, int first, int num ) {
+	int i;
+
+	for ( i = MAX( first, 0 ); i < first + num && i < list->count; i++ ) {
+		list->used[i] = qtrue;
+	}
+}
+
+/*
+=================
+GC_Compact
+
+Move the used elements of array to the front and set keptBefore. Returns the
+number of elements kept.
+=================
+*/
+static int GC_Compact( gcList_t *list, void *array, int size ) {
+	int i, numKept;
+
+	for ( i = 0, numKept = 0; i < list->count; i++ ) {
+		list->keptBefore[i] = numKept;
+
+		if ( list->used[i] ) {
+			if ( numKept != i ) {
+				Com_Memcpy( (byte *)array + numKept * size, (byte *)array + i * size, size );
+			}
+			numKept++;
+		}
+	}
+	list->keptBefore[list->count] = numKept;
+	list->removed = list->count - numKept;
+
+	return numKept;
+}
+
+// elements that were removed (or were out of range) become -1
+static int GC_Remap( const gcList_t *list, int num ) {
+	if ( num < 0 || num >= list->count || !list->used[num] ) {
+		return -1;
+	}
+
+	return list->keptBefore[num];
+}
+
+// the used elements of a range are next to each other after GC_Compact
+static void GC_RemapRange( const gcList_t *list, int *first, int *num ) {
+	if ( *first < 0 || *num <= 0 || *first + *num > list->count ) {
+		*first = MIN( MAX( *first, 0 ), list->count );
+		*first = list->keptBefore[*first];
+		*num = 0;
+		return;
+	}
+
+	*num = list->keptBefore[*first + *num] - list->keptBefore[*first];
+	*first = list->keptBefore[*first];
+}
+
+static void GC_Report( const gcList_t *list, const char *name ) {
+	if ( list->removed ) {
+		Com_Printf( "Removed %d of %d %s.\n", list->removed, list->count, name );
+	}
+}
+
+/*
+=================
+BSP_CollectGarbage
+
+Remove surfaces, brushes, brush sides, planes, shaders, vertexes, indexes,
+lightmaps, and fogs that aren't reachable from the nodes, leafs, and
+submodels and update everything that refers to them. MST_BAD surfaces are
+removed too.
+
+Fogs are applied to entities inside the fog brush, so a fog is only removed
+if nothing uses it and its brush doesn't exist.
+=================
+*/
+void BSP_CollectGarbage( bspFile_t *bsp ) {
+	gcList_t surfaces, brushes, sides, planes, shaders, verts, indexes, lightmaps, fogs;
+	qboolean lightmapPairs;
+	dsurface_t *surface;
+	dbrush_t *brush;
+	int i;
+
+	GC_Init( &surfaces, bsp->numSurfaces );
+	GC_Init( &brushes, bsp->numBrushes );
+	GC_Init( &sides, bsp->numBrushSides );
+	GC_Init( &planes, bsp->numPlanes );
+	GC_Init( &shaders, bsp->numShaders );
+	GC_Init( &verts, bsp->numDrawVerts );
+	GC_Init( &indexes, bsp->numDrawIndexes );
+	GC_Init( &lightmaps, bsp->numLightmaps );
+	GC_Init( &fogs, bsp->numFogs );
+
+	//
+	// mark what's used, in the order things refer to each other
+	//
+	for ( i = 0; i < bsp->numSubmodels; i++ ) {
+		GC_UseRange( &surfaces, bsp->submodels[i].firstSurface, bsp->submodels[i].numSurfaces );
+		GC_UseRange( &brushes, bsp->submodels[i].firstBrush, bsp->submodels[i].numBrushes );
+	}
+
+	for ( i = 0; i < bsp->numLeafSurfaces; i++ ) {
+		GC_Use( &surfaces, bsp->leafSurfaces[i] );
+	}
+
+	for ( i = 0; i < bsp->numLeafBrushes; i++ ) {
+		GC_Use( &brushes, bsp->leafBrushes[i] );
+	}
+
+	for ( i = 0; i < bsp->numFogs; i++ ) {
+		if ( bsp->fogs[i].brushNum >= 0 && bsp->fogs[i].brushNum < bsp->numBrushes ) {
+			GC_Use( &fogs, i );
+			GC_Use( &brushes, bsp->fogs[i].brushNum );
+		}
+	}
+
+	// all used lightmaps are even when there's a deluxe map after each lightmap
+	lightmapPairs = qtrue;
+
+	for ( i = 0, surface = bsp->surfaces; i < bsp->numSurfaces; i++, surface++ ) {
+		if ( surface->surfaceType == MST_BAD ) {
+			surfaces.used[i] = qfalse;
+		}
+
+		if ( !surfaces.used[i] ) {
+			continue;
+		}
+
+		GC_Use( &shaders, surface->shaderNum );
+		GC_Use( &fogs, surface->fogNum );
+		GC_UseRange( &verts, surface->firstVert, surface->numVerts );
+		GC_UseRange( &indexes, surface->firstIndex, surface->numIndexes );
+		GC_Use( &lightmaps, surface->lightmapNum );
+
+		if ( surface->lightmapNum >= 0 && ( surface->lightmapNum & 1 ) ) {
+			lightmapPairs = qfalse;
+		}
+	}
+
+	for ( i = 0, brush = bsp->brushes; i < bsp->numBrushes; i++, brush++ ) {
+		if ( brushes.used[i] ) {
+			GC_Use( &shaders, brush->shaderNum );
+			GC_UseRange( &sides, brush->firstSide, brush->numSides );
+		}
+	}
+
+	for ( i = 0; i < bsp->numBrushSides; i++ ) {
+		if ( sides.used[i] ) {
+			GC_Use( &shaders, bsp->brushSides[i].shaderNum );
+			GC_Use( &planes, bsp->brushSides[i].planeNum );
+		}
+	}
+
+	for ( i = 0; i < bsp->numNodes; i++ ) {
+		GC_Use( &planes, bsp->nodes[i].planeNum );
+	}
+
+	// plane x^1 must stay the opposite of plane x
+	for ( i = 0; i + 1 < bsp->numPlanes; i += 2 ) {
+		if ( planes.used[i] || planes.used[i + 1] ) {
+			planes.used[i] = planes.used[i + 1] = qtrue;
+		}
+	}
+
+	for ( i = 0; i < bsp->numSurfaces; i++ ) {
+		// lightmaps past the end are external, leave them alone
+		if ( surfaces.used[i] && bsp->surfaces[i].lightmapNum >= bsp->numLightmaps ) {
+			Com_Memset( lightmaps.used, qtrue, lightmaps.count );
+			break;
+		}
+	}
+
+	if ( lightmapPairs ) {
+		for ( i = 0; i + 1 < bsp->numLightmaps; i += 2 ) {
+			lightmaps.used[i + 1] = lightmaps.used[i];
+		}
+	}
+
+	//
+	// compact the arrays
+	//
+	bsp->numSurfaces = GC_Compact( &surfaces, bsp->surfaces, sizeof ( *bsp->surfaces ) );
+	bsp->numBrushes = GC_Compact( &brushes, bsp->brushes, sizeof ( *bsp->brushes ) );
+	bsp->numBrushSides = GC_Compact( &sides, bsp->brushSides, sizeof ( *bsp->brushSides ) );
+	bsp->numPlanes = GC_Compact( &planes, bsp->planes, sizeof ( *bsp->planes ) );
+	bsp->numShaders = GC_Compact( &shaders, bsp->shaders, sizeof ( *bsp->shaders ) );
+	bsp->numDrawVerts = GC_Compact( &verts, bsp->drawVerts, sizeof ( *bsp->drawVerts ) );
+	bsp->numDrawIndexes = GC_Compact( &indexes, bsp->drawIndexes, sizeof ( *bsp->drawIndexes ) );
+	bsp->numLightmaps = GC_Compact( &lightmaps, bsp->lightmapData, 128 * 128 * 3 );
+	bsp->numFogs = GC_Compact( &fogs, bsp->fogs, sizeof ( *bsp->fogs ) );
+
+	//
+	// update references
+	//
+	for ( i = 0; i < bsp->numSubmodels; i++ ) {
+		GC_RemapRange( &surfaces, &bsp->submodels[i].firstSurface, &bsp->submodels[i].numSurfaces );
+		GC_RemapRange( &brushes, &bsp->submodels[i].firstBrush, &bsp->submodels[i].numBrushes );
+	}
+
+	// removed entries become -1 and are removed by BSP_UpdateLeafLists
+	for ( i = 0; i < bsp->numLeafSurfaces; i++ ) {
+		bsp->leafSurfaces[i] = GC_Remap( &surfaces, bsp->leafSurfaces[i] );
+	}
+
+	for ( i = 0; i < bsp->numLeafBrushes; i++ ) {
+		bsp->leafBrushes[i] = GC_Remap( &brushes, bsp->leafBrushes[i] );
+	}
+
+	for ( i = 0; i < bsp->numNodes; i++ ) {
+		bsp->nodes[i].planeNum = GC_Remap( &planes, bsp->nodes[i].planeNum );
+	}
+
+	for ( i = 0; i < bsp->numFogs; i++ ) {
+		bsp->fogs[i].brushNum = GC_Remap( &brushes, bsp->fogs[i].brushNum );
+	}
+
+	for ( i = 0, surface = bsp->surfaces; i < bsp->numSurfaces; i++, surface++ ) {
+		surface->shaderNum = GC_Remap( &shaders, surface->shaderNum );
+		surface->fogNum = GC_Remap( &fogs, surface->fogNum );
+		GC_RemapRange( &verts, &surface->firstVert, &surface->numVerts );
+		GC_RemapRange( &indexes, &surface->firstIndex, &surface->numIndexes );
+
+		// keep negative values, such as -3 for vertex lighting
+		if ( surface->lightmapNum >= 0 && surface->lightmapNum < lightmaps.count ) {
+			surface->lightmapNum = GC_Remap( &lightmaps, surface->lightmapNum );
+		}
+	}
+
+	for ( i = 0, brush = bsp->brushes; i < bsp->numBrushes; i++, brush++ ) {
+		brush->shaderNum = GC_Remap( &shaders, brush->shaderNum );
+		GC_RemapRange( &sides, &brush->firstSide, &brush->numSides );
+	}
+
+	// visibleSide is relative to the brush's first side, the brush keeps all of its sides
+	for ( i = 0; i < bsp->numFogs; i++ ) {
+		if ( bsp->fogs[i].brushNum >= 0 && bsp->fogs[i].visibleSide >= bsp->brushes[bsp->fogs[i].brushNum].numSides ) {
+			Com_Printf( "WARNING: Fog %d visible side %d is not a side of brush %d.\n", i, bsp->fogs[i].visibleSide, bsp->fogs[i].brushNum );
+		}
+	}
+
+	for ( i = 0; i < bsp->numBrushSides; i++ ) {
+		bsp->brushSides[i].shaderNum = GC_Remap( &shaders, bsp->brushSides[i].shaderNum );
+		bsp->brushSides[i].planeNum = GC_Remap( &planes, bsp->brushSides[i].planeNum );
+		bsp->brushSides[i].surfaceNum = GC_Remap( &surfaces, bsp->brushSides[i].surfaceNum );
+	}
+
+	GC_Report( &surfaces, "surfaces" );
+	GC_Report( &brushes, "brushes" );
+	GC_Report( &sides, "brush sides" );
+	GC_Report( &planes, "planes" );
+	GC_Report( &shaders, "shaders" );
+	GC_Report( &verts, "vertexes" );
+	GC_Report( &indexes, "indexes" );
+	GC_Report( &lightmaps, "lightmaps" );
+	GC_Report( &fogs, "fogs" );
+
+	GC_Free( &surfaces );
+	GC_Free( &brushes );
+	GC_Free( &sides );
+	GC_Free( &planes );
+	GC_Free( &shaders );
+	GC_Free( &verts );
+	GC_Free( &indexes );
+	GC_Free( &lightmaps );
+	GC_Free( &fogs );
+}
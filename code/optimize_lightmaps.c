@@ -0,0 +1,939 @@
+/*
+===========================================================================
+Copyright (C) 2015 Zack Middleton
+
+This file is part of BSP sekai Source Code.
+
+BSP sekai Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+BSP sekai Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with BSP sekai Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, BSP sekai Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+
+
+
+// optimize_lightmaps.c -- repack lightmaps
+
+#include "sekai.h"
+#include "bsp.h"
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+#define LIGHTMAP_SIZE		128
+#define LIGHTMAP_BYTES		( LIGHTMAP_SIZE * LIGHTMAP_SIZE * 3 )
+
+typedef struct {
+	int			page;			// lightmapNum / stride
+	int			x, y;
+	int			width, height;
+
+	uint64_t	hash;
+	int			original;		// block with the same pixels that is packed instead, or itself
+
+	int			newPage;
+	int			newX, newY;
+} lmBlock_t;
+
+typedef struct {
+	int			stride;			// 2 if each lightmap is followed by a deluxe map
+	int			numPages;		// logical pages, numLightmaps / stride
+
+	lmBlock_t	*blocks;
+	int			numBlocks;
+	int			*surfaceBlocks;	// block of each surface, -1 if it doesn't use a lightmap
+} lmBlocks_t;
+
+/*
+=================
+LM_ValidRect
+
+Check that the surface's lightmap rectangle is on the page and its vertexes'
+lightmap coordinates are inside it, so that moving the rectangle moves
+everything the surface uses.
+=================
+*/
+static qboolean LM_ValidRect( const bspFile_t *bsp, const dsurface_t *surface ) {
+	const drawVert_t *vert;
+	float s, t;
+	int i;
+
+	if ( surface->lightmapWidth <= 0 || surface->lightmapHeight <= 0 || surface->lightmapX < 0 || surface->lightmapY < 0
+		|| surface->lightmapX + surface->lightmapWidth > LIGHTMAP_SIZE || surface->lightmapY + surface->lightmapHeight > LIGHTMAP_SIZE ) {
+		return qfalse;
+	}
+
+	if ( surface->firstVert < 0 || surface->numVerts < 0 || surface->firstVert + surface->numVerts > bsp->numDrawVerts ) {
+		return qfalse;
+	}
+
+	for ( i = 0, vert = &bsp->drawVerts[surface->firstVert]; i < surface->numVerts; i++, vert++ ) {
+		s = vert->lightmap[0] * LIGHTMAP_SIZE;
+		t = vert->lightmap[1] * LIGHTMAP_SIZE;
+
+		// allow for rounding and texel centers
+		if ( s < surface->lightmapX - 1 || s > surface->lightmapX + surface->lightmapWidth + 1
+			|| t < surface->lightmapY - 1 || t > surface->lightmapY + surface->lightmapHeight + 1 ) {
+			return qfalse;
+		}
+	}
+
+	return qtrue;
+}
+
+static int LM_FindGroup( int *groups, int i ) {
+	while ( groups[i] != i ) {
+		groups[i] = groups[groups[i]];
+		i = groups[i];
+	}
+	return i;
+}
+
+/*
+=================
+LM_SamePixels
+=================
+*/
+static qboolean LM_SamePixels( const bspFile_t *bsp, const lmBlocks_t *lm, const lmBlock_t *a, const lmBlock_t *b ) {
+	const byte *dataA, *dataB;
+	int k, y;
+
+	if ( a->width != b->width || a->height != b->height ) {
+		return qfalse;
+	}
+
+	for ( k = 0; k < lm->stride; k++ ) {
+		dataA = bsp->lightmapData + ( a->page * lm->stride + k ) * LIGHTMAP_BYTES;
+		dataB = bsp->lightmapData + ( b->page * lm->stride + k ) * LIGHTMAP_BYTES;
+
+		for ( y = 0; y < a->height; y++ ) {
+			if ( memcmp( dataA + ( ( a->y + y ) * LIGHTMAP_SIZE + a->x ) * 3,
+						dataB + ( ( b->y + y ) * LIGHTMAP_SIZE + b->x ) * 3, a->width * 3 ) ) {
+				return qfalse;
+			}
+		}
+	}
+
+	return qtrue;
+}
+
+/*
+=================
+LM_FindBlocks
+
+Split the used part of each lightmap page into blocks that can be moved on
+their own. Surfaces whose rectangles overlap are put in the same block. If
+any surface on a page doesn't have a valid rectangle the whole page is one
+block. Returns qfalse if the lightmaps can't be repacked.
+=================
+*/
+static qboolean LM_FindBlocks( const bspFile_t *bsp, lmBlocks_t *lm ) {
+	const dsurface_t *surface;
+	int *pageSurfaces, *pageStart, *pageCount;
+	int *groups, *owners, *groupBlocks;
+	byte *validPages;
+	int rect[4], *rects;
+	qboolean changed;
+	int i, j, x, y, page, num, owner;
+
+	Com_Memset( lm, 0, sizeof ( *lm ) );
+
+	if ( bsp->numLightmaps <= 0 ) {
+		return qfalse;
+	}
+
+	// all used lightmaps are even when there's a deluxe map after each lightmap
+	lm->stride = 2;
+
+	for ( i = 0, surface = bsp->surfaces; i < bsp->numSurfaces; i++, surface++ ) {
+		if ( surface->lightmapNum < 0 ) {
+			continue;
+		}
+
+		// lightmaps past the end are external
+		if ( surface->lightmapNum >= bsp->numLightmaps ) {
+			return qfalse;
+		}
+
+		if ( surface->lightmapNum & 1 ) {
+			lm->stride = 1;
+		}
+	}
+
+	if ( lm->stride == 2 && ( bsp->numLightmaps & 1 ) ) {
+		lm->stride = 1;
+	}
+
+	lm->numPages = bsp->numLightmaps / lm->stride;
+
+	// list the surfaces on each page
+	pageCount = malloc( ( lm->numPages + 1 ) * sizeof ( *pageCount ) );
+	pageStart = malloc( ( lm->numPages + 1 ) * sizeof ( *pageStart ) );
+	pageSurfaces = malloc( ( bsp->numSurfaces + 1 ) * sizeof ( *pageSurfaces ) );
+	validPages = malloc( lm->numPages + 1 );
+	Com_Memset( pageCount, 0, ( lm->numPages + 1 ) * sizeof ( *pageCount ) );
+	Com_Memset( validPages, qtrue, lm->numPages + 1 );
+
+	for ( i = 0, surface = bsp->surfaces; i < bsp->numSurfaces; i++, surface++ ) {
+		if ( surface->lightmapNum >= 0 ) {
+			page = surface->lightmapNum / lm->stride;
+			pageCount[page]++;
+
+			if ( !LM_ValidRect( bsp, surface ) ) {
+				validPages[page] = qfalse;
+			}
+		}
+	}
+
+	pageStart[0] = 0;
+	for ( i = 0; i < lm->numPages; i++ ) {
+		pageStart[i + 1] = pageStart[i] + pageCount[i];
+		pageCount[i] = pageStart[i];
+	}
+
+	for ( i = 0, surface = bsp->surfaces; i < bsp->numSurfaces; i++, surface++ ) {
+		if ( surface->lightmapNum >= 0 ) {
+			page = surface->lightmapNum / lm->stride;
+			pageSurfaces[pageCount[page]++] = i;
+		}
+	}
+
+	//
+	// group the surfaces with overlapping rectangles
+	//
+	lm->surfaceBlocks = malloc( ( bsp->numSurfaces + 1 ) * sizeof ( *lm->surfaceBlocks ) );
+	lm->blocks = malloc( ( bsp->numSurfaces + 1 ) * sizeof ( *lm->blocks ) );
+	groups = malloc( ( bsp->numSurfaces + 1 ) * sizeof ( *groups ) );
+	groupBlocks = malloc( ( bsp->numSurfaces + 1 ) * sizeof ( *groupBlocks ) );
+	rects = malloc( ( bsp->numSurfaces + 1 ) * 4 * sizeof ( *rects ) );
+	owners = malloc( LIGHTMAP_SIZE * LIGHTMAP_SIZE * sizeof ( *owners ) );
+
+	for ( i = 0; i < bsp->numSurfaces; i++ ) {
+		lm->surfaceBlocks[i] = -1;
+		groups[i] = i;
+	}
+
+	for ( page = 0; page < lm->numPages; page++ ) {
+		if ( pageStart[page] == pageStart[page + 1] ) {
+			continue;
+		}
+
+		if ( !validPages[page] ) {
+			lmBlock_t *block = &lm->blocks[lm->numBlocks];
+
+			block->page = page;
+			block->x = block->y = 0;
+			block->width = block->height = LIGHTMAP_SIZE;
+
+			for ( j = pageStart[page]; j < pageStart[page + 1]; j++ ) {
+				lm->surfaceBlocks[pageSurfaces[j]] = lm->numBlocks;
+			}
+
+			lm->numBlocks++;
+			continue;
+		}
+
+		// the bounds of merged groups may overlap other groups, repeat until they don't
+		for ( j = pageStart[page]; j < pageStart[page + 1]; j++ ) {
+			surface = &bsp->surfaces[pageSurfaces[j]];
+			num = pageSurfaces[j] * 4;
+			rects[num + 0] = surface->lightmapX;
+			rects[num + 1] = surface->lightmapY;
+			rects[num + 2] = surface->lightmapX + surface->lightmapWidth;
+			rects[num + 3] = surface->lightmapY + surface->lightmapHeight;
+		}
+
+		do {
+			changed = qfalse;
+
+			for ( j = 0; j < LIGHTMAP_SIZE * LIGHTMAP_SIZE; j++ ) {
+				owners[j] = -1;
+			}
+
+			for ( j = pageStart[page]; j < pageStart[page + 1]; j++ ) {
+				num = LM_FindGroup( groups, pageSurfaces[j] );
+				Com_Memcpy( rect, &rects[num * 4], sizeof ( rect ) );
+
+				for ( y = rect[1]; y < rect[3]; y++ ) {
+					for ( x = rect[0]; x < rect[2]; x++ ) {
+						owner = owners[y * LIGHTMAP_SIZE + x];
+
+						if ( owner == -1 ) {
+							owners[y * LIGHTMAP_SIZE + x] = num;
+							continue;
+						}
+
+						owner = LM_FindGroup( groups, owner );
+						num = LM_FindGroup( groups, num );
+
+						if ( owner != num ) {
+							// merge the groups and their bounds
+							groups[owner] = num;
+							rects[num * 4 + 0] = MIN( rects[num * 4 + 0], rects[owner * 4 + 0] );
+							rects[num * 4 + 1] = MIN( rects[num * 4 + 1], rects[owner * 4 + 1] );
+							rects[num * 4 + 2] = MAX( rects[num * 4 + 2], rects[owner * 4 + 2] );
+							rects[num * 4 + 3] = MAX( rects[num * 4 + 3], rects[owner * 4 + 3] );
+							changed = qtrue;
+						}
+
+						owners[y * LIGHTMAP_SIZE + x] = num;
+					}
+				}
+			}
+		} while ( changed );
+
+		for ( j = pageStart[page]; j < pageStart[page + 1]; j++ ) {
+			groupBlocks[LM_FindGroup( groups, pageSurfaces[j] )] = -1;
+		}
+
+		for ( j = pageStart[page]; j < pageStart[page + 1]; j++ ) {
+			num = LM_FindGroup( groups, pageSurfaces[j] );
+
+			if ( groupBlocks[num] == -1 ) {
+				lmBlock_t *block = &lm->blocks[lm->numBlocks];
+
+				block->page = page;
+				block->x = rects[num * 4 + 0];
+				block->y = rects[num * 4 + 1];
+				block->width = rects[num * 4 + 2] - block->x;
+				block->height = rects[num * 4 + 3] - block->y;
+
+				groupBlocks[num] = lm->numBlocks++;
+			}
+
+			lm->surfaceBlocks[pageSurfaces[j]] = groupBlocks[num];
+		}
+	}
+
+	free( pageCount );
+	free( pageStart );
+	free( pageSurfaces );
+	free( validPages );
+	free( groups );
+	free( groupBlocks );
+	free( rects );
+	free( owners );
+
+	return qtrue;
+}
+
+/*
+=================
+LM_FreeBlocks
+=================
+*/
+static void LM_FreeBlocks( lmBlocks_t *lm ) {
+	free( lm->blocks );
+	free( lm->surfaceBlocks );
+	Com_Memset( lm, 0, sizeof ( *lm ) );
+}
+
+/*
+=================
+LM_CheckVerts
+
+Moving blocks moves the lightmap coordinates of their surfaces' vertexes, so a
+vertex can't be shared by surfaces in different blocks.
+=================
+*/
+static qboolean LM_CheckVerts( const bspFile_t *bsp, const lmBlocks_t *lm ) {
+	const dsurface_t *surface;
+	int *vertBlocks;
+	qboolean ok;
+	int i, j;
+
+	vertBlocks = malloc( ( bsp->numDrawVerts + 1 ) * sizeof ( *vertBlocks ) );
+
+	for ( i = 0; i < bsp->numDrawVerts; i++ ) {
+		vertBlocks[i] = -1;
+	}
+
+	ok = qtrue;
+
+	for ( i = 0, surface = bsp->surfaces; i < bsp->numSurfaces && ok; i++, surface++ ) {
+		if ( lm->surfaceBlocks[i] == -1 ) {
+			continue;
+		}
+
+		if ( surface->firstVert < 0 || surface->numVerts < 0 || surface->firstVert + surface->numVerts > bsp->numDrawVerts ) {
+			ok = qfalse;
+			break;
+		}
+
+		for ( j = surface->firstVert; j < surface->firstVert + surface->numVerts; j++ ) {
+			if ( vertBlocks[j] != -1 && vertBlocks[j] != lm->surfaceBlocks[i] ) {
+				ok = qfalse;
+				break;
+			}
+
+			vertBlocks[j] = lm->surfaceBlocks[i];
+		}
+	}
+
+	free( vertBlocks );
+
+	return ok;
+}
+
+static int BlockHashCompare( const void *a, const void *b ) {
+	const lmBlock_t *blockA = *(const lmBlock_t **)a;
+	const lmBlock_t *blockB = *(const lmBlock_t **)b;
+
+	if ( blockA->hash != blockB->hash ) {
+		return blockA->hash < blockB->hash ? -1 : 1;
+	}
+
+	// keep the first block as the original
+	return blockA < blockB ? -1 : blockA > blockB;
+}
+
+/*
+=================
+LM_FindDuplicates
+
+Point blocks with the same pixels as an earlier block at it. Returns the
+number of duplicates.
+=================
+*/
+static int LM_FindDuplicates( const bspFile_t *bsp, lmBlocks_t *lm ) {
+	lmBlock_t **sorted;
+	int i, j, k, y, numDuplicates;
+
+	for ( i = 0; i < lm->numBlocks; i++ ) {
+		lmBlock_t *block = &lm->blocks[i];
+		uint64_t hash = ( (uint64_t)block->width << 32 ) | block->height;
+
+		for ( k = 0; k < lm->stride; k++ ) {
+			const byte *data = bsp->lightmapData + ( block->page * lm->stride + k ) * LIGHTMAP_BYTES;
+
+			for ( y = block->y; y < block->y + block->height; y++ ) {
+				hash = Com_Hash64( data + ( y * LIGHTMAP_SIZE + block->x ) * 3, block->width * 3, hash );
+			}
+		}
+
+		block->hash = hash;
+		block->original = i;
+	}
+
+	sorted = malloc( ( lm->numBlocks + 1 ) * sizeof ( *sorted ) );
+
+	for ( i = 0; i < lm->numBlocks; i++ ) {
+		sorted[i] = &lm->blocks[i];
+	}
+
+	qsort( sorted, lm->numBlocks, sizeof ( *sorted ), BlockHashCompare );
+
+	numDuplicates = 0;
+
+	for ( i = 0; i < lm->numBlocks; i++ ) {
+		// compare with each earlier original with the same hash
+		for ( j = i - 1; j >= 0 && sorted[j]->hash == sorted[i]->hash; j-- ) {
+			if ( sorted[j]->original == sorted[j] - lm->blocks && LM_SamePixels( bsp, lm, sorted[i], sorted[j] ) ) {
+				sorted[i]->original = sorted[j] - lm->blocks;
+				numDuplicates++;
+				break;
+			}
+		}
+	}
+
+	free( sorted );
+
+	return numDuplicates;
+}
+
+/*
+=============================================================================
+
+SKYLINE PACKER
+
+=============================================================================
+*/
+
+typedef struct {
+	int			x, y, width;
+} skylineNode_t;
+
+typedef struct {
+	skylineNode_t	*nodes;
+	int				numNodes;
+} skyline_t;
+
+/*
+=================
+Skyline_Fit
+
+Returns the lowest y a width x height rectangle fits at starting on node, or
+-1 if it doesn't fit.
+=================
+*/
+static int Skyline_Fit( const skyline_t *skyline, int node, int width, int height, int size ) {
+	int x, y, left;
+
+	x = skyline->nodes[node].x;
+
+	if ( x + width > size ) {
+		return -1;
+	}
+
+	y = 0;
+	left = width;
+
+	while ( left > 0 ) {
+		y = MAX( y, skyline->nodes[node].y );
+
+		if ( y + height > size ) {
+			return -1;
+		}
+
+		left -= skyline->nodes[node].width;
+		node++;
+	}
+
+	return y;
+}
+
+/*
+=================
+Skyline_Insert
+
+Place a rectangle at the bottom most, then left most, position. Returns
+qfalse if it doesn't fit.
+=================
+*/
+static qboolean Skyline_Insert( skyline_t *skyline, int width, int height, int size, int *outX, int *outY ) {
+	int i, y, bestNode, bestY, bestWidth, x, right;
+	skylineNode_t *node;
+
+	bestNode = -1;
+	bestY = bestWidth = size + 1;
+
+	for ( i = 0; i < skyline->numNodes; i++ ) {
+		y = Skyline_Fit( skyline, i, width, height, size );
+
+		if ( y == -1 ) {
+			continue;
+		}
+
+		if ( y < bestY || ( y == bestY && skyline->nodes[i].width < bestWidth ) ) {
+			bestNode = i;
+			bestY = y;
+			bestWidth = skyline->nodes[i].width;
+		}
+	}
+
+	if ( bestNode == -1 ) {
+		return qfalse;
+	}
+
+	x = skyline->nodes[bestNode].x;
+	right = x + width;
+
+	// remove the nodes under the rectangle and shorten the one it ends in
+	for ( i = bestNode; i < skyline->numNodes; ) {
+		node = &skyline->nodes[i];
+
+		if ( node->x >= right ) {
+			break;
+		}
+
+		if ( node->x + node->width > right ) {
+			node->width = node->x + node->width - right;
+			node->x = right;
+			break;
+		}
+
+		memmove( node, node + 1, ( skyline->numNodes - i - 1 ) * sizeof ( *node ) );
+		skyline->numNodes--;
+	}
+
+	memmove( &skyline->nodes[bestNode + 1], &skyline->nodes[bestNode], ( skyline->numNodes - bestNode ) * sizeof ( *node ) );
+	skyline->numNodes++;
+
+	node = &skyline->nodes[bestNode];
+	node->x = x;
+	node->y = bestY + height;
+	node->width = width;
+
+	// merge nodes at the same height
+	for ( i = 0; i < skyline->numNodes - 1; ) {
+		if ( skyline->nodes[i].y == skyline->nodes[i + 1].y ) {
+			skyline->nodes[i].width += skyline->nodes[i + 1].width;
+			memmove( &skyline->nodes[i + 1], &skyline->nodes[i + 2], ( skyline->numNodes - i - 2 ) * sizeof ( *node ) );
+			skyline->numNodes--;
+		} else {
+			i++;
+		}
+	}
+
+	*outX = x;
+	*outY = bestY;
+	return qtrue;
+}
+
+static int BlockSizeCompare( const void *a, const void *b ) {
+	const lmBlock_t *blockA = *(const lmBlock_t **)a;
+	const lmBlock_t *blockB = *(const lmBlock_t **)b;
+
+	if ( blockA->height != blockB->height ) {
+		return blockB->height - blockA->height;
+	}
+
+	if ( blockA->width != blockB->width ) {
+		return blockB->width - blockA->width;
+	}
+
+	return blockA < blockB ? -1 : blockA > blockB;
+}
+
+/*
+=================
+LM_PackBlocks
+
+Place the original blocks on size x size pages, tallest first, on the first
+page they fit. Returns the number of pages.
+=================
+*/
+static int LM_PackBlocks( lmBlocks_t *lm, int size ) {
+	lmBlock_t **sorted;
+	skyline_t *pages;
+	int i, j, numSorted, numPages;
+
+	sorted = malloc( ( lm->numBlocks + 1 ) * sizeof ( *sorted ) );
+	numSorted = 0;
+
+	for ( i = 0; i < lm->numBlocks; i++ ) {
+		if ( lm->blocks[i].original == i ) {
+			sorted[numSorted++] = &lm->blocks[i];
+		}
+	}
+
+	qsort( sorted, numSorted, sizeof ( *sorted ), BlockSizeCompare );
+
+	// there can't be more pages than blocks
+	pages = malloc( ( numSorted + 1 ) * sizeof ( *pages ) );
+	numPages = 0;
+
+	for ( i = 0; i < numSorted; i++ ) {
+		lmBlock_t *block = sorted[i];
+
+		for ( j = 0; j < numPages; j++ ) {
+			if ( Skyline_Insert( &pages[j], block->width, block->height, size, &block->newX, &block->newY ) ) {
+				break;
+			}
+		}
+
+		if ( j == numPages ) {
+			// each node is at least a texel wide
+			pages[j].nodes = malloc( ( size + 1 ) * sizeof ( *pages[j].nodes ) );
+			pages[j].nodes[0].x = 0;
+			pages[j].nodes[0].y = 0;
+			pages[j].nodes[0].width = size;
+			pages[j].numNodes = 1;
+			numPages++;
+
+			Skyline_Insert( &pages[j], block->width, block->height, size, &block->newX, &block->newY );
+		}
+
+		block->newPage = j;
+	}
+
+	for ( i = 0; i < lm->numBlocks; i++ ) {
+		lmBlock_t *original = &lm->blocks[lm->blocks[i].original];
+
+		lm->blocks[i].newPage = original->newPage;
+		lm->blocks[i].newX = original->newX;
+		lm->blocks[i].newY = original->newY;
+	}
+
+	for ( i = 0; i < numPages; i++ ) {
+		free( pages[i].nodes );
+	}
+
+	free( pages );
+	free( sorted );
+
+	return numPages;
+}
+
+/*
+=================
+LM_CopyBlocks
+
+Copy the original blocks from the lightmaps to newData, which has numPages
+size x size pages for each of the lightmap's stride.
+=================
+*/
+static void LM_CopyBlocks( const bspFile_t *bsp, const lmBlocks_t *lm, byte *newData, int size ) {
+	const lmBlock_t *block;
+	const byte *src;
+	byte *dest;
+	int i, k, y;
+
+	for ( i = 0, block = lm->blocks; i < lm->numBlocks; i++, block++ ) {
+		if ( block->original != i ) {
+			continue;
+		}
+
+		for ( k = 0; k < lm->stride; k++ ) {
+			src = bsp->lightmapData + ( block->page * lm->stride + k ) * LIGHTMAP_BYTES;
+			dest = newData + (size_t)( block->newPage * lm->stride + k ) * size * size * 3;
+
+			for ( y = 0; y < block->height; y++ ) {
+				Com_Memcpy( dest + ( (size_t)( block->newY + y ) * size + block->newX ) * 3,
+							src + ( ( block->y + y ) * LIGHTMAP_SIZE + block->x ) * 3, block->width * 3 );
+			}
+		}
+	}
+}
+
+/*
+=================
+LM_MoveSurfaces
+
+Point the surfaces and their vertexes at the new place of their block on the
+size x size pages.
+=================
+*/
+static void LM_MoveSurfaces( bspFile_t *bsp, const lmBlocks_t *lm, int size ) {
+	const lmBlock_t *block;
+	dsurface_t *surface;
+	drawVert_t *vert;
+	byte *movedVerts;
+	int i, j, dx, dy;
+
+	movedVerts = malloc( bsp->numDrawVerts + 1 );
+	Com_Memset( movedVerts, 0, bsp->numDrawVerts + 1 );
+
+	for ( i = 0, surface = bsp->surfaces; i < bsp->numSurfaces; i++, surface++ ) {
+		if ( lm->surfaceBlocks[i] == -1 ) {
+			continue;
+		}
+
+		block = &lm->blocks[lm->surfaceBlocks[i]];
+		dx = block->newX - block->x;
+		dy = block->newY - block->y;
+
+		surface->lightmapNum = block->newPage * lm->stride;
+		surface->lightmapX += dx;
+		surface->lightmapY += dy;
+
+		for ( j = 0, vert = &bsp->drawVerts[surface->firstVert]; j < surface->numVerts; j++, vert++ ) {
+			if ( movedVerts[surface->firstVert + j] ) {
+				continue;
+			}
+
+			movedVerts[surface->firstVert + j] = qtrue;
+			vert->lightmap[0] = ( vert->lightmap[0] * LIGHTMAP_SIZE + dx ) / size;
+			vert->lightmap[1] = ( vert->lightmap[1] * LIGHTMAP_SIZE + dy ) / size;
+		}
+	}
+
+	free( movedVerts );
+}
+
+/*
+=================
+LM_FindMovableBlocks
+
+Returns qfalse if the lightmaps can't be moved, action is used in the message.
+=================
+*/
+static qboolean LM_FindMovableBlocks( const bspFile_t *bsp, lmBlocks_t *lm, const char *action ) {
+	if ( !LM_FindBlocks( bsp, lm ) ) {
+		Com_Printf( "Not %s lightmaps, there are none or they are external.\n", action );
+		LM_FreeBlocks( lm );
+		return qfalse;
+	}
+
+	if ( !LM_CheckVerts( bsp, lm ) ) {
+		Com_Printf( "Not %s lightmaps, surfaces on different parts share vertexes.\n", action );
+		LM_FreeBlocks( lm );
+		return qfalse;
+	}
+
+	return qtrue;
+}
+
+/*
+=================
+BSP_RepackLightmaps
+
+Move the parts of the lightmaps that surfaces use onto as few pages as
+possible, sharing the parts with the same pixels.
+=================
+*/
+void BSP_RepackLightmaps( bspFile_t *bsp ) {
+	lmBlocks_t lm;
+	byte *newData;
+	int numPages, numDuplicates, numLightmaps;
+
+	if ( !LM_FindMovableBlocks( bsp, &lm, "repacking" ) ) {
+		return;
+	}
+
+	numDuplicates = LM_FindDuplicates( bsp, &lm );
+	numPages = LM_PackBlocks( &lm, LIGHTMAP_SIZE );
+
+	if ( numPages >= lm.numPages ) {
+		Com_Printf( "Lightmaps didn't pack into fewer than %d pages, %d blocks (%d duplicates).\n", lm.numPages, lm.numBlocks, numDuplicates );
+		LM_FreeBlocks( &lm );
+		return;
+	}
+
+	numLightmaps = numPages * lm.stride;
+	newData = malloc( numLightmaps * LIGHTMAP_BYTES + 1 );
+	Com_Memset( newData, 0, numLightmaps * LIGHTMAP_BYTES );
+
+	LM_CopyBlocks( bsp, &lm, newData, LIGHTMAP_SIZE );
+	LM_MoveSurfaces( bsp, &lm, LIGHTMAP_SIZE );
+
+	Com_Printf( "Lightmaps %d -> %d pages, %d blocks (%d duplicates).\n", lm.numPages, numPages, lm.numBlocks, numDuplicates );
+
+	BSP_FreeArray( bsp, bsp->lightmapData );
+	bsp->lightmapData = newData;
+	bsp->numLightmaps = numLightmaps;
+
+	LM_FreeBlocks( &lm );
+}
+
+/*
+=============================================================================
+
+EXTERNAL LIGHTMAPS
+
+=============================================================================
+*/
+
+/*
+=================
+BSP_PackLightmapAtlases
+
+Move the lightmaps into size x size atlases that are returned (and freed by
+the caller) instead of kept in the BSP. Surfaces use lightmap numbers past the
+end of the now empty lightmap lump, which engines that support external
+lightmaps load from maps/<name>/lm_XXXX. Returns NULL if the lightmaps can't
+be moved.
+=================
+*/
+byte *BSP_PackLightmapAtlases( bspFile_t *bsp, int size, int *numAtlases ) {
+	lmBlocks_t lm;
+	byte *atlasData;
+	size_t atlasBytes;
+	int numPages, numDuplicates;
+
+	*numAtlases = 0;
+
+	if ( !LM_FindMovableBlocks( bsp, &lm, "externalizing" ) ) {
+		return NULL;
+	}
+
+	numDuplicates = LM_FindDuplicates( bsp, &lm );
+	numPages = LM_PackBlocks( &lm, size );
+
+	*numAtlases = numPages * lm.stride;
+	atlasBytes = (size_t)*numAtlases * size * size * 3;
+	atlasData = malloc( atlasBytes + 1 );
+	Com_Memset( atlasData, 0, atlasBytes );
+
+	LM_CopyBlocks( bsp, &lm, atlasData, size );
+	LM_MoveSurfaces( bsp, &lm, size );
+
+	Com_Printf( "Lightmaps %d -> %d %dx%d atlases, %d blocks (%d duplicates).\n", bsp->numLightmaps, *numAtlases, size, size, lm.numBlocks, numDuplicates );
+
+	BSP_FreeArray( bsp, bsp->lightmapData );
+	bsp->lightmapData = NULL;
+	bsp->numLightmaps = 0;
+
+	LM_FreeBlocks( &lm );
+
+	return atlasData;
+}
+
+/*
+=================
+BSP_WriteLightmapAtlases
+
+Write the atlases as 24 bit TGA files in a directory named after the BSP
+without its extension, next to the BSP.
+=================
+*/
+qboolean BSP_WriteLightmapAtlases( const char *bspFilename, const byte *atlasData, int numAtlases, int size ) {
+	char dir[1024], filename[1100];
+	const byte *src;
+	byte *tga, *dest;
+	long tgaLength;
+	char *s;
+	int i, x, y;
+
+	Q_strncpyz( dir, bspFilename, sizeof ( dir ) );
+
+	s = strrchr( dir, '.' );
+	if ( s && !strchr( s, '/' ) && !strchr( s, '\\' ) ) {
+		*s = '\0';
+	}
+
+#ifdef _WIN32
+	_mkdir( dir );
+#else
+	mkdir( dir, 0755 );
+#endif
+
+	tgaLength = 18 + size * size * 3;
+	tga = malloc( tgaLength );
+
+	// uncompressed true color, origin at the top left
+	Com_Memset( tga, 0, 18 );
+	tga[2] = 2;
+	tga[12] = size & 255;
+	tga[13] = size >> 8;
+	tga[14] = size & 255;
+	tga[15] = size >> 8;
+	tga[16] = 24;
+	tga[17] = 0x20;
+
+	for ( i = 0; i < numAtlases; i++ ) {
+		src = atlasData + (size_t)i * size * size * 3;
+		dest = tga + 18;
+
+		// TGA stores BGR
+		for ( y = 0; y < size; y++ ) {
+			for ( x = 0; x < size; x++, src += 3, dest += 3 ) {
+				dest[0] = src[2];
+				dest[1] = src[1];
+				dest[2] = src[0];
+			}
+		}
+
+		snprintf( filename, sizeof ( filename ), "%s/lm_%04d.tga", dir, i );
+
+		if ( FS_WriteFile( filename, tga, tgaLength ) != tgaLength ) {
+			Com_Printf( "Error: Could not write '%s'.\n", filename );
+			free( tga );
+			return qfalse;
+		}
+	}
+
+	free( tga );
+
+	return qtrue;
+}
@@ -0,0 +1,205 @@
+/*
+===========================================================================
+Copyright (C) 2015 Zack Middleton
+
+This file is part of BSP sekai Source Code.
+
+BSP sekai Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+BSP sekai Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with BSP sekai Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, BSP sekai Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+
+
+
+// optimize_planes.c -- snap and merge duplicate planes
+
+#include "sekai.h"
+#include "bsp.h"
+
+#include <math.h>
+
+// same as q3map2
+#define NORMAL_EPSILON		0.00001f
+#define DIST_EPSILON		0.01f
+
+/*
+=================
+SnapPlane
+
+Make almost axial normals axial and round the distance if it's close to a
+whole number. Returns qtrue if the plane was changed.
+=================
+*/
+static qboolean SnapPlane( dplane_t *plane ) {
+	dplane_t old;
+	float dist;
+	int i;
+
+	old = *plane;
+
+	for ( i = 0; i < 3; i++ ) {
+		if ( fabs( plane->normal[i] - 1 ) < NORMAL_EPSILON ) {
+			VectorSet( plane->normal, 0, 0, 0 );
+			plane->normal[i] = 1;
+			break;
+		}
+		if ( fabs( plane->normal[i] + 1 ) < NORMAL_EPSILON ) {
+			VectorSet( plane->normal, 0, 0, 0 );
+			plane->normal[i] = -1;
+			break;
+		}
+	}
+
+	dist = floor( plane->dist + 0.5f );
+	if ( fabs( plane->dist - dist ) < DIST_EPSILON ) {
+		plane->dist = dist;
+	}
+
+	return old.normal[0] != plane->normal[0] || old.normal[1] != plane->normal[1]
+		|| old.normal[2] != plane->normal[2] || old.dist != plane->dist;
+}
+
+static uint32_t PlaneHash( const dplane_t *plane ) {
+	int64_t cell[4];
+	int i;
+
+	for ( i = 0; i < 3; i++ ) {
+		cell[i] = (int64_t)floor( plane->normal[i] / NORMAL_EPSILON + 0.5 );
+	}
+	cell[3] = (int64_t)floor( plane->dist / DIST_EPSILON + 0.5 );
+
+	return (uint32_t)Com_Hash64( cell, sizeof ( cell ), 0 );
+}
+
+static qboolean SamePlane( const dplane_t *a, const dplane_t *b ) {
+	return fabs( a->normal[0] - b->normal[0] ) < NORMAL_EPSILON
+		&& fabs( a->normal[1] - b->normal[1] ) < NORMAL_EPSILON
+		&& fabs( a->normal[2] - b->normal[2] ) < NORMAL_EPSILON
+		&& fabs( a->dist - b->dist ) < DIST_EPSILON;
+}
+
+/*
+=================
+BSP_MergePlanes
+
+Snap planes and merge the ones that are the same. Planes are merged a pair at
+a time, so plane x^1 is still the opposite of plane x. A pair that is the
+same as another with the planes swapped is merged too.
+=================
+*/
+void BSP_MergePlanes( bspFile_t *bsp ) {
+	dplane_t *planes;
+	int *remap, *table, *next;
+	uint32_t *hashes;
+	int numPairs, numPlanes, numSnapped, tableSize;
+	int i, p, slot;
+
+	if ( bsp->numPlanes < 2 ) {
+		return;
+	}
+
+	planes = malloc( bsp->numPlanes * sizeof ( *planes ) );
+	remap = malloc( bsp->numPlanes * sizeof ( *remap ) );
+	hashes = malloc( bsp->numPlanes * sizeof ( *hashes ) );
+	next = malloc( bsp->numPlanes * sizeof ( *next ) );
+
+	tableSize = 1;
+	while ( tableSize < bsp->numPlanes * 2 ) {
+		tableSize <<= 1;
+	}
+
+	table = malloc( tableSize * sizeof ( *table ) );
+	for ( i = 0; i < tableSize; i++ ) {
+		table[i] = -1;
+	}
+
+	// a plane without an opposite at the end is kept as is
+	numPairs = bsp->numPlanes / 2;
+	numPlanes = 0;
+	numSnapped = 0;
+
+	for ( i = 0; i < numPairs; i++ ) {
+		dplane_t pair[2];
+
+		pair[0] = bsp->planes[i*2+0];
+		pair[1] = bsp->planes[i*2+1];
+		numSnapped += SnapPlane( &pair[0] );
+		numSnapped += SnapPlane( &pair[1] );
+
+		// look for a kept plane that's the same as the first plane and has the same opposite
+		hashes[numPlanes] = PlaneHash( &pair[0] );
+
+		for ( p = table[hashes[numPlanes] & ( tableSize - 1 )]; p != -1; p = next[p] ) {
+			if ( hashes[p] == hashes[numPlanes] && SamePlane( &planes[p], &pair[0] ) && SamePlane( &planes[p^1], &pair[1] ) ) {
+				break;
+			}
+		}
+
+		if ( p != -1 ) {
+			remap[i*2+0] = p;
+			remap[i*2+1] = p^1;
+			continue;
+		}
+
+		remap[i*2+0] = numPlanes;
+		remap[i*2+1] = numPlanes + 1;
+
+		hashes[numPlanes + 1] = PlaneHash( &pair[1] );
+
+		for ( p = 0; p < 2; p++ ) {
+			planes[numPlanes] = pair[p];
+			slot = hashes[numPlanes] & ( tableSize - 1 );
+			next[numPlanes] = table[slot];
+			table[slot] = numPlanes;
+			numPlanes++;
+		}
+	}
+
+	if ( bsp->numPlanes & 1 ) {
+		remap[bsp->numPlanes - 1] = numPlanes;
+		planes[numPlanes++] = bsp->planes[bsp->numPlanes - 1];
+	}
+
+	free( table );
+	free( next );
+	free( hashes );
+
+	for ( i = 0; i < bsp->numNodes; i++ ) {
+		if ( bsp->nodes[i].planeNum >= 0 && bsp->nodes[i].planeNum < bsp->numPlanes ) {
+			bsp->nodes[i].planeNum = remap[bsp->nodes[i].planeNum];
+		}
+	}
+
+	for ( i = 0; i < bsp->numBrushSides; i++ ) {
+		if ( bsp->brushSides[i].planeNum >= 0 && bsp->brushSides[i].planeNum < bsp->numPlanes ) {
+			bsp->brushSides[i].planeNum = remap[bsp->brushSides[i].planeNum];
+		}
+	}
+
+	free( remap );
+
+	Com_Printf( "Snapped %d planes, merged %d of %d planes.\n", numSnapped, bsp->numPlanes - numPlanes, bsp->numPlanes );
+
+	BSP_FreeArray( bsp, bsp->planes );
+	bsp->planes = realloc( planes, numPlanes * sizeof ( *planes ) );
+	bsp->numPlanes = numPlanes;
+}
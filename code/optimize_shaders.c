@@ -0,0 +1,149 @@
+/*
+===========================================================================
+Copyright (C) 2015 Zack Middleton
+
+This file is part of BSP sekai Source Code.
+
+BSP sekai Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+BSP sekai Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with BSP sekai Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, BSP sekai Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+
+
+// optimize_shaders.c -- merge duplicate shaders
+
+#include "sekai.h"
+#include "bsp.h"
+
+/*
+=================
+ShaderHash
+=================
+*/
+static uint64_t ShaderHash( const dshader_t *shader ) {
+	const char *end;
+	size_t length;
+
+	// the name may not be terminated and the bytes after it may be garbage
+	end = memchr( shader->shader, '\0', sizeof ( shader->shader ) );
+	length = end ? (size_t)( end - shader->shader ) : sizeof ( shader->shader );
+
+	return Com_Hash64( shader->shader, length, ( (uint64_t)(unsigned)shader->surfaceFlags << 32 ) | (unsigned)shader->contentFlags );
+}
+
+/*
+=================
+SameShader
+=================
+*/
+static qboolean SameShader( const dshader_t *a, const dshader_t *b ) {
+	return a->surfaceFlags == b->surfaceFlags && a->contentFlags == b->contentFlags
+		&& strncmp( a->shader, b->shader, sizeof ( a->shader ) ) == 0;
+}
+
+/*
+=================
+BSP_DedupeShaders
+
+Merge shaders with the same name, surface flags, and content flags and remap
+shaderNum of brushes, brush sides, and surfaces. The first of each is kept,
+so the order is unchanged if there aren't any duplicates.
+=================
+*/
+void BSP_DedupeShaders( bspFile_t *bsp ) {
+	dshader_t *shaders;
+	int *table, *remap;
+	int tableSize, numShaders;
+	int i, slot;
+
+	if ( bsp->numShaders < 2 ) {
+		return;
+	}
+
+	tableSize = 1;
+	while ( tableSize < bsp->numShaders * 2 ) {
+		tableSize <<= 1;
+	}
+
+	table = malloc( tableSize * sizeof ( *table ) );
+	remap = malloc( bsp->numShaders * sizeof ( *remap ) );
+	shaders = malloc( bsp->numShaders * sizeof ( *shaders ) );
+
+	for ( i = 0; i < tableSize; i++ ) {
+		table[i] = -1;
+	}
+
+	numShaders = 0;
+
+	for ( i = 0; i < bsp->numShaders; i++ ) {
+		const dshader_t *in = &bsp->shaders[i];
+
+		slot = ShaderHash( in ) & ( tableSize - 1 );
+
+		while ( table[slot] != -1 && !SameShader( &shaders[table[slot]], in ) ) {
+			slot = ( slot + 1 ) & ( tableSize - 1 );
+		}
+
+		if ( table[slot] == -1 ) {
+			table[slot] = numShaders;
+			Com_Memset( &shaders[numShaders], 0, sizeof ( *shaders ) );
+			strncpy( shaders[numShaders].shader, in->shader, sizeof ( shaders[numShaders].shader ) );
+			shaders[numShaders].surfaceFlags = in->surfaceFlags;
+			shaders[numShaders].contentFlags = in->contentFlags;
+			numShaders++;
+		}
+
+		remap[i] = table[slot];
+	}
+
+	free( table );
+
+	if ( numShaders == bsp->numShaders ) {
+		free( remap );
+		free( shaders );
+		return;
+	}
+
+	for ( i = 0; i < bsp->numBrushes; i++ ) {
+		if ( bsp->brushes[i].shaderNum >= 0 && bsp->brushes[i].shaderNum < bsp->numShaders ) {
+			bsp->brushes[i].shaderNum = remap[bsp->brushes[i].shaderNum];
+		}
+	}
+
+	for ( i = 0; i < bsp->numBrushSides; i++ ) {
+		if ( bsp->brushSides[i].shaderNum >= 0 && bsp->brushSides[i].shaderNum < bsp->numShaders ) {
+			bsp->brushSides[i].shaderNum = remap[bsp->brushSides[i].shaderNum];
+		}
+	}
+
+	for ( i = 0; i < bsp->numSurfaces; i++ ) {
+		if ( bsp->surfaces[i].shaderNum >= 0 && bsp->surfaces[i].shaderNum < bsp->numShaders ) {
+			bsp->surfaces[i].shaderNum = remap[bsp->surfaces[i].shaderNum];
+		}
+	}
+
+	free( remap );
+
+	BSP_FreeArray( bsp, bsp->shaders );
+	bsp->shaders = realloc( shaders, numShaders * sizeof ( *shaders ) );
+	bsp->numShaders = numShaders;
+}
@@ -0,0 +1,738 @@
+/*
+===========================================================================
+Copyright (C) 2015 Zack Middleton
+
+This file is part of BSP sekai Source Code.
+
+BSP sekai Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+BSP sekai Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with BSP sekai Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, BSP sekai Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+
+
+
+// optimize_surfaces.c -- sort and merge surfaces to reduce draw calls and state changes
+
+#include "sekai.h"
+#include "bsp.h"
+
+typedef struct {
+	int			shaderNum;
+	int			lightmapNum;
+	int			fogNum;
+	uint32_t	morton;
+	int			surfaceNum;
+} surfaceKey_t;
+
+static int SurfaceKeyCompare( const void *a, const void *b ) {
+	const surfaceKey_t *ka = a, *kb = b;
+
+	if ( ka->shaderNum != kb->shaderNum ) {
+		return ka->shaderNum < kb->shaderNum ? -1 : 1;
+	}
+	if ( ka->lightmapNum != kb->lightmapNum ) {
+		return ka->lightmapNum < kb->lightmapNum ? -1 : 1;
+	}
+	if ( ka->fogNum != kb->fogNum ) {
+		return ka->fogNum < kb->fogNum ? -1 : 1;
+	}
+	if ( ka->morton != kb->morton ) {
+		return ka->morton < kb->morton ? -1 : 1;
+	}
+	return ka->surfaceNum - kb->surfaceNum;
+}
+
+static int IntCompare( const void *a, const void *b ) {
+	return *(const int *)a - *(const int *)b;
+}
+
+// spread the low 10 bits out to every third bit
+static uint32_t MortonSpread( uint32_t x ) {
+	x &= 0x3ff;
+	x = ( x | ( x << 16 ) ) & 0x030000ff;
+	x = ( x | ( x << 8 ) ) & 0x0300f00f;
+	x = ( x | ( x << 4 ) ) & 0x030c30c3;
+	x = ( x | ( x << 2 ) ) & 0x09249249;
+	return x;
+}
+
+/*
+=================
+SurfaceCenter
+
+Center of the surface's vertexes, or the flare origin.
+=================
+*/
+static void SurfaceCenter( const bspFile_t *bsp, const dsurface_t *surface, vec3_t center ) {
+	vec3_t mins, maxs;
+	int i, j;
+
+	if ( surface->surfaceType == MST_FLARE || surface->numVerts <= 0
+		|| surface->firstVert < 0 || surface->firstVert + surface->numVerts > bsp->numDrawVerts ) {
+		VectorCopy( surface->lightmapOrigin, center );
+		return;
+	}
+
+	VectorCopy( bsp->drawVerts[surface->firstVert].xyz, mins );
+	VectorCopy( bsp->drawVerts[surface->firstVert].xyz, maxs );
+
+	for ( i = 1; i < surface->numVerts; i++ ) {
+		for ( j = 0; j < 3; j++ ) {
+			mins[j] = MIN( mins[j], bsp->drawVerts[surface->firstVert + i].xyz[j] );
+			maxs[j] = MAX( maxs[j], bsp->drawVerts[surface->firstVert + i].xyz[j] );
+		}
+	}
+
+	for ( j = 0; j < 3; j++ ) {
+		center[j] = ( mins[j] + maxs[j] ) * 0.5f;
+	}
+}
+
+/*
+=================
+CountStateChanges
+
+Count how often the shader and lightmap change drawing the surfaces of every
+leaf in order, like the renderer does with everything visible.
+=================
+*/
+static void CountStateChanges( const bspFile_t *bsp, int *shaderChanges, int *lightmapChanges ) {
+	const dsurface_t *surface, *last;
+	byte *drawn;
+	int i, j, num;
+
+	drawn = malloc( bsp->numSurfaces + 1 );
+	Com_Memset( drawn, 0, bsp->numSurfaces + 1 );
+
+	*shaderChanges = *lightmapChanges = 0;
+	last = NULL;
+
+	for ( i = 0; i < bsp->numLeafs; i++ ) {
+		for ( j = 0; j < bsp->leafs[i].numLeafSurfaces; j++ ) {
+			num = bsp->leafs[i].firstLeafSurface + j;
+			if ( num < 0 || num >= bsp->numLeafSurfaces ) {
+				continue;
+			}
+
+			num = bsp->leafSurfaces[num];
+			if ( num < 0 || num >= bsp->numSurfaces || drawn[num] ) {
+				continue;
+			}
+
+			drawn[num] = qtrue;
+			surface = &bsp->surfaces[num];
+
+			if ( last && last->shaderNum != surface->shaderNum ) {
+				( *shaderChanges )++;
+			}
+			if ( last && last->lightmapNum != surface->lightmapNum ) {
+				( *lightmapChanges )++;
+			}
+
+			last = surface;
+		}
+	}
+
+	free( drawn );
+}
+
+/*
+=================
+BSP_SortSurfaces
+
+Sort the surfaces of each submodel by shader, lightmap, fog, and then the
+Morton code of their center so surfaces near each other stay together.
+The surfaces of each leaf are sorted the same way.
+=================
+*/
+void BSP_SortSurfaces( bspFile_t *bsp ) {
+	surfaceKey_t *keys;
+	dsurface_t *surfaces;
+	byte *sorted;
+	int *remap;
+	int shaderChanges[2], lightmapChanges[2];
+	const dmodel_t *model;
+	vec3_t center, size;
+	int i, j, first, num;
+
+	if ( bsp->numSurfaces < 2 ) {
+		return;
+	}
+
+	CountStateChanges( bsp, &shaderChanges[0], &lightmapChanges[0] );
+
+	keys = malloc( bsp->numSurfaces * sizeof ( *keys ) );
+	sorted = malloc( bsp->numSurfaces );
+	Com_Memset( sorted, 0, bsp->numSurfaces );
+
+	// surfaces outside of the submodels stay where they are
+	for ( i = 0; i < bsp->numSurfaces; i++ ) {
+		keys[i].surfaceNum = i;
+	}
+
+	for ( i = 0, model = bsp->submodels; i < bsp->numSubmodels; i++, model++ ) {
+		first = model->firstSurface;
+		num = model->numSurfaces;
+
+		if ( first < 0 || num < 2 || first + num > bsp->numSurfaces ) {
+			continue;
+		}
+
+		// don't sort submodels that share surfaces
+		for ( j = first; j < first + num && !sorted[j]; j++ ) {
+		}
+		if ( j < first + num ) {
+			continue;
+		}
+
+		for ( j = 0; j < 3; j++ ) {
+			size[j] = MAX( model->maxs[j] - model->mins[j], 1 );
+		}
+
+		for ( j = first; j < first + num; j++ ) {
+			const dsurface_t *surface = &bsp->surfaces[j];
+			uint32_t cell[3];
+			int k;
+
+			SurfaceCenter( bsp, surface, center );
+
+			for ( k = 0; k < 3; k++ ) {
+				float f = ( center[k] - model->mins[k] ) / size[k];
+
+				cell[k] = (uint32_t)( MIN( MAX( f, 0 ), 1 ) * 1023 );
+			}
+
+			keys[j].shaderNum = surface->shaderNum;
+			keys[j].lightmapNum = surface->lightmapNum;
+			keys[j].fogNum = surface->fogNum;
+			keys[j].morton = MortonSpread( cell[0] ) | ( MortonSpread( cell[1] ) << 1 ) | ( MortonSpread( cell[2] ) << 2 );
+			sorted[j] = qtrue;
+		}
+
+		qsort( &keys[first], num, sizeof ( *keys ), SurfaceKeyCompare );
+	}
+
+	free( sorted );
+
+	// move the surfaces and update everything that refers to them
+	surfaces = malloc( bsp->numSurfaces * sizeof ( *surfaces ) );
+	remap = malloc( bsp->numSurfaces * sizeof ( *remap ) );
+
+	for ( i = 0; i < bsp->numSurfaces; i++ ) {
+		surfaces[i] = bsp->surfaces[keys[i].surfaceNum];
+		remap[keys[i].surfaceNum] = i;
+	}
+
+	free( keys );
+
+	for ( i = 0; i < bsp->numLeafSurfaces; i++ ) {
+		if ( bsp->leafSurfaces[i] >= 0 && bsp->leafSurfaces[i] < bsp->numSurfaces ) {
+			bsp->leafSurfaces[i] = remap[bsp->leafSurfaces[i]];
+		}
+	}
+
+	for ( i = 0; i < bsp->numLeafs; i++ ) {
+		first = bsp->leafs[i].firstLeafSurface;
+		num = bsp->leafs[i].numLeafSurfaces;
+
+		if ( first >= 0 && num > 1 && first + num <= bsp->numLeafSurfaces ) {
+			qsort( &bsp->leafSurfaces[first], num, sizeof ( *bsp->leafSurfaces ), IntCompare );
+		}
+	}
+
+	for ( i = 0; i < bsp->numBrushSides; i++ ) {
+		if ( bsp->brushSides[i].surfaceNum >= 0 && bsp->brushSides[i].surfaceNum < bsp->numSurfaces ) {
+			bsp->brushSides[i].surfaceNum = remap[bsp->brushSides[i].surfaceNum];
+		}
+	}
+
+	free( remap );
+
+	BSP_FreeArray( bsp, bsp->surfaces );
+	bsp->surfaces = surfaces;
+
+	CountStateChanges( bsp, &shaderChanges[1], &lightmapChanges[1] );
+
+	Com_Printf( "Shader changes %d -> %d, lightmap changes %d -> %d drawing every leaf.\n",
+		shaderChanges[0], shaderChanges[1], lightmapChanges[0], lightmapChanges[1] );
+}
+
+
+/*
+==============================================================================
+
+Merging planar surfaces
+
+==============================================================================
+*/
+
+// the renderers' ParseFace truncates planar surfaces with more than
+// MAX_FACE_POINTS vertexes and gives them the default shader, indexes are
+// limited by SHADER_MAX_INDEXES
+#define MAX_MERGED_VERTS		64
+#define MAX_MERGED_INDEXES		6000
+
+#define MERGE_NORMAL_EPSILON	0.0001f
+#define MERGE_DIST_EPSILON		0.01f
+
+typedef struct {
+	int			modelNum;
+	uint64_t	leafHash;		// hash of the leafs that list the surface
+	int			shaderNum;
+	int			lightmapNum;
+	int			fogNum;
+	int			plane[4];		// quantized normal and dist
+	float		dist;
+	int			surfaceNum;
+} mergeKey_t;
+
+static int MergeKeyCompare( const void *a, const void *b ) {
+	const mergeKey_t *ka = a, *kb = b;
+	int i;
+
+	if ( ka->modelNum != kb->modelNum ) {
+		return ka->modelNum < kb->modelNum ? -1 : 1;
+	}
+	if ( ka->leafHash != kb->leafHash ) {
+		return ka->leafHash < kb->leafHash ? -1 : 1;
+	}
+	if ( ka->shaderNum != kb->shaderNum ) {
+		return ka->shaderNum < kb->shaderNum ? -1 : 1;
+	}
+	if ( ka->lightmapNum != kb->lightmapNum ) {
+		return ka->lightmapNum < kb->lightmapNum ? -1 : 1;
+	}
+	if ( ka->fogNum != kb->fogNum ) {
+		return ka->fogNum < kb->fogNum ? -1 : 1;
+	}
+	for ( i = 0; i < 4; i++ ) {
+		if ( ka->plane[i] != kb->plane[i] ) {
+			return ka->plane[i] < kb->plane[i] ? -1 : 1;
+		}
+	}
+	return ka->surfaceNum - kb->surfaceNum;
+}
+
+/*
+=================
+MergeableSurface
+
+Planar surfaces with valid vertexes and whole triangles.
+=================
+*/
+static qboolean MergeableSurface( const bspFile_t *bsp, const dsurface_t *surface ) {
+	int i;
+
+	if ( surface->surfaceType != MST_PLANAR || surface->numVerts <= 0 || surface->numIndexes <= 0 || surface->numIndexes % 3 ) {
+		return qfalse;
+	}
+
+	if ( surface->numVerts > MAX_MERGED_VERTS || surface->numIndexes > MAX_MERGED_INDEXES ) {
+		return qfalse;
+	}
+
+	if ( surface->firstVert < 0 || surface->firstVert + surface->numVerts > bsp->numDrawVerts
+		|| surface->firstIndex < 0 || surface->firstIndex + surface->numIndexes > bsp->numDrawIndexes ) {
+		return qfalse;
+	}
+
+	for ( i = 0; i < surface->numIndexes; i++ ) {
+		if ( bsp->drawIndexes[surface->firstIndex + i] < 0 || bsp->drawIndexes[surface->firstIndex + i] >= surface->numVerts ) {
+			return qfalse;
+		}
+	}
+
+	return qtrue;
+}
+
+/*
+=================
+CanMergeSurfaces
+
+The sort key only has a hash of the leafs and a quantized plane, check them.
+=================
+*/
+static qboolean CanMergeSurfaces( const bspFile_t *bsp, const mergeKey_t *a, const mergeKey_t *b, const int *leafStart, const int *leafEnd, const int *surfaceLeafs ) {
+	const dsurface_t *sa = &bsp->surfaces[a->surfaceNum];
+	const dsurface_t *sb = &bsp->surfaces[b->surfaceNum];
+	int numLeafs;
+	int i;
+
+	if ( a->modelNum != b->modelNum || a->leafHash != b->leafHash || a->shaderNum != b->shaderNum
+		|| a->lightmapNum != b->lightmapNum || a->fogNum != b->fogNum ) {
+		return qfalse;
+	}
+
+	for ( i = 0; i < 3; i++ ) {
+		if ( sa->lightmapVecs[2][i] - sb->lightmapVecs[2][i] > MERGE_NORMAL_EPSILON || sb->lightmapVecs[2][i] - sa->lightmapVecs[2][i] > MERGE_NORMAL_EPSILON ) {
+			return qfalse;
+		}
+	}
+
+	if ( a->dist - b->dist > MERGE_DIST_EPSILON || b->dist - a->dist > MERGE_DIST_EPSILON ) {
+		return qfalse;
+	}
+
+	numLeafs = leafEnd[a->surfaceNum] - leafStart[a->surfaceNum];
+
+	if ( numLeafs != leafEnd[b->surfaceNum] - leafStart[b->surfaceNum] ) {
+		return qfalse;
+	}
+
+	return memcmp( &surfaceLeafs[leafStart[a->surfaceNum]], &surfaceLeafs[leafStart[b->surfaceNum]], numLeafs * sizeof ( *surfaceLeafs ) ) == 0;
+}
+
+/*
+=================
+BSP_MergeSurfaces
+
+Merge planar surfaces of the same submodel that have the same shader,
+lightmap, fog, and plane and are listed by the same leafs, up to the vertex
+and index limits of the renderer. The vertexes and indexes of merged
+surfaces are added after the ones still used by other surfaces.
+=================
+*/
+void BSP_MergeSurfaces( bspFile_t *bsp ) {
+	const dmodel_t *model;
+	dsurface_t *surface, *merged;
+	mergeKey_t *keys;
+	int *surfaceModels, *leafStart, *leafEnd, *surfaceLeafs;
+	int *groupLength, *mergedInto, *keptBefore;
+	int *vertsBefore, *indexesBefore;
+	byte *rebuilt;
+	drawVert_t *drawVerts;
+	int *drawIndexes;
+	int numKeys, numVerts, numIndexes, numSurfaces, numMerged;
+	int firstVert, firstIndex;
+	int addedVerts, addedIndexes;
+	int numOldVerts, numOldIndexes;
+	int i, j, k, num;
+
+	if ( bsp->numSurfaces < 2 ) {
+		return;
+	}
+
+	// submodel of each surface
+	surfaceModels = malloc( bsp->numSurfaces * sizeof ( *surfaceModels ) );
+	for ( i = 0; i < bsp->numSurfaces; i++ ) {
+		surfaceModels[i] = -1;
+	}
+
+	for ( i = 0, model = bsp->submodels; i < bsp->numSubmodels; i++, model++ ) {
+		for ( j = MAX( model->firstSurface, 0 ); j < model->firstSurface + model->numSurfaces && j < bsp->numSurfaces; j++ ) {
+			if ( surfaceModels[j] == -1 ) {
+				surfaceModels[j] = i;
+			}
+		}
+	}
+
+	// leafs that list each surface, in order, counted and then filled in
+	leafStart = malloc( ( bsp->numSurfaces + 1 ) * sizeof ( *leafStart ) );
+	leafEnd = malloc( ( bsp->numSurfaces + 1 ) * sizeof ( *leafEnd ) );
+	Com_Memset( leafEnd, 0, ( bsp->numSurfaces + 1 ) * sizeof ( *leafEnd ) );
+	surfaceLeafs = NULL;
+
+	for ( k = 0; k < 2; k++ ) {
+		for ( i = 0; i < bsp->numLeafs; i++ ) {
+			for ( j = 0; j < bsp->leafs[i].numLeafSurfaces; j++ ) {
+				num = bsp->leafs[i].firstLeafSurface + j;
+				if ( num < 0 || num >= bsp->numLeafSurfaces ) {
+					continue;
+				}
+
+				num = bsp->leafSurfaces[num];
+				if ( num < 0 || num >= bsp->numSurfaces ) {
+					continue;
+				}
+
+				if ( k == 0 ) {
+					leafEnd[num]++;
+				} else if ( leafEnd[num] == leafStart[num] || surfaceLeafs[leafEnd[num] - 1] != i ) {
+					// a leaf listing a surface twice is the same as once
+					surfaceLeafs[leafEnd[num]++] = i;
+				}
+			}
+		}
+
+		if ( k == 0 ) {
+			leafStart[0] = 0;
+			for ( i = 0; i < bsp->numSurfaces; i++ ) {
+				leafStart[i + 1] = leafStart[i] + leafEnd[i];
+				leafEnd[i] = leafStart[i];
+			}
+			surfaceLeafs = malloc( ( leafStart[bsp->numSurfaces] + 1 ) * sizeof ( *surfaceLeafs ) );
+		}
+	}
+
+	keys = malloc( bsp->numSurfaces * sizeof ( *keys ) );
+	numKeys = 0;
+
+	for ( i = 0, surface = bsp->surfaces; i < bsp->numSurfaces; i++, surface++ ) {
+		mergeKey_t *key;
+
+		if ( surfaceModels[i] == -1 || !MergeableSurface( bsp, surface ) ) {
+			continue;
+		}
+
+		key = &keys[numKeys++];
+		key->modelNum = surfaceModels[i];
+		key->leafHash = Com_Hash64( &surfaceLeafs[leafStart[i]], ( leafEnd[i] - leafStart[i] ) * sizeof ( *surfaceLeafs ), 0 );
+		key->shaderNum = surface->shaderNum;
+		key->lightmapNum = surface->lightmapNum;
+		key->fogNum = surface->fogNum;
+		key->dist = DotProduct( bsp->drawVerts[surface->firstVert].xyz, surface->lightmapVecs[2] );
+		for ( j = 0; j < 3; j++ ) {
+			key->plane[j] = (int)( surface->lightmapVecs[2][j] * 1000 );
+		}
+		key->plane[3] = (int)( key->dist * 10 );
+		key->surfaceNum = i;
+	}
+
+	free( surfaceModels );
+
+	qsort( keys, numKeys, sizeof ( *keys ), MergeKeyCompare );
+
+	//
+	// group the surfaces to merge, the first of each group is kept
+	//
+	groupLength = malloc( ( numKeys + 1 ) * sizeof ( *groupLength ) );
+	mergedInto = malloc( bsp->numSurfaces * sizeof ( *mergedInto ) );
+	for ( i = 0; i < bsp->numSurfaces; i++ ) {
+		mergedInto[i] = i;
+	}
+
+	addedVerts = addedIndexes = 0;
+	numMerged = 0;
+
+	for ( i = 0; i < numKeys; i = j ) {
+		surface = &bsp->surfaces[keys[i].surfaceNum];
+		numVerts = surface->numVerts;
+		numIndexes = surface->numIndexes;
+
+		for ( j = i + 1; j < numKeys && CanMergeSurfaces( bsp, &keys[i], &keys[j], leafStart, leafEnd, surfaceLeafs ); j++ ) {
+			surface = &bsp->surfaces[keys[j].surfaceNum];
+
+			if ( numVerts + surface->numVerts > MAX_MERGED_VERTS || numIndexes + surface->numIndexes > MAX_MERGED_INDEXES ) {
+				break;
+			}
+
+			numVerts += surface->numVerts;
+			numIndexes += surface->numIndexes;
+			mergedInto[keys[j].surfaceNum] = keys[i].surfaceNum;
+		}
+
+		groupLength[i] = j - i;
+
+		if ( j - i > 1 ) {
+			addedVerts += numVerts;
+			addedIndexes += numIndexes;
+			numMerged += j - i;
+		}
+	}
+
+	free( leafStart );
+	free( leafEnd );
+	free( surfaceLeafs );
+
+	if ( !numMerged ) {
+		free( keys );
+		free( groupLength );
+		free( mergedInto );
+		return;
+	}
+
+	//
+	// keep the vertexes and indexes that surfaces which weren't merged use
+	//
+	rebuilt = malloc( bsp->numSurfaces );
+	Com_Memset( rebuilt, 0, bsp->numSurfaces );
+
+	for ( i = 0; i < numKeys; i += groupLength[i] ) {
+		rebuilt[keys[i].surfaceNum] = ( groupLength[i] > 1 );
+	}
+
+	// counted as used first, then replaced by the number used before each
+	vertsBefore = malloc( ( bsp->numDrawVerts + 1 ) * sizeof ( *vertsBefore ) );
+	indexesBefore = malloc( ( bsp->numDrawIndexes + 1 ) * sizeof ( *indexesBefore ) );
+	Com_Memset( vertsBefore, 0, ( bsp->numDrawVerts + 1 ) * sizeof ( *vertsBefore ) );
+	Com_Memset( indexesBefore, 0, ( bsp->numDrawIndexes + 1 ) * sizeof ( *indexesBefore ) );
+
+	for ( i = 0, surface = bsp->surfaces; i < bsp->numSurfaces; i++, surface++ ) {
+		if ( mergedInto[i] != i || rebuilt[i] ) {
+			continue;
+		}
+
+		for ( j = MAX( surface->firstVert, 0 ); j < surface->firstVert + surface->numVerts && j < bsp->numDrawVerts; j++ ) {
+			vertsBefore[j] = 1;
+		}
+
+		for ( j = MAX( surface->firstIndex, 0 ); j < surface->firstIndex + surface->numIndexes && j < bsp->numDrawIndexes; j++ ) {
+			indexesBefore[j] = 1;
+		}
+	}
+
+	drawVerts = malloc( ( bsp->numDrawVerts + addedVerts + 1 ) * sizeof ( *drawVerts ) );
+	drawIndexes = malloc( ( bsp->numDrawIndexes + addedIndexes + 1 ) * sizeof ( *drawIndexes ) );
+
+	for ( i = 0, numVerts = 0; i < bsp->numDrawVerts; i++ ) {
+		num = vertsBefore[i];
+		vertsBefore[i] = numVerts;
+
+		if ( num ) {
+			drawVerts[numVerts++] = bsp->drawVerts[i];
+		}
+	}
+	vertsBefore[bsp->numDrawVerts] = numVerts;
+
+	for ( i = 0, numIndexes = 0; i < bsp->numDrawIndexes; i++ ) {
+		num = indexesBefore[i];
+		indexesBefore[i] = numIndexes;
+
+		if ( num ) {
+			drawIndexes[numIndexes++] = bsp->drawIndexes[i];
+		}
+	}
+	indexesBefore[bsp->numDrawIndexes] = numIndexes;
+
+	// indexes are relative to the first vertex so they don't change
+	for ( i = 0, surface = bsp->surfaces; i < bsp->numSurfaces; i++, surface++ ) {
+		if ( mergedInto[i] != i || rebuilt[i] ) {
+			continue;
+		}
+
+		if ( surface->firstVert >= 0 && surface->firstVert + surface->numVerts <= bsp->numDrawVerts ) {
+			surface->firstVert = vertsBefore[surface->firstVert];
+		}
+
+		if ( surface->firstIndex >= 0 && surface->firstIndex + surface->numIndexes <= bsp->numDrawIndexes ) {
+			surface->firstIndex = indexesBefore[surface->firstIndex];
+		}
+	}
+
+	free( rebuilt );
+	free( vertsBefore );
+	free( indexesBefore );
+
+	//
+	// add the vertexes and indexes of the merged surfaces after them
+	//
+	for ( i = 0; i < numKeys; i += groupLength[i] ) {
+		if ( groupLength[i] == 1 ) {
+			continue;
+		}
+
+		merged = &bsp->surfaces[keys[i].surfaceNum];
+		firstVert = numVerts;
+		firstIndex = numIndexes;
+
+		for ( k = i; k < i + groupLength[i]; k++ ) {
+			surface = &bsp->surfaces[keys[k].surfaceNum];
+
+			for ( j = 0; j < surface->numIndexes; j++ ) {
+				drawIndexes[numIndexes++] = bsp->drawIndexes[surface->firstIndex + j] + numVerts - firstVert;
+			}
+
+			Com_Memcpy( &drawVerts[numVerts], &bsp->drawVerts[surface->firstVert], surface->numVerts * sizeof ( *drawVerts ) );
+			numVerts += surface->numVerts;
+
+			// cover the lightmap area of all of them
+			if ( k > i && merged->lightmapNum >= 0 ) {
+				int right = MAX( merged->lightmapX + merged->lightmapWidth, surface->lightmapX + surface->lightmapWidth );
+				int bottom = MAX( merged->lightmapY + merged->lightmapHeight, surface->lightmapY + surface->lightmapHeight );
+
+				merged->lightmapX = MIN( merged->lightmapX, surface->lightmapX );
+				merged->lightmapY = MIN( merged->lightmapY, surface->lightmapY );
+				merged->lightmapWidth = right - merged->lightmapX;
+				merged->lightmapHeight = bottom - merged->lightmapY;
+			}
+		}
+
+		merged->firstVert = firstVert;
+		merged->numVerts = numVerts - firstVert;
+		merged->firstIndex = firstIndex;
+		merged->numIndexes = numIndexes - firstIndex;
+	}
+
+	free( keys );
+	free( groupLength );
+
+	numOldVerts = bsp->numDrawVerts;
+	numOldIndexes = bsp->numDrawIndexes;
+
+	BSP_FreeArray( bsp, bsp->drawVerts );
+	bsp->drawVerts = drawVerts;
+	bsp->numDrawVerts = numVerts;
+
+	BSP_FreeArray( bsp, bsp->drawIndexes );
+	bsp->drawIndexes = drawIndexes;
+	bsp->numDrawIndexes = numIndexes;
+
+	//
+	// remove the surfaces that were merged into another
+	//
+	keptBefore = malloc( ( bsp->numSurfaces + 1 ) * sizeof ( *keptBefore ) );
+
+	for ( i = 0, numSurfaces = 0; i < bsp->numSurfaces; i++ ) {
+		keptBefore[i] = numSurfaces;
+
+		if ( mergedInto[i] == i ) {
+			bsp->surfaces[numSurfaces++] = bsp->surfaces[i];
+		}
+	}
+	keptBefore[bsp->numSurfaces] = numSurfaces;
+
+	for ( i = 0; i < bsp->numSubmodels; i++ ) {
+		dmodel_t *m = &bsp->submodels[i];
+
+		if ( m->firstSurface < 0 || m->numSurfaces < 0 || m->firstSurface + m->numSurfaces > bsp->numSurfaces ) {
+			continue;
+		}
+
+		m->numSurfaces = keptBefore[m->firstSurface + m->numSurfaces] - keptBefore[m->firstSurface];
+		m->firstSurface = keptBefore[m->firstSurface];
+	}
+
+	// the leafs that list a removed surface also list the one it was merged into
+	for ( i = 0; i < bsp->numLeafSurfaces; i++ ) {
+		num = bsp->leafSurfaces[i];
+
+		if ( num >= 0 && num < bsp->numSurfaces ) {
+			bsp->leafSurfaces[i] = mergedInto[num] == num ? keptBefore[num] : -1;
+		}
+	}
+
+	for ( i = 0; i < bsp->numBrushSides; i++ ) {
+		num = bsp->brushSides[i].surfaceNum;
+
+		if ( num >= 0 && num < bsp->numSurfaces ) {
+			bsp->brushSides[i].surfaceNum = keptBefore[mergedInto[num]];
+		}
+	}
+
+	Com_Printf( "Merged %d planar surfaces into %d, %d -> %d vertexes, %d -> %d indexes.\n", numMerged, numMerged - ( bsp->numSurfaces - numSurfaces ),
+		numOldVerts, bsp->numDrawVerts, numOldIndexes, bsp->numDrawIndexes );
+
+	bsp->numSurfaces = numSurfaces;
+
+	free( keptBefore );
+	free( mergedInto );
+}
@@ -0,0 +1,274 @@
+/*
+===========================================================================
+Copyright (C) 2015 Zack Middleton
+
+This file is part of BSP sekai Source Code.
+
+BSP sekai Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+BSP sekai Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with BSP sekai Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, BSP sekai Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+
+
+
+// optimize_tree.c -- reorder nodes and leafs for walking the tree
+
+#include "sekai.h"
+#include "bsp.h"
+
+#include <limits.h>
+
+typedef struct {
+	double	nodeStep;		// average distance from a node to its child nodes, in nodes
+	int		maxDepth;
+	double	averageDepth;	// of the leafs
+} treeStats_t;
+
+/*
+=================
+TreeStats
+
+Walk the tree from node 0 without recursing, nodes seen before (or out of
+range) are skipped.
+=================
+*/
+static void TreeStats( const bspFile_t *bsp, treeStats_t *stats ) {
+	int *stack, *depths;
+	byte *visited;
+	int64_t stepTotal, depthTotal;
+	int numSteps, numLeafs, numStack;
+	int node, depth, child;
+	int i;
+
+	Com_Memset( stats, 0, sizeof ( *stats ) );
+
+	if ( bsp->numNodes <= 0 ) {
+		return;
+	}
+
+	stack = malloc( bsp->numNodes * sizeof ( *stack ) );
+	depths = malloc( bsp->numNodes * sizeof ( *depths ) );
+	visited = malloc( bsp->numNodes );
+	Com_Memset( visited, 0, bsp->numNodes );
+
+	stepTotal = depthTotal = 0;
+	numSteps = numLeafs = 0;
+
+	stack[0] = 0;
+	depths[0] = 1;
+	visited[0] = qtrue;
+	numStack = 1;
+
+	while ( numStack ) {
+		numStack--;
+		node = stack[numStack];
+		depth = depths[numStack];
+
+		for ( i = 0; i < 2; i++ ) {
+			child = bsp->nodes[node].children[i];
+
+			if ( child < 0 ) {
+				stats->maxDepth = MAX( stats->maxDepth, depth );
+				depthTotal += depth;
+				numLeafs++;
+				continue;
+			}
+
+			if ( child >= bsp->numNodes || visited[child] ) {
+				continue;
+			}
+
+			stepTotal += abs( child - node );
+			numSteps++;
+
+			visited[child] = qtrue;
+			stack[numStack] = child;
+			depths[numStack] = depth + 1;
+			numStack++;
+		}
+	}
+
+	if ( numSteps ) {
+		stats->nodeStep = (double)stepTotal / numSteps;
+	}
+	if ( numLeafs ) {
+		stats->averageDepth = (double)depthTotal / numLeafs;
+	}
+
+	free( stack );
+	free( depths );
+	free( visited );
+}
+
+typedef struct {
+	int		cluster;
+	int		order;		// when the walk first reached the leaf
+	int		leafNum;
+} leafKey_t;
+
+static int LeafKeyCompare( const void *a, const void *b ) {
+	const leafKey_t *ka = a, *kb = b;
+
+	// opaque leafs last
+	if ( ka->cluster != kb->cluster ) {
+		if ( ka->cluster < 0 || kb->cluster < 0 ) {
+			return ka->cluster < 0 ? 1 : -1;
+		}
+		return ka->cluster < kb->cluster ? -1 : 1;
+	}
+	if ( ka->order != kb->order ) {
+		return ka->order < kb->order ? -1 : 1;
+	}
+	return ka->leafNum - kb->leafNum;
+}
+
+/*
+=================
+BSP_ReorderTree
+
+Number the nodes in depth first order with the front child right after its
+parent, so walking down the tree mostly moves forward in memory. Node 0
+stays the root. Leafs are sorted by cluster and then the order the walk
+reaches them, leaf 0 stays first.
+=================
+*/
+void BSP_ReorderTree( bspFile_t *bsp ) {
+	treeStats_t before, after;
+	dnode_t *nodes;
+	dleaf_t *leafs;
+	leafKey_t *keys;
+	int *nodeRemap, *leafRemap, *stack;
+	int numStack, numOrdered, leafOrder;
+	int node, child;
+	int i, j;
+
+	if ( bsp->numNodes <= 0 ) {
+		return;
+	}
+
+	TreeStats( bsp, &before );
+
+	nodeRemap = malloc( bsp->numNodes * sizeof ( *nodeRemap ) );
+	stack = malloc( bsp->numNodes * sizeof ( *stack ) );
+	keys = malloc( ( bsp->numLeafs + 1 ) * sizeof ( *keys ) );
+
+	for ( i = 0; i < bsp->numNodes; i++ ) {
+		nodeRemap[i] = -1;
+	}
+
+	for ( i = 0; i < bsp->numLeafs; i++ ) {
+		keys[i].cluster = bsp->leafs[i].cluster;
+		keys[i].order = INT_MAX;
+		keys[i].leafNum = i;
+	}
+
+	//
+	// depth first walk, the back child is pushed first so the front one is next
+	//
+	numOrdered = 0;
+	leafOrder = 0;
+
+	stack[0] = 0;
+	nodeRemap[0] = -2;
+	numStack = 1;
+
+	while ( numStack ) {
+		node = stack[--numStack];
+		nodeRemap[node] = numOrdered++;
+
+		for ( j = 0; j < 2; j++ ) {
+			child = bsp->nodes[node].children[j];
+
+			if ( child < 0 && -child - 1 < bsp->numLeafs && keys[-child - 1].order == INT_MAX ) {
+				keys[-child - 1].order = leafOrder++;
+			}
+		}
+
+		for ( j = 1; j >= 0; j-- ) {
+			child = bsp->nodes[node].children[j];
+
+			if ( child >= 0 && child < bsp->numNodes && nodeRemap[child] == -1 ) {
+				nodeRemap[child] = -2;
+				stack[numStack++] = child;
+			}
+		}
+	}
+
+	free( stack );
+
+	// nodes that can't be reached keep their order after the others
+	for ( i = 0; i < bsp->numNodes; i++ ) {
+		if ( nodeRemap[i] == -1 ) {
+			nodeRemap[i] = numOrdered++;
+		}
+	}
+
+	// leaf 0 stays first
+	if ( bsp->numLeafs > 1 ) {
+		qsort( &keys[1], bsp->numLeafs - 1, sizeof ( *keys ), LeafKeyCompare );
+	}
+
+	leafRemap = malloc( ( bsp->numLeafs + 1 ) * sizeof ( *leafRemap ) );
+	leafs = malloc( ( bsp->numLeafs + 1 ) * sizeof ( *leafs ) );
+
+	for ( i = 0; i < bsp->numLeafs; i++ ) {
+		leafs[i] = bsp->leafs[keys[i].leafNum];
+		leafRemap[keys[i].leafNum] = i;
+	}
+
+	free( keys );
+
+	//
+	// move the nodes and update the children
+	//
+	nodes = malloc( bsp->numNodes * sizeof ( *nodes ) );
+
+	for ( i = 0; i < bsp->numNodes; i++ ) {
+		dnode_t *out = &nodes[nodeRemap[i]];
+
+		*out = bsp->nodes[i];
+
+		for ( j = 0; j < 2; j++ ) {
+			child = out->children[j];
+
+			if ( child >= 0 && child < bsp->numNodes ) {
+				out->children[j] = nodeRemap[child];
+			} else if ( child < 0 && -child - 1 < bsp->numLeafs ) {
+				out->children[j] = -leafRemap[-child - 1] - 1;
+			}
+		}
+	}
+
+	free( nodeRemap );
+	free( leafRemap );
+
+	BSP_FreeArray( bsp, bsp->nodes );
+	bsp->nodes = nodes;
+
+	BSP_FreeArray( bsp, bsp->leafs );
+	bsp->leafs = leafs;
+
+	TreeStats( bsp, &after );
+
+	Com_Printf( "Average node to child node distance %.1f -> %.1f nodes, depth %d (average leaf depth %.1f).\n",
+		before.nodeStep, after.nodeStep, after.maxDepth, after.averageDepth );
+}
@@ -0,0 +1,744 @@
+/*
+===========================================================================
+Copyright (C) 2015 Zack Middleton
+
+This file is part of BSP sekai Source Code.
+
+BSP sekai Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+BSP sekai Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with BSP sekai Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, BSP sekai Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+
+
+// optimize_verts.c -- weld and reorder the vertexes and indexes of triangle surfaces
+
+#include "sekai.h"
+#include "bsp.h"
+
+#include <limits.h>
+#include <math.h>
+
+typedef enum {
+	WELD_XYZ,
+	WELD_ST,
+	WELD_LIGHTMAP,
+	WELD_NORMAL,
+	WELD_COLOR,
+	WELD_MAX
+} weldTolerance_t;
+
+// how far apart each part of two vertexes may be to weld them
+static float weldTolerances[WELD_MAX] = { 0.001f, 0.00001f, 0.00001f, 0.0001f, 0 };
+
+// smallest spatial hash cell, so a tolerance of 0 doesn't make a cell per vertex
+#define WELD_MIN_CELL_SIZE		0.125f
+
+/*
+=================
+BSP_SetWeldTolerances
+
+Set the tolerances from a comma separated list of xyz, st, lightmap, normal,
+and color (0 to 255) tolerances. Tolerances left out are unchanged.
+=================
+*/
+qboolean BSP_SetWeldTolerances( const char *list ) {
+	const char *p;
+	char *end;
+	float value;
+	int i;
+
+	for ( i = 0, p = list; i < WELD_MAX && *p; i++ ) {
+		if ( *p != ',' ) {
+			value = strtod( p, &end );
+			if ( end == p || value < 0 || ( *end && *end != ',' ) ) {
+				Com_Printf( "Error: bad weld tolerance '%s'.\n", p );
+				return qfalse;
+			}
+			weldTolerances[i] = value;
+			p = end;
+		}
+
+		if ( *p == ',' ) {
+			p++;
+		}
+	}
+
+	if ( *p ) {
+		Com_Printf( "Error: too many weld tolerances, expected <xyz>,<st>,<lightmap>,<normal>,<color>.\n" );
+		return qfalse;
+	}
+
+	return qtrue;
+}
+
+static int64_t WeldCell( float value, float cellSize ) {
+	double cell = value / cellSize;
+	int64_t i = (int64_t)cell;
+
+	return ( cell < i ) ? i - 1 : i;
+}
+
+static uint32_t WeldCellHash( int64_t x, int64_t y, int64_t z ) {
+	int64_t cell[3];
+
+	cell[0] = x;
+	cell[1] = y;
+	cell[2] = z;
+
+	return (uint32_t)Com_Hash64( cell, sizeof ( cell ), 0 );
+}
+
+static qboolean WeldFloats( const float *a, const float *b, int count, float tolerance ) {
+	int i;
+
+	for ( i = 0; i < count; i++ ) {
+		if ( a[i] - b[i] > tolerance || b[i] - a[i] > tolerance ) {
+			return qfalse;
+		}
+	}
+
+	return qtrue;
+}
+
+static qboolean WeldVerts( const drawVert_t *a, const drawVert_t *b ) {
+	int i;
+
+	if ( !WeldFloats( a->xyz, b->xyz, 3, weldTolerances[WELD_XYZ] )
+		|| !WeldFloats( a->st, b->st, 2, weldTolerances[WELD_ST] )
+		|| !WeldFloats( a->lightmap, b->lightmap, 2, weldTolerances[WELD_LIGHTMAP] )
+		|| !WeldFloats( a->normal, b->normal, 3, weldTolerances[WELD_NORMAL] ) ) {
+		return qfalse;
+	}
+
+	for ( i = 0; i < 4; i++ ) {
+		if ( abs( a->color[i] - b->color[i] ) > weldTolerances[WELD_COLOR] ) {
+			return qfalse;
+		}
+	}
+
+	return qtrue;
+}
+
+/*
+=================
+BSP_TriangleSurface
+
+Only the triangles of planar, triangle soup, and terrain surfaces are drawn
+from the vertexes, patch control points and foliage origins are left as is.
+Surfaces sharing vertexes or indexes with another surface are left as is too.
+=================
+*/
+static qboolean BSP_TriangleSurface( const bspFile_t *bsp, const dsurface_t *surface, const byte *vertSurfaces, const byte *indexSurfaces ) {
+	int i;
+
+	if ( surface->surfaceType != MST_PLANAR && surface->surfaceType != MST_TRIANGLE_SOUP && surface->surfaceType != MST_TERRAIN ) {
+		return qfalse;
+	}
+
+	if ( surface->numVerts < 2 || surface->numIndexes <= 0 ) {
+		return qfalse;
+	}
+
+	if ( surface->firstVert < 0 || surface->firstVert + surface->numVerts > bsp->numDrawVerts ) {
+		return qfalse;
+	}
+
+	if ( surface->firstIndex < 0 || surface->firstIndex + surface->numIndexes > bsp->numDrawIndexes ) {
+		return qfalse;
+	}
+
+	for ( i = 0; i < surface->numVerts; i++ ) {
+		if ( vertSurfaces[surface->firstVert + i] != 1 ) {
+			return qfalse;
+		}
+	}
+
+	for ( i = 0; i < surface->numIndexes; i++ ) {
+		if ( indexSurfaces[surface->firstIndex + i] != 1 ) {
+			return qfalse;
+		}
+	}
+
+	for ( i = 0; i < surface->numIndexes; i++ ) {
+		if ( bsp->drawIndexes[surface->firstIndex + i] < 0 || bsp->drawIndexes[surface->firstIndex + i] >= surface->numVerts ) {
+			return qfalse;
+		}
+	}
+
+	return qtrue;
+}
+
+/*
+=================
+BSP_TriangleSurfaces
+
+Returns an array with qtrue for each surface whose vertexes and indexes can
+be changed, see BSP_TriangleSurface. maxVerts is set to the most vertexes
+of those surfaces.
+=================
+*/
+static byte *BSP_TriangleSurfaces( const bspFile_t *bsp, int *maxVerts ) {
+	const dsurface_t *surface;
+	byte *vertSurfaces, *indexSurfaces, *triangleSurfaces;
+	int i, j;
+
+	// count the surfaces using each vertex and index, up to 2
+	vertSurfaces = malloc( bsp->numDrawVerts + 1 );
+	Com_Memset( vertSurfaces, 0, bsp->numDrawVerts + 1 );
+	indexSurfaces = malloc( bsp->numDrawIndexes + 1 );
+	Com_Memset( indexSurfaces, 0, bsp->numDrawIndexes + 1 );
+
+	for ( i = 0, surface = bsp->surfaces; i < bsp->numSurfaces; i++, surface++ ) {
+		if ( surface->firstIndex >= 0 && surface->numIndexes > 0 && surface->firstIndex + surface->numIndexes <= bsp->numDrawIndexes ) {
+			for ( j = surface->firstIndex; j < surface->firstIndex + surface->numIndexes; j++ ) {
+				if ( indexSurfaces[j] < 2 ) {
+					indexSurfaces[j]++;
+				}
+			}
+		}
+
+		if ( surface->firstVert >= 0 && surface->numVerts > 0 && surface->firstVert + surface->numVerts <= bsp->numDrawVerts ) {
+			for ( j = surface->firstVert; j < surface->firstVert + surface->numVerts; j++ ) {
+				if ( vertSurfaces[j] < 2 ) {
+					vertSurfaces[j]++;
+				}
+			}
+		}
+	}
+
+	triangleSurfaces = malloc( bsp->numSurfaces + 1 );
+	*maxVerts = 0;
+
+	for ( i = 0, surface = bsp->surfaces; i < bsp->numSurfaces; i++, surface++ ) {
+		triangleSurfaces[i] = BSP_TriangleSurface( bsp, surface, vertSurfaces, indexSurfaces );
+
+		if ( triangleSurfaces[i] ) {
+			*maxVerts = MAX( *maxVerts, surface->numVerts );
+		}
+	}
+
+	free( vertSurfaces );
+	free( indexSurfaces );
+
+	return triangleSurfaces;
+}
+
+/*
+=================
+BSP_WeldVerts
+
+Weld vertexes that are within the tolerances of each other. The Quake 3
+format has surface relative indexes, so only vertexes of the same surface
+are welded. Vertexes are found using a hash of the xyz grid cell.
+=================
+*/
+void BSP_WeldVerts( bspFile_t *bsp ) {
+	dsurface_t *surface;
+	drawVert_t *drawVerts;
+	byte *welded;
+	int *weldTo, *keptBefore;
+	int *cellHeads, *cellNext;
+	uint32_t *cellHashes;
+	int numCells, maxVerts, numDrawVerts;
+	float cellSize, tolerance;
+	int64_t mins[3], maxs[3], x, y, z;
+	uint32_t hash;
+	int i, j, k, v, first;
+
+	if ( bsp->numDrawVerts <= 0 ) {
+		return;
+	}
+
+	welded = BSP_TriangleSurfaces( bsp, &maxVerts );
+
+	weldTo = malloc( bsp->numDrawVerts * sizeof ( *weldTo ) );
+	for ( i = 0; i < bsp->numDrawVerts; i++ ) {
+		weldTo[i] = i;
+	}
+
+	numCells = 1;
+	while ( numCells < maxVerts * 2 ) {
+		numCells <<= 1;
+	}
+
+	cellHeads = malloc( numCells * sizeof ( *cellHeads ) );
+	cellNext = malloc( MAX( maxVerts, 1 ) * sizeof ( *cellNext ) );
+	cellHashes = malloc( MAX( maxVerts, 1 ) * sizeof ( *cellHashes ) );
+
+	for ( i = 0; i < numCells; i++ ) {
+		cellHeads[i] = -1;
+	}
+
+	tolerance = weldTolerances[WELD_XYZ];
+	cellSize = MAX( tolerance, WELD_MIN_CELL_SIZE );
+
+	for ( i = 0, surface = bsp->surfaces; i < bsp->numSurfaces; i++, surface++ ) {
+		if ( !welded[i] ) {
+			continue;
+		}
+
+		first = surface->firstVert;
+
+		for ( j = 0; j < surface->numVerts; j++ ) {
+			const drawVert_t *vert = &bsp->drawVerts[first + j];
+
+			// look for a vertex to weld to in the cells within tolerance
+			for ( k = 0; k < 3; k++ ) {
+				mins[k] = WeldCell( vert->xyz[k] - tolerance, cellSize );
+				maxs[k] = WeldCell( vert->xyz[k] + tolerance, cellSize );
+			}
+
+			for ( x = mins[0]; x <= maxs[0] && weldTo[first + j] == first + j; x++ ) {
+				for ( y = mins[1]; y <= maxs[1] && weldTo[first + j] == first + j; y++ ) {
+					for ( z = mins[2]; z <= maxs[2]; z++ ) {
+						hash = WeldCellHash( x, y, z );
+
+						for ( v = cellHeads[hash & ( numCells - 1 )]; v != -1; v = cellNext[v] ) {
+							if ( cellHashes[v] == hash && WeldVerts( &bsp->drawVerts[first + v], vert ) ) {
+								break;
+							}
+						}
+
+						if ( v != -1 ) {
+							weldTo[first + j] = first + v;
+							break;
+						}
+					}
+				}
+			}
+
+			if ( weldTo[first + j] != first + j ) {
+				continue;
+			}
+
+			hash = WeldCellHash( WeldCell( vert->xyz[0], cellSize ), WeldCell( vert->xyz[1], cellSize ), WeldCell( vert->xyz[2], cellSize ) );
+			cellHashes[j] = hash;
+			cellNext[j] = cellHeads[hash & ( numCells - 1 )];
+			cellHeads[hash & ( numCells - 1 )] = j;
+		}
+
+		for ( j = 0; j < surface->numVerts; j++ ) {
+			if ( weldTo[first + j] == first + j ) {
+				cellHeads[cellHashes[j] & ( numCells - 1 )] = -1;
+			}
+		}
+	}
+
+	free( cellHeads );
+	free( cellNext );
+	free( cellHashes );
+	// remove the welded vertexes
+	keptBefore = malloc( ( bsp->numDrawVerts + 1 ) * sizeof ( *keptBefore ) );
+	drawVerts = malloc( bsp->numDrawVerts * sizeof ( *drawVerts ) );
+
+	for ( i = 0, numDrawVerts = 0; i < bsp->numDrawVerts; i++ ) {
+		keptBefore[i] = numDrawVerts;
+
+		if ( weldTo[i] == i ) {
+			drawVerts[numDrawVerts++] = bsp->drawVerts[i];
+		}
+	}
+	keptBefore[bsp->numDrawVerts] = numDrawVerts;
+
+	if ( numDrawVerts == bsp->numDrawVerts ) {
+		free( drawVerts );
+		free( keptBefore );
+		free( weldTo );
+		free( welded );
+		return;
+	}
+
+	for ( i = 0, surface = bsp->surfaces; i < bsp->numSurfaces; i++, surface++ ) {
+		if ( surface->firstVert < 0 || surface->firstVert > bsp->numDrawVerts ) {
+			continue;
+		}
+
+		first = surface->firstVert;
+
+		// other surfaces don't use welded vertexes, so their indexes are unchanged
+		if ( welded[i] ) {
+			for ( j = surface->firstIndex; j < surface->firstIndex + surface->numIndexes; j++ ) {
+				bsp->drawIndexes[j] = keptBefore[weldTo[first + bsp->drawIndexes[j]]] - keptBefore[first];
+			}
+		}
+
+		if ( surface->numVerts > 0 && first + surface->numVerts <= bsp->numDrawVerts ) {
+			surface->numVerts = keptBefore[first + surface->numVerts] - keptBefore[first];
+		}
+
+		surface->firstVert = keptBefore[first];
+	}
+
+	Com_Printf( "Welded %d of %d vertexes.\n", bsp->numDrawVerts - numDrawVerts, bsp->numDrawVerts );
+
+	free( keptBefore );
+	free( weldTo );
+	free( welded );
+
+	BSP_FreeArray( bsp, bsp->drawVerts );
+	bsp->drawVerts = realloc( drawVerts, numDrawVerts * sizeof ( *drawVerts ) );
+	bsp->numDrawVerts = numDrawVerts;
+}
+
+
+/*
+==============================================================================
+
+Vertex cache optimization
+
+Triangles are reordered using Tom Forsyth's "Linear-Speed Vertex Cache
+Optimisation": each step adds the triangle with the highest score, where a
+vertex scores higher if it's near the front of a simulated LRU cache and if
+it has fewer triangles left to add.
+
+==============================================================================
+*/
+
+#define VCACHE_SIZE				32	// LRU cache the triangle order is optimized for
+#define VCACHE_MAX_VALENCE		64	// vertexes with more triangles left score the same
+#define VCACHE_FIFO_SIZE		16	// FIFO cache used to measure the miss ratio
+
+typedef struct {
+	float	cacheScores[VCACHE_SIZE];
+	float	valenceScores[VCACHE_MAX_VALENCE + 1];
+
+	// vertexes
+	int		*triStart;		// first entry of each vertex in vertTris
+	int		*vertTris;		// triangles of each vertex that aren't added yet
+	int		*numActive;		// number of those triangles
+	int		*cachePos;		// position in the LRU cache, -1 if not in it
+	float	*vertScores;
+
+	// triangles
+	float	*triScores;
+	byte	*triAdded;
+
+	int		*remap;
+	int		*indexes;
+} vcache_t;
+
+static void VCache_Init( vcache_t *vc, int maxVerts, int maxIndexes ) {
+	int i;
+
+	// the last triangle's vertexes score the same so that they don't depend on winding
+	for ( i = 0; i < 3; i++ ) {
+		vc->cacheScores[i] = 0.75f;
+	}
+	for ( ; i < VCACHE_SIZE; i++ ) {
+		vc->cacheScores[i] = pow( 1.0f - (float)( i - 3 ) / ( VCACHE_SIZE - 3 ), 1.5f );
+	}
+
+	vc->valenceScores[0] = 0;
+	for ( i = 1; i <= VCACHE_MAX_VALENCE; i++ ) {
+		vc->valenceScores[i] = 2.0f * pow( i, -0.5f );
+	}
+
+	vc->triStart = malloc( ( maxVerts + 1 ) * sizeof ( *vc->triStart ) );
+	vc->vertTris = malloc( maxIndexes * sizeof ( *vc->vertTris ) );
+	vc->numActive = malloc( maxVerts * sizeof ( *vc->numActive ) );
+	vc->cachePos = malloc( maxVerts * sizeof ( *vc->cachePos ) );
+	vc->vertScores = malloc( maxVerts * sizeof ( *vc->vertScores ) );
+	vc->triScores = malloc( ( maxIndexes / 3 + 1 ) * sizeof ( *vc->triScores ) );
+	vc->triAdded = malloc( maxIndexes / 3 + 1 );
+	vc->remap = malloc( maxVerts * sizeof ( *vc->remap ) );
+	vc->indexes = malloc( maxIndexes * sizeof ( *vc->indexes ) );
+}
+
+static void VCache_Shutdown( vcache_t *vc ) {
+	free( vc->triStart );
+	free( vc->vertTris );
+	free( vc->numActive );
+	free( vc->cachePos );
+	free( vc->vertScores );
+	free( vc->triScores );
+	free( vc->triAdded );
+	free( vc->remap );
+	free( vc->indexes );
+}
+
+static float VCache_VertScore( const vcache_t *vc, int vert ) {
+	float score;
+
+	if ( vc->numActive[vert] == 0 ) {
+		return -1;
+	}
+
+	score = vc->cachePos[vert] >= 0 ? vc->cacheScores[vc->cachePos[vert]] : 0;
+	score += vc->valenceScores[MIN( vc->numActive[vert], VCACHE_MAX_VALENCE )];
+
+	return score;
+}
+
+/*
+=================
+VCache_SetVertScore
+
+Update the vertex's score and the scores of its triangles that aren't added.
+=================
+*/
+static void VCache_SetVertScore( vcache_t *vc, int vert ) {
+	float score, delta;
+	int i;
+
+	score = VCache_VertScore( vc, vert );
+	delta = score - vc->vertScores[vert];
+	vc->vertScores[vert] = score;
+
+	for ( i = vc->triStart[vert]; i < vc->triStart[vert] + vc->numActive[vert]; i++ ) {
+		vc->triScores[vc->vertTris[i]] += delta;
+	}
+}
+
+/*
+=================
+VCache_FifoMisses
+
+Count the misses of a FIFO cache drawing the triangles. lastMiss is set to
+the miss count when each vertex was added to the cache.
+=================
+*/
+static int VCache_FifoMisses( const int *indexes, int numIndexes, int numVerts, int *lastMiss ) {
+	int i, misses;
+
+	for ( i = 0; i < numVerts; i++ ) {
+		lastMiss[i] = INT_MIN / 2;
+	}
+
+	for ( i = 0, misses = 0; i < numIndexes; i++ ) {
+		if ( misses - lastMiss[indexes[i]] >= VCACHE_FIFO_SIZE ) {
+			lastMiss[indexes[i]] = misses++;
+		}
+	}
+
+	return misses;
+}
+
+/*
+=================
+VCache_OptimizeSurface
+
+Reorder the triangles of a surface for the vertex cache and then reorder
+the vertexes in the order the triangles first use them.
+=================
+*/
+static void VCache_OptimizeSurface( vcache_t *vc, bspFile_t *bsp, const dsurface_t *surface ) {
+	int *indexes = &bsp->drawIndexes[surface->firstIndex];
+	drawVert_t *verts = &bsp->drawVerts[surface->firstVert];
+	int numVerts = surface->numVerts;
+	int numTris = surface->numIndexes / 3;
+	int cache[VCACHE_SIZE + 3];
+	int newCache[VCACHE_SIZE + 3];
+	int cacheSize, newCacheSize;
+	int bestTri, nextTri, numAdded;
+	float bestScore;
+	drawVert_t *newVerts;
+	int i, j, k, vert, tri;
+
+	// list the triangles of each vertex
+	Com_Memset( vc->numActive, 0, numVerts * sizeof ( *vc->numActive ) );
+	for ( i = 0; i < numTris * 3; i++ ) {
+		vc->numActive[indexes[i]]++;
+	}
+
+	vc->triStart[0] = 0;
+	for ( i = 0; i < numVerts; i++ ) {
+		vc->triStart[i + 1] = vc->triStart[i] + vc->numActive[i];
+		vc->numActive[i] = 0;
+	}
+
+	for ( i = 0; i < numTris * 3; i++ ) {
+		vert = indexes[i];
+		vc->vertTris[vc->triStart[vert] + vc->numActive[vert]++] = i / 3;
+	}
+
+	for ( i = 0; i < numVerts; i++ ) {
+		vc->cachePos[i] = -1;
+		vc->vertScores[i] = VCache_VertScore( vc, i );
+	}
+
+	for ( i = 0; i < numTris; i++ ) {
+		vc->triAdded[i] = qfalse;
+		vc->triScores[i] = vc->vertScores[indexes[i*3+0]] + vc->vertScores[indexes[i*3+1]] + vc->vertScores[indexes[i*3+2]];
+	}
+
+	cacheSize = 0;
+	bestTri = -1;
+	nextTri = 0;
+
+	for ( numAdded = 0; numAdded < numTris; numAdded++ ) {
+		if ( bestTri == -1 ) {
+			// nothing in the cache is connected to a triangle that's left, start at the next one
+			while ( vc->triAdded[nextTri] ) {
+				nextTri++;
+			}
+			bestTri = nextTri;
+		}
+
+		tri = bestTri;
+		vc->triAdded[tri] = qtrue;
+
+		// remove the triangle from its vertexes and put them at the front of the cache
+		newCacheSize = 0;
+
+		for ( i = 0; i < 3; i++ ) {
+			vert = indexes[tri*3+i];
+			vc->indexes[numAdded*3+i] = vert;
+
+			for ( j = vc->triStart[vert]; j < vc->triStart[vert] + vc->numActive[vert]; j++ ) {
+				if ( vc->vertTris[j] == tri ) {
+					vc->vertTris[j] = vc->vertTris[vc->triStart[vert] + vc->numActive[vert] - 1];
+					vc->numActive[vert]--;
+					break;
+				}
+			}
+
+			for ( j = 0; j < newCacheSize; j++ ) {
+				if ( newCache[j] == vert ) {
+					break;
+				}
+			}
+			if ( j == newCacheSize ) {
+				newCache[newCacheSize++] = vert;
+			}
+		}
+
+		for ( i = 0; i < cacheSize; i++ ) {
+			vert = cache[i];
+
+			for ( j = 0; j < 3; j++ ) {
+				if ( indexes[tri*3+j] == vert ) {
+					break;
+				}
+			}
+			if ( j == 3 ) {
+				newCache[newCacheSize++] = vert;
+			}
+		}
+
+		// update the scores of the vertexes in the cache and the ones pushed out of it
+		for ( i = 0; i < newCacheSize; i++ ) {
+			vc->cachePos[newCache[i]] = i < VCACHE_SIZE ? i : -1;
+		}
+
+		for ( i = 0; i < newCacheSize; i++ ) {
+			VCache_SetVertScore( vc, newCache[i] );
+		}
+
+		cacheSize = MIN( newCacheSize, VCACHE_SIZE );
+		Com_Memcpy( cache, newCache, cacheSize * sizeof ( *cache ) );
+
+		// the triangle's own score doesn't matter anymore
+		bestTri = -1;
+		bestScore = -1;
+
+		for ( i = 0; i < cacheSize; i++ ) {
+			vert = cache[i];
+
+			for ( k = vc->triStart[vert]; k < vc->triStart[vert] + vc->numActive[vert]; k++ ) {
+				if ( vc->triScores[vc->vertTris[k]] > bestScore ) {
+					bestScore = vc->triScores[vc->vertTris[k]];
+					bestTri = vc->vertTris[k];
+				}
+			}
+		}
+	}
+
+	// number the vertexes in the order they're first used, unused ones go last
+	for ( i = 0; i < numVerts; i++ ) {
+		vc->remap[i] = -1;
+	}
+
+	for ( i = 0, k = 0; i < numTris * 3; i++ ) {
+		if ( vc->remap[vc->indexes[i]] == -1 ) {
+			vc->remap[vc->indexes[i]] = k++;
+		}
+		indexes[i] = vc->remap[vc->indexes[i]];
+	}
+
+	for ( i = 0; i < numVerts; i++ ) {
+		if ( vc->remap[i] == -1 ) {
+			vc->remap[i] = k++;
+		}
+	}
+
+	for ( i = numTris * 3; i < surface->numIndexes; i++ ) {
+		indexes[i] = vc->remap[indexes[i]];
+	}
+
+	newVerts = malloc( numVerts * sizeof ( *newVerts ) );
+	for ( i = 0; i < numVerts; i++ ) {
+		newVerts[vc->remap[i]] = verts[i];
+	}
+	Com_Memcpy( verts, newVerts, numVerts * sizeof ( *verts ) );
+	free( newVerts );
+}
+
+/*
+=================
+BSP_OptimizeVertexCache
+
+Reorder the triangles of triangle surfaces for the post-transform vertex
+cache and their vertexes for fetching them in order. The average cache miss
+ratio (vertexes transformed per triangle) of a FIFO cache is printed.
+=================
+*/
+void BSP_OptimizeVertexCache( bspFile_t *bsp ) {
+	const dsurface_t *surface;
+	byte *triangleSurfaces;
+	vcache_t vc;
+	int maxVerts, maxIndexes;
+	int64_t missesBefore, missesAfter, numTris;
+	int i;
+
+	triangleSurfaces = BSP_TriangleSurfaces( bsp, &maxVerts );
+
+	maxIndexes = 0;
+	for ( i = 0, surface = bsp->surfaces; i < bsp->numSurfaces; i++, surface++ ) {
+		if ( triangleSurfaces[i] ) {
+			maxIndexes = MAX( maxIndexes, surface->numIndexes );
+		}
+	}
+
+	VCache_Init( &vc, maxVerts, maxIndexes );
+
+	missesBefore = missesAfter = numTris = 0;
+
+	for ( i = 0, surface = bsp->surfaces; i < bsp->numSurfaces; i++, surface++ ) {
+		if ( !triangleSurfaces[i] || surface->numIndexes < 3 ) {
+			continue;
+		}
+
+		// a partial triangle at the end is dropped by the renderer, so it's kept at the end
+		missesBefore += VCache_FifoMisses( &bsp->drawIndexes[surface->firstIndex], surface->numIndexes / 3 * 3, surface->numVerts, vc.remap );
+		VCache_OptimizeSurface( &vc, bsp, surface );
+		missesAfter += VCache_FifoMisses( &bsp->drawIndexes[surface->firstIndex], surface->numIndexes / 3 * 3, surface->numVerts, vc.remap );
+		numTris += surface->numIndexes / 3;
+	}
+
+	VCache_Shutdown( &vc );
+	free( triangleSurfaces );
+
+	if ( numTris > 0 ) {
+		Com_Printf( "Average cache miss ratio %.3f -> %.3f (%d entry FIFO, %ld triangles).\n",
+			(double)missesBefore / numTris, (double)missesAfter / numTris, VCACHE_FIFO_SIZE, (long)numTris );
+	}
+}
@@ -28,6 +28,7 @@ Suite 120, Rockville, Maryland 20850 USA.
 ===========================================================================
 */
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -42,7 +43,10 @@ typedef enum {
 	qtrue = 1
 } qboolean;
 
+#define SEKAI_VERSION "0.2"
+
 #define MAX_QPATH 64
+#define MAX_OSPATH 256
 
 #define ERR_DROP 0	// passed to Com_Error, ignored
 
@@ -56,8 +60,10 @@ typedef enum {
 
 #ifdef WIN32
 #define Q_stricmp stricmp
+#define Q_stricmpn strnicmp
 #else
 #define Q_stricmp strcasecmp
+#define Q_stricmpn strncasecmp
 #endif
 
 // FIXME: assumes host is little endian
@@ -66,7 +72,8 @@ typedef enum {
 #define LittleFloat(x) (x)
 
 #define VectorSet( v, a, b, c ) do { v[0] = a; v[1] = b; v[2] = c; } while (0)
-#define VectorCopy( src, dst ) do { dst[0] = src[0]; dst[1] = src[2]; dst[2] = src[2]; } while (0)
+#define VectorCopy( src, dst ) do { dst[0] = src[0]; dst[1] = src[1]; dst[2] = src[2]; } while (0)
+#define DotProduct( a, b ) ( (a)[0] * (b)[0] + (a)[1] * (b)[1] + (a)[2] * (b)[2] )
 
 #define MIN( x, y ) ( (x) < (y) ? (x) : (y) )
 #define MAX( x, y ) ( (x) > (y) ? (x) : (y) )
@@ -76,6 +83,48 @@ long FS_WriteFile( const char *filename, void *buf, long length );
 long FS_ReadFile( const char *filename, void **buffer );
 void FS_FreeFile( void *buffer );
 
+// random access file handles, -1 is an invalid handle
+int FS_Open( const char *filename, qboolean write );
+void FS_Close( int fd );
+long FS_Pread( int fd, void *buf, long length, long offset );
+long FS_Pwrite( int fd, const void *buf, long length, long offset );
+long FS_FileLength( int fd );
+qboolean FS_Truncate( int fd, long length );
+qboolean FS_Sync( int fd );
+qboolean FS_FileExists( const char *filename );
+
+int64_t Sys_Microseconds( void );
+int Com_NumCPUs( void );
+void Sys_CatchQuit( void );
+qboolean Sys_QuitRequested( void );
+
+// hash.c
+uint64_t Com_Hash64( const void *buffer, size_t length, uint64_t seed );
+
+// lz.c
+int LZ_CompressBound( int length );
+int LZ_Compress( const void *source, int length, void *dest, int destSize );
+int LZ_Decompress( const void *source, int sourceLength, void *dest, int length );
+
+// cache.c
+uint64_t Cache_Key( const void *data, long length, const char *recipe );
+qboolean Cache_Fetch( const char *cacheDir, uint64_t key, const char *filename );
+void Cache_Store( const char *cacheDir, uint64_t key, const void *data, long length );
+void Cache_Stats( const char *cacheDir, qboolean hit );
+
+// trace.c, begin and end events are recorded when built with SEKAI_TRACE and Trace_Init was called
+#ifdef SEKAI_TRACE
+void Trace_Init( const char *filename );
+void Trace_Event( const char *name, const char *arg, char phase );
+#define TRACE_BEGIN( name ) Trace_Event( name, NULL, 'B' )
+#define TRACE_BEGIN_FILE( name, file ) Trace_Event( name, file, 'B' )
+#define TRACE_END( name ) Trace_Event( name, NULL, 'E' )
+#else
+#define TRACE_BEGIN( name ) do { } while (0)
+#define TRACE_BEGIN_FILE( name, file ) do { } while (0)
+#define TRACE_END( name ) do { } while (0)
+#endif
+
 // md4.c
 unsigned Com_BlockChecksum (const void *buffer, int length);
 
@@ -0,0 +1,196 @@
+/*
+===========================================================================
+Copyright (C) 2015 Zack Middleton
+
+This file is part of BSP sekai Source Code.
+
+BSP sekai Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+BSP sekai Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with BSP sekai Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, BSP sekai Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+
+
+// trace.c -- Chrome trace event timeline (chrome://tracing or ui.perfetto.dev)
+//
+// Only built with SEKAI_TRACE, otherwise the TRACE_ macros in sekai.h are
+// empty. Each thread records begin and end events into its own buffer so
+// threads don't wait on each other while tracing, the buffers are written
+// as JSON when bspsekai exits.
+
+#include "q_shared.h"
+#include "qcommon.h"
+
+#ifdef SEKAI_TRACE
+
+#include <pthread.h>
+
+typedef struct {
+	const char	*name;		// not copied, string literal or pass name
+	char		*arg;		// copied, file name
+	int64_t		time;
+	char		phase;
+} traceEvent_t;
+
+typedef struct traceThread_s {
+	int				tid;
+	traceEvent_t	*events;
+	int				numEvents;
+	int				maxEvents;
+	struct traceThread_s *next;
+} traceThread_t;
+
+static char				*trace_filename = NULL;
+static int64_t			trace_startTime;
+static traceThread_t	*trace_threads = NULL;
+static int				trace_numThreads = 0;
+static pthread_mutex_t	trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread traceThread_t *trace_thread = NULL;
+
+static void Trace_WriteString( FILE *f, const char *s ) {
+	fputc( '"', f );
+
+	for ( ; *s; s++ ) {
+		if ( *s == '"' || *s == '\\' ) {
+			fputc( '\\', f );
+			fputc( *s, f );
+		} else if ( (unsigned char)*s < ' ' ) {
+			fprintf( f, "\\u%04x", *s );
+		} else {
+			fputc( *s, f );
+		}
+	}
+
+	fputc( '"', f );
+}
+
+static void Trace_Write( void ) {
+	traceThread_t	*thread;
+	traceEvent_t	*event;
+	FILE			*f;
+	qboolean		first;
+	int				i;
+
+	f = fopen( trace_filename, "wb" );
+
+	if ( !f ) {
+		Com_Printf( "Error: Could not write trace '%s'\n", trace_filename );
+		return;
+	}
+
+	pthread_mutex_lock( &trace_lock );
+
+	fprintf( f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" );
+	first = qtrue;
+
+	for ( thread = trace_threads; thread; thread = thread->next ) {
+		fprintf( f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+				first ? "" : ",\n", thread->tid, thread->tid == 1 ? "main" : "thread", thread->tid );
+		first = qfalse;
+
+		for ( i = 0; i < thread->numEvents; i++ ) {
+			event = &thread->events[i];
+
+			fprintf( f, ",\n{\"name\":" );
+			Trace_WriteString( f, event->name );
+			fprintf( f, ",\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%lld", event->phase, thread->tid,
+					(long long)( event->time - trace_startTime ) );
+
+			if ( event->arg ) {
+				fprintf( f, ",\"args\":{\"file\":" );
+				Trace_WriteString( f, event->arg );
+				fprintf( f, "}" );
+			}
+
+			fprintf( f, "}" );
+		}
+	}
+
+	fprintf( f, "\n]}\n" );
+
+	pthread_mutex_unlock( &trace_lock );
+
+	fclose( f );
+}
+
+/*
+=================
+Trace_Init
+
+Start recording events, they're written to filename at exit.
+=================
+*/
+void Trace_Init( const char *filename ) {
+	trace_filename = strdup( filename );
+	trace_startTime = Sys_Microseconds();
+
+	atexit( Trace_Write );
+}
+
+/*
+=================
+Trace_Event
+
+Add a begin ('B') or end ('E') event for this thread. Events of a thread
+must nest.
+=================
+*/
+void Trace_Event( const char *name, const char *arg, char phase ) {
+	traceThread_t	*thread;
+	traceEvent_t	*event;
+
+	if ( !trace_filename ) {
+		return;
+	}
+
+	thread = trace_thread;
+
+	if ( !thread ) {
+		thread = calloc( 1, sizeof ( *thread ) );
+
+		pthread_mutex_lock( &trace_lock );
+		thread->tid = ++trace_numThreads;
+		thread->next = trace_threads;
+		trace_threads = thread;
+		pthread_mutex_unlock( &trace_lock );
+
+		trace_thread = thread;
+	}
+
+	// the buffer is only read by Trace_Write, which holds the lock
+	if ( thread->numEvents == thread->maxEvents ) {
+		pthread_mutex_lock( &trace_lock );
+		thread->maxEvents = thread->maxEvents ? thread->maxEvents * 2 : 256;
+		thread->events = realloc( thread->events, thread->maxEvents * sizeof ( *thread->events ) );
+		pthread_mutex_unlock( &trace_lock );
+	}
+
+	event = &thread->events[thread->numEvents];
+	event->name = name;
+	event->arg = arg ? strdup( arg ) : NULL;
+	event->time = Sys_Microseconds();
+	event->phase = phase;
+
+	thread->numEvents++;
+}
+
+#endif